@@ -1,10 +1,12 @@
 #include "ComputeMST.h"
 
 #include <iostream>
-#include <iomanip>      // std::setprecision
+#include <vector>
+#include <omp.h>
 
 #include "MSTEdgeExt.h"
 #include "DisjointSet.h"
+#include "PointGrid.h"
 #include "../ModelFitting/Line3DTwoPoint.h"
 #include "../ModelFitting/Neighbour26.h"
 
@@ -28,57 +30,49 @@ void ComputeMST::from_threshold_graph( const ModelSet& models,
     /// compute the projection point add it to graph
     create_graph_nodes( models, graph );
 
-    /// connect each pair of the nodes with a threshold
-    int counter = 0;
-    const int total = graph.num_nodes();
-    #pragma omp parallel for schedule(dynamic)
-    for( unsigned i=0; i<graph.num_nodes(); i++ )
+    /// connect the pairs of nodes within the threshold, the candidates
+    /// are found with a uniform grid over the projection points
+    const double radius = search_radius( models );
+    const PointGrid grid( graph.get_nodes(), radius );
+
+    // the edges found by every thread are merged at the end
+    vector<vector<EdgeExt> > thread_edges( omp_get_max_threads() );
+    #pragma omp parallel
     {
-        #pragma omp critical
-        {
-            long long temp = (long long)(1000) * ++counter / total;
-            cout << "\r ";
-            cout.width(10);
-            cout << fixed << setprecision(1) << temp / 10.0 << "%    ";
-            cout.flush();
-        }
+        vector<EdgeExt>& edges = thread_edges[ omp_get_thread_num() ];
+        vector<int> candidates;
 
-        for( unsigned j=i+1; j<graph.num_nodes(); j++ )
+        #pragma omp for schedule(dynamic, 256)
+        for( int i=0; i<(int) graph.num_nodes(); i++ )
         {
             const int& lineidi  = models.labelID[i];
             const Line3D* linei = models.lines[lineidi];
-
-
-            const int& lineidj  = models.labelID[j];
-            const Line3D* linej = models.lines[lineidj];
-
             const Vec3d& proj1 = graph.get_node( i );
-            const Vec3d& proj2 = graph.get_node( j );
 
+            candidates.clear();
+            grid.query( proj1, candidates );
+            for( unsigned k=0; k<candidates.size(); k++ )
+            {
+                const int& j = candidates[k];
+                if( j<=i ) continue;
 
-            const double dist = edge_weight_func( linei, proj1, linej, proj2 );
-            if( dist>get_threshold(linei, linej) ) continue;
+                const int& lineidj  = models.labelID[j];
+                const Line3D* linej = models.lines[lineidj];
+                const Vec3d& proj2 = graph.get_node( j );
 
-            /// Weight is between [0.5-1] after this manipulation
-            double weight = 1.0;
-            /*
-            const Vec3d& directioni = linei->getDirection();
-            const Vec3d& directionj = linej->getDirection();
-            const Vec3d norm_direction = direction / sqrt( direction.dot(direction) );
-            weight  = abs( norm_direction.dot( directioni ) );
-            weight += abs( norm_direction.dot( directionj ) );
-            weight = (2 - weight) / 4;
-            weight = sqrt( weight );
-            /**/
+                const double dist = edge_weight_func( linei, proj1, linej, proj2 );
+                if( dist>get_threshold(linei, linej) ) continue;
 
-            #pragma omp critical
-            {
-                graph.add_edge( EdgeExt(i, j,
-                                        dist*weight,
-                                        std::min(linei->getSigma(), linej->getSigma()) ) );
+                edges.push_back( EdgeExt(i, j, dist,
+                                         std::min(linei->getSigma(), linej->getSigma()) ) );
             }
         }
     }
+    for( unsigned t=0; t<thread_edges.size(); t++ )
+    {
+        for( unsigned k=0; k<thread_edges[t].size(); k++ ) graph.add_edge( thread_edges[t][k] );
+    }
+    cout << " Number of edges: " << graph.num_edges() << endl;
 
     graph.get_min_span_tree( tree, &djs );
     cout << endl << "Done" << endl << endl;
@@ -130,16 +124,12 @@ void ComputeMST::neighborhood_graph( const ModelSet& models,
     // Determine critical points which are connected to at most one
     // other points
     vector<unsigned> critical_points;
-    vector<unsigned> neighbor_counts( tree.num_nodes(), 0 );
-    for( unsigned int i=0; i<tree.num_edges(); i++ )
-    {
-        const Edge &e = tree.get_edge( i );
-        neighbor_counts[ e.node1 ]++;
-        neighbor_counts[ e.node2 ]++;
-    }
-
+    vector<int> rowptr, neighbours;
+    tree.get_adjacency( rowptr, neighbours );
+    vector<int> neighbor_counts( tree.num_nodes(), 0 );
     for( unsigned i=0; i<neighbor_counts.size(); i++ )
     {
+        neighbor_counts[i] = rowptr[i+1] - rowptr[i];
         if( neighbor_counts[i]==1 )
         {
             critical_points.push_back( i );
@@ -154,60 +144,63 @@ void ComputeMST::neighborhood_graph( const ModelSet& models,
     // Add more edges to the graph based on the tree
     graph = tree;
 
-    int counter = 0;
-    const int total = critical_points.size();
-    #pragma omp parallel for schedule(dynamic)
-    for( unsigned k=0; k<critical_points.size(); k++ )
+    const PointGrid grid( graph.get_nodes(), search_radius( models ) );
+    vector<vector<EdgeExt> > thread_edges( omp_get_max_threads() );
+    #pragma omp parallel
     {
-        #pragma omp critical
-        {
-            long long temp = (long long)(1000) * ++counter / total;
-            cout << "\r ";
-            cout.width(10);
-            cout << fixed << setprecision(1) << temp / 10.0 << "%    ";
-            cout.flush();
-        }
+        vector<EdgeExt>& edges = thread_edges[ omp_get_thread_num() ];
+        vector<int> candidates;
 
-        const unsigned i = critical_points[k];
+        #pragma omp for schedule(dynamic)
+        for( int k=0; k<(int) critical_points.size(); k++ )
+        {
+            const int i = critical_points[k];
 
-        const int& lineidi  = models.labelID[i];
-        const Line3D* linei = models.lines[lineidi];
-        const Vec3d& proj1 = graph.get_node( i );
+            const int& lineidi  = models.labelID[i];
+            const Line3D* linei = models.lines[lineidi];
+            const Vec3d& proj1 = graph.get_node( i );
 
-        for( unsigned j=0; j<graph.num_nodes(); j++ )
-        {
-            if( i==j ) continue;
-            if( i<j && neighbor_counts[j]==1 ) continue;
+            candidates.clear();
+            grid.query( proj1, candidates );
+            for( unsigned c=0; c<candidates.size(); c++ )
+            {
+                const int& j = candidates[c];
+                if( i==j ) continue;
+                if( i<j && neighbor_counts[j]==1 ) continue;
 
-            const int& lineidj  = models.labelID[j];
-            const Line3D* linej = models.lines[lineidj];
-            const Vec3d& proj2 = graph.get_node( j );
+                const int& lineidj  = models.labelID[j];
+                const Line3D* linej = models.lines[lineidj];
+                const Vec3d& proj2 = graph.get_node( j );
 
-            const double dist = edge_weight_func( linei, proj1, linej, proj2 );
-            if( dist>get_threshold(linei, linej) ) continue;
+                const double dist = edge_weight_func( linei, proj1, linej, proj2 );
+                if( dist>get_threshold(linei, linej) ) continue;
 
-            #pragma omp critical
-            {
-                graph.add_edge( EdgeExt(i, j, dist,
-                                        std::min(linei->getSigma(), linej->getSigma()) ) );
+                edges.push_back( EdgeExt(i, j, dist,
+                                         std::min(linei->getSigma(), linej->getSigma()) ) );
             }
         }
     }
+    for( unsigned t=0; t<thread_edges.size(); t++ )
+    {
+        for( unsigned k=0; k<thread_edges[t].size(); k++ ) graph.add_edge( thread_edges[t][k] );
+    }
+
+    /// add the new edges to the tree
+    graph.extend_min_span_tree( tree, djs );
+}
 
-    /// build edges
-    std::priority_queue<EdgeExt> edges = graph.get_edges();
-    while( !edges.empty() && tree.num_edges()<tree.num_nodes()-1 )
+double ComputeMST::search_radius( const ModelSet& models )
+{
+    /* A pair of nodes is only kept if
+           edge_weight_func(...) <= get_threshold(...) = 0.6 * (sigma1 + sigma2)
+       where edge_weight_func(...) >= distance - max(sigma1, sigma2). So
+       the nodes of an edge are at most 2.2 * max sigma apart. */
+    double max_sigma = 0.0;
+    for( unsigned i=0; i<models.lines.size(); i++ )
     {
-        EdgeExt e = edges.top();
-        const int sid1 = djs.find( e.node1 );
-        const int sid2 = djs.find( e.node2 );
-        if( sid1 != sid2 )
-        {
-            tree.add_edge( e );
-            djs.merge( sid1, sid2 );
-        }
-        edges.pop();
+        max_sigma = std::max( max_sigma, models.lines[i]->getSigma() );
     }
+    return 2.2 * max_sigma;
 }
 
 void ComputeMST::create_graph_nodes( const ModelSet& models,
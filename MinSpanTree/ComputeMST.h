@@ -69,6 +69,9 @@ private:
 
     inline static double get_threshold( const Line3D* line1, const Line3D* line2 );
 
+    // the maximum distance between the two nodes of an edge
+    static double search_radius( const ModelSet& models );
+
 };
 
 double ComputeMST::get_threshold( const Line3D* line1,
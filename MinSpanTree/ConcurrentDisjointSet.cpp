@@ -0,0 +1,37 @@
+#include "ConcurrentDisjointSet.h"
+
+ConcurrentDisjointSet::ConcurrentDisjointSet( int n_size )
+{
+    reset( n_size );
+}
+
+void ConcurrentDisjointSet::reset( int n_size )
+{
+    // std::atomic can not be copied, the vector is rebuilt
+    std::vector<std::atomic<int> > p( n_size );
+    parent.swap( p );
+
+    #pragma omp parallel for schedule(static)
+    for( int i=0; i<n_size; i++ )
+    {
+        parent[i].store( i, std::memory_order_relaxed );
+    }
+}
+
+int ConcurrentDisjointSet::finalize( void )
+{
+    const int n = get_size();
+    int num_sets = 0;
+
+    /* The roots do not change anymore. Every element is linked to its root,
+       which is the smallest element of the set (the roots are always linked
+       under a smaller index). */
+    #pragma omp parallel for schedule(static) reduction(+:num_sets)
+    for( int i=0; i<n; i++ )
+    {
+        const int root = find( i );
+        parent[i].store( root, std::memory_order_relaxed );
+        if( root==i ) num_sets++;
+    }
+    return num_sets;
+}
@@ -0,0 +1,108 @@
+#ifndef MST_CONCURRENT_DISJOINT_SET_H
+#define MST_CONCURRENT_DISJOINT_SET_H
+
+#include <atomic>
+#include <vector>
+#include <utility>
+
+/* A disjoint set that can be used from many threads at the same time
+   without locks (Anderson and Woll 1991, Jayanti and Tarjan 2016).
+
+   Every element points to its parent, a root points to itself. Two roots
+   are linked with a compare-and-swap on the parent of the root with the
+   larger index, so a set is always rooted at its smallest element. find()
+   does path splitting with compare-and-swap as well; a failed swap only
+   means that another thread shortened the path first.
+
+   merge(), find() and same() can be called concurrently. finalize() must be
+   called when no other thread uses the set: it flattens every path, after
+   that label(i) is the smallest element of the set of i. */
+
+class ConcurrentDisjointSet
+{
+public:
+    ConcurrentDisjointSet( int n_size = 0 );
+
+    /// reset to n_size singletons (not thread safe)
+    void reset( int n_size );
+
+    /// Find: the current root of the set of id
+    inline int find( int id ) const;
+
+    /// Union: join the sets of id1 and id2, return false if they were in
+    /// the same set already
+    inline bool merge( int id1, int id2 );
+
+    /// whether id1 and id2 are in the same set
+    inline bool same( int id1, int id2 ) const;
+
+    /// Link every element to its root (in parallel, not thread safe), return
+    /// the number of sets
+    int finalize( void );
+
+    /// The canonical label of id (the smallest element of its set), only
+    /// valid after finalize()
+    inline int label( const int& id ) const
+    {
+        return parent[id].load( std::memory_order_relaxed );
+    }
+
+    inline int get_size( void ) const
+    {
+        return (int) parent.size();
+    }
+
+private:
+    // the set is neither copyable nor assignable
+    ConcurrentDisjointSet( const ConcurrentDisjointSet& );
+    ConcurrentDisjointSet& operator=( const ConcurrentDisjointSet& );
+
+    mutable std::vector<std::atomic<int> > parent;
+};
+
+
+inline int ConcurrentDisjointSet::find( int id ) const
+{
+    while( true )
+    {
+        const int p  = parent[id].load( std::memory_order_acquire );
+        const int gp = parent[p].load( std::memory_order_acquire );
+        if( p==gp ) return p;
+        // path splitting: link id to its grand parent and go on from its
+        // (old) parent
+        int expected = p;
+        parent[id].compare_exchange_weak( expected, gp, std::memory_order_release,
+                                          std::memory_order_relaxed );
+        id = p;
+    }
+}
+
+inline bool ConcurrentDisjointSet::merge( int id1, int id2 )
+{
+    while( true )
+    {
+        id1 = find( id1 );
+        id2 = find( id2 );
+        if( id1==id2 ) return false;
+        // link the root with the larger index
+        if( id1 < id2 ) std::swap( id1, id2 );
+        int expected = id1;
+        if( parent[id1].compare_exchange_strong( expected, id2,
+                std::memory_order_acq_rel ) ) return true;
+        // id1 is not a root anymore, try again
+    }
+}
+
+inline bool ConcurrentDisjointSet::same( int id1, int id2 ) const
+{
+    while( true )
+    {
+        id1 = find( id1 );
+        id2 = find( id2 );
+        if( id1==id2 ) return true;
+        // id1 may have been linked after it was found
+        if( parent[id1].load( std::memory_order_acquire )==id1 ) return false;
+    }
+}
+
+#endif // MST_CONCURRENT_DISJOINT_SET_H
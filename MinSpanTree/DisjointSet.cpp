@@ -1,42 +1,16 @@
 #include "DisjointSet.h"
 
-#include <stdio.h>
-#include <string.h>
-
-DisjointSet::DisjointSet() : size(0), data(nullptr)
-{
-
-}
-
-DisjointSet::DisjointSet( int n_size ) : size( n_size )
-{
-    data = new int[size];
-    memset( data, -1, size*sizeof(int) );
-}
-
-DisjointSet::DisjointSet( const DisjointSet& djs )
+DisjointSet::DisjointSet() : size(0)
 {
-    delete[] data;
 
-    size = djs.size;
-    data = new int[size];
-    memcpy( data, djs.data, size*sizeof(int) );
 }
 
-DisjointSet& DisjointSet::operator=( const DisjointSet& djs )
+DisjointSet::DisjointSet( int n_size )
+    : size( n_size )
+    , data( n_size, -1 )
+    , rank( n_size, 0 )
 {
-    delete[] data;
-
-    size = djs.size;
-    data = new int[size];
-    memcpy( data, djs.data, size*sizeof(int) );
 
-    return *this;
-}
-
-DisjointSet::~DisjointSet()
-{
-    delete[] data;
 }
 
 std::ostream& operator<<( std::ostream& out, const DisjointSet& djs )
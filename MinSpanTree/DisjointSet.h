@@ -2,10 +2,14 @@
 #define MST_DISJOINT_SET_H
 
 #include <iostream>
+#include <vector>
 /* A disjoint-set data structure is a data structure that keeps track of a set
    of elements partitioned into a number of disjoint (non-overlapping) subsets.
    A union-find algorithm is an algorithm that performs two useful operations
-   on such a data structure.*/
+   on such a data structure.
+
+   The subsets are merged by rank and find() uses path halving, so there is no
+   recursion and the trees stay shallow. */
 
 class DisjointSet
 {
@@ -13,19 +17,18 @@ public:
     /// Constructor
     DisjointSet();
     DisjointSet( int n_size );
-    DisjointSet( const DisjointSet& djs );
-    DisjointSet& operator=( const DisjointSet& djs );
-
-    /// Destructor
-    ~DisjointSet();
 
-    /// Get the labeling at index i
+    /// Get the labeling at index i (the parent of i, -1 for a root)
     inline int operator[]( const int& i ) const;
 
     /// Find: Determine which subset a particular element is in. This can be used
     /// to determinine if two elements are in the same subset.
     inline int find(int id) const;
 
+    /// Same as find() but without path compression: the set is not modified,
+    /// so it can be called from several threads as long as nobody merges.
+    inline int root(int id) const;
+
     /// Union: Join two subsets into a single subset
     inline void merge( int id1, int id2 );
 
@@ -40,8 +43,10 @@ public:
 private:
     /// Size of the set
     int size;
-    /// Labeling of each element
-    mutable int *data;
+    /// Labeling of each element (parent, -1 for a root)
+    mutable std::vector<int> data;
+    /// Upper bound of the height of the tree of each root
+    std::vector<unsigned char> rank;
 };
 
 
@@ -52,25 +57,37 @@ inline int DisjointSet::operator[]( const int& i ) const
 
 inline int DisjointSet::find(int id) const
 {
-    if( data[id] == -1 )
-    {
-        return id;
-    }
-    else
+    while( data[id] != -1 )
     {
-        data[id] = find( data[id] );
-        return data[id];
+        // path halving: link id to its grand parent
+        const int parent = data[id];
+        if( data[parent] != -1 ) data[id] = data[parent];
+        id = data[id];
     }
+    return id;
+}
+
+inline int DisjointSet::root(int id) const
+{
+    while( data[id] != -1 ) id = data[id];
+    return id;
 }
 
 inline void DisjointSet::merge( int id1, int id2 )
 {
-    if( data[id1]!=-1 ) id1 = find(id1);
-    if( data[id2]!=-1 ) id2 = find(id2);
+    id1 = find(id1);
+    id2 = find(id2);
     if( id1==id2 ) return;
-    data[id1] = id2;
+    // union by rank
+    if( rank[id1] > rank[id2] )
+    {
+        data[id2] = id1;
+    }
+    else
+    {
+        data[id1] = id2;
+        if( rank[id1]==rank[id2] ) rank[id2]++;
+    }
 }
 
 #endif // MST_DISJOINT_SET_H
-
-
@@ -98,6 +98,8 @@ GLMinSpanTree::GLMinSpanTree( const MST::Graph<MST::EdgeExt, cv::Vec3d>& g,
         sigma_max = std::max( sigma_max, s );
     }
     sigma_range = sigma_max - sigma_min;
+
+    build_edges();
 }
 
 
@@ -121,47 +123,43 @@ void GLMinSpanTree::keyboard( unsigned char key )
     {
         branch_display = (branch_display + 1) % color_map.size();
     }
+    build_edges();
 }
 
 
-void GLMinSpanTree::render( void )
+void GLMinSpanTree::build_edges( void )
 {
-    glBegin( GL_LINES );
-    for( unsigned i=0; i<graph.num_edges(); i++ )
+    const int num_edges = (int) graph.num_edges();
+    vector<VertexBuffer::Vertex> vertices( 2 * num_edges );
+
+    #pragma omp parallel for schedule(static)
+    for( int i=0; i<num_edges; i++ )
     {
         const EdgeExt& e = graph.get_edge( i );
         const Vec3d& p1 = graph.get_node( e.node1 );
         const Vec3d& p2 = graph.get_node( e.node2 );
 
-        int index = djs.find( e.node1 );
+        // root() does not modify the disjoint set (unlike find())
+        int index = djs.root( e.node1 );
         std::unordered_map<int, MapElement>::const_iterator it;
         it = color_map.find( index );
-        if( it==color_map.end() )
-        {
-            glColor3ub(25,25,25);
-        } else if ( it->second.rank>=3 && branch_display!=it->second.rank ) {
-            glColor3ub(25,25,25);
-        }
-        else if( it->second.rank<3 )
+        Vec3b c( 25, 25, 25 ); // the branches that are not highlighted
+        if( it!=color_map.end() && ( it->second.rank<3 || branch_display==it->second.rank ) )
         {
-            float val = e.getSigma() / sigma_max;
-            val = sqrt( val );
-            const Vec3b c = it->second.color * val;
-            glColor3ubv( &c[0] );
-        } else {
-            float val = e.getSigma() / sigma_max;
-            val = sqrt( sqrt( val ) );
-            const Vec3b c = it->second.color * val;
-            glColor3ubv( &c[0] );
+            const float val = e.getSigma() / sigma_max;
+            c = it->second.color * ( it->second.rank<3 ? sqrt( val ) : sqrt( sqrt( val ) ) );
         }
 
-        glVertex3dv( &p1[0] );
-        glVertex3dv( &p2[0] );
+        vertices[2*i  ].set( (float) p1[0], (float) p1[1], (float) p1[2], c[0], c[1], c[2] );
+        vertices[2*i+1].set( (float) p2[0], (float) p2[1], (float) p2[2], c[0], c[1], c[2] );
     }
 
-    glEnd();
+    edges.update( vertices );
+}
 
-    /**/
+void GLMinSpanTree::render( void )
+{
+    edges.draw( GL_LINES );
 }
 
 
@@ -5,6 +5,7 @@
 #include <opencv2/core/core.hpp>
 
 #include "GLViewer.h"
+#include "GLVertexBuffer.h"
 #include "MSTGraph.h"
 #include "MSTEdgeExt.h"
 
@@ -72,6 +73,10 @@ private:
            "branch_display==0": branch i will be displayed. However,
         the three most important branches are alwasy shown. */
     int branch_display;
+
+    // the edges, coloured by branch (rebuilt when 'branch_display' changes)
+    VertexBuffer edges;
+    void build_edges( void );
 };
 
 }// end of namespace
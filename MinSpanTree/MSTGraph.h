@@ -1,8 +1,8 @@
 #pragma once
 
 #include <iostream>
-#include <queue>
 #include <vector>
+#include <algorithm>
 #include "MSTEdge.h"
 #include "DisjointSet.h"
 
@@ -15,8 +15,8 @@ class Graph
 private:
     // number of nodes
     std::vector<NodeType> nodes;
-    // Edges of the graph
-    std::priority_queue<EdgeType> edges;
+    // Edges of the graph (in the order they are added)
+    std::vector<EdgeType> edges;
 
 public:
     // Constructor & Destructor
@@ -45,7 +45,7 @@ public:
     }
 
     inline void reset( const std::vector<NodeType>& new_nodes,
-                       const std::priority_queue<EdgeType>& new_edges )
+                       const std::vector<EdgeType>& new_edges )
     {
         // update the nodes
         nodes = new_nodes;
@@ -58,13 +58,13 @@ public:
     inline void clear_edges(void)
     {
         // clear the edges
-        edges = std::priority_queue<EdgeType>();
+        edges.clear();
     }
 
     // add an edge to a graph
     inline void add_edge( EdgeType edge )
     {
-        edges.push( edge );
+        edges.push_back( edge );
     }
 
     // add an node to a graph
@@ -74,7 +74,7 @@ public:
     }
 
     //getters
-    inline const std::priority_queue<EdgeType>& get_edges( void ) const
+    inline const std::vector<EdgeType>& get_edges( void ) const
     {
         return edges;
     }
@@ -91,7 +91,7 @@ public:
 
     inline const EdgeType& get_edge(const int& i) const
     {
-        return *(&edges.top()+i);
+        return edges[i];
     }
 
     unsigned num_edges(void) const
@@ -104,12 +104,48 @@ public:
         return (unsigned)nodes.size();
     }
 
-    // get a minimum spanning tree of the current graph
+    // get a minimum spanning tree (forest) of the current graph
     void get_min_span_tree( Graph<EdgeType, NodeType>& dst, DisjointSet* djs_ptr = nullptr ) const;
 
+    // Kruskal continued from a forest: add the edges of the current graph to
+    // the forest dst, djs are the connected components of dst
+    void extend_min_span_tree( Graph<EdgeType, NodeType>& dst, DisjointSet& djs ) const;
+
+    // Compressed sparse row adjacency of the graph: the neighbours of node i
+    // are neighbours[ rowptr[i] ], ..., neighbours[ rowptr[i+1]-1 ] and, if
+    // edge_ids is not NULL, the edges connecting them are (*edge_ids)[...]
+    void get_adjacency( std::vector<int>& rowptr,
+                        std::vector<int>& neighbours,
+                        std::vector<int>* edge_ids = nullptr ) const;
+
     // print graph for debug
     template<class E, class N>
     friend std::ostream& operator<<( std::ostream& out, Graph<E, N>& g );
+
+private:
+    /* Filter-Kruskal (Osipov, Sanders and Singler 2009) on the edges
+       order[first], ..., order[last-1]: the edges are partitioned around a
+       pivot weight, the light edges are processed first, then the heavy
+       edges within a component of the forest are dropped (in parallel)
+       before the heavy edges are processed. Only the small partitions are
+       sorted. */
+    void filter_kruskal( int* first, int* last,
+                         Graph<EdgeType, NodeType>& dst, DisjointSet& djs ) const;
+
+    // drop the edges order[first], ..., order[last-1] within a component
+    // of djs, return the new end of the range
+    int* filter( int* first, int* last, const DisjointSet& djs ) const;
+
+    // the edges are ordered by weight, the ties by their index so that
+    // the tree does not depend on the sorting
+    inline bool lighter( const int& i, const int& j ) const
+    {
+        return ( edges[i].weight < edges[j].weight ) ||
+               ( edges[i].weight == edges[j].weight && i < j );
+    }
+
+    // partitions that are not larger than this are sorted
+    static const int KRUSKAL_SORT_SIZE = 4096;
 };
 
 
@@ -120,10 +156,66 @@ void Graph<EdgeType, NodeType>::get_min_span_tree( Graph<EdgeType, NodeType>& ds
     DisjointSet djs( this->num_nodes() );
 
     /// build edges
-    std::priority_queue<EdgeType> edges = this->get_edges();
-    while( !edges.empty() && dst.num_edges()<dst.num_nodes()-1 )
+    extend_min_span_tree( dst, djs );
+
+    /// also return the disjoint set
+    if( djs_ptr ) *djs_ptr = djs;
+}
+
+template<class EdgeType, class NodeType>
+void Graph<EdgeType, NodeType>::extend_min_span_tree( Graph<EdgeType, NodeType>& dst, DisjointSet& djs ) const
+{
+    if( edges.empty() ) return;
+
+    // the edges are processed through their indices
+    std::vector<int> order( edges.size() );
+    for( unsigned i=0; i<order.size(); i++ ) order[i] = i;
+
+    // the edges within a component of the initial forest are useless
+    int* first = &order[0];
+    int* last  = first + order.size();
+    if( dst.num_edges()>0 ) last = filter( first, last, djs );
+
+    filter_kruskal( first, last, dst, djs );
+}
+
+template<class EdgeType, class NodeType>
+void Graph<EdgeType, NodeType>::filter_kruskal( int* first, int* last,
+        Graph<EdgeType, NodeType>& dst, DisjointSet& djs ) const
+{
+    const unsigned max_num_edges = ( dst.num_nodes()>0 ) ? dst.num_nodes()-1 : 0;
+
+    while( last - first > KRUSKAL_SORT_SIZE )
+    {
+        if( dst.num_edges()>=max_num_edges ) return;
+
+        // median of three as pivot, the light partition is never empty
+        const long n = last - first;
+        int a = first[0], b = first[n/2], c = first[n-1];
+        if( lighter( b, a ) ) std::swap( a, b );
+        if( lighter( c, b ) ) std::swap( b, c );
+        if( lighter( b, a ) ) std::swap( a, b );
+        const int pivot = b;
+
+        int* middle = std::partition( first, last, [this, pivot]( const int& i )
+        {
+            return lighter( i, pivot );
+        } );
+
+        filter_kruskal( first, middle, dst, djs );
+
+        first = middle;
+        last  = filter( first, last, djs );
+    }
+
+    std::sort( first, last, [this]( const int& i, const int& j )
+    {
+        return lighter( i, j );
+    } );
+
+    for( ; first!=last && dst.num_edges()<max_num_edges; ++first )
     {
-        EdgeType e = edges.top();
+        const EdgeType& e = edges[*first];
         const int sid1 = djs.find( e.node1 );
         const int sid2 = djs.find( e.node2 );
         if( sid1 != sid2 )
@@ -131,11 +223,59 @@ void Graph<EdgeType, NodeType>::get_min_span_tree( Graph<EdgeType, NodeType>& ds
             dst.add_edge( e );
             djs.merge( sid1, sid2 );
         }
-        edges.pop();
     }
+}
 
-    /// also return the disjoint set
-    if( djs_ptr ) *djs_ptr = djs;
+template<class EdgeType, class NodeType>
+int* Graph<EdgeType, NodeType>::filter( int* first, int* last, const DisjointSet& djs ) const
+{
+    const int n = (int)( last - first );
+    std::vector<char> keep( n );
+
+    #pragma omp parallel for schedule(static)
+    for( int k=0; k<n; k++ )
+    {
+        const EdgeType& e = edges[ first[k] ];
+        keep[k] = ( djs.root( e.node1 ) != djs.root( e.node2 ) );
+    }
+
+    int* out = first;
+    for( int k=0; k<n; k++ )
+    {
+        if( keep[k] ) *out++ = first[k];
+    }
+    return out;
+}
+
+template<class EdgeType, class NodeType>
+void Graph<EdgeType, NodeType>::get_adjacency( std::vector<int>& rowptr,
+        std::vector<int>& neighbours,
+        std::vector<int>* edge_ids ) const
+{
+    // count the edges of every node
+    rowptr.assign( num_nodes() + 1, 0 );
+    for( unsigned i=0; i<edges.size(); i++ )
+    {
+        rowptr[ edges[i].node1 + 1 ]++;
+        rowptr[ edges[i].node2 + 1 ]++;
+    }
+    for( unsigned i=0; i<num_nodes(); i++ ) rowptr[i+1] += rowptr[i];
+
+    neighbours.resize( rowptr.back() );
+    if( edge_ids ) edge_ids->resize( rowptr.back() );
+
+    std::vector<int> pos( rowptr.begin(), rowptr.end() - 1 );
+    for( unsigned i=0; i<edges.size(); i++ )
+    {
+        const EdgeType& e = edges[i];
+        if( edge_ids )
+        {
+            (*edge_ids)[ pos[e.node1] ] = i;
+            (*edge_ids)[ pos[e.node2] ] = i;
+        }
+        neighbours[ pos[e.node1]++ ] = e.node2;
+        neighbours[ pos[e.node2]++ ] = e.node1;
+    }
 }
 
 template<class E, class N>
@@ -150,11 +290,9 @@ std::ostream& operator<<( std::ostream& out, Graph<E, N>& g )
     out << "Number of Edge: " << g.num_edges() << std::endl;
 
     // Transverse the edges and print them
-    const E* pt_edge = &g.edges.top();
     for( unsigned int i=0; i<g.edges.size(); i++ )
     {
-        std::cout << (*pt_edge) << std::endl;
-        pt_edge++;
+        std::cout << g.edges[i] << std::endl;
     }
     return out;
 }
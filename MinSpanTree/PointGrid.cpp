@@ -0,0 +1,68 @@
+#include "PointGrid.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace cv;
+
+PointGrid::PointGrid( const vector<Vec3d>& points, const double& radius )
+    : points( points ), radius( radius )
+    , cell_size( max( radius, 1e-6 ) )
+    , origin( 0, 0, 0 ), dims( 1, 1, 1 )
+{
+    if( points.empty() ) return;
+
+    Vec3d max_pos = points[0];
+    origin = points[0];
+    for( unsigned i=1; i<points.size(); i++ )
+    {
+        for( int d=0; d<3; d++ )
+        {
+            origin[d]  = min( origin[d],  points[i][d] );
+            max_pos[d] = max( max_pos[d], points[i][d] );
+        }
+    }
+    for( int d=0; d<3; d++ )
+    {
+        dims[d] = (int) std::floor( ( max_pos[d] - origin[d] ) / cell_size ) + 1;
+    }
+
+    // sort the points by cell
+    vector<pair<long long, int> > sorted( points.size() );
+    for( unsigned i=0; i<points.size(); i++ )
+    {
+        sorted[i] = make_pair( cell_of( cell_coord( points[i] ) ), (int) i );
+    }
+    std::sort( sorted.begin(), sorted.end() );
+    keys.resize( sorted.size() );
+    order.resize( sorted.size() );
+    for( unsigned i=0; i<sorted.size(); i++ )
+    {
+        keys[i]  = sorted[i].first;
+        order[i] = sorted[i].second;
+    }
+}
+
+void PointGrid::query( const Vec3d& pos, vector<int>& indeces ) const
+{
+    const Vec3i center = cell_coord( pos );
+    const double radius2 = radius * radius;
+    for( int z = max( center[2]-1, 0 ); z <= min( center[2]+1, dims[2]-1 ); z++ )
+    {
+        for( int y = max( center[1]-1, 0 ); y <= min( center[1]+1, dims[1]-1 ); y++ )
+        {
+            for( int x = max( center[0]-1, 0 ); x <= min( center[0]+1, dims[0]-1 ); x++ )
+            {
+                const long long key = cell_of( Vec3i( x, y, z ) );
+                const vector<long long>::const_iterator first = lower_bound( keys.begin(), keys.end(), key );
+                for( vector<long long>::const_iterator it = first; it != keys.end() && *it==key; ++it )
+                {
+                    const int& i = order[ it - keys.begin() ];
+                    const Vec3d diff = points[i] - pos;
+                    if( diff.dot( diff ) <= radius2 ) indeces.push_back( i );
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef MST_POINT_GRID_H
+#define MST_POINT_GRID_H
+
+#include <vector>
+#include <cmath>
+#include <opencv2/core/core.hpp>
+
+/* A uniform grid over a set of 3D points for radius queries. The points
+   are sorted by the index of their cell, so the grid only takes memory for
+   the non-empty cells. With a cell size of 'radius', the points within a
+   distance 'radius' of a position are in the 27 cells around it. */
+class PointGrid
+{
+public:
+    PointGrid( const std::vector<cv::Vec3d>& points, const double& radius );
+
+    // the indeces of the points within a distance 'radius' of pos (the
+    // indeces are appended to 'indeces', in increasing order per cell)
+    void query( const cv::Vec3d& pos, std::vector<int>& indeces ) const;
+
+private:
+    inline long long cell_of( const cv::Vec3i& cell ) const
+    {
+        return cell[0] + dims[0] * ( cell[1] + dims[1] * (long long) cell[2] );
+    }
+    inline cv::Vec3i cell_coord( const cv::Vec3d& pos ) const
+    {
+        return cv::Vec3i( (int) std::floor( ( pos[0] - origin[0] ) / cell_size ),
+                          (int) std::floor( ( pos[1] - origin[1] ) / cell_size ),
+                          (int) std::floor( ( pos[2] - origin[2] ) / cell_size ) );
+    }
+
+    const std::vector<cv::Vec3d>& points;
+    const double radius;
+    double cell_size;
+    cv::Vec3d origin;
+    cv::Vec3i dims;
+
+    std::vector<long long> keys;  // cell index of the points, sorted
+    std::vector<int>       order; // the points sorted by cell index
+};
+
+#endif // MST_POINT_GRID_H
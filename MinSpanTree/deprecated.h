@@ -43,20 +43,8 @@ void tree_from_critical_points( const ModelSet& models, Graph<Edge, cv::Vec3d>&
     tree.reset( graph.get_nodes() );
 
     // computing min span tree from a neighborhood system
-    DisjointSet djs( graph.num_nodes() );
-    std::priority_queue<Edge> edges = graph.get_edges();
-    while( !edges.empty() && tree.num_edges()<tree.num_nodes()-1 )
-    {
-        Edge e = edges.top();
-        const int sid1 = djs.find( e.node1 );
-        const int sid2 = djs.find( e.node2 );
-        if( sid1 != sid2 )
-        {
-            tree.add_edge( e );
-            djs.merge( sid1, sid2 );
-        }
-        edges.pop();
-    }
+    DisjointSet djs;
+    graph.get_min_span_tree( tree, &djs );
 
     graph.clear_edges();
 
@@ -271,19 +259,7 @@ void tree_from_critical_points( const ModelSet& models, Graph<Edge, cv::Vec3d>&
         }
     }
 
-    edges = graph.get_edges();
-    while( !edges.empty() && tree.num_edges()<tree.num_nodes()-1 )
-    {
-        Edge e = edges.top();
-        const int sid1 = djs.find( e.node1 );
-        const int sid2 = djs.find( e.node2 );
-        if( sid1 != sid2 )
-        {
-            tree.add_edge( e );
-            djs.merge( sid1, sid2 );
-        }
-        edges.pop();
-    }
+    graph.extend_min_span_tree( tree, djs );
 
 
 }
@@ -0,0 +1,173 @@
+#include "gtest/gtest.h"
+
+#include "../MSTGraph.h"
+#include "../DisjointSet.h"
+#include "../ConcurrentDisjointSet.h"
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <random>
+using namespace std;
+using namespace MST;
+
+TEST( Graph, MinSpanTree )
+{
+    /* [1] --3-- [2]
+        |       / | \
+        7    2    4    6
+        |  /      |      \
+       [3] --1-- [4] --5-- [0] */
+    Graph<Edge> graph( 5 );
+    graph.add_edge( Edge(1, 2, 3) );
+    graph.add_edge( Edge(1, 3, 7) );
+    graph.add_edge( Edge(2, 3, 2) );
+    graph.add_edge( Edge(2, 4, 4) );
+    graph.add_edge( Edge(2, 0, 6) );
+    graph.add_edge( Edge(3, 4, 1) );
+    graph.add_edge( Edge(4, 0, 5) );
+
+    Graph<Edge> tree;
+    DisjointSet djs;
+    graph.get_min_span_tree( tree, &djs );
+
+    ASSERT_EQ( tree.num_edges(), 4u );
+    float weight = 0;
+    for( unsigned i=0; i<tree.num_edges(); i++ ) weight += tree.get_edge(i).weight;
+    EXPECT_FLOAT_EQ( weight, 11.0f );
+    for( int i=1; i<5; i++ ) EXPECT_EQ( djs.find(i), djs.find(0) );
+
+    // the forest as compressed sparse row adjacency
+    vector<int> rowptr, neighbours, edge_ids;
+    tree.get_adjacency( rowptr, neighbours, &edge_ids );
+    ASSERT_EQ( rowptr.size(), 6u );
+    ASSERT_EQ( neighbours.size(), 8u );
+    const int degree[5] = { 1, 1, 2, 2, 2 };
+    for( int i=0; i<5; i++ )
+    {
+        EXPECT_EQ( rowptr[i+1] - rowptr[i], degree[i] );
+        for( int k=rowptr[i]; k<rowptr[i+1]; k++ )
+        {
+            const Edge& e = tree.get_edge( edge_ids[k] );
+            EXPECT_TRUE( ( e.node1==i && e.node2==neighbours[k] ) ||
+                         ( e.node2==i && e.node1==neighbours[k] ) );
+        }
+    }
+}
+
+TEST( Graph, FilterKruskal )
+{
+    // large enough for the partitions and the filtering of the heavy edges
+    const int num_nodes = 5000;
+    const int num_edges = 100000;
+    std::mt19937 rng( 7 );
+    Graph<Edge> graph( num_nodes );
+    for( int i=0; i<num_edges; i++ )
+    {
+        graph.add_edge( Edge( rng()%num_nodes, rng()%num_nodes, float( rng()%1000 ) ) );
+    }
+
+    Graph<Edge> tree;
+    DisjointSet djs;
+    graph.get_min_span_tree( tree, &djs );
+
+    // Kruskal on all the sorted edges
+    vector<Edge> edges = graph.get_edges();
+    std::stable_sort( edges.begin(), edges.end(), []( const Edge& e1, const Edge& e2 )
+    {
+        return e1.weight < e2.weight;
+    } );
+    DisjointSet djs2( num_nodes );
+    unsigned num_tree_edges = 0;
+    double weight2 = 0;
+    for( unsigned i=0; i<edges.size(); i++ )
+    {
+        if( djs2.find( edges[i].node1 )==djs2.find( edges[i].node2 ) ) continue;
+        djs2.merge( edges[i].node1, edges[i].node2 );
+        weight2 += edges[i].weight;
+        num_tree_edges++;
+    }
+
+    double weight = 0;
+    for( unsigned i=0; i<tree.num_edges(); i++ ) weight += tree.get_edge(i).weight;
+    EXPECT_EQ( tree.num_edges(), num_tree_edges );
+    EXPECT_DOUBLE_EQ( weight, weight2 );
+    for( int i=1; i<num_nodes; i++ )
+    {
+        EXPECT_EQ( djs.find(i)==djs.find(0), djs2.find(i)==djs2.find(0) );
+    }
+}
+
+TEST( ConcurrentDisjointSet, Stress )
+{
+    const int num_threads = 64;
+    const int num_elements = 1<<16;
+    const int num_merges = 1<<15;
+
+    for( int round=0; round<4; round++ )
+    {
+        std::mt19937 rng( round );
+        vector<std::pair<int,int> > merges( num_merges );
+        for( int i=0; i<num_merges; i++ )
+        {
+            merges[i].first  = rng() % num_elements;
+            merges[i].second = rng() % num_elements;
+        }
+
+        // all the threads merge and query at the same time
+        ConcurrentDisjointSet cdjs( num_elements );
+        vector<int> num_linked( num_threads, 0 );
+        vector<std::thread> threads;
+        for( int t=0; t<num_threads; t++ )
+        {
+            threads.push_back( std::thread( [&, t]()
+            {
+                for( int i=t; i<num_merges; i+=num_threads )
+                {
+                    if( cdjs.merge( merges[i].first, merges[i].second ) ) num_linked[t]++;
+                    cdjs.same( merges[i].first, merges[(i*7)%num_merges].second );
+                    cdjs.find( (i*13) % num_elements );
+                }
+            } ) );
+        }
+        for( int t=0; t<num_threads; t++ ) threads[t].join();
+
+        // every merge has been done or found done
+        for( int i=0; i<num_merges; i++ )
+        {
+            ASSERT_TRUE( cdjs.same( merges[i].first, merges[i].second ) );
+        }
+
+        const int num_sets = cdjs.finalize();
+
+        DisjointSet djs( num_elements );
+        for( int i=0; i<num_merges; i++ ) djs.merge( merges[i].first, merges[i].second );
+
+        // the canonical label is the smallest element of the set
+        vector<int> smallest( num_elements, num_elements );
+        for( int i=0; i<num_elements; i++ )
+        {
+            int& s = smallest[ djs.find(i) ];
+            s = std::min( s, i );
+        }
+        int num_sets2 = 0;
+        for( int i=0; i<num_elements; i++ )
+        {
+            ASSERT_EQ( cdjs.label(i), smallest[ djs.find(i) ] );
+            if( djs[i]==-1 ) num_sets2++;
+        }
+        EXPECT_EQ( num_sets, num_sets2 );
+
+        // each successful merge removed one set
+        int linked = 0;
+        for( int t=0; t<num_threads; t++ ) linked += num_linked[t];
+        EXPECT_EQ( linked, num_elements - num_sets );
+    }
+}
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    int flag = RUN_ALL_TESTS();
+    return flag;
+}
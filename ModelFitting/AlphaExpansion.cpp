@@ -0,0 +1,298 @@
+#include "AlphaExpansion.h"
+
+#include <iostream>
+#include <algorithm>
+#include <omp.h>
+
+#include "smart_assert.h"
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+// a pair of neighbouring sites of the region of an expansion, and the
+// energies of the pair when the sites keep their labels (00), or when the
+// second (01) or the first (10) takes the label alpha
+struct RegionPair
+{
+    int i, j;
+    double e00, e01, e10;
+};
+}
+
+
+AlphaExpansion::AlphaExpansion( const vector<Vec3i>& dataPoints,
+                                vector<int>& labelings,
+                                const LineModelArray& lines,
+                                const NeighbourPairs& pairs,
+                                int block_size )
+    : tildaP( dataPoints ), labelID( labelings ), lines( lines )
+    , pairs( pairs ), block_size( block_size )
+    , using_smoothcost_func( nullptr )
+{
+    // the points of a label may reach 2 voxels out of their bounding box
+    // (see expand()), that is less than half a block
+    smart_assert( block_size >= 8, "Error: invalid block size" );
+    smart_assert( pairs.num_sites()==tildaP.size(),
+                  "Error: the neighbour pairs of the model set are not built" );
+
+    // the pairs only store the forward neighbours, add the backward ones
+    const int num_sites = (int) tildaP.size();
+    adj_rowptr.assign( num_sites + 1, 0 );
+    for( int site = 0; site < num_sites; site++ )
+    {
+        for( unsigned k = pairs.begin( site ); k < pairs.end( site ); k++ )
+        {
+            adj_rowptr[ site + 1 ]++;
+            adj_rowptr[ pairs.site2[k] + 1 ]++;
+        }
+    }
+    for( int site = 0; site < num_sites; site++ ) adj_rowptr[site+1] += adj_rowptr[site];
+    adj_site.resize( adj_rowptr[num_sites] );
+    vector<unsigned> pos( adj_rowptr.begin(), adj_rowptr.end() - 1 );
+    for( int site = 0; site < num_sites; site++ )
+    {
+        for( unsigned k = pairs.begin( site ); k < pairs.end( site ); k++ )
+        {
+            adj_site[ pos[site]++ ] = pairs.site2[k];
+            adj_site[ pos[ pairs.site2[k] ]++ ] = site;
+        }
+    }
+}
+
+
+int AlphaExpansion::expand_label( const int& alpha, MaxFlow& graph, vector<int>& local )
+{
+    // the region: the sites next to the sites of alpha
+    vector<int> region;
+    for( unsigned k = label_rowptr[alpha]; k < label_rowptr[alpha+1]; k++ )
+    {
+        const int& site = label_site[k];
+        if( labelID[site]!=alpha ) continue;
+        for( unsigned n = adj_rowptr[site]; n < adj_rowptr[site+1]; n++ )
+        {
+            const int& site2 = adj_site[n];
+            if( labelID[site2]==alpha || local[site2]>=0 ) continue;
+            local[site2] = (int) region.size();
+            region.push_back( site2 );
+        }
+    }
+    if( region.empty() ) return 0;
+
+    const int num_nodes = (int) region.size();
+    vector<Vec3d>  P0( num_nodes ), P1( num_nodes ); // projections on the current lines and on alpha
+    vector<double> u0( num_nodes ), u1( num_nodes ); // exact unary energies
+    vector<double> g1( num_nodes, 0.0 );             // unary energies added by the truncated pairs
+    for( int r = 0; r < num_nodes; r++ )
+    {
+        const int& site = region[r];
+        const Vec3d p_tilde( tildaP[site] );
+        P0[r] = lines.projection( labelID[site], p_tilde );
+        P1[r] = lines.projection( alpha, p_tilde );
+        u0[r] = compute_datacost_for_one( lines, labelID[site], p_tilde, P0[r] );
+        u1[r] = compute_datacost_for_one( lines, alpha, p_tilde, P1[r] );
+    }
+
+    graph.reset( num_nodes );
+    vector<RegionPair> region_pairs;
+    for( int r = 0; r < num_nodes; r++ )
+    {
+        const int& site = region[r];
+        const int& label = labelID[site];
+        for( unsigned n = adj_rowptr[site]; n < adj_rowptr[site+1]; n++ )
+        {
+            const int& site2 = adj_site[n];
+            const int& label2 = labelID[site2];
+            const int& r2 = local[site2];
+            if( r2 < 0 )
+            {
+                // the label of site2 is fixed
+                const Vec3d p2 = lines.projection( label2, Vec3d( tildaP[site2] ) );
+                u0[r] += pair_energy( label, label2, P0[r], p2 );
+                u1[r] += pair_energy( alpha, label2, P1[r], p2 );
+            }
+            else if( r < r2 )
+            {
+                RegionPair pair;
+                pair.i = r;
+                pair.j = r2;
+                pair.e00 = pair_energy( label, label2, P0[r], P0[r2] );
+                pair.e01 = pair_energy( label, alpha, P0[r], P1[r2] );
+                pair.e10 = pair_energy( alpha, label2, P1[r], P0[r2] );
+                region_pairs.push_back( pair );
+
+                // the energy is 0 if both take alpha, truncate the energy of
+                // (00) if the pair is not submodular
+                const double e00 = min( pair.e00, pair.e01 + pair.e10 );
+                g1[r]  += pair.e10 - e00;
+                g1[r2] -= pair.e10;
+                graph.add_edge( r, r2, pair.e01 + pair.e10 - e00, 0.0 );
+            }
+        }
+    }
+
+    // the source side keeps its label, the sink side takes alpha
+    for( int r = 0; r < num_nodes; r++ )
+    {
+        const double cost0 = u0[r], cost1 = u1[r] + g1[r];
+        const double m = min( cost0, cost1 );
+        graph.add_tweights( r, cost1 - m, cost0 - m );
+    }
+    graph.maxflow();
+
+    // exact change of the energy
+    double delta = 0.0;
+    for( int r = 0; r < num_nodes; r++ )
+    {
+        if( graph.is_sink_side( r ) ) delta += u1[r] - u0[r];
+    }
+    for( unsigned k = 0; k < region_pairs.size(); k++ )
+    {
+        const RegionPair& pair = region_pairs[k];
+        const bool xi = graph.is_sink_side( pair.i );
+        const bool xj = graph.is_sink_side( pair.j );
+        if( xi && xj )  delta -= pair.e00;
+        else if( xj )   delta += pair.e01 - pair.e00;
+        else if( xi )   delta += pair.e10 - pair.e00;
+    }
+
+    int num_changed = 0;
+    const bool accept = ( delta < 0 );
+    for( int r = 0; r < num_nodes; r++ )
+    {
+        if( accept && graph.is_sink_side( r ) )
+        {
+            labelID[ region[r] ] = alpha;
+            num_changed++;
+        }
+        local[ region[r] ] = -1;
+    }
+    return num_changed;
+}
+
+
+int AlphaExpansion::expand( LevenbergMarquardt::SmoothCostType whatSmoothCost, int max_sweeps, bool verbose )
+{
+    switch( whatSmoothCost )
+    {
+    case LevenbergMarquardt::Linear:
+        if( verbose ) cout << endl << "Alpha Expansion::Linear" << endl;
+        using_smoothcost_func = &smoothcost_func_linear;
+        break;
+    case LevenbergMarquardt::Quadratic:
+        if( verbose ) cout << endl << "Alpha Expansion::Quadratic" << endl;
+        using_smoothcost_func = &smoothcost_func_quadratic;
+        break;
+    }
+
+    const int num_sites = (int) tildaP.size();
+    const int num_lines = lines.size();
+    if( verbose ) cout << "Initial Energy = " << compute_energy( tildaP, labelID, lines, pairs, using_smoothcost_func ) << endl;
+
+    // the position of the sites in the region of an expansion (-1 if they
+    // are not in it), one for every thread: expand_label() resets the
+    // entries it sets, so they are allocated once
+    vector<vector<int> > local_buffers( omp_get_max_threads() );
+
+    int total_changed = 0;
+    for( int sweep = 0; sweep < max_sweeps; sweep++ )
+    {
+        // the sites of every label
+        label_rowptr.assign( num_lines + 1, 0 );
+        for( int site = 0; site < num_sites; site++ ) label_rowptr[ labelID[site] + 1 ]++;
+        for( int label = 0; label < num_lines; label++ ) label_rowptr[label+1] += label_rowptr[label];
+        label_site.resize( num_sites );
+        vector<unsigned> pos( label_rowptr.begin(), label_rowptr.end() - 1 );
+        for( int site = 0; site < num_sites; site++ ) label_site[ pos[ labelID[site] ]++ ] = site;
+
+        // The expansion of a label reads the labels of the sites up to 2
+        // voxels away from its sites. A label goes to the block of the centre
+        // of the bounding box of its sites if this stays within half a block
+        // of the block, so that two blocks of the same colour never touch
+        // the same sites.
+        Vec3i grid( 1, 1, 1 );
+        for( int site = 0; site < num_sites; site++ )
+        {
+            for( int d=0; d<3; d++ ) grid[d] = max( grid[d], tildaP[site][d] / block_size + 1 );
+        }
+        const int half = block_size / 2;
+        vector<vector<int> > block_labels( grid[0] * grid[1] * grid[2] );
+        vector<int> deferred;
+        for( int label = 0; label < num_lines; label++ )
+        {
+            if( label_rowptr[label]==label_rowptr[label+1] ) continue;
+            Vec3i lo = tildaP[ label_site[ label_rowptr[label] ] ];
+            Vec3i hi = lo;
+            for( unsigned k = label_rowptr[label]; k < label_rowptr[label+1]; k++ )
+            {
+                for( int d=0; d<3; d++ )
+                {
+                    lo[d] = min( lo[d], tildaP[ label_site[k] ][d] );
+                    hi[d] = max( hi[d], tildaP[ label_site[k] ][d] );
+                }
+            }
+            Vec3i block;
+            bool fits = true;
+            for( int d=0; d<3; d++ )
+            {
+                block[d] = ( lo[d] + hi[d] ) / 2 / block_size;
+                fits = fits && ( lo[d] - 2 >= block[d] * block_size - half )
+                       && ( hi[d] + 2 < ( block[d] + 1 ) * block_size + half );
+            }
+            if( fits ) block_labels[ block[0] + grid[0] * ( block[1] + grid[1] * block[2] ) ].push_back( label );
+            else deferred.push_back( label );
+        }
+
+        // the blocks of every colour
+        vector<vector<int> > colours( 8 );
+        for( int z=0; z<grid[2]; z++ ) for( int y=0; y<grid[1]; y++ ) for( int x=0; x<grid[0]; x++ )
+                {
+                    const int b = x + grid[0] * ( y + grid[1] * z );
+                    if( !block_labels[b].empty() ) colours[ x%2 + 2*(y%2) + 4*(z%2) ].push_back( b );
+                }
+
+        int num_changed = 0;
+        for( int c = 0; c < 8; c++ )
+        {
+            const vector<int>& colour = colours[c];
+            #pragma omp parallel reduction(+:num_changed)
+            {
+                MaxFlow graph;
+                vector<int>& local = local_buffers[ omp_get_thread_num() ];
+                if( local.empty() ) local.assign( num_sites, -1 );
+                #pragma omp for schedule(dynamic, 1)
+                for( int i = 0; i < (int) colour.size(); i++ )
+                {
+                    const vector<int>& labels = block_labels[ colour[i] ];
+                    for( unsigned k = 0; k < labels.size(); k++ )
+                    {
+                        num_changed += expand_label( labels[k], graph, local );
+                    }
+                }
+            }
+        }
+        if( !deferred.empty() )
+        {
+            MaxFlow graph;
+            vector<int>& local = local_buffers[0];
+            if( local.empty() ) local.assign( num_sites, -1 );
+            for( unsigned k = 0; k < deferred.size(); k++ )
+            {
+                num_changed += expand_label( deferred[k], graph, local );
+            }
+        }
+        total_changed += num_changed;
+
+        if( verbose )
+        {
+            cout << "Sweep " << sweep << ": " << num_changed << " points relabelled, ";
+            cout << deferred.size() << " labels expanded serially" << endl;
+            cout << " New Energy = " << compute_energy( tildaP, labelID, lines, pairs, using_smoothcost_func ) << endl;
+        }
+        if( num_changed==0 ) break;
+    }
+
+    if( verbose ) cout << "Alpha Expansion Done. " << endl;
+    return total_changed;
+}
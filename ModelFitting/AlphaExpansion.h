@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+#include "LevenbergMarquardt.h"
+#include "EnergyFunctions.h"
+#include "LineModelArray.h"
+#include "NeighbourPairs.h"
+#include "MaxFlow.h"
+
+/* Discrete relabeling of the points with alpha expansion (graph cuts)
+
+   The line models are fixed and the labels of the points are reassigned
+   to decrease the same energy as Levenberg Marquardt: the data cost of
+   every point and the smooth cost of every pair of neighbouring points.
+   The expansion of a label 'alpha' only considers the points next to the
+   points of alpha (a point only takes the labels of its neighbours), so
+   the binary problem of every expansion is small. Non-submodular pair
+   terms are truncated, and a move is only accepted if it decreases the
+   exact energy.
+
+   The labels are assigned to cubic blocks of 'block_size' voxels. The
+   blocks are coloured like a checkerboard (8 colours): the labels of
+   blocks of the same colour are expanded in parallel, unless their points
+   reach too far out of their block, then they are expanded one after
+   another at the end of a sweep. */
+class AlphaExpansion
+{
+public:
+    AlphaExpansion( const std::vector<cv::Vec3i>& dataPoints,
+                    std::vector<int>& labelings,
+                    const LineModelArray& lines,
+                    const NeighbourPairs& pairs,
+                    int block_size = 16 );
+
+    // max_sweeps - maximum number of sweeps over all the labels
+    // verbose - print the progress and the energy after every sweep
+    // return the number of points that are relabelled
+    int expand( LevenbergMarquardt::SmoothCostType whatSmoothCost = LevenbergMarquardt::Quadratic,
+                int max_sweeps = 5, bool verbose = true );
+
+private:
+    // expand label alpha, return the number of points that are relabelled
+    int expand_label( const int& alpha, MaxFlow& graph, std::vector<int>& local );
+
+    // energy of a pair of neighbouring points with labels l1, l2 (their
+    // projections on their lines are p1, p2)
+    inline double pair_energy( const int& l1, const int& l2, const cv::Vec3d& p1, const cv::Vec3d& p2 ) const
+    {
+        if( l1==l2 ) return 0.0;
+        double smooth_cost_i = 0, smooth_cost_j = 0;
+        using_smoothcost_func( lines, l1, l2, p1, p2, smooth_cost_i, smooth_cost_j, NULL );
+        return smooth_cost_i + smooth_cost_j;
+    }
+
+private:
+    const std::vector<cv::Vec3i>& tildaP;  /// Original positions of the points
+    std::vector<int>&             labelID; /// Labels of the points
+    const LineModelArray&         lines;   /// Lines
+    const NeighbourPairs&         pairs;   /// Pairs of neighbouring points
+    const int block_size;
+
+    // all the (26) neighbours of every site, in compressed row storage
+    std::vector<unsigned> adj_rowptr;
+    std::vector<int>      adj_site;
+
+    // the sites of every label (built at the beginning of a sweep, a site
+    // may have changed its label since)
+    std::vector<unsigned> label_rowptr;
+    std::vector<int>      label_site;
+
+    SmoothCostFunc using_smoothcost_func;
+};
@@ -0,0 +1,709 @@
+#include "DomainDecomposition.h"
+
+#include <iostream>
+#include <limits>
+#include <algorithm>
+#include <fstream>
+#include <cmath>
+#include <new>
+#include <memory>
+#include <omp.h>
+
+#if !( _MSC_VER && !__INTEL_COMPILER )
+#include <sys/mman.h> // For the worker processes
+#include <sys/wait.h>
+#include <unistd.h>
+#include <dirent.h>
+#endif
+
+#include "ModelSet.h"
+#include "smart_assert.h"
+#include "SparseMatrixCV/SparseMatrixCV.h"
+#include "SparseMatrix/SparseMatrixArena.h"
+
+using namespace std;
+using namespace cv;
+
+// maximum number of Levenberg Marquardt iterations of a block in a sweep
+static const int max_block_iterations = 10;
+
+namespace
+{
+// Append a row of the Jacobian of the smooth cost of a pair of lines to the
+// Jacobian matrix of a block. ki, kj: local indices of the lines, -1 if the
+// line is frozen (its columns are dropped).
+inline void append_row( const LineJacobian::Matx1_12d& J, const int& ki, const int& kj,
+                        vector<double>&   Jacobian_nzv,
+                        vector<unsigned>& Jacobian_colindx,
+                        vector<unsigned>& Jacobian_rowptr )
+{
+    if( ki>=0 && kj>=0 )
+    {
+        LineJacobian::append_row( J, ki, kj, Jacobian_nzv, Jacobian_colindx, Jacobian_rowptr );
+        return;
+    }
+
+    const int first = ( ki>=0 ) ? 0 : LineJacobian::NUM_PARAM_PER_LINE;
+    LineJacobian::Matx16d J_free;
+    for( int i=0; i<LineJacobian::NUM_PARAM_PER_LINE; i++ )
+    {
+        J_free( 0, i ) = J( 0, first + i );
+    }
+    LineJacobian::append_row( J_free, ( ki>=0 ) ? ki : kj,
+                              Jacobian_nzv, Jacobian_colindx, Jacobian_rowptr );
+}
+}
+
+
+DomainDecomposition::DomainDecomposition( const vector<Vec3i>& dataPoints,
+        const vector<int>& labelings,
+        LineModelArray& lines,
+        const NeighbourPairs& pairs,
+        int block_size )
+    : tildaP( dataPoints ), labelID( labelings ), lines( lines )
+    , pairs( pairs ), block_size( block_size ), num_processes( 0 )
+    , using_smoothcost_func( nullptr )
+{
+    smart_assert( block_size > 0, "Error: invalid block size" );
+    smart_assert( pairs.num_sites()==tildaP.size(),
+                  "Error: the neighbour pairs of the model set are not built" );
+}
+
+
+void DomainDecomposition::partition( const Vec3i& offset )
+{
+    const int num_sites = (int) tildaP.size();
+    const int num_lines = lines.size();
+
+    // centroid of the data points of each line
+    vector<Vec3d> centroid( num_lines, Vec3d(0,0,0) );
+    vector<int> count( num_lines, 0 );
+    Vec3i grid( 1, 1, 1 ); // size of the block grid
+    for( int site = 0; site < num_sites; site++ )
+    {
+        centroid[ labelID[site] ] += Vec3d( tildaP[site] );
+        count[ labelID[site] ]++;
+        for( int d=0; d<3; d++ )
+        {
+            grid[d] = max( grid[d], ( tildaP[site][d] + offset[d] ) / block_size + 1 );
+        }
+    }
+
+    // the lines of each block (only the non-empty blocks are kept)
+    blocks.clear();
+    line_block.assign( num_lines, -1 );
+    line_local.assign( num_lines, -1 );
+    vector<int> block_index( grid[0] * grid[1] * grid[2], -1 );
+    for( int label = 0; label < num_lines; label++ )
+    {
+        if( count[label]==0 ) continue;
+
+        int bpos[3];
+        for( int d=0; d<3; d++ )
+        {
+            const double c = centroid[label][d] / count[label] + offset[d];
+            bpos[d] = min( grid[d] - 1, max( 0, int( c / block_size ) ) );
+        }
+        int& b = block_index[ bpos[0] + grid[0] * ( bpos[1] + grid[1] * bpos[2] ) ];
+        if( b==-1 )
+        {
+            b = (int) blocks.size();
+            blocks.push_back( Block() );
+        }
+        line_block[label] = b;
+        line_local[label] = (int) blocks[b].lines.size();
+        blocks[b].lines.push_back( label );
+    }
+    const int num_blocks = (int) blocks.size();
+
+    // the sites of the lines of each block
+    site_local.assign( num_sites, -1 );
+    for( int site = 0; site < num_sites; site++ )
+    {
+        Block& block = blocks[ line_block[ labelID[site] ] ];
+        site_local[site] = (int) block.sites.size();
+        block.sites.push_back( site );
+    }
+    for( int b = 0; b < num_blocks; b++ )
+    {
+        blocks[b].num_own_sites = (int) blocks[b].sites.size();
+    }
+
+    // the pairs of each block, the sites of the halo and the couplings
+    // between the blocks (a pair with lines in two different blocks)
+    vector<vector<int> > halo( num_blocks );
+    vector<Vec2i> couplings;
+    for( int site = 0; site < num_sites; site++ )
+    {
+        for( unsigned i = pairs.begin( site ); i < pairs.end( site ); i++ )
+        {
+            const int& site2 = pairs.site2[i];
+            const int& l1 = labelID[site];
+            const int& l2 = labelID[site2];
+            if( l1==l2 ) continue;
+
+            const int& b1 = line_block[l1];
+            const int& b2 = line_block[l2];
+            blocks[b1].pairs.push_back( Vec2i( site, site2 ) );
+            if( b1!=b2 )
+            {
+                blocks[b2].pairs.push_back( Vec2i( site, site2 ) );
+                halo[b1].push_back( site2 );
+                halo[b2].push_back( site );
+                couplings.push_back( Vec2i( min( b1, b2 ), max( b1, b2 ) ) );
+            }
+        }
+    }
+
+    // local indices of the sites of the pairs
+    #pragma omp parallel for schedule(dynamic, 1)
+    for( int b = 0; b < num_blocks; b++ )
+    {
+        Block& block = blocks[b];
+        vector<int>& h = halo[b];
+        std::sort( h.begin(), h.end() );
+        h.erase( std::unique( h.begin(), h.end() ), h.end() );
+        block.sites.insert( block.sites.end(), h.begin(), h.end() );
+
+        for( unsigned i = 0; i < block.pairs.size(); i++ )
+        {
+            for( int k = 0; k < 2; k++ )
+            {
+                const int site = block.pairs[i][k];
+                if( line_block[ labelID[site] ]==b )
+                {
+                    block.pairs[i][k] = site_local[site];
+                }
+                else
+                {
+                    block.pairs[i][k] = block.num_own_sites
+                                        + int( std::lower_bound( h.begin(), h.end(), site ) - h.begin() );
+                }
+            }
+        }
+    }
+
+    // greedy colouring of the blocks, coupled blocks have different colours
+    std::sort( couplings.begin(), couplings.end(), []( const Vec2i& a, const Vec2i& b )
+    {
+        return a[0] < b[0] || ( a[0]==b[0] && a[1] < b[1] );
+    } );
+    couplings.erase( std::unique( couplings.begin(), couplings.end() ), couplings.end() );
+    vector<vector<int> > coupled( num_blocks );
+    for( unsigned i = 0; i < couplings.size(); i++ )
+    {
+        coupled[ couplings[i][1] ].push_back( couplings[i][0] );
+    }
+
+    colours.clear();
+    vector<char> used;
+    for( int b = 0; b < num_blocks; b++ )
+    {
+        used.assign( colours.size() + 1, 0 );
+        for( unsigned i = 0; i < coupled[b].size(); i++ )
+        {
+            used[ blocks[ coupled[b][i] ].colour ] = 1;
+        }
+        int c = 0;
+        while( used[c] ) c++;
+
+        blocks[b].colour = c;
+        if( c==(int) colours.size() ) colours.push_back( vector<int>() );
+        colours[c].push_back( b );
+    }
+}
+
+
+double DomainDecomposition::block_energy( const int& b,
+        vector<Vec3d>& P,
+        vector<LineJacobian::Matx36d>* nablaP,
+        vector<double>* Jacobian_nzv,
+        vector<unsigned>* Jacobian_colindx,
+        vector<unsigned>* Jacobian_rowptr,
+        vector<double>* energy_matrix ) const
+{
+    const Block& block = blocks[b];
+    const bool with_jacobian = ( Jacobian_nzv!=NULL );
+
+    double energy = 0.0;
+
+    // data cost
+    for( int k = 0; k < (int) block.sites.size(); k++ )
+    {
+        const int& site = block.sites[k];
+        const int& label = labelID[site];
+
+        if( k >= block.num_own_sites )
+        {
+            // halo: the line is frozen, the Jacobian matrix of the projection
+            // is only needed for the columns of the lines of the block
+            P[k] = lines.projection( label, tildaP[site] );
+            if( with_jacobian ) (*nablaP)[k] = LineJacobian::Matx36d::zeros();
+            continue;
+        }
+
+        if( with_jacobian )
+        {
+            Vec3d X1, X2;
+            lines.getEndPoints( label, X1, X2 );
+            LineJacobian::Matx16d J_datacost;
+            LineJacobian::datacost( X1, X2, tildaP[site], P[k], (*nablaP)[k], J_datacost );
+
+            const double datacost = compute_datacost_for_one( lines, label, tildaP[site], P[k] );
+            energy += datacost;
+            energy_matrix->push_back( sqrt( datacost ) );
+            LineJacobian::append_row( J_datacost, line_local[label],
+                                      *Jacobian_nzv, *Jacobian_colindx, *Jacobian_rowptr );
+        }
+        else
+        {
+            P[k] = lines.projection( label, tildaP[site] );
+            energy += compute_datacost_for_one( lines, label, tildaP[site], P[k] );
+        }
+    }
+
+    // smooth cost
+    for( unsigned i = 0; i < block.pairs.size(); i++ )
+    {
+        const int& ki = block.pairs[i][0];
+        const int& kj = block.pairs[i][1];
+        const int& li = labelID[ block.sites[ki] ];
+        const int& lj = labelID[ block.sites[kj] ];
+
+        double smoothcost_i = 0, smoothcost_j = 0;
+        std::pair<double, double> coefficiency( 1.0, 1.0 );
+        using_smoothcost_func( lines, li, lj, P[ki], P[kj], smoothcost_i, smoothcost_j,
+                               with_jacobian ? &coefficiency : NULL );
+        energy += smoothcost_i + smoothcost_j;
+
+        if( !with_jacobian ) continue;
+
+        energy_matrix->push_back( sqrt( smoothcost_i ) );
+        energy_matrix->push_back( sqrt( smoothcost_j ) );
+
+        Vec3d Xi1, Xi2, Xj1, Xj2;
+        lines.getEndPoints( li, Xi1, Xi2 );
+        lines.getEndPoints( lj, Xj1, Xj2 );
+
+        LineJacobian::Matx1_12d J[2];
+        LineJacobian::smoothcost( Xi1, Xi2, Xj1, Xj2,
+                                  P[ki], (*nablaP)[ki],
+                                  P[kj], (*nablaP)[kj],
+                                  coefficiency.first, coefficiency.second,
+                                  J[0], J[1] );
+
+        for( int ji = 0; ji < 2; ji++ )
+        {
+            append_row( J[ji], local_line( li, b ), local_line( lj, b ),
+                        *Jacobian_nzv, *Jacobian_colindx, *Jacobian_rowptr );
+        }
+    }
+
+    return energy;
+}
+
+
+void DomainDecomposition::reestimate_block( const int& b, double lambda, const int& max_iterations,
+        BlockReport& report )
+{
+    const Clock::time_point time_begin = Clock::now();
+    const Block& block = blocks[b];
+    const int numParamPerLine = LineModelArray::NUM_PARAM_PER_LINE;
+    const int numParam = numParamPerLine * (int) block.lines.size();
+
+    vector<Vec3d> P( block.sites.size() );
+    vector<LineJacobian::Matx36d> nablaP( block.sites.size() );
+
+    vector<double> Jacobian_nzv;
+    vector<unsigned> Jacobian_colindx;
+    vector<unsigned> Jacobian_rowptr;
+    vector<double> energy_matrix;
+
+    double energy_before = 0.0;
+    int energy_increase_count = 0;
+
+    int iter = 0;
+    for( ; iter < max_iterations; iter++ )
+    {
+        SparseMatrixArena::Scope arena_scope;
+
+        Jacobian_nzv.clear();
+        Jacobian_colindx.clear();
+        Jacobian_rowptr.assign( 1, 0 );
+        energy_matrix.clear();
+
+        energy_before = block_energy( b, P, &nablaP, &Jacobian_nzv, &Jacobian_colindx,
+                                      &Jacobian_rowptr, &energy_matrix );
+        if( iter==0 ) report.energy = energy_before;
+
+        const SparseMatrixCV Jacobian = SparseMatrix( (int) Jacobian_rowptr.size() - 1, numParam,
+                                        Jacobian_nzv, Jacobian_colindx, Jacobian_rowptr );
+        const SparseMatrixCV Jt = Jacobian.t();
+        const SparseMatrixCV A = Jt * Jacobian + SparseMatrixCV::I( numParam ) * lambda;
+        const Mat_<double> B = Jt * cv::Mat_<double>( (int) energy_matrix.size(), 1, &energy_matrix.front() );
+
+        Mat_<double> X;
+        const int solver_iterations = solve( A, B, X );
+
+        // a step with an invalid solution is rejected without being applied
+        bool valid = ( solver_iterations>=0 && X.rows==numParam );
+        for( int i = 0; valid && i < numParam; i++ ) valid = std::isfinite( X( i ) );
+        if( !valid )
+        {
+            report.failed_solves++;
+            lambda *= 4.12;
+            if( ++energy_increase_count>=3 ) break;
+            continue;
+        }
+        report.solver_iterations += solver_iterations;
+
+        for( int k = 0; k < (int) block.lines.size(); k++ )
+        {
+            for( int i = 0; i < numParamPerLine; i++ )
+            {
+                lines.updateParameterWithDelta( block.lines[k], i, -X( k * numParamPerLine + i ) );
+            }
+        }
+
+        const double new_energy = block_energy( b, P, NULL, NULL, NULL, NULL, NULL );
+
+        if( new_energy < energy_before )
+        {
+            energy_before = new_energy;
+            lambda *= 0.50;
+            energy_increase_count = 0;
+            report.accepted++;
+        }
+        else
+        {
+            // reverse the result of this iteration
+            for( int k = 0; k < (int) block.lines.size(); k++ )
+            {
+                for( int i = 0; i < numParamPerLine; i++ )
+                {
+                    lines.updateParameterWithDelta( block.lines[k], i, X( k * numParamPerLine + i ) );
+                }
+            }
+            lambda *= 4.12;
+            if( ++energy_increase_count>=3 ) break;
+        }
+    }
+
+    adjust_endpoints( b );
+
+    report.block = b;
+    report.colour = block.colour;
+    report.iterations = std::min( iter + 1, max_iterations );
+    report.new_energy = energy_before;
+    report.time_total = elapsed_ms( time_begin );
+    report.done = true;
+}
+
+
+void DomainDecomposition::adjust_endpoints( const int& b )
+{
+    const Block& block = blocks[b];
+
+    vector<double> minT( block.lines.size(), (std::numeric_limits<double>::max)() );
+    vector<double> maxT( block.lines.size(), -(std::numeric_limits<double>::max)() );
+    for( int k = 0; k < block.num_own_sites; k++ )
+    {
+        const int& site = block.sites[k];
+        const int& label = labelID[site];
+        const int& local = line_local[label];
+
+        Vec3d p1, p2;
+        lines.getEndPoints( label, p1, p2 );
+        Vec3d dir = p2 - p1;
+        dir /= sqrt( dir.dot( dir ) ); // normalize the direction
+        const double t = ( Vec3d( tildaP[site] ) - p1 ).dot( dir );
+        maxT[local] = max( t+1, maxT[local] );
+        minT[local] = min( t-1, minT[local] );
+    }
+
+    for( int local = 0; local < (int) block.lines.size(); local++ )
+    {
+        if( minT[local] < maxT[local] )
+        {
+            const int& label = block.lines[local];
+            Vec3d p1, p2;
+            lines.getEndPoints( label, p1, p2 );
+            Vec3d dir = p2 - p1;
+            dir /= sqrt( dir.dot( dir ) ); // normalize the direction
+            lines.setPositions( label, p1 + dir * minT[local], p1 + dir * maxT[local] );
+        }
+    }
+}
+
+
+void DomainDecomposition::reestimate_colour( const int& c, const double& lambda,
+        const int& num_workers, vector<BlockReport>& reports )
+{
+    if( num_workers>0 && reestimate_colour_processes( c, lambda, num_workers, reports ) ) return;
+
+    // the blocks of the same colour do not share any energy term
+    const vector<int>& colour = colours[c];
+    #pragma omp parallel for schedule(dynamic, 1)
+    for( int i = 0; i < (int) colour.size(); i++ )
+    {
+        reestimate_block( colour[i], lambda, max_block_iterations, reports[ colour[i] ] );
+    }
+}
+
+
+bool DomainDecomposition::can_fork_workers( void )
+{
+#if _MSC_VER && !__INTEL_COMPILER
+    return false;
+#else
+    // the threads of this process (Linux only, elsewhere the workers are
+    // never forked)
+    DIR* dir = opendir( "/proc/self/task" );
+    if( dir==NULL ) return false;
+    int num_threads = 0;
+    while( const dirent* entry = readdir( dir ) )
+    {
+        if( entry->d_name[0]!='.' ) num_threads++;
+    }
+    closedir( dir );
+    return num_threads==1;
+#endif
+}
+
+
+bool DomainDecomposition::reestimate_colour_processes( const int& c, const double& lambda,
+        const int& max_workers, vector<BlockReport>& reports )
+{
+#if _MSC_VER && !__INTEL_COMPILER
+    return false;
+#else
+    const vector<int>& colour = colours[c];
+    const int numParamPerLine = LineModelArray::NUM_PARAM_PER_LINE;
+    const int num_workers = std::min( max_workers, (int) colour.size() );
+
+    // the lines of the blocks of the colour in the shared memory
+    vector<int> line_offset( colour.size() + 1, 0 );
+    for( unsigned i = 0; i < colour.size(); i++ )
+    {
+        line_offset[i+1] = line_offset[i] + (int) blocks[ colour[i] ].lines.size();
+    }
+
+    // shared memory: the end points of the lines, then the reports of the blocks
+    const size_t params_bytes = sizeof(double) * numParamPerLine * line_offset.back();
+    const size_t bytes = params_bytes + sizeof(BlockReport) * colour.size();
+    void* shared = mmap( NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    if( shared==MAP_FAILED ) return false;
+    double* params = static_cast<double*>( shared );
+    BlockReport* shared_reports = reinterpret_cast<BlockReport*>( static_cast<char*>( shared ) + params_bytes );
+    for( unsigned i = 0; i < colour.size(); i++ ) new( shared_reports + i ) BlockReport();
+
+    vector<pid_t> workers;
+    for( int w = 0; w < num_workers; w++ )
+    {
+        const pid_t pid = fork();
+        if( pid==0 )
+        {
+            // worker process: a copy of the parent, which has a single thread
+            for( int i = w; i < (int) colour.size(); i += num_workers )
+            {
+                const Block& block = blocks[ colour[i] ];
+                BlockReport report;
+                reestimate_block( colour[i], lambda, max_block_iterations, report );
+
+                double* dst = params + numParamPerLine * line_offset[i];
+                for( unsigned k = 0; k < block.lines.size(); k++, dst += numParamPerLine )
+                {
+                    Vec3d p1, p2;
+                    lines.getEndPoints( block.lines[k], p1, p2 );
+                    for( int j = 0; j < 3; j++ )
+                    {
+                        dst[j] = p1[j];
+                        dst[3+j] = p2[j];
+                    }
+                }
+                shared_reports[i] = report;
+            }
+            _exit( 0 );
+        }
+        // if a worker can not be created, its blocks are solved below
+        if( pid>0 ) workers.push_back( pid );
+    }
+    for( unsigned w = 0; w < workers.size(); w++ )
+    {
+        int status = 0;
+        waitpid( workers[w], &status, 0 );
+    }
+
+    // get the lines back from the workers (the blocks of a worker that did
+    // not finish are solved by this process)
+    for( int i = 0; i < (int) colour.size(); i++ )
+    {
+        const Block& block = blocks[ colour[i] ];
+        if( !shared_reports[i].done )
+        {
+            reestimate_block( colour[i], lambda, max_block_iterations, reports[ colour[i] ] );
+            continue;
+        }
+        const double* src = params + numParamPerLine * line_offset[i];
+        for( unsigned k = 0; k < block.lines.size(); k++, src += numParamPerLine )
+        {
+            lines.setPositions( block.lines[k], Vec3d( src[0], src[1], src[2] ),
+                                Vec3d( src[3], src[4], src[5] ) );
+        }
+        reports[ colour[i] ] = shared_reports[i];
+    }
+
+    munmap( shared, bytes );
+    return true;
+#endif
+}
+
+
+double DomainDecomposition::reestimate( double lambda,
+                                        LevenbergMarquardt::SmoothCostType whatSmoothCost,
+                                        int max_sweeps, double tolerance,
+                                        const ModelSet* modelset,
+                                        const string& serialize_dataname,
+                                        const LevenbergMarquardt::Options& options )
+{
+    smart_assert( lines.size()!=0, "No line models available" );
+
+    const Clock::time_point time_begin = Clock::now();
+
+    switch( whatSmoothCost )
+    {
+    case LevenbergMarquardt::Linear:
+        if( options.verbose ) cout << endl << "Levenberg Marquardt (Domain Decomposition)::Linear" << endl;
+        using_smoothcost_func = &smoothcost_func_linear;
+        break;
+    case LevenbergMarquardt::Quadratic:
+        if( options.verbose ) cout << endl << "Levenberg Marquardt (Domain Decomposition)::Quadratic" << endl;
+        using_smoothcost_func = &smoothcost_func_quadratic;
+        break;
+    }
+
+    std::ofstream report;
+    if( !options.report_file.empty() )
+    {
+        report.open( options.report_file.c_str() );
+        smart_assert( report.is_open(), "Cannot open the report file " << options.report_file );
+    }
+
+    // fork() is only safe while this process has a single thread: with the
+    // thread pool of OpenMP (or any other thread) running, a worker may
+    // inherit locks that are never released. The worker processes are
+    // refused in that case, and this process stays single-threaded (no
+    // OpenMP thread, synchronous checkpoints) while they are used.
+    int num_workers = num_processes;
+    const int max_threads = omp_get_max_threads();
+    if( num_workers>0 && !can_fork_workers() )
+    {
+        cerr << "Warning: this process already has several threads, ";
+        cerr << "the blocks are solved by the threads instead of worker processes" << endl;
+        num_workers = 0;
+    }
+    if( num_workers>0 ) omp_set_num_threads( 1 );
+
+    double energy_before = compute_energy( tildaP, labelID, lines, pairs, using_smoothcost_func );
+    if( options.verbose ) cout << "Initial Energy = " << energy_before << endl;
+
+    std::unique_ptr<Checkpoint> checkpoint;
+    if( modelset )
+    {
+        const bool async = options.async_checkpoint && num_workers==0;
+        checkpoint.reset( new Checkpoint( *modelset, serialize_dataname, async ) );
+    }
+
+    string reason = "max_sweeps";
+    int sweep = 0;
+    for( ; sweep < max_sweeps; sweep++ )
+    {
+        IterationReport it;
+        it.iteration = sweep;
+        it.energy = energy_before;
+        it.lambda = lambda;
+
+        // shift the block grid every other sweep
+        const int shift = ( sweep % 2 ) ? block_size / 2 : 0;
+        partition( Vec3i( shift, shift, shift ) );
+
+        Clock::time_point t = Clock::now();
+        vector<BlockReport> block_reports( blocks.size() );
+        for( int c = 0; c < (int) colours.size(); c++ )
+        {
+            reestimate_colour( c, lambda, num_workers, block_reports );
+        }
+        it.time_solve = elapsed_ms( t );
+
+        int failed_solves = 0;
+        for( unsigned b = 0; b < block_reports.size(); b++ )
+        {
+            block_reports[b].sweep = sweep;
+            it.solver_iterations += block_reports[b].solver_iterations;
+            failed_solves += block_reports[b].failed_solves;
+            write_report( report, block_reports[b] );
+        }
+
+        t = Clock::now();
+        const double new_energy = compute_energy( tildaP, labelID, lines, pairs, using_smoothcost_func );
+        it.time_energy = elapsed_ms( t );
+        it.new_energy = new_energy;
+        it.accepted = ( new_energy < energy_before );
+
+        if( checkpoint && options.checkpoint_every > 0 && ( sweep + 1 ) % options.checkpoint_every == 0 )
+        {
+            t = Clock::now();
+            checkpoint->save();
+            it.time_checkpoint = elapsed_ms( t );
+        }
+
+        it.time_total = elapsed_ms( time_begin );
+        write_report( report, it );
+
+        if( options.verbose )
+        {
+            cout << "Sweep " << sweep << ": " << blocks.size() << " blocks, " << colours.size() << " colours";
+            cout << ", Energy = " << new_energy << ", Solver iterations = " << it.solver_iterations;
+            if( failed_solves ) cout << ", Failed solves = " << failed_solves;
+            cout << endl;
+        }
+
+        const bool converged = ( energy_before - new_energy ) <= tolerance * energy_before;
+        energy_before = new_energy;
+        if( converged )
+        {
+            reason = "energy";
+            sweep++;
+            break;
+        }
+        if( options.time_budget > 0 && it.time_total >= 1000.0 * options.time_budget )
+        {
+            reason = "time_budget";
+            sweep++;
+            break;
+        }
+    }
+
+    // the final model set is always serialized
+    if( checkpoint )
+    {
+        checkpoint.reset();
+        modelset->serialize( serialize_dataname );
+    }
+
+    write_report_done( report, reason, sweep, energy_before, lambda, elapsed_ms( time_begin ) );
+
+    // the blocks are solved on all the threads, release all their arenas
+    #pragma omp parallel
+    {
+        SparseMatrixArena::release_memory();
+    }
+    if( num_workers>0 ) omp_set_num_threads( max_threads );
+
+    if( options.verbose )
+    {
+        cout << "Levenberg Marquardt (Domain Decomposition) Done (" << reason << "). Energy = ";
+        cout << energy_before << endl;
+    }
+    return energy_before;
+}
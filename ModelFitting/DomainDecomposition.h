@@ -0,0 +1,163 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <opencv2/core/core.hpp>
+
+#include "LevenbergMarquardt.h"
+#include "EnergyFunctions.h"
+#include "LineModelArray.h"
+#include "NeighbourPairs.h"
+#include "FittingReport.h"
+
+class ModelSet;
+
+/* Levenberg Marquardt on blocks of the volume (domain decomposition)
+
+   The volume is split into cubic blocks of 'block_size' voxels. A line
+   belongs to the block containing the centroid of its data points. Every
+   block runs its own Levenberg Marquardt on its lines, the lines of the
+   neighbouring blocks (the halo) are frozen. The blocks are coloured so that
+   no energy term involves the lines of two blocks of the same colour: the
+   blocks of a colour are solved in parallel and every block update decreases
+   the global energy (multiplicative Schwarz iteration). The block grid is
+   shifted by half a block every other sweep, so that the lines on the
+   boundary of a block are inside a block in the next sweep.
+
+   The size of the linear systems (and their memory) only depends on the
+   size of the blocks.
+
+   The blocks of a colour are solved either by the threads of this process,
+   or by worker processes (see set_num_processes()): the workers are forked
+   for every colour, so that they start from the current line models (the
+   halo of their blocks included), and they send the lines of their blocks
+   back through shared memory. This is a stand-in for a distributed run
+   (e.g. with MPI) on a single machine. */
+class DomainDecomposition
+{
+public:
+    DomainDecomposition( const std::vector<cv::Vec3i>& dataPoints,
+                         const std::vector<int>& labelings,
+                         LineModelArray& lines,
+                         const NeighbourPairs& pairs,
+                         int block_size = 32 );
+
+    // lambda - initial damping of the Levenberg Marquardt of the blocks
+    // max_sweeps - maximum number of sweeps over all the blocks
+    // tolerance - stop when the relative decrease of the energy in a sweep
+    //     is smaller than this
+    // modelset - if not NULL, it is serialized every options.checkpoint_every
+    //     sweeps (asynchronously if options.async_checkpoint) and at the end
+    // options - checkpoints, report (one line per block and per sweep),
+    //     progress and time budget (the other stopping criteria are given
+    //     by the parameters above)
+    // return the final energy
+    double reestimate( double lambda = 1e2,
+                       LevenbergMarquardt::SmoothCostType whatSmoothCost = LevenbergMarquardt::Linear,
+                       int max_sweeps = 10, double tolerance = 1e-4,
+                       const ModelSet* modelset = NULL,
+                       const std::string& serialize_dataname = "default",
+                       const LevenbergMarquardt::Options& options = LevenbergMarquardt::Options() );
+
+    // Solve the blocks of a colour with this number of worker processes
+    // (0: with the threads of this process). The workers are forked, so they
+    // are only used if this process has no other thread when reestimate()
+    // starts (see can_fork_workers()): call omp_set_num_threads( 1 ) before
+    // the first parallel region of the program. Only on Linux.
+    inline void set_num_processes( const int& n )
+    {
+        num_processes = n;
+    }
+
+    // whether this process can fork the worker processes, i.e. it has a
+    // single thread
+    static bool can_fork_workers( void );
+
+    inline int num_blocks( void ) const
+    {
+        return (int) blocks.size();
+    }
+
+    inline int num_colours( void ) const
+    {
+        return (int) colours.size();
+    }
+
+    // split the volume into blocks, with the block grid shifted by offset
+    // (this is done by reestimate(), it is public for testing)
+    void partition( const cv::Vec3i& offset = cv::Vec3i(0,0,0) );
+
+    // the block of a line, -1 if the line has no data point
+    inline int block_of_line( const int& label ) const
+    {
+        return line_block[label];
+    }
+
+    // the colour of a block
+    inline int colour_of_block( const int& block ) const
+    {
+        return blocks[block].colour;
+    }
+
+private:
+    struct Block
+    {
+        std::vector<int> lines;     // labels of the lines of the block
+        std::vector<int> sites;     // the sites of the lines of the block, followed
+                                    //   by the sites of the halo (frozen lines)
+        int num_own_sites;          // number of sites of the lines of the block
+        std::vector<cv::Vec2i> pairs; // neighbouring pairs (local indices of sites)
+                                      //   involving at least one line of the block
+        int colour;
+    };
+
+    // Levenberg Marquardt on block b, the statistics are written to report
+    void reestimate_block( const int& b, double lambda, const int& max_iterations,
+                           BlockReport& report );
+
+    // Levenberg Marquardt on all the blocks of colour c, with the threads of
+    // this process or with worker processes
+    void reestimate_colour( const int& c, const double& lambda, const int& num_workers,
+                            std::vector<BlockReport>& reports );
+    bool reestimate_colour_processes( const int& c, const double& lambda, const int& max_workers,
+                                      std::vector<BlockReport>& reports );
+
+    // energy of block b: the datacost of the sites of its lines and the
+    // smoothcost of its pairs. P: OUTPUT, projections of the local sites.
+    // If Jacobian_nzv is not NULL, the Jacobian matrix of the residuals (with
+    // respect to the lines of the block), the residuals and nablaP are
+    // computed as well.
+    double block_energy( const int& b,
+                         std::vector<cv::Vec3d>& P,
+                         std::vector<LineJacobian::Matx36d>* nablaP,
+                         std::vector<double>* Jacobian_nzv,
+                         std::vector<unsigned>* Jacobian_colindx,
+                         std::vector<unsigned>* Jacobian_rowptr,
+                         std::vector<double>* energy_matrix ) const;
+
+    // adjust the end points of the lines of block b to their data points
+    void adjust_endpoints( const int& b );
+
+    // local index of a line in block b, -1 if the line is frozen in the block
+    inline int local_line( const int& label, const int& b ) const
+    {
+        return ( line_block[label]==b ) ? line_local[label] : -1;
+    }
+
+private:
+    const std::vector<cv::Vec3i>& tildaP;  /// Original positions of the points
+    const std::vector<int>&       labelID; /// Labels of the points
+    LineModelArray&               lines;   /// Lines
+    const NeighbourPairs&         pairs;   /// Pairs of neighbouring points
+    const int block_size;
+    int num_processes;
+
+    std::vector<Block> blocks;
+    std::vector<std::vector<int> > colours; // the blocks of each colour
+
+    std::vector<int> line_block;  // block of each line
+    std::vector<int> line_local;  // index of each line in its block
+    std::vector<int> site_local;  // index of each site in the block of its line
+
+    SmoothCostFunc using_smoothcost_func;
+};
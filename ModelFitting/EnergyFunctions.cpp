@@ -1,8 +1,8 @@
 #include <opencv2/core/core.hpp>
 #include "EnergyFunctions.h"
-#include "Line3D.h"
-#include "Neighbour26.h"
-#include "Data3D.h"
+#include "LineModelArray.h"
+#include "NeighbourPairs.h"
+#include "smart_assert.h"
 #include "Timer.h"
 #include "../SparseMatrixCV/SparseMatrixCV.h"
 #include <vector>
@@ -23,27 +23,23 @@ using namespace cv;
 
 static const double epsilon_double = 1e-50;
 
-double compute_datacost_for_one( const Line3D* line_i, const Vec3d& pi )
+double compute_datacost_for_one( const LineModelArray& lines, const int& label,
+                                 const Vec3d& pi_tilde, const Vec3d& pi )
 {
-    const Vec3d proj_point = line_i->projection( pi );
-    const Vec3d dir = proj_point - pi;
+    const Vec3d dir = pi - pi_tilde;
     const double dist2 = dir.dot(dir);
-    const double sigma2 = line_i->getSigma() * line_i->getSigma();
+    const double sigma2 = lines.getSigma( label ) * lines.getSigma( label );
     return DATA_COST2 * dist2 / sigma2;
 }
 
 void smoothcost_func_quadratic(
-    const Line3D* line_i,  const Line3D* line_j,
-    const Vec3d& pi_tilde, const Vec3d& pj_tilde,
+    const LineModelArray& lines, const int& label_i, const int& label_j,
+    const Vec3d& pi, const Vec3d& pj,
     double& smooth_cost_i, double& smooth_cost_j, void* func_data )
 {
-    // single projection
-    const Vec3d pi = line_i->projection( pi_tilde );
-    const Vec3d pj = line_j->projection( pj_tilde );
-
     // double projection
-    const Vec3d pi_prime = line_j->projection( pi );
-    const Vec3d pj_prime = line_i->projection( pj );
+    const Vec3d pi_prime = lines.projection( label_j, pi );
+    const Vec3d pj_prime = lines.projection( label_i, pj );
 
     // distance vector
     const Vec3d pi_pj       = pi - pj;
@@ -61,17 +57,13 @@ void smoothcost_func_quadratic(
 
 
 void smoothcost_func_linear(
-    const Line3D* line_i, const Line3D* line_j,
-    const cv::Vec3d& pi_tilde, const cv::Vec3d& pj_tilde,
+    const LineModelArray& lines, const int& label_i, const int& label_j,
+    const cv::Vec3d& pi, const cv::Vec3d& pj,
     double& smooth_cost_i, double& smooth_cost_j, void* func_data )
 {
-    // single projection
-    const Vec3d pi = line_i->projection( pi_tilde );
-    const Vec3d pj = line_j->projection( pj_tilde );
-
     // double projection
-    const Vec3d pi_prime = line_j->projection( pi );
-    const Vec3d pj_prime = line_i->projection( pj );
+    const Vec3d pi_prime = lines.projection( label_j, pi );
+    const Vec3d pj_prime = lines.projection( label_i, pj );
 
     // distance vector
     const Vec3d pi_pj       = pi - pj;
@@ -99,52 +91,179 @@ void smoothcost_func_linear(
     }
 }
 
+double compute_energy_for_one(
+    const int& site,
+    const std::vector<cv::Vec3i>& dataPoints,
+    const std::vector<int>& labelings,
+    const LineModelArray& lines,
+    const NeighbourPairs& pairs,
+    const std::vector<cv::Vec3d>& P,
+    SmoothCostFunc using_smoothcost_func )
+{
+    const int& l1 = labelings[site];
+
+    // data cost
+    double energy = compute_datacost_for_one( lines, l1, dataPoints[site], P[site] );
+
+    // smooth cost
+    for( unsigned i = pairs.begin( site ); i < pairs.end( site ); i++ )
+    {
+        const int& site2 = pairs.site2[i];
+        const int& l2 = labelings[site2];
+
+        if( l1==l2 ) continue;
+
+        double energy_smoothness_i = 0, energy_smoothness_j = 0;
+
+        using_smoothcost_func( lines, l1, l2, P[site], P[site2],
+                               energy_smoothness_i, energy_smoothness_j, NULL );
+
+        energy += energy_smoothness_i + energy_smoothness_j;
+    }
+
+    return energy;
+}
+
 // compute total energy: smoothcost + datacost
 double compute_energy(
     const std::vector<cv::Vec3i>& dataPoints,
     const std::vector<int>& labelings,
-    const std::vector<Line3D*>& lines,
-    const Data3D<int>& indeces,
+    const LineModelArray& lines,
+    const NeighbourPairs& pairs,
     SmoothCostFunc using_smoothcost_func )
 {
     smart_assert( using_smoothcost_func, "Please define what smooth cost energy function you want to use. " );
-    double energy = 0.0;
+    smart_assert( pairs.num_sites()==dataPoints.size(), "The neighbour pairs are not built for these points. " );
+
+    const int num_sites = (int) dataPoints.size();
+    if( num_sites==0 ) return 0.0;
 
-    // computer data cost
-    for( int site = 0; site < (int) dataPoints.size(); site++ )
+    // projections of the points on their lines
+    vector<Vec3d> P( num_sites );
+    lines.project( &labelings[0], &dataPoints[0], &P[0], num_sites );
+
+    vector<double> site_energy( num_sites );
+
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for( int site = 0; site < num_sites; site++ )
     {
-        const int& label = labelings[site];
-        energy += compute_datacost_for_one( lines[label], dataPoints[site] );
+        site_energy[site] = compute_energy_for_one( site, dataPoints, labelings, lines,
+                            pairs, P, using_smoothcost_func );
     }
 
-    // compute smooth cost
-    for( unsigned site = 0; site < dataPoints.size(); site++ )   // For each data point
+    // sum up the energy in a fixed order (the result is deterministic)
+    double energy = 0.0;
+    for( unsigned site = 0; site < site_energy.size(); site++ )
     {
-        for( int neibourIndex=0; neibourIndex<13; neibourIndex++ )
-        {
-            // neighbour position
-            Vec3i neig;
-            Neighbour26::getNeigbour( neibourIndex, dataPoints[site], neig );
+        energy += site_energy[site];
+    }
+    return energy;
+}
 
-            if( !indeces.isValid(neig) ) continue; // not a valid position, otherwise
 
-            const int site2 = indeces.at(neig);
-            if( site2==-1 ) continue ; // not a neighbour, other wise, found a neighbour
+IncrementalEnergy::IncrementalEnergy( const std::vector<cv::Vec3i>& dataPoints,
+                                      const std::vector<int>& labelings,
+                                      const LineModelArray& lines,
+                                      const NeighbourPairs& pairs,
+                                      SmoothCostFunc using_smoothcost_func )
+    : dataPoints( dataPoints ), labelings( labelings ), lines( lines )
+    , pairs( pairs ), using_smoothcost_func( using_smoothcost_func )
+    , P( dataPoints.size() )
+    , old_P( dataPoints.size() )
+    , projected( dataPoints.size(), 0 )
+    , site_energy( dataPoints.size(), 0.0 )
+    , old_energy( dataPoints.size(), 0.0 )
+    , updated( dataPoints.size(), 0 )
+    , total( 0.0 ), old_total( 0.0 )
+{
+    smart_assert( using_smoothcost_func, "Please define what smooth cost energy function you want to use. " );
+    smart_assert( pairs.num_sites()==dataPoints.size(), "The neighbour pairs are not built for these points. " );
+}
 
-            const int l1 = labelings[site];
-            const int l2 = labelings[site2];
+double IncrementalEnergy::compute( void )
+{
+    const int num_sites = (int) dataPoints.size();
+    if( num_sites > 0 )
+    {
+        lines.project( &labelings[0], &dataPoints[0], &P[0], num_sites );
+    }
+
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for( int site = 0; site < num_sites; site++ )
+    {
+        site_energy[site] = compute_energy_for_one( site, dataPoints, labelings, lines,
+                            pairs, P, using_smoothcost_func );
+        updated[site] = 0;
+        projected[site] = 0;
+    }
 
-            if( l1==l2 ) continue;
+    old_total = total = sum();
+    return total;
+}
 
-            double energy_smoothness_i = 0, energy_smoothness_j = 0;
+double IncrementalEnergy::update( const std::vector<bool>& line_changed )
+{
+    smart_assert( (int) line_changed.size()==lines.size(), "Invalid number of lines" );
+
+    const int num_sites = (int) dataPoints.size();
+
+    // re-project the points whose line has changed
+    #pragma omp parallel for schedule(static)
+    for( int site = 0; site < num_sites; site++ )
+    {
+        const int& label = labelings[site];
+        projected[site] = line_changed[label];
+        if( projected[site] )
+        {
+            old_P[site] = P[site];
+            P[site] = lines.projection( label, dataPoints[site] );
+        }
+    }
 
-            using_smoothcost_func( lines[l1], lines[l2],
-                                   dataPoints[site], dataPoints[site2],
-                                   energy_smoothness_i, energy_smoothness_j, NULL );
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for( int site = 0; site < num_sites; site++ )
+    {
+        // the energy of the site depends on its line and the lines of its
+        // forward neighbours
+        bool changed = line_changed[ labelings[site] ];
+        for( unsigned i = pairs.begin( site ); !changed && i < pairs.end( site ); i++ )
+        {
+            changed = line_changed[ labelings[ pairs.site2[i] ] ];
+        }
 
-            energy += energy_smoothness_i + energy_smoothness_j;
+        updated[site] = changed;
+        if( changed )
+        {
+            old_energy[site]  = site_energy[site];
+            site_energy[site] = compute_energy_for_one( site, dataPoints, labelings, lines,
+                                pairs, P, using_smoothcost_func );
         }
     }
 
+    old_total = total;
+    total = sum();
+    return total;
+}
+
+void IncrementalEnergy::rollback( void )
+{
+    for( unsigned site = 0; site < site_energy.size(); site++ )
+    {
+        if( updated[site] ) site_energy[site] = old_energy[site];
+        if( projected[site] ) P[site] = old_P[site];
+        updated[site] = 0;
+        projected[site] = 0;
+    }
+    total = old_total;
+}
+
+double IncrementalEnergy::sum( void ) const
+{
+    // sum up the energy in a fixed order (the result is deterministic)
+    double energy = 0.0;
+    for( unsigned site = 0; site < site_energy.size(); site++ )
+    {
+        energy += site_energy[site];
+    }
     return energy;
 }
@@ -4,38 +4,102 @@
 #include <array>
 #include <opencv2/core/core.hpp>
 
-class Line3D;
-template<class T>
-class Data3D;
+class LineModelArray;
+class NeighbourPairs;
 class SparseMatrixCV;
 
 extern const double DATA_COST2;
 extern const double PAIRWISE_SMOOTH2;
 
+// pi, pj: projections of the data points i and j on their own lines
+// (label_i and label_j respectively)
 typedef void (*SmoothCostFunc)( \
-	const Line3D* line_i, const Line3D* line_j, \
-	const cv::Vec3d& pi_tilde, const cv::Vec3d& pj_tilde, \
+	const LineModelArray& lines, const int& label_i, const int& label_j, \
+	const cv::Vec3d& pi, const cv::Vec3d& pj, \
 	double& smooth_cost_i, double& smooth_cost_j, void* func_data );
 
 
-// compute datacost for asigning a data point to a line
-double compute_datacost_for_one( const Line3D* line_i, const cv::Vec3d& pi );
+// compute datacost for asigning a data point pi_tilde to a line
+// (pi is the projection of pi_tilde on the line)
+double compute_datacost_for_one( const LineModelArray& lines, const int& label,
+	const cv::Vec3d& pi_tilde, const cv::Vec3d& pi );
 
 // compute smoothcost for a pair of neighbouring pixels
 void smoothcost_func_quadratic(
-	const Line3D* line_i, const Line3D* line_j,
-	const cv::Vec3d& pi_tilde, const cv::Vec3d& pj_tilde,
+	const LineModelArray& lines, const int& label_i, const int& label_j,
+	const cv::Vec3d& pi, const cv::Vec3d& pj,
 	double& smooth_cost_i, double& smooth_cost_j, void* func_data = NULL );
 
 // compute smoothcost for a pair of neighbouring pixels
 void smoothcost_func_linear(
-	const Line3D* line_i, const Line3D* line_j,
-	const cv::Vec3d& pi_tilde, const cv::Vec3d& pj_tilde,
+	const LineModelArray& lines, const int& label_i, const int& label_j,
+	const cv::Vec3d& pi, const cv::Vec3d& pj,
 	double& smooth_cost_i, double& smooth_cost_j, void* func_data = NULL );
 
 // compute total energy: smoothcost + datacost
+// The energy of the sites are computed in parallel and summed up in the order
+// of the sites, so the result does not depend on the number of threads.
 double compute_energy(
 	const std::vector<cv::Vec3i>& dataPoints,
 	const std::vector<int>& labelings,
-	const std::vector<Line3D*>& lines,
-	const Data3D<int>& indeces, SmoothCostFunc using_smoothcost_func );
+	const LineModelArray& lines,
+	const NeighbourPairs& pairs, SmoothCostFunc using_smoothcost_func );
+
+// compute the energy of one site: its datacost and the smoothcost of the
+// pairs it forms with its (forward) neighbours
+// projections: projections of the data points on their lines
+double compute_energy_for_one(
+	const int& site,
+	const std::vector<cv::Vec3i>& dataPoints,
+	const std::vector<int>& labelings,
+	const LineModelArray& lines,
+	const NeighbourPairs& pairs,
+	const std::vector<cv::Vec3d>& projections,
+	SmoothCostFunc using_smoothcost_func );
+
+
+// Total energy with a cache of the energy of every site. After the lines
+// are updated, only the sites whose line (or the line of one of their
+// neighbours) changed are re-evaluated.
+class IncrementalEnergy
+{
+public:
+	IncrementalEnergy( const std::vector<cv::Vec3i>& dataPoints,
+	                   const std::vector<int>& labelings,
+	                   const LineModelArray& lines,
+	                   const NeighbourPairs& pairs,
+	                   SmoothCostFunc using_smoothcost_func );
+
+	// evaluate the energy of all the sites
+	double compute( void );
+
+	// re-evaluate the sites that are affected by the lines with
+	// line_changed[label]==true and return the new total energy
+	double update( const std::vector<bool>& line_changed );
+
+	// undo the last update() (once the lines are restored)
+	void rollback( void );
+
+	inline double energy( void ) const
+	{
+		return total;
+	}
+
+private:
+	double sum( void ) const;
+
+	const std::vector<cv::Vec3i>& dataPoints;
+	const std::vector<int>&       labelings;
+	const LineModelArray&         lines;
+	const NeighbourPairs&         pairs;
+	SmoothCostFunc using_smoothcost_func;
+
+	std::vector<cv::Vec3d> P;           // projections of the points on their lines
+	std::vector<cv::Vec3d> old_P;       // projections before the last update
+	std::vector<unsigned char> projected; // sites re-projected in the last update
+
+	std::vector<double> site_energy;    // cached energy of each site
+	std::vector<double> old_energy;     // energy of the sites before the last update
+	std::vector<unsigned char> updated; // sites re-evaluated in the last update
+	double total, old_total;
+};
@@ -0,0 +1,90 @@
+#include "FittingReport.h"
+
+#include <iomanip>
+#include <cmath>
+
+#include "ModelSet.h"
+
+using namespace std;
+
+namespace
+{
+// a number in JSON, null if it is not finite (nan and inf are not valid JSON)
+struct Number
+{
+    const double value;
+    Number( const double& v ) : value( v ) { }
+};
+
+inline std::ostream& operator<<( std::ostream& out, const Number& n )
+{
+    if( std::isfinite( n.value ) ) return out << n.value;
+    return out << "null";
+}
+}
+
+void write_report( std::ofstream& out, const IterationReport& it )
+{
+    if( !out.is_open() ) return;
+    out << std::setprecision( 12 );
+    out << "{\"iteration\":"         << it.iteration;
+    out << ",\"energy\":"            << Number( it.energy );
+    out << ",\"new_energy\":"        << Number( it.new_energy );
+    out << ",\"accepted\":"          << ( it.accepted ? "true" : "false" );
+    out << ",\"lambda\":"            << Number( it.lambda );
+    out << ",\"gain_ratio\":"        << Number( it.gain_ratio );
+    out << ",\"gradient_norm\":"     << Number( it.gradient_norm );
+    out << ",\"solver_iterations\":" << it.solver_iterations;
+    out << ",\"time_datacost\":"     << Number( it.time_datacost );
+    out << ",\"time_smoothcost\":"   << Number( it.time_smoothcost );
+    out << ",\"time_assemble\":"     << Number( it.time_assemble );
+    out << ",\"time_solve\":"        << Number( it.time_solve );
+    out << ",\"time_energy\":"       << Number( it.time_energy );
+    out << ",\"time_checkpoint\":"   << Number( it.time_checkpoint );
+    out << ",\"time_total\":"        << Number( it.time_total ) << "}" << endl;
+}
+
+void write_report( std::ofstream& out, const BlockReport& br )
+{
+    if( !out.is_open() ) return;
+    out << std::setprecision( 12 );
+    out << "{\"sweep\":"             << br.sweep;
+    out << ",\"block\":"             << br.block;
+    out << ",\"colour\":"            << br.colour;
+    out << ",\"done\":"              << ( br.done ? "true" : "false" );
+    out << ",\"iterations\":"        << br.iterations;
+    out << ",\"accepted\":"          << br.accepted;
+    out << ",\"solver_iterations\":" << br.solver_iterations;
+    out << ",\"failed_solves\":"     << br.failed_solves;
+    out << ",\"energy\":"            << Number( br.energy );
+    out << ",\"new_energy\":"        << Number( br.new_energy );
+    out << ",\"time_total\":"        << Number( br.time_total ) << "}" << endl;
+}
+
+void write_report_done( std::ofstream& out, const string& reason, const int& iterations,
+                        const double& energy, const double& lambda, const double& time_total )
+{
+    if( !out.is_open() ) return;
+    out << std::setprecision( 12 );
+    out << "{\"done\":true,\"reason\":\"" << reason << "\",\"iterations\":" << iterations;
+    out << ",\"energy\":" << Number( energy ) << ",\"lambda\":" << Number( lambda );
+    out << ",\"time_total\":" << Number( time_total ) << "}" << endl;
+}
+
+
+void Checkpoint::save( void )
+{
+    wait();
+    if( !async )
+    {
+        modelset.serialize( dataname );
+        return;
+    }
+    snapshot = modelset.line_array;
+    worker = std::thread( &Checkpoint::run, this );
+}
+
+void Checkpoint::run( void )
+{
+    modelset.serialize( dataname, snapshot );
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <chrono>
+#include <fstream>
+
+#include "LineModelArray.h"
+
+class ModelSet;
+
+/* Telemetry and checkpoints of the model fitting (see LevenbergMarquardt
+   and DomainDecomposition): the reports are written as JSON lines, one
+   object per line. Times are in milliseconds. */
+
+typedef std::chrono::steady_clock Clock;
+
+inline double elapsed_ms( const Clock::time_point& begin )
+{
+    return std::chrono::duration<double, std::milli>( Clock::now() - begin ).count();
+}
+
+// Statistics of one iteration of Levenberg Marquardt (or of one sweep of
+// the domain decomposition)
+struct IterationReport
+{
+    int iteration;
+    double energy, new_energy, lambda, gain_ratio, gradient_norm;
+    int solver_iterations;
+    bool accepted;
+    double time_datacost, time_smoothcost, time_assemble, time_solve;
+    double time_energy, time_checkpoint, time_total;
+
+    IterationReport( void )
+        : iteration( 0 ), energy( 0 ), new_energy( 0 ), lambda( 0 ), gain_ratio( 0 )
+        , gradient_norm( 0 ), solver_iterations( 0 ), accepted( false )
+        , time_datacost( 0 ), time_smoothcost( 0 ), time_assemble( 0 ), time_solve( 0 )
+        , time_energy( 0 ), time_checkpoint( 0 ), time_total( 0 ) { }
+};
+
+// Statistics of the Levenberg Marquardt of one block of the domain
+// decomposition in a sweep (plain data, it may be filled by another process)
+struct BlockReport
+{
+    int sweep, block, colour;
+    int iterations;        // iterations of Levenberg Marquardt
+    int accepted;          // number of accepted steps
+    int solver_iterations; // total number of iterations of the linear solver
+    int failed_solves;     // number of steps with an invalid solution (not applied)
+    double energy, new_energy; // energy of the block before and after
+    double time_total;
+    bool done;             // the block has been solved
+
+    BlockReport( void )
+        : sweep( 0 ), block( 0 ), colour( 0 ), iterations( 0 ), accepted( 0 )
+        , solver_iterations( 0 ), failed_solves( 0 ), energy( 0 ), new_energy( 0 )
+        , time_total( 0 ), done( false ) { }
+};
+
+// Write a report as a line of JSON (nothing if the file is not opened)
+void write_report( std::ofstream& out, const IterationReport& it );
+void write_report( std::ofstream& out, const BlockReport& br );
+// the last line of a report: why and when the fitting stopped
+void write_report_done( std::ofstream& out, const std::string& reason, const int& iterations,
+                        const double& energy, const double& lambda, const double& time_total );
+
+// Serialize a model set during model fitting. With async, the line models
+// are copied and written in a background thread, so that the model fitting
+// can go on (the points and the labels do not change during the fitting).
+class Checkpoint
+{
+public:
+    Checkpoint( const ModelSet& modelset, const std::string& dataname, bool async )
+        : modelset( modelset ), dataname( dataname ), async( async ) { }
+
+    ~Checkpoint( void )
+    {
+        wait();
+    }
+
+    void save( void );
+
+    // wait for the last checkpoint to be written
+    void wait( void )
+    {
+        if( worker.joinable() ) worker.join();
+    }
+
+private:
+    Checkpoint( const Checkpoint& );
+    Checkpoint& operator=( const Checkpoint& );
+
+    void run( void );
+
+    const ModelSet& modelset;
+    const std::string dataname;
+    const bool async;
+    LineModelArray snapshot;
+    std::thread worker;
+};
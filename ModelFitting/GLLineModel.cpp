@@ -5,16 +5,12 @@ using namespace GLViewer;
 
 
 GLLineModel::GLLineModel( cv::Vec3i size )
-    : size( size ), render_mode(1)
+    : size( size ), render_mode(1), built_modes(0)
 {
-    // creat a mutex
-    // hMutex = CreateMutex( NULL, false, NULL );
 }
 
 GLLineModel::~GLLineModel( void )
 {
-    // destroy the mutex
-    // CloseHandle( hMutex );
 }
 
 
@@ -45,7 +41,9 @@ void normal_vectors(  const Vec3f v1, Vec3f& v2, Vec3f& v3 )
     v3 /= length;
 }
 
-void DrawCircle(const Vec3f& centre, const Vec3f& dir, const float& r )
+// the 10 segments of a circle (20 vertices for GL_LINES)
+void circle_vertices( const Vec3f& centre, const Vec3f& dir, const float& r,
+                      const Vec3b& color, VertexBuffer::Vertex* v )
 {
     const int num_segments = 10;
     float theta = 2 * 3.1415926 / float(num_segments);
@@ -62,11 +60,12 @@ void DrawCircle(const Vec3f& centre, const Vec3f& dir, const float& r )
     smart_assert( dir.dot(norm1)<1e-3, "Should be perpendicular with each other" );
     smart_assert( dir.dot(norm2)<1e-3, "Should be perpendicular with each other" );
 
-    glBegin(GL_LINE_LOOP);
+    const Vec3f first = centre + norm1 * x + norm2 * y;
     for(int ii = 0; ii < num_segments; ii++)
     {
         Vec3f pos = centre + norm1 * x + norm2 * y;
-        glVertex3fv( &pos[0] );//output vertex
+        if( ii>0 ) ( v++ )->set( pos[0], pos[1], pos[2], color[0], color[1], color[2] );
+        ( v++ )->set( pos[0], pos[1], pos[2], color[0], color[1], color[2] );
 
         //calculate the tangential vector
         //remember, the radial vector is (x, y)
@@ -82,130 +81,144 @@ void DrawCircle(const Vec3f& centre, const Vec3f& dir, const float& r )
         x *= radial_factor;
         y *= radial_factor;
     }
-    glEnd();
+    // close the loop
+    v->set( first[0], first[1], first[2], color[0], color[1], color[2] );
 }
 
-void GLLineModel::render( void )
+void GLLineModel::build_buffers( const char& modes )
 {
-    // in case there is any previously bind texture, you need to unbind them
+    // the data points and the labels are not consistent (yet)
+    const int num = ( labelings.size()==dataPoints.size() ) ? (int) dataPoints.size() : 0;
 
-    /////////////////////////////////////////////////////
-    ////// Draw the axis
-    /////////////////////////////////////////////////////
-    //glBegin( GL_LINES );
-    //// x-axis
-    //glColor3f(  1.0f, 0.0f, 0.0f );
-    //glVertex3i( 0, 0, 0 );
-    //glVertex3i( size[0], 0, 0 );
-    //// y-axis
-    //glColor3f(  0.0f, 1.0f, 0.0f );
-    //glVertex3i( 0, 0, 0 );
-    //glVertex3i( 0, size[1], 0 );
-    //// z-axis
-    //glColor3f(  0.0f, 0.0f, 1.0f );
-    //glVertex3i( 0, 0, 0 );
-    //glVertex3i( 0, 0, size[2] );
-    //glEnd();
+    // the projections of the data points on their line models
+    vector<Vec3f> prj( num );
+    #pragma omp parallel for schedule(static)
+    for( int i=0; i < num; i++ )
+    {
+        prj[i] = lines[ labelings[i] ]->projection( dataPoints[i] );
+    }
 
-    // WaitForSingleObject( hMutex, INFINITE );
+    vector<VertexBuffer::Vertex> vertices;
 
     /////////////////////////////////////////////////
-    // draw the projection points
+    // the projection points
     /////////////////////////////////////////////////
-    if( render_mode & 4 )
+    if( modes & 4 )
     {
-        glPointSize( 3.0 );
-        glBegin( GL_POINTS );
-        for( int i=0; i < (int) dataPoints.size(); i++ )
+        vertices.resize( num );
+        #pragma omp parallel for schedule(static)
+        for( int i=0; i < num; i++ )
         {
-            const int& lineID = labelings[i];
-            Vec3f prj = lines[lineID]->projection( dataPoints[i] );
-            glColor3ubv( &lineColors[lineID][0] );
-            glVertex3fv( &prj[0] );
+            const Vec3b& c = lineColors[ labelings[i] ];
+            vertices[i].set( prj[i][0], prj[i][1], prj[i][2], c[0], c[1], c[2] );
         }
-        glEnd();
+        points_buffer.update( vertices );
     }
 
     /////////////////////////////////////////////////
-    // draw the end points of the lines
-    /////////////////////////////////////////////////
-    //glPointSize( 6.0 );
-    //glBegin( GL_POINTS );
-    //for( int i=0; i < (int) dataPoints.size(); i++ ) {
-    //	int lineID = labelings[i];
-    //	Vec3f p1, p2;
-    //	lines[lineID]->getEndPoints( p1, p2 );
-    //	glColor3ubv( &lineColors[lineID][0] );
-    //	glVertex3fv( &p1[0] );
-    //	glVertex3fv( &p2[0] );
-    //}
-    //glEnd();
-
-    /////////////////////////////////////////////////
-    // draw a short line alond the line model
+    // a short line alond the line model
     /////////////////////////////////////////////////
-    if( render_mode & 1 )
+    if( modes & 1 )
     {
-        glColor3f( 0.4f, 0.4f, 0.4f );
-        glBegin( GL_LINES );
-        for( int i=0; i < (int) dataPoints.size(); i++ )
+        vertices.resize( 2 * num );
+        #pragma omp parallel for schedule(static)
+        for( int i=0; i < num; i++ )
         {
-            const int lineID = labelings[i]; // label id
-            const Vec3f prj = lines[lineID]->projection( dataPoints[i] );  // position
-            const Vec3f dir = lines[lineID]->getDirection(); // direction
-            glVertex3fv( &(prj + dir * 0.5 )[0] );
-            glVertex3fv( &(prj - dir * 0.5 )[0] );
+            const Vec3f dir = lines[ labelings[i] ]->getDirection(); // direction
+            const Vec3f p1 = prj[i] + dir * 0.5, p2 = prj[i] - dir * 0.5;
+            vertices[2*i  ].set( p1[0], p1[1], p1[2], 102, 102, 102 );
+            vertices[2*i+1].set( p2[0], p2[1], p2[2], 102, 102, 102 );
         }
-        glEnd();
+        lines_buffer.update( vertices );
     }
 
-    if( render_mode & 2 )
+    /////////////////////////////////////////////////
+    // the lines of the projection direction, from the projection point
+    // (colour of the line model) to the data point (dark grey)
+    /////////////////////////////////////////////////
+    if( modes & 2 )
     {
-        /////////////////////////////////////////////////
-        // draw the lines of the projection direction
-        /////////////////////////////////////////////////
-        glBegin( GL_LINES );
-        for( int i=0; i < (int) dataPoints.size(); i++ )
+        vertices.resize( 2 * num );
+        #pragma omp parallel for schedule(static)
+        for( int i=0; i < num; i++ )
         {
-            const int lineID = labelings[i]; // label id
-            Vec3f prj = lines[lineID]->projection( dataPoints[i] ); // position
-            // draw projection point
-            glColor3ubv( &lineColors[lineID][0] );
-            glVertex3fv( &prj[0] );
-            // draw data points
-            glColor3f( 0.1f, 0.1f, 0.1f );
-            glVertex3iv( &dataPoints[i][0] );
+            const Vec3b& c = lineColors[ labelings[i] ];
+            const Vec3i& p = dataPoints[i];
+            vertices[2*i  ].set( prj[i][0], prj[i][1], prj[i][2], c[0], c[1], c[2] );
+            vertices[2*i+1].set( (float) p[0], (float) p[1], (float) p[2], 26, 26, 26 );
         }
-        glEnd();
+        projections_buffer.update( vertices );
     }
 
-    if( render_mode & 8 )
+    /////////////////////////////////////////////////
+    // a circle around the line model (radius: two sigmas)
+    /////////////////////////////////////////////////
+    if( modes & 8 )
     {
-        for( int i=0; i < (int) dataPoints.size(); i++ )
+        vertices.resize( 20 * num );
+        #pragma omp parallel for schedule(static)
+        for( int i=0; i < num; i++ )
         {
             const int lineID = labelings[i]; // label id
-            const Vec3f prj = lines[lineID]->projection( dataPoints[i] ); // position
             const Vec3f dir = lines[lineID]->getDirection();
-
-            glColor3ubv( &lineColors[lineID][0] );
-            DrawCircle( prj, dir, lines[lineID]->getSigma()*2 );
+            circle_vertices( prj[i], dir, float( lines[lineID]->getSigma()*2 ),
+                             lineColors[lineID], &vertices[20*i] );
         }
+        circles_buffer.update( vertices );
+    }
+
+    built_modes |= modes;
+}
+
+void GLLineModel::render( void )
+{
+    // in case there is any previously bind texture, you need to unbind them
+
+    /////////////////////////////////////////////////////
+    ////// Draw the axis
+    /////////////////////////////////////////////////////
+    //glBegin( GL_LINES );
+    //// x-axis
+    //glColor3f(  1.0f, 0.0f, 0.0f );
+    //glVertex3i( 0, 0, 0 );
+    //glVertex3i( size[0], 0, 0 );
+    //// y-axis
+    //glColor3f(  0.0f, 1.0f, 0.0f );
+    //glVertex3i( 0, 0, 0 );
+    //glVertex3i( 0, size[1], 0 );
+    //// z-axis
+    //glColor3f(  0.0f, 0.0f, 1.0f );
+    //glVertex3i( 0, 0, 0 );
+    //glVertex3i( 0, 0, size[2] );
+    //glEnd();
+
+    std::lock_guard<std::mutex> lock( mutex );
 
+    // the geometry is only rebuilt after an update of the model
+    const char missing = render_mode & ~built_modes & 15;
+    if( missing ) build_buffers( missing );
+
+    if( render_mode & 4 )
+    {
+        glPointSize( 3.0 );
+        points_buffer.draw( GL_POINTS );
     }
-    // ReleaseMutex( hMutex );
+    if( render_mode & 1 ) lines_buffer.draw( GL_LINES );
+    if( render_mode & 2 ) projections_buffer.draw( GL_LINES );
+    if( render_mode & 8 ) circles_buffer.draw( GL_LINES );
 }
 
 
 void GLLineModel::updatePoints( const vector<Vec3i>& pts )
 {
-    // WaitForSingleObject( hMutex, INFINITE );
+    std::lock_guard<std::mutex> lock( mutex );
     dataPoints = pts;
-    // ReleaseMutex( hMutex );
+    built_modes = 0;
 }
 
 void GLLineModel::updateModel( const vector<Line3D*>& lns, const vector<int>& lbls )
 {
-    // WaitForSingleObject( hMutex, INFINITE );
+    std::lock_guard<std::mutex> lock( mutex );
     if( lbls.size()==dataPoints.size() )
     {
         lines = lns;
@@ -219,6 +232,7 @@ void GLLineModel::updateModel( const vector<Line3D*>& lns, const vector<int>& lb
                 (rand()%228 ) + 28 );
             lineColors.push_back( c );
         }
+        built_modes = 0;
     }
     else
     {
@@ -226,7 +240,6 @@ void GLLineModel::updateModel( const vector<Line3D*>& lns, const vector<int>& lb
         std::cout << "  Location: file "<< __FILE__ << ", line " << __LINE__ << std::endl;
         system( "pause" );
     }
-    // ReleaseMutex( hMutex );
 }
 
 void GLLineModel::init(void)
@@ -261,6 +274,9 @@ void GLLineModel::init(void)
 
 void GLLineModel::keyboard( unsigned char key )
 {
+    std::lock_guard<std::mutex> lock( mutex );
     render_mode++;
+    // the line models may have been refined in place since the last update
+    built_modes = 0;
     if( render_mode==0 ) render_mode = 1;
 }
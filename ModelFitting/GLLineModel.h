@@ -2,9 +2,11 @@
 #define GLLINEMODEL_H_
 
 #include "GLViewer.h"
+#include "GLVertexBuffer.h"
 #include "Data3D.h"
 #include "Line3D.h"
 #include <vector>
+#include <mutex>
 
 using namespace std;
 using namespace cv;
@@ -27,6 +29,16 @@ class GLLineModel : public GLViewer::Object
     vector<int> labelings;
 
     char render_mode;
+
+    // The geometry of the render modes 4 (projection points), 1 (short
+    // lines along the models), 2 (projection directions) and 8 (circles),
+    // built when a mode is first rendered after an update
+    VertexBuffer points_buffer, lines_buffer, projections_buffer, circles_buffer;
+    // render modes whose buffer is up to date
+    char built_modes;
+    void build_buffers( const char& modes );
+
+    std::mutex mutex;
 public:
     GLLineModel( cv::Vec3i size );
 
@@ -0,0 +1,259 @@
+// Matrix-free mode of Levenberg Marquardt: the products with J and J' are
+// computed with the local Jacobians of the residuals (1 by 6 for the data
+// cost of a site, 1 by 12 for the smooth cost of a pair of sites with
+// different labels), so neither the Jacobian matrix nor J'*J is assembled.
+// The memory is linear in the number of residuals and parameters.
+
+#include "LevenbergMarquardt.h"
+
+#include <cmath>
+#include <vector>
+
+#include "LineModelArray.h"
+#include "EnergyFunctions.h"
+#include "smart_assert.h"
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+// The dot products are summed up in a fixed order, so the solution does not
+// depend on the number of threads
+inline double dot( const vector<double>& a, const vector<double>& b )
+{
+    double sum = 0.0;
+    for( unsigned i=0; i<a.size(); i++ ) sum += a[i] * b[i];
+    return sum;
+}
+}
+
+
+void LevenbergMarquardt::release_matrix_free( void )
+{
+    vector<LineJacobian::Matx16d>().swap( local_J_data );
+    vector<LineJacobian::Matx1_12d>().swap( local_J_pairs );
+    vector<double>().swap( residual_data );
+    vector<double>().swap( residual_pairs );
+    vector<int>().swap( pair_sites );
+    vector<unsigned>().swap( line_site_ptr );
+    vector<int>().swap( line_site );
+    vector<unsigned>().swap( line_pair_ptr );
+    vector<unsigned>().swap( line_pair );
+    vector<double>().swap( Jv_data );
+    vector<double>().swap( Jv_pairs );
+}
+
+
+void LevenbergMarquardt::local_jacobians( void )
+{
+    const int num_sites = (int) tildaP.size();
+    const int num_lines = lines.size();
+
+    // the pairs of sites with different labels (the smooth cost of the
+    // other pairs is zero, and so are their rows), and the number of pairs
+    // of every line
+    pair_sites.clear();
+    line_pair_ptr.assign( num_lines + 1, 0 );
+    for( int site = 0; site < num_sites; site++ )
+    {
+        for( unsigned k = pairs.begin( site ); k < pairs.end( site ); k++ )
+        {
+            const int& site2 = pairs.site2[k];
+            const int& l1 = labelID[site];
+            const int& l2 = labelID[site2];
+            if( l1==l2 ) continue;
+            pair_sites.push_back( site );
+            pair_sites.push_back( site2 );
+            line_pair_ptr[l1+1]++;
+            line_pair_ptr[l2+1]++;
+        }
+    }
+    const int num_pairs = (int) pair_sites.size() / 2;
+
+    local_J_data.resize( num_sites );
+    residual_data.resize( num_sites );
+    local_J_pairs.resize( 2 * num_pairs );
+    residual_pairs.resize( 2 * num_pairs );
+
+    // data cost (this also computes P and nablaP for the smooth cost)
+    #pragma omp parallel for schedule(static)
+    for( int site = 0; site < num_sites; site++ )
+    {
+        Jacobian_datacost_for_one( site, local_J_data[site] );
+        residual_data[site] = sqrt( compute_datacost_for_one( lines, labelID[site], tildaP[site], P[site] ) );
+    }
+
+    // smooth cost
+    #pragma omp parallel for schedule(dynamic, 256)
+    for( int pair = 0; pair < num_pairs; pair++ )
+    {
+        const int& site  = pair_sites[2*pair];
+        const int& site2 = pair_sites[2*pair+1];
+
+        double smoothcost_i = 0, smoothcost_j = 0;
+        std::pair<double, double> coefficiency;
+        using_smoothcost_func( lines, labelID[site], labelID[site2], P[site], P[site2],
+                               smoothcost_i, smoothcost_j, &coefficiency );
+        residual_pairs[2*pair]   = sqrt( smoothcost_i );
+        residual_pairs[2*pair+1] = sqrt( smoothcost_j );
+
+        (this->*using_Jacobian_smoothcost_for_pair)( site, site2,
+                local_J_pairs[2*pair], local_J_pairs[2*pair+1], &coefficiency );
+    }
+
+    // the sites of every line
+    line_site_ptr.assign( num_lines + 1, 0 );
+    for( int site = 0; site < num_sites; site++ ) line_site_ptr[ labelID[site] + 1 ]++;
+    for( int label = 0; label < num_lines; label++ ) line_site_ptr[label+1] += line_site_ptr[label];
+    line_site.resize( num_sites );
+    vector<unsigned> pos( line_site_ptr.begin(), line_site_ptr.end() - 1 );
+    for( int site = 0; site < num_sites; site++ ) line_site[ pos[ labelID[site] ]++ ] = site;
+
+    // the pairs of every line
+    for( int label = 0; label < num_lines; label++ ) line_pair_ptr[label+1] += line_pair_ptr[label];
+    line_pair.resize( line_pair_ptr[num_lines] );
+    pos.assign( line_pair_ptr.begin(), line_pair_ptr.end() - 1 );
+    for( int pair = 0; pair < num_pairs; pair++ )
+    {
+        line_pair[ pos[ labelID[ pair_sites[2*pair] ] ]++ ]   = 2 * pair;
+        line_pair[ pos[ labelID[ pair_sites[2*pair+1] ] ]++ ] = 2 * pair + 1;
+    }
+}
+
+
+void LevenbergMarquardt::multiply_Jt( const double* w_data, const double* w_pairs, double* y ) const
+{
+    const int num_lines = lines.size();
+
+    // every line gathers the rows of its own residuals (no write conflicts)
+    #pragma omp parallel for schedule(dynamic, 64)
+    for( int label = 0; label < num_lines; label++ )
+    {
+        double sum[LineJacobian::NUM_PARAM_PER_LINE] = { 0, 0, 0, 0, 0, 0 };
+        for( unsigned k = line_site_ptr[label]; k < line_site_ptr[label+1]; k++ )
+        {
+            const int& site = line_site[k];
+            const LineJacobian::Matx16d& J = local_J_data[site];
+            for( int i=0; i<LineJacobian::NUM_PARAM_PER_LINE; i++ ) sum[i] += J( 0, i ) * w_data[site];
+        }
+        for( unsigned k = line_pair_ptr[label]; k < line_pair_ptr[label+1]; k++ )
+        {
+            const unsigned pair = line_pair[k] / 2;
+            const int offset = ( line_pair[k] % 2 ) * LineJacobian::NUM_PARAM_PER_LINE;
+            for( unsigned row = 2 * pair; row < 2 * pair + 2; row++ )
+            {
+                const LineJacobian::Matx1_12d& J = local_J_pairs[row];
+                for( int i=0; i<LineJacobian::NUM_PARAM_PER_LINE; i++ ) sum[i] += J( 0, offset + i ) * w_pairs[row];
+            }
+        }
+        for( int i=0; i<LineJacobian::NUM_PARAM_PER_LINE; i++ )
+        {
+            y[ label * LineJacobian::NUM_PARAM_PER_LINE + i ] = sum[i];
+        }
+    }
+}
+
+
+void LevenbergMarquardt::multiply_JtJ( const double* v, double* y, const double& lambda )
+{
+    const int num_sites = (int) tildaP.size();
+    const int N = LineJacobian::NUM_PARAM_PER_LINE;
+    Jv_data.resize( num_sites );
+    Jv_pairs.resize( local_J_pairs.size() );
+
+    // J * v
+    #pragma omp parallel for schedule(static)
+    for( int site = 0; site < num_sites; site++ )
+    {
+        const double* v1 = v + labelID[site] * N;
+        double Jv = 0.0;
+        for( int i=0; i<N; i++ ) Jv += local_J_data[site]( 0, i ) * v1[i];
+        Jv_data[site] = Jv;
+    }
+    const int num_pairs = (int) pair_sites.size() / 2;
+    #pragma omp parallel for schedule(static)
+    for( int pair = 0; pair < num_pairs; pair++ )
+    {
+        const double* v1 = v + labelID[ pair_sites[2*pair] ] * N;
+        const double* v2 = v + labelID[ pair_sites[2*pair+1] ] * N;
+        for( int row = 2 * pair; row < 2 * pair + 2; row++ )
+        {
+            const LineJacobian::Matx1_12d& J = local_J_pairs[row];
+            double Jv_pair = 0.0;
+            for( int i=0; i<N; i++ ) Jv_pair += J( 0, i ) * v1[i] + J( 0, N + i ) * v2[i];
+            Jv_pairs[row] = Jv_pair;
+        }
+    }
+
+    // J' * ( J * v ) + lambda * v
+    multiply_Jt( &Jv_data.front(), Jv_pairs.empty() ? NULL : &Jv_pairs.front(), y );
+    #pragma omp parallel for schedule(static)
+    for( int i = 0; i < (int) numParam; i++ ) y[i] += lambda * v[i];
+}
+
+
+int LevenbergMarquardt::solve_matrix_free( const Mat_<double>& B, Mat_<double>& X,
+        const double& lambda, const Options& options )
+{
+    const int n = (int) numParam;
+    const int N = LineJacobian::NUM_PARAM_PER_LINE;
+    smart_assert( B.isContinuous() && (int) B.total()==n, "Invalid size of B" );
+    const double* b = (const double*) B.data;
+
+    // Jacobi preconditioner: the diagonal of J'*J + lambda*I
+    vector<double> inv_diag( n );
+    const int num_lines = lines.size();
+    #pragma omp parallel for schedule(dynamic, 64)
+    for( int label = 0; label < num_lines; label++ )
+    {
+        double d[LineJacobian::NUM_PARAM_PER_LINE] = { 0, 0, 0, 0, 0, 0 };
+        for( unsigned k = line_site_ptr[label]; k < line_site_ptr[label+1]; k++ )
+        {
+            const LineJacobian::Matx16d& J = local_J_data[ line_site[k] ];
+            for( int i=0; i<N; i++ ) d[i] += J( 0, i ) * J( 0, i );
+        }
+        for( unsigned k = line_pair_ptr[label]; k < line_pair_ptr[label+1]; k++ )
+        {
+            const unsigned pair = line_pair[k] / 2;
+            const int offset = ( line_pair[k] % 2 ) * N;
+            for( unsigned row = 2 * pair; row < 2 * pair + 2; row++ )
+            {
+                const LineJacobian::Matx1_12d& J = local_J_pairs[row];
+                for( int i=0; i<N; i++ ) d[i] += J( 0, offset + i ) * J( 0, offset + i );
+            }
+        }
+        for( int i=0; i<N; i++ ) inv_diag[ label * N + i ] = 1.0 / ( d[i] + lambda );
+    }
+
+    // preconditioned conjugate gradients, starting from X = 0
+    X = Mat_<double>( n, 1, 0.0 );
+    double* x = (double*) X.data;
+    vector<double> r( b, b + n ), z( n ), p( n ), q( n );
+    for( int i=0; i<n; i++ ) z[i] = inv_diag[i] * r[i];
+    p = z;
+    double rz = dot( r, z );
+    const double b_norm = sqrt( dot( r, r ) );
+    if( b_norm==0.0 ) return 0;
+
+    int iter = 0;
+    while( iter < options.cg_max_iterations )
+    {
+        multiply_JtJ( &p.front(), &q.front(), lambda );
+        const double alpha = rz / dot( p, q );
+        for( int i=0; i<n; i++ )
+        {
+            x[i] += alpha * p[i];
+            r[i] -= alpha * q[i];
+        }
+        iter++;
+        if( sqrt( dot( r, r ) ) <= options.cg_tolerance * b_norm ) break;
+
+        for( int i=0; i<n; i++ ) z[i] = inv_diag[i] * r[i];
+        const double rz_new = dot( r, z );
+        const double beta = rz_new / rz;
+        rz = rz_new;
+        for( int i=0; i<n; i++ ) p[i] = z[i] + beta * p[i];
+    }
+    return iter;
+}
@@ -6,17 +6,20 @@
 #include <omp.h>
 #include <array>
 #include <vector>
+#include <fstream>
+#include <chrono>
+#include <thread>
 
 #include <sys/types.h> // For serialization
 #include <sys/stat.h>  // For serialization
 #include <unistd.h>    // For serialization
 
-#include "Line3D.h"
-#include "Neighbour26.h"
+#include "LineModelArray.h"
 #include "Data3D.h"
 #include "Timer.h"
 #include "ModelSet.h"
 #include "EnergyFunctions.h"
+#include "FittingReport.h"
 #include "SparseMatrixCV/SparseMatrixCV.h"
 
 
@@ -28,248 +31,80 @@
 using namespace std;
 using namespace cv;
 
+// a line is considered as unchanged by an update if none of its parameters
+// moved more than this
+static const double epsilon_delta = 1e-10;
 
 LevenbergMarquardt::LevenbergMarquardt( const vector<Vec3i>& dataPoints,
                                         const vector<int>& labelings,
-                                        const ModelSet& modelset,
-                                        const Data3D<int>& labelIDs,
+                                        ModelSet& modelset,
                                         SmoothCostType smooth_cost_type )
-    : modelset( modelset ), tildaP( dataPoints ), lines( modelset.lines )
-    , labelID( labelings ), labelID3d( labelIDs )
+    : modelset( modelset ), tildaP( dataPoints ), lines( modelset.line_array )
+    , labelID( labelings ), pairs( modelset.pairs )
 
 {
     smart_assert( lines.size()!=0, "Error: model set is empty" );
+    smart_assert( pairs.num_sites()==tildaP.size(),
+                  "Error: the neighbour pairs of the model set are not built" );
 
-    numParamPerLine = lines[0]->getNumOfParameters();
-    numParam = numParamPerLine * (int) lines.size();
+    numParamPerLine = LineModelArray::NUM_PARAM_PER_LINE;
+    numParam = numParamPerLine * lines.size();
+    smart_assert( numParamPerLine==LineJacobian::NUM_PARAM_PER_LINE,
+                  "Error: the Jacobians are for two-point line models only" );
 
     // projection points of original points
     P = vector<Vec3d>( tildaP.size() );
     // Jacobian matrix of the projection points
-    nablaP = vector<SparseMatrixCV>( tildaP.size() );
+    nablaP = vector<LineJacobian::Matx36d>( tildaP.size() );
 
     using_smoothcost_func = nullptr;
 }
 
 
-void  LevenbergMarquardt::Jacobian_projection(
-    const Vec3d& X1, const Vec3d& X2,
-    const SparseMatrixCV& nablaX1, const SparseMatrixCV& nablaX2,
-    const Vec3d& tildeP,           const SparseMatrixCV& nablaTildeP,
-    Vec3d& P, SparseMatrixCV& nablaP )
+void LevenbergMarquardt::Jacobian_datacost_for_one( const int& site, LineJacobian::Matx16d& nabla_datacost )
 {
-    // Assume that the projection point P = T * X1 + (1-T) * X2
-    Vec3d X1_X2 = X1 - X2;
-    const double A = ( tildeP - X2 ).dot( X1_X2 );
-    const double B = ( X1_X2 ).dot( X1_X2 );
-    const double T = A / B;
-
-    // Compute the Jacobian matrix for A and B
-    const SparseMatrixCV nablaX1_nablaX2 = nablaX1 - nablaX2;
-    const SparseMatrixCV nablaA = X1_X2.t() * SparseMatrixCV( nablaTildeP - nablaX2 ) + (tildeP - X2).t() * nablaX1_nablaX2;
-    const SparseMatrixCV nablaB = X1_X2.t() * 2 * nablaX1_nablaX2;
-
-    // Compute the Jacobian matrix for T (1 by N matrix)
-    const SparseMatrixCV nablaT = ( nablaA * B - nablaB * A ) / ( B * B );
-
-    // Compute the projection point (3 by 1 vector)
-    P = T * X1 + (1-T) * X2;
-
-    // And the Jacobian matrix of the projection point (3 by N matrix)
-    nablaP = X1 * nablaT + nablaX1 * T + nablaX2 * (1-T) - X2 * nablaT;
-}
-
-
-SparseMatrixCV LevenbergMarquardt::Jacobian_datacost_for_one( const int& site )
-{
-    const int label = labelID[site];
-    const Line3D* line = lines[label];
-
     // end points of the line
     Vec3d X1, X2;
-    line->getEndPoints( X1, X2 );
+    lines.getEndPoints( labelID[site], X1, X2 );
 
-    // Jacobian matrix of the end points of the line
-    const unsigned indecesM1[][2] =
-    {
-        {0, 0 + label * numParamPerLine},
-        {1, 1 + label * numParamPerLine},
-        {2, 2 + label * numParamPerLine}
-    };
-    const unsigned indecesM2[][2] =
-    {
-        {0, 3 + label * numParamPerLine},
-        {1, 4 + label * numParamPerLine},
-        {2, 5 + label * numParamPerLine}
-    };
-    static const double values[] = { 1.0, 1.0, 1.0 };
-    const SparseMatrixCV nablaX1( 3, numParam, indecesM1, values, 3 );
-    const SparseMatrixCV nablaX2( 3, numParam, indecesM2, values, 3 );
-
-    static const SparseMatrixCV zero_matrix(3, numParam);
-    Jacobian_projection( X1, X2, nablaX1, nablaX2,
-                         tildaP[site], zero_matrix,
-                         P[site], nablaP[site] );
-
-    const Vec3d tildeP_P = Vec3d(tildaP[site]) - P[site];
-    const double tildaP_P_lenght = max( 1e-20, sqrt( tildeP_P.dot(tildeP_P) ) );
-
-    // TODO: there is memory leak without clone()!
-    return ( -1.0/tildaP_P_lenght*DATA_COST ) * tildeP_P.t() * nablaP[site].clone();
+    LineJacobian::datacost( X1, X2, tildaP[site], P[site], nablaP[site], nabla_datacost );
 }
 
 
 
 void LevenbergMarquardt::Jacobian_smoothcost_quadratic(
     const int& sitei, const int& sitej,
-    SparseMatrixCV& nabla_smooth_cost_i,
-    SparseMatrixCV& nabla_smooth_cost_j, void* func_data  )
+    LineJacobian::Matx1_12d& nabla_smooth_cost_i,
+    LineJacobian::Matx1_12d& nabla_smooth_cost_j, void* func_data  )
 {
-    const int labeli = labelID[sitei];
-    const int labelj = labelID[sitej];
-    const Line3D* linei = lines[labeli];
-    const Line3D* linej = lines[labelj];
-
     // end points of the lines
     Vec3d Xi1, Xi2, Xj1, Xj2;
-    linei->getEndPoints( Xi1, Xi2 );
-    linej->getEndPoints( Xj1, Xj2 );
-
-    // Jacobian matrix of the end points of the line
-    const unsigned indecesXi1[][2] =
-    {
-        {0, 0 + labeli * numParamPerLine},
-        {1, 1 + labeli * numParamPerLine},
-        {2, 2 + labeli * numParamPerLine}
-    };
-    const unsigned indecesXi2[][2] =
-    {
-        {0, 3 + labeli * numParamPerLine},
-        {1, 4 + labeli * numParamPerLine},
-        {2, 5 + labeli * numParamPerLine}
-    };
-    const unsigned indecesXj1[][2] =
-    {
-        {0, 0 + labelj * numParamPerLine},
-        {1, 1 + labelj * numParamPerLine},
-        {2, 2 + labelj * numParamPerLine}
-    };
-    const unsigned indecesXj2[][2] =
-    {
-        {0, 3 + labelj * numParamPerLine},
-        {1, 4 + labelj * numParamPerLine},
-        {2, 5 + labelj * numParamPerLine}
-    };
-    static const double values[] = { 1.0, 1.0, 1.0 };
-    const SparseMatrixCV nablaXi1(3, numParam, indecesXi1, values, 3 );
-    const SparseMatrixCV nablaXi2(3, numParam, indecesXi2, values, 3 );
-    const SparseMatrixCV nablaXj1(3, numParam, indecesXj1, values, 3 );
-    const SparseMatrixCV nablaXj2(3, numParam, indecesXj2, values, 3 );
-
-    const Vec3d& Pi = P[sitei];
-    const Vec3d& Pj = P[sitej];
-    const SparseMatrixCV& nablaPi = nablaP[sitei];
-    const SparseMatrixCV& nablaPj = nablaP[sitej];
-
-    Vec3d Pi_prime, Pj_prime;
-    SparseMatrixCV nablaPi_prime, nablaPj_prime;
-    Jacobian_projection( Xj1, Xj2, nablaXj1, nablaXj2, Pi,      nablaPi,             Pi_prime, nablaPi_prime );
-    Jacobian_projection( Xi1, Xi2, nablaXi1, nablaXi2, Pj,      nablaPj,             Pj_prime, nablaPj_prime );
-
-    const double dist_pi_pj2       = max(1e-27, double( (Pi-Pj).dot(Pi-Pj) ) );
-    const double dist_pi_pi_prime2 = max(1e-27, double( (Pi-Pi_prime).dot(Pi-Pi_prime) ) );
-    const double dist_pj_pj_prime2 = max(1e-27, double( (Pj-Pj_prime).dot(Pj-Pj_prime))  );
-    const double dist_pi_pj        = sqrt( dist_pi_pj2 );
-    const double dist_pi_pi_prime  = sqrt( dist_pi_pi_prime2 );
-    const double dist_pj_pj_prime  = sqrt( dist_pj_pj_prime2 );
-
-    const SparseMatrixCV nabla_pi_pi_prime = ( Pi - Pi_prime ).t() * ( nablaPi - nablaPi_prime ) / dist_pi_pi_prime;
-    const SparseMatrixCV nabla_pj_pj_prime = ( Pj - Pj_prime ).t() * ( nablaPj - nablaPj_prime ) / dist_pj_pj_prime;
-    const SparseMatrixCV nabla_pi_pj       = ( Pi - Pj ).t() * ( nablaPi - nablaPj ) / dist_pi_pj;
-
-    // output result
-    nabla_smooth_cost_i = ( nabla_pi_pi_prime * dist_pi_pj - nabla_pi_pj * dist_pi_pi_prime ) * (1.0 / dist_pi_pj2 * PAIRWISE_SMOOTH);
-    nabla_smooth_cost_j = ( nabla_pj_pj_prime * dist_pi_pj - nabla_pi_pj * dist_pj_pj_prime ) * (1.0 / dist_pi_pj2 * PAIRWISE_SMOOTH);
+    lines.getEndPoints( labelID[sitei], Xi1, Xi2 );
+    lines.getEndPoints( labelID[sitej], Xj1, Xj2 );
+
+    LineJacobian::smoothcost( Xi1, Xi2, Xj1, Xj2,
+                              P[sitei], nablaP[sitei],
+                              P[sitej], nablaP[sitej],
+                              1.0, 1.0,
+                              nabla_smooth_cost_i, nabla_smooth_cost_j );
 }
 
 
 void LevenbergMarquardt::Jacobian_smoothcost_abs_esp( const int& sitei, const int& sitej,
-        SparseMatrixCV& nabla_smooth_cost_i,
-        SparseMatrixCV& nabla_smooth_cost_j, void* func_data )
+        LineJacobian::Matx1_12d& nabla_smooth_cost_i,
+        LineJacobian::Matx1_12d& nabla_smooth_cost_j, void* func_data )
 {
-    const int labeli = labelID[sitei];
-    const int labelj = labelID[sitej];
-    const Line3D* linei = lines[labeli];
-    const Line3D* linej = lines[labelj];
-
     // end points of the lines
     Vec3d Xi1, Xi2, Xj1, Xj2;
-    linei->getEndPoints( Xi1, Xi2 );
-    linej->getEndPoints( Xj1, Xj2 );
-//
-//	// original points
-//	const Vec3d tildePi = tildaP[sitei];
-//	const Vec3d tildePj = tildaP[sitej];
-
-    // Jacobian matrix of the end points of the line
-    const unsigned indecesXi1[][2] =
-    {
-        {0, 0 + labeli * numParamPerLine},
-        {1, 1 + labeli * numParamPerLine},
-        {2, 2 + labeli * numParamPerLine}
-    };
-    const unsigned indecesXi2[][2] =
-    {
-        {0, 3 + labeli * numParamPerLine},
-        {1, 4 + labeli * numParamPerLine},
-        {2, 5 + labeli * numParamPerLine}
-    };
-    const unsigned indecesXj1[][2] =
-    {
-        {0, 0 + labelj * numParamPerLine},
-        {1, 1 + labelj * numParamPerLine},
-        {2, 2 + labelj * numParamPerLine}
-    };
-    const unsigned indecesXj2[][2] =
-    {
-        {0, 3 + labelj * numParamPerLine},
-        {1, 4 + labelj * numParamPerLine},
-        {2, 5 + labelj * numParamPerLine}
-    };
-    static const double values[] = { 1.0, 1.0, 1.0 };
-    const SparseMatrixCV nablaXi1(3, numParam, indecesXi1, values, 3 );
-    const SparseMatrixCV nablaXi2(3, numParam, indecesXi2, values, 3 );
-    const SparseMatrixCV nablaXj1(3, numParam, indecesXj1, values, 3 );
-    const SparseMatrixCV nablaXj2(3, numParam, indecesXj2, values, 3 );
-
-    const Vec3d& Pi = P[sitei];
-    const Vec3d& Pj = P[sitej];
-    const SparseMatrixCV& nablaPi = nablaP[sitei];
-    const SparseMatrixCV& nablaPj = nablaP[sitej];
-
-    Vec3d Pi_prime, Pj_prime;
-    SparseMatrixCV nablaPi_prime, nablaPj_prime;
-    Jacobian_projection( Xj1, Xj2, nablaXj1, nablaXj2, Pi,      nablaPi,             Pi_prime, nablaPi_prime );
-    Jacobian_projection( Xi1, Xi2, nablaXi1, nablaXi2, Pj,      nablaPj,             Pj_prime, nablaPj_prime );
-
-    const double dist_pi_pj2       = max(1e-27, double( (Pi-Pj).dot(Pi-Pj) ) );
-    const double dist_pi_pi_prime2 = max(1e-27, double( (Pi-Pi_prime).dot(Pi-Pi_prime) ) );
-    const double dist_pj_pj_prime2 = max(1e-27, double( (Pj-Pj_prime).dot(Pj-Pj_prime))  );
-    const double dist_pi_pj        = sqrt( dist_pi_pj2 );
-    const double dist_pi_pi_prime  = sqrt( dist_pi_pi_prime2 );
-    const double dist_pj_pj_prime  = sqrt( dist_pj_pj_prime2 );
-
-    const SparseMatrixCV nabla_pi_pi_prime = ( Pi - Pi_prime ).t() * ( nablaPi - nablaPi_prime ) / dist_pi_pi_prime;
-    const SparseMatrixCV nabla_pj_pj_prime = ( Pj - Pj_prime ).t() * ( nablaPj - nablaPj_prime ) / dist_pj_pj_prime;
-    const SparseMatrixCV nabla_pi_pj       = ( Pi - Pj ).t() * ( nablaPi - nablaPj ) / dist_pi_pj;
-
-    // output result
-    std::pair<double,double>& oldsmoothcost = *((std::pair<double,double>*)func_data);
-    nabla_smooth_cost_i = ( nabla_pi_pi_prime * dist_pi_pj - nabla_pi_pj * dist_pi_pi_prime )
-                          * (1.0 / dist_pi_pj2 * PAIRWISE_SMOOTH * oldsmoothcost.first );
-    nabla_smooth_cost_j = ( nabla_pj_pj_prime * dist_pi_pj - nabla_pi_pj * dist_pj_pj_prime )
-                          * (1.0 / dist_pi_pj2 * PAIRWISE_SMOOTH * oldsmoothcost.second );
-//	double temp = PAIRWISE_SMOOTH * oldsmoothcost.first;
+    lines.getEndPoints( labelID[sitei], Xi1, Xi2 );
+    lines.getEndPoints( labelID[sitej], Xj1, Xj2 );
+
+    const std::pair<double,double>& oldsmoothcost = *((std::pair<double,double>*)func_data);
+    LineJacobian::smoothcost( Xi1, Xi2, Xj1, Xj2,
+                              P[sitei], nablaP[sitei],
+                              P[sitej], nablaP[sitej],
+                              oldsmoothcost.first, oldsmoothcost.second,
+                              nabla_smooth_cost_i, nabla_smooth_cost_j );
 }
 
 void LevenbergMarquardt::Jacobian_datacost_thread_func(
@@ -283,29 +118,18 @@ void LevenbergMarquardt::Jacobian_datacost_thread_func(
     // be splited into multiple thread
     const int& label = labelID[site];
 
+    // Computing derivative for data cost analytically (this also computes
+    // the projection P[site] of the point)
+    LineJacobian::Matx16d J_datacost;
+    Jacobian_datacost_for_one( site, J_datacost );
+
     // computing datacost
-    const double datacost_i = compute_datacost_for_one( lines[label], tildaP[site] );
+    const double datacost_i = compute_datacost_for_one( lines, label, tildaP[site], P[site] );
 
     energy_matrix.push_back( sqrt(datacost_i) );
 
-    // Computing derivative for data cost analytically
-    const SparseMatrixCV J_datacost = Jacobian_datacost_for_one( site );
-
-    unsigned nnz;
-    const double* non_zero_value = NULL;
-    const unsigned* column_index = NULL;
-    const unsigned* row_pointer = NULL;
-    J_datacost.getRowMatrixData( nnz, non_zero_value, column_index, row_pointer );
-
-    smart_assert( J_datacost.row()==1 && J_datacost.col()==numParam,
-                  "Number of row is not correct for Jacobian matrix" );
-
-    for( unsigned i=0; i<nnz; i++ )
-    {
-        Jacobian_nzv.push_back( non_zero_value[i] );
-        Jacobian_colindx.push_back( column_index[i] );
-    }
-    Jacobian_rowptr.push_back( (unsigned) Jacobian_nzv.size() );
+    LineJacobian::append_row( J_datacost, label,
+                              Jacobian_nzv, Jacobian_colindx, Jacobian_rowptr );
 }
 
 
@@ -383,14 +207,9 @@ void LevenbergMarquardt::Jacobian_smoothcost_thread_func(
     vector<double>& energy_matrix,
     const int site )
 {
-    for( unsigned neibourIndex=0; neibourIndex<13; neibourIndex++ )   // find it's neighbour
+    for( unsigned i = pairs.begin( site ); i < pairs.end( site ); i++ )   // for each neighbour
     {
-        Vec3i neig;  // the neighbour position
-        Neighbour26::getNeigbour( neibourIndex, tildaP[site], neig );
-        if( !labelID3d.isValid(neig) ) continue; // not a valid position
-
-        const int site2 = labelID3d.at(neig);
-        if( site2==-1 ) continue ; // not a neighbour
+        const int site2 = pairs.site2[i];
 
         const int l1 = labelID[site];
         const int l2 = labelID[site2];
@@ -398,8 +217,7 @@ void LevenbergMarquardt::Jacobian_smoothcost_thread_func(
 
         double smoothcost_i_before = 0, smoothcost_j_before = 0;
         std::pair<double, double> coefficiency;
-        using_smoothcost_func( lines[l1], lines[l2],
-                               tildaP[site], tildaP[site2],
+        using_smoothcost_func( lines, l1, l2, P[site], P[site2],
                                smoothcost_i_before, smoothcost_j_before, &coefficiency );
 
         // add more rows to energy_matrix according to smooth cost
@@ -407,27 +225,13 @@ void LevenbergMarquardt::Jacobian_smoothcost_thread_func(
         energy_matrix.push_back( sqrt( smoothcost_j_before ) );
 
         ////// Computing derivative of pair-wise smooth cost analytically
-        SparseMatrixCV J[2];
+        LineJacobian::Matx1_12d J[2];
         (this->*using_Jacobian_smoothcost_for_pair)( site, site2, J[0], J[1], &coefficiency );
 
-
         for( unsigned ji = 0; ji<2; ji++ )
         {
-            unsigned nnz;
-            const double* non_zero_value = NULL;
-            const unsigned* column_index = NULL;
-            const unsigned* row_pointer = NULL;
-            J[ji].getRowMatrixData( nnz, non_zero_value, column_index, row_pointer );
-
-            smart_assert( J[ji].row()==1 && J[ji].col()==numParam,
-                          "Number of row is not correct for Jacobian matrix" );
-
-            for( unsigned n1=0; n1 < nnz; n1++ )
-            {
-                Jacobian_nzv.push_back( non_zero_value[n1] );
-                Jacobian_colindx.push_back( column_index[n1] );
-            }
-            Jacobian_rowptr.push_back( (int) Jacobian_nzv.size() );
+            LineJacobian::append_row( J[ji], l1, l2,
+                                      Jacobian_nzv, Jacobian_colindx, Jacobian_rowptr );
         }
 
     } // end of - for each pair of pi and pj
@@ -446,7 +250,6 @@ void LevenbergMarquardt::Jacobian_smoothcosts_openmp(
     // // // // // // // // // // // // // // // // // //
 //	const vector<Line3D*>& lines = modelset.models;
 //	int numParamPerLine = lines[0]->getNumOfParameters();
-//	const Data3D<int>& indeces = labelID3d;
 
     int max_num_threads = omp_get_max_threads(); // maximum number of thread
     vector<unsigned int> nzv_size( max_num_threads, 0);
@@ -602,13 +405,13 @@ void LevenbergMarquardt::Jacobian_smoothcosts(
 void LevenbergMarquardt::adjust_endpoints( void )
 {
     // update the end points of the line
-    vector<double> minT( (int) labelID.size(), (std::numeric_limits<double>::max)() );
-    vector<double> maxT( (int) labelID.size(), (std::numeric_limits<double>::min)() );
+    vector<double> minT( lines.size(), (std::numeric_limits<double>::max)() );
+    vector<double> maxT( lines.size(), (std::numeric_limits<double>::min)() );
     for( unsigned site = 0; site < tildaP.size(); site++ )   // For each data point
     {
         const int label = labelID[site];
         Vec3d p1, p2;
-        lines[label]->getEndPoints( p1, p2 );
+        lines.getEndPoints( label, p1, p2 );
 
         const Vec3d& pos = p1;
         Vec3d dir = p2 - p1;
@@ -617,157 +420,306 @@ void LevenbergMarquardt::adjust_endpoints( void )
         maxT[label] = max( t+1, maxT[label] );
         minT[label] = min( t-1, minT[label] );
     }
-    for( unsigned label=0; label < labelID.size(); label++ )
+    for( int label=0; label < lines.size(); label++ )
     {
         if( minT[label] < maxT[label] )
         {
             Vec3d p1, p2;
-            lines[label]->getEndPoints( p1, p2 );
+            lines.getEndPoints( label, p1, p2 );
 
             const Vec3d& pos = p1;
             Vec3d dir = p2 - p1;
             dir /= sqrt( dir.dot( dir ) ); // normalize the direction
 
-            lines[label]->setPositions( pos + dir * minT[label], pos + dir * maxT[label] );
+            lines.setPositions( label, pos + dir * minT[label], pos + dir * maxT[label] );
         }
     }
 }
 
-void LevenbergMarquardt::update_lines( const Mat_<double>& delta )
+void LevenbergMarquardt::update_lines( const Mat_<double>& delta, double scale )
 {
-    for( unsigned label=0; label < lines.size(); label++ )
-    {
-        for( unsigned i=0; i < numParamPerLine; i++ )
-        {
-            const double& d = delta.at<double>( label * numParamPerLine + i );
-            lines[label]->updateParameterWithDelta( i, d );
-        }
-    }
+    smart_assert( delta.isContinuous() && delta.total()==numParam,
+                  "Invalid size of delta" );
+    lines.apply_delta( (const double*) delta.data, scale );
 }
 
 void LevenbergMarquardt::reestimate( double lambda, SmoothCostType whatSmoothCost,
-                                     const string& serialize_dataname )
+                                     const string& serialize_dataname,
+                                     const Options& options )
 {
     smart_assert( lines.size()!=0, "No line models available" );
 
+    const Clock::time_point time_begin = Clock::now();
+
     switch( whatSmoothCost )
     {
     case Linear:
-        cout << endl << "Levenberg Marquardt::Linear" << endl;
+        if( options.verbose ) cout << endl << "Levenberg Marquardt::Linear" << endl;
         using_Jacobian_smoothcost_for_pair = &LevenbergMarquardt::Jacobian_smoothcost_abs_esp;
         using_smoothcost_func = &smoothcost_func_linear;
         break;
     case Quadratic:
-        cout << endl << "Levenberg Marquardt::Quadratic" << endl;
+        if( options.verbose ) cout << endl << "Levenberg Marquardt::Quadratic" << endl;
         using_Jacobian_smoothcost_for_pair = &LevenbergMarquardt::Jacobian_smoothcost_quadratic;
         using_smoothcost_func = &smoothcost_func_quadratic;
         break;
     }
 
-    cout << "Computing initial energy... ";
-    cout.flush();
-    double energy_before = compute_energy( tildaP, labelID, lines, labelID3d, using_smoothcost_func );
-    cout << endl;
+    // the buffers of the matrix-free mode are released however reestimate
+    // ends (they are as large as the Jacobian matrix)
+    struct MatrixFreeBuffers
+    {
+        LevenbergMarquardt& lm;
+        ~MatrixFreeBuffers( void )
+        {
+            lm.release_matrix_free();
+        }
+    } matrix_free_buffers = { *this };
+
+    IncrementalEnergy energy( tildaP, labelID, lines, pairs, using_smoothcost_func );
+    double energy_before = energy.compute();
+    if( options.verbose ) cout << "Initial Energy = " << energy_before << endl;
+
+    Checkpoint checkpoint( modelset, serialize_dataname, options.async_checkpoint );
+
+    std::ofstream report;
+    if( !options.report_file.empty() )
+    {
+        report.open( options.report_file.c_str() );
+        smart_assert( report.is_open(), "Cannot open the report file " << options.report_file );
+    }
 
     // Identity matrix
-    const SparseMatrixCV I  = SparseMatrixCV::I( numParam );
+    const SparseMatrixCV I  = options.matrix_free ? SparseMatrixCV() : SparseMatrixCV::I( numParam );
 
-    // counting number in
+    // counting number of consecutive rejected steps
     int energy_increase_count = 0;
-
-    for( int lmiter = 0; lmiter<15; lmiter++ )
+    // number of accepted steps since the last checkpoint
+    int accepted_count = 0;
+    // factor of lambda after a rejected step (trust region)
+    double nu = 2.0;
+
+    // Data for Jacobian matrix
+    //  - # of cols: number of data points;
+    //  - # of rows: number of parameters for all the line models
+    // (they are cleared in every iteration but keep their capacity)
+    vector<double> Jacobian_nzv;
+    vector<unsigned> Jacobian_colindx;
+    vector<unsigned> Jacobian_rowptr;
+    vector<double> energy_matrix;
+
+    string reason = "max_iterations";
+    int lmiter = 0;
+    for( ; lmiter < options.max_iterations; lmiter++ )
     {
+        // The small temporary matrices of this iteration are allocated from
+        // the arena of the thread and released in bulk at the end of the
+        // iteration (the large ones, e.g. J'*J, go to the heap)
+        SparseMatrixArena::Scope arena_scope;
+
+        IterationReport it;
+        it.iteration = lmiter;
+        it.energy = energy_before;
+        it.lambda = lambda;
+
+        // gradient of the energy (up to a factor 2)
+        Mat_<double> B;
+        // the matrix J'*J + lambda*I (unless the mode is matrix-free)
+        SparseMatrixCV A;
+        Clock::time_point t;
+
+        if( options.matrix_free )
+        {
+            // only the local Jacobians of the residuals are computed
+            t = Clock::now();
+            local_jacobians();
+            it.time_datacost = elapsed_ms( t );
+
+            t = Clock::now();
+            B = Mat_<double>( (int) numParam, 1 );
+            multiply_Jt( &residual_data.front(), residual_pairs.empty() ? NULL : &residual_pairs.front(),
+                         (double*) B.data );
+            it.time_assemble = elapsed_ms( t );
+        }
+        else
+        {
+            Jacobian_nzv.clear();
+            Jacobian_colindx.clear();
+            Jacobian_rowptr.assign( 1, 0 );
+            energy_matrix.clear();
+
+            // // // // // // // // // // // // // // // // // //
+            // Construct Jacobian Matrix -  data cost
+            // // // // // // // // // // // // // // // // // //
+            t = Clock::now();
+            Jacobian_datacosts_openmp( Jacobian_nzv, Jacobian_colindx, Jacobian_rowptr, energy_matrix );
+            it.time_datacost = elapsed_ms( t );
+
+            // // // // // // // // // // // // // // // // // //
+            // Construct Jacobian Matrix - smooth cost
+            // // // // // // // // // // // // // // // // // //
+            t = Clock::now();
+            Jacobian_smoothcosts_openmp( Jacobian_nzv, Jacobian_colindx, Jacobian_rowptr, energy_matrix );
+            it.time_smoothcost = elapsed_ms( t );
+
+            // Construct Jacobian matrix
+            t = Clock::now();
+            const SparseMatrixCV Jacobian = SparseMatrix(
+                                                (int) Jacobian_rowptr.size() - 1,
+                                                (int) numParam,
+                                                Jacobian_nzv, Jacobian_colindx, Jacobian_rowptr );
+
+            const SparseMatrixCV Jt = Jacobian.t();
+            const SparseMatrixCV Jt_J = multiply_openmp( Jt, Jacobian );
+
+            // A = Jt_J + Jt_J.diag() * lambda;
+            A = Jt_J + I * lambda;
+
+            B = Jt * cv::Mat_<double>( (int) energy_matrix.size(), 1, &energy_matrix.front() ) ;
+            it.time_assemble = elapsed_ms( t );
+        }
 
-        // Data for Jacobian matrix
-        //  - # of cols: number of data points;
-        //  - # of rows: number of parameters for all the line models
-        vector<double> Jacobian_nzv;
-        vector<unsigned> Jacobian_colindx;
-        vector<unsigned> Jacobian_rowptr(1, 0);
-        vector<double> energy_matrix;
-
-        // // // // // // // // // // // // // // // // // //
-        // Construct Jacobian Matrix -  data cost
-        // // // // // // // // // // // // // // // // // //
-        //Jacobian_datacosts( Jacobian_nzv, Jacobian_colindx, Jacobian_rowptr, energy_matrix );
-        cout << "Compute data cost begin... ";
-        cout.flush();
-        Jacobian_datacosts_openmp( Jacobian_nzv, Jacobian_colindx, Jacobian_rowptr, energy_matrix );
-        cout << "Done. " << endl;
-
-        // // // // // // // // // // // // // // // // // //
-        // Construct Jacobian Matrix - smooth cost
-        // // // // // // // // // // // // // // // // // //
-        cout << "Compute smooth cost begin... ";
-        cout.flush();
-        // Jacobian_smoothcosts_openmp_critical_section( Jacobian_nzv, Jacobian_colindx, Jacobian_rowptr, energy_matrix );
-        Jacobian_smoothcosts_openmp( Jacobian_nzv, Jacobian_colindx, Jacobian_rowptr, energy_matrix );
-        //Jacobian_smoothcosts( Jacobian_nzv, Jacobian_colindx, Jacobian_rowptr, energy_matrix );
-        cout << "Done. " << endl;
-
-        // Construct Jacobian matrix
-        const SparseMatrixCV Jacobian = SparseMatrix(
-                                            (int) Jacobian_rowptr.size() - 1,
-                                            (int) lines.size() * numParamPerLine,
-                                            Jacobian_nzv, Jacobian_colindx, Jacobian_rowptr );
-
-        const SparseMatrixCV Jt = Jacobian.t();
-        const SparseMatrixCV Jt_J = multiply_openmp( Jt, Jacobian );
-
-        // const SparseMatrixCV A = Jt_J + Jt_J.diag() * lambda;
-        const SparseMatrixCV A = Jt_J + I * lambda;
-
-        // TODO: the following line could be optimized
-        const Mat_<double> B = Jt * cv::Mat_<double>( (int) energy_matrix.size(), 1, &energy_matrix.front() ) ;
+        // max norm of the gradient
+        for( unsigned i=0; i < numParam; i++ )
+        {
+            it.gradient_norm = max( it.gradient_norm, std::abs( B( i ) ) );
+        }
+        if( it.gradient_norm <= options.gradient_tolerance )
+        {
+            reason = "gradient";
+            write_report( report, it );
+            break;
+        }
 
         Mat_<double> X;
 
-        cout << "Solve linear equation begin... ";
-        cout.flush();
-        solve( A, B, X );
-        cout << "Done. " << endl;
-
+        t = Clock::now();
+        if( options.matrix_free )
+        {
+            it.solver_iterations = solve_matrix_free( B, X, lambda, options );
+        }
+        else
+        {
+            it.solver_iterations = solve( A, B, X );
+        }
+        it.time_solve = elapsed_ms( t );
 
-        update_lines( -X );
+        update_lines( X, -1.0 );
 
-        cout << "Computing new energy... ";
-        double new_energy = compute_energy( tildaP, labelID, lines, labelID3d, using_smoothcost_func );
-        cout << "Done. " << endl;
+        // only the energy of the sites with lines that moved is re-evaluated
+        t = Clock::now();
+        vector<bool> line_changed( lines.size(), false );
+        for( int label=0; label < lines.size(); label++ )
+        {
+            for( unsigned i=0; i < numParamPerLine && !line_changed[label]; i++ )
+            {
+                line_changed[label] = std::abs( X.at<double>( label * numParamPerLine + i ) ) > epsilon_delta;
+            }
+        }
+        const double new_energy = energy.update( line_changed );
+        it.time_energy = elapsed_ms( t );
+        it.new_energy = new_energy;
+
+        // ratio between the actual and the predicted decrease of the energy,
+        // the predicted decrease of the step -X is X'*(B + lambda*X)
+        double predicted = 0.0;
+        for( unsigned i=0; i < numParam; i++ )
+        {
+            predicted += X( i ) * ( B( i ) + lambda * X( i ) );
+        }
+        it.gain_ratio = ( predicted > 0 ) ? ( energy_before - new_energy ) / predicted : 0.0;
 
+        bool converged = false;
         if( new_energy < energy_before )
         {
             // if energy is decreasing
-            // adjust the endpoints of the lines
+            // adjust the endpoints of the lines (the lines stay the same, so
+            // does the cached energy)
             adjust_endpoints();
+            converged = ( energy_before - new_energy ) <= options.energy_tolerance * energy_before;
             energy_before = new_energy;
-            lambda *= 0.50;
+            if( options.trust_region )
+            {
+                const double r = 2.0 * it.gain_ratio - 1.0;
+                lambda *= max( 1.0 / 3.0, 1.0 - r * r * r );
+                nu = 2.0;
+            }
+            else
+            {
+                lambda *= 0.50;
+            }
             energy_increase_count = 0;
+            it.accepted = true;
+
+            if( options.checkpoint_every > 0 && ++accepted_count >= options.checkpoint_every )
+            {
+                t = Clock::now();
+                checkpoint.save();
+                it.time_checkpoint = elapsed_ms( t );
+                accepted_count = 0;
+            }
         }
         else
         {
             // if energy is increasing, reverse the result of this iteration
             update_lines( X );
-            lambda *= 4.12;
-            if( ++energy_increase_count>=3 )
+            energy.rollback();
+            if( options.trust_region )
+            {
+                lambda *= nu;
+                nu *= 2.0;
+            }
+            else
             {
-                // If energy_increase_count in three consecutive iterations
-                // then the energy is probably converged
-                break;
+                lambda *= 4.12;
             }
+            ++energy_increase_count;
+            it.accepted = false;
         }
 
-        cout << endl << " New Energy = "  << energy_before << endl;
-        cout << " Lambda = " << lambda << endl << endl;
+        it.time_total = elapsed_ms( time_begin );
+        write_report( report, it );
+
+        if( options.verbose )
+        {
+            cout << "Iteration " << lmiter << ( it.accepted ? " accepted" : " rejected" );
+            cout << ": Energy = " << energy_before << ", Lambda = " << lambda;
+            cout << ", Solver iterations = " << it.solver_iterations << endl;
+        }
 
-        cout << "Serialization begin. " << endl;
-        modelset.serialize( serialize_dataname );
-        cout << "Serialization done. " << endl  << endl;
+        if( converged )
+        {
+            reason = "energy";
+            lmiter++;
+            break;
+        }
+        if( energy_increase_count >= options.max_rejections )
+        {
+            // the energy is probably converged
+            reason = "rejections";
+            lmiter++;
+            break;
+        }
+        if( options.time_budget > 0 && it.time_total >= 1000.0 * options.time_budget )
+        {
+            reason = "time_budget";
+            lmiter++;
+            break;
+        }
     }
 
-    cout << "Serialization begin. " << endl;
+    // the final model set is always serialized
+    checkpoint.wait();
     modelset.serialize( serialize_dataname );
-    cout << "Serialization done. " << endl  << endl;
-    cout << "Levenberg Marquardt Done. " << endl;
+
+    write_report_done( report, reason, lmiter, energy_before, lambda, elapsed_ms( time_begin ) );
+
+    if( options.verbose )
+    {
+        cout << "Levenberg Marquardt Done (" << reason << "). Energy = " << energy_before << endl;
+    }
+
+    SparseMatrixArena::release_memory();
 }
 
 
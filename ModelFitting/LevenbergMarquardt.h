@@ -3,8 +3,10 @@
 #include <opencv2/core/core.hpp>
 #include "ModelSet.h"
 #include "EnergyFunctions.h"
+#include "LineJacobian.h"
 #include <array>
 #include <vector>
+#include <string>
 
 using namespace cv;
 
@@ -21,10 +23,41 @@ class LevenbergMarquardt
 public:
     enum SmoothCostType { Quadratic, Linear };
 
+    // Convergence policy, checkpoints and report of reestimate()
+    struct Options
+    {
+        int max_iterations;        // maximum number of iterations
+        int max_rejections;        // stop after this number of consecutive rejected steps
+        double energy_tolerance;   // stop when the relative decrease of the energy of an
+                                   //   accepted step is smaller than this
+        double gradient_tolerance; // stop when the max norm of the gradient J^T*r is smaller than this
+        double time_budget;        // stop after this number of seconds (0: no limit)
+        bool trust_region;         // update lambda with the ratio between the actual and the
+                                   //   predicted decrease of the energy (otherwise lambda is
+                                   //   multiplied by 0.5 or 4.12)
+        int checkpoint_every;      // serialize the model set every N accepted steps
+                                   //   (0: only at the end)
+        bool async_checkpoint;     // serialize the model set in a background thread
+        std::string report_file;   // report of every iteration as JSON lines (empty: no report)
+        bool verbose;              // print the progress
+        bool matrix_free;          // solve (J'J + lambda*I) X = J'r with conjugate gradients and
+                                   //   products with the local Jacobians of the residuals, the
+                                   //   Jacobian matrix and J'J are never assembled
+        int cg_max_iterations;     // maximum number of iterations of conjugate gradients
+        double cg_tolerance;       // relative residual of conjugate gradients
+
+        Options( void )
+            : max_iterations( 15 ), max_rejections( 3 )
+            , energy_tolerance( 1e-6 ), gradient_tolerance( 1e-10 )
+            , time_budget( 0.0 ), trust_region( true )
+            , checkpoint_every( 1 ), async_checkpoint( true )
+            , report_file( "" ), verbose( true )
+            , matrix_free( false ), cg_max_iterations( 500 ), cg_tolerance( 1e-3 ) { }
+    };
+
     LevenbergMarquardt( const vector<Vec3i>& dataPoints,
                         const vector<int>& labelings,
-                        const ModelSet& modelset,
-                        const Data3D<int>& labelIDs,
+                        ModelSet& modelset,
                         SmoothCostType smooth_cost_type = Quadratic );
 
     // lambda - damping function for Levenberg Marquardt
@@ -32,21 +65,23 @@ public:
     //    the bigger lambda is, the slower it converges
     void reestimate( double lambda = 1e2,
                      SmoothCostType whatSmoothCost = Linear,
-                     const string& serialize_dataname = "default" );
+                     const string& serialize_dataname = "default",
+                     const Options& options = Options() );
 
 private:
-    const ModelSet& modelset;          /// A set of line models
+    ModelSet& modelset;                /// A set of line models
 
     const vector<Vec3i>&   tildaP;     /// Original positions of the points in 3D
-    const vector<Line3D*>& lines;      /// Lines
+    LineModelArray&        lines;      /// Lines
     const vector<int>&     labelID;    /// Corresponding labels of the points above
-    const Data3D<int>&     labelID3d;  /// Labeling of the data
+    const NeighbourPairs&  pairs;      /// Pairs of neighbouring points
 
     unsigned numParamPerLine;
     unsigned numParam;
 
     vector<Vec3d>  P;              // projection points of original points
-    vector<SparseMatrixCV> nablaP; // Jacobian matrix of the projection points
+    vector<LineJacobian::Matx36d> nablaP; // Jacobian matrix of the projection points
+                                          // (with respect to the 6 parameters of their lines)
 
     SmoothCostFunc using_smoothcost_func;
 
@@ -98,35 +133,67 @@ private:
         const int site );
 
 private:
-    // X1, X2: 3 by 1 vector, end point of the lines
-    // nablaX1, nablaX2: 3 * numParam, 3 non-zero values, Jacobian matrix of the end points of the line
-    // P: 3 by 1, OUTPUT, projection point
-    // nablaP: 1 by N, OUTPUT, jacobian matrix of the projection point
-    void  Jacobian_projection(
-        const cv::Vec3d& X1, const cv::Vec3d& X2,                                    // two end points of a line
-        const SparseMatrixCV& nablaX1, const SparseMatrixCV& nablaX2,          // Jacobians of the end points of the line
-        const cv::Vec3d& tildeP,           const SparseMatrixCV& nablaTildeP,      // a point, and the Jacobian of the point
-        cv::Vec3d& P, SparseMatrixCV& nablaP );
-
-    SparseMatrixCV Jacobian_datacost_for_one( const int& site );
+    // Jacobian of the data cost of one site (1 by 6, with respect to the line of the site)
+    void Jacobian_datacost_for_one( const int& site, LineJacobian::Matx16d& nabla_datacost );
 
     void (LevenbergMarquardt::*using_Jacobian_smoothcost_for_pair)( const int& sitei, const int& sitej,
-            SparseMatrixCV& nabla_smooth_cost_i,
-            SparseMatrixCV& nabla_smooth_cost_j, void* func_data );
+            LineJacobian::Matx1_12d& nabla_smooth_cost_i,
+            LineJacobian::Matx1_12d& nabla_smooth_cost_j, void* func_data );
 
     // for two different type of smooth cost
+    // nabla_smooth_cost_i, nabla_smooth_cost_j: 1 by 12, with respect to the parameters
+    //     of [line of sitei, line of sitej]
     void Jacobian_smoothcost_abs_esp( const int& sitei, const int& sitej,
-                                      SparseMatrixCV& nabla_smooth_cost_i,
-                                      SparseMatrixCV& nabla_smooth_cost_j, void* func_data = NULL );
+                                      LineJacobian::Matx1_12d& nabla_smooth_cost_i,
+                                      LineJacobian::Matx1_12d& nabla_smooth_cost_j, void* func_data = NULL );
     void Jacobian_smoothcost_quadratic( const int& sitei, const int& sitej,
-                                        SparseMatrixCV& nabla_smooth_cost_i,
-                                        SparseMatrixCV& nabla_smooth_cost_j, void* func_data = NULL );
+                                        LineJacobian::Matx1_12d& nabla_smooth_cost_i,
+                                        LineJacobian::Matx1_12d& nabla_smooth_cost_j, void* func_data = NULL );
 
     // Update model according to delta
     // (delta can be consider as the gradient computed with levenberg marquart)
-    void update_lines( const Mat_<double>& delta );
+    void update_lines( const Mat_<double>& delta, double scale = 1.0 );
 
     // adjust the end points of the lines so that they don't shift away from the data
     void adjust_endpoints( void );
+
+private:
+    /// Matrix-free mode (see LevenbergMarquardt-matrixfree.cpp)
+
+    // Local Jacobians and residuals: one row for the data cost of every
+    // site (with respect to its line), two rows for the smooth cost of
+    // every pair of sites with different labels (with respect to the lines
+    // of the two sites, the rows of the other pairs would be zero). The
+    // sites of pair i are pair_sites[2*i] and pair_sites[2*i+1].
+    vector<LineJacobian::Matx16d>   local_J_data;
+    vector<LineJacobian::Matx1_12d> local_J_pairs;
+    vector<double> residual_data;
+    vector<double> residual_pairs;
+    vector<int>    pair_sites;
+
+    // the sites of every line, and the rows of the pairs of every line
+    // (2 * pair + 0 if the line is the one of the first site of the pair,
+    // 2 * pair + 1 for the second site)
+    vector<unsigned> line_site_ptr;
+    vector<int>      line_site;
+    vector<unsigned> line_pair_ptr;
+    vector<unsigned> line_pair;
+
+    // temporary vector of the products (J*v)
+    vector<double> Jv_data;
+    vector<double> Jv_pairs;
+
+    // compute the local Jacobians and the residuals of the current lines
+    void local_jacobians( void );
+    // free all the buffers above
+    void release_matrix_free( void );
+    // y = J' * w
+    void multiply_Jt( const double* w_data, const double* w_pairs, double* y ) const;
+    // y = ( J'*J + lambda*I ) * v
+    void multiply_JtJ( const double* v, double* y, const double& lambda );
+    // solve ( J'*J + lambda*I ) X = B with preconditioned conjugate
+    // gradients, return the number of iterations
+    int solve_matrix_free( const Mat_<double>& B, Mat_<double>& X, const double& lambda,
+                           const Options& options );
 };
 
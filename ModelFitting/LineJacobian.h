@@ -0,0 +1,195 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <opencv2/core/core.hpp>
+
+extern const double DATA_COST;
+extern const double PAIRWISE_SMOOTH;
+
+/* Analytic Jacobian kernels for the two-point line models (Line3DTwoPoint).
+
+   A line is represented by two end points X1 and X2, which gives 6 local
+   parameters per line: [X1(0), X1(1), X1(2), X2(0), X2(1), X2(2)]. The data
+   cost only depends on one line (6 local parameters) and the smooth cost on
+   a pair of lines (12 local parameters, line i first, then line j).
+
+   All the Jacobians are fixed-size cv::Matx on the stack, so none of the
+   kernels below allocates memory on the heap. The local Jacobians are then
+   appended to the global (compressed row storage) Jacobian matrix with
+   append_row(). */
+namespace LineJacobian
+{
+// number of parameters of a line
+static const int NUM_PARAM_PER_LINE = 6;
+
+typedef cv::Matx<double, 3, 6>  Matx36d;
+typedef cv::Matx<double, 1, 6>  Matx16d;
+typedef cv::Matx<double, 3, 12> Matx3_12d;
+typedef cv::Matx<double, 1, 12> Matx1_12d;
+
+// Jacobian matrix of an end point: the identity on columns [offset, offset+3)
+template<int N>
+inline cv::Matx<double, 3, N> endpoint( const int& offset )
+{
+    cv::Matx<double, 3, N> nablaX = cv::Matx<double, 3, N>::zeros();
+    nablaX( 0, offset   ) = 1.0;
+    nablaX( 1, offset+1 ) = 1.0;
+    nablaX( 2, offset+2 ) = 1.0;
+    return nablaX;
+}
+
+// X1, X2: end points of the line
+// nablaX1, nablaX2: 3 by N, Jacobian matrix of the end points of the line
+// tildeP, nablaTildeP: the point to project and its Jacobian matrix (3 by N)
+// P: OUTPUT, projection point
+// nablaP: 3 by N, OUTPUT, jacobian matrix of the projection point
+template<int N>
+inline void projection( const cv::Vec3d& X1, const cv::Vec3d& X2,
+                        const cv::Matx<double, 3, N>& nablaX1,
+                        const cv::Matx<double, 3, N>& nablaX2,
+                        const cv::Vec3d& tildeP,
+                        const cv::Matx<double, 3, N>& nablaTildeP,
+                        cv::Vec3d& P, cv::Matx<double, 3, N>& nablaP )
+{
+    // Assume that the projection point P = T * X1 + (1-T) * X2
+    const cv::Vec3d X1_X2 = X1 - X2;
+    const cv::Vec3d tildeP_X2 = tildeP - X2;
+    const double A = tildeP_X2.dot( X1_X2 );
+    const double B = X1_X2.dot( X1_X2 );
+    const double T = A / B;
+
+    // Compute the Jacobian matrix for A and B (1 by N matrices)
+    const cv::Matx<double, 3, N> nablaX1_nablaX2 = nablaX1 - nablaX2;
+    const cv::Matx<double, 1, N> nablaA = X1_X2.t() * ( nablaTildeP - nablaX2 )
+                                          + tildeP_X2.t() * nablaX1_nablaX2;
+    const cv::Matx<double, 1, N> nablaB = X1_X2.t() * nablaX1_nablaX2 * 2.0;
+
+    // Compute the Jacobian matrix for T (1 by N matrix)
+    const cv::Matx<double, 1, N> nablaT = ( nablaA * B - nablaB * A ) * ( 1.0 / ( B * B ) );
+
+    // Compute the projection point (3 by 1 vector)
+    P = T * X1 + (1-T) * X2;
+
+    // And the Jacobian matrix of the projection point (3 by N matrix)
+    const cv::Matx<double, 3, 1> X1_X2_col = X1_X2;
+    nablaP = X1_X2_col * nablaT + nablaX1 * T + nablaX2 * (1-T);
+}
+
+// Jacobian of the data cost for assigning point 'tildeP' to line (X1, X2)
+// P, nablaP: OUTPUT, projection point and its Jacobian matrix, they are
+//     reused by the smooth cost
+// nabla_datacost: OUTPUT, 1 by 6, Jacobian of the data cost
+inline void datacost( const cv::Vec3d& X1, const cv::Vec3d& X2,
+                      const cv::Vec3d& tildeP,
+                      cv::Vec3d& P, Matx36d& nablaP,
+                      Matx16d& nabla_datacost )
+{
+    projection<6>( X1, X2, endpoint<6>(0), endpoint<6>(3),
+                   tildeP, Matx36d::zeros(), P, nablaP );
+
+    const cv::Vec3d tildeP_P = tildeP - P;
+    const double tildaP_P_lenght = std::max( 1e-20, std::sqrt( tildeP_P.dot(tildeP_P) ) );
+
+    nabla_datacost = tildeP_P.t() * nablaP * ( -1.0 / tildaP_P_lenght * DATA_COST );
+}
+
+// Jacobian of the smooth cost of a pair of neighbouring points i and j
+// Xi1, Xi2, Xj1, Xj2: end points of line i and line j
+// Pi, nablaPi, Pj, nablaPj: projection points and their Jacobian matrices
+//     as computed by datacost()
+// coefficient_i, coefficient_j: weights of the smooth cost (1.0 for the
+//     quadratic smooth cost)
+// nabla_smooth_cost_i, nabla_smooth_cost_j: OUTPUT, 1 by 12, Jacobians with
+//     respect to [line i, line j]
+inline void smoothcost( const cv::Vec3d& Xi1, const cv::Vec3d& Xi2,
+                        const cv::Vec3d& Xj1, const cv::Vec3d& Xj2,
+                        const cv::Vec3d& Pi, const Matx36d& nablaPi,
+                        const cv::Vec3d& Pj, const Matx36d& nablaPj,
+                        const double& coefficient_i, const double& coefficient_j,
+                        Matx1_12d& nabla_smooth_cost_i,
+                        Matx1_12d& nabla_smooth_cost_j )
+{
+    // Jacobian of the projection points with respect to the pair of lines
+    Matx3_12d nablaPi12 = Matx3_12d::zeros();
+    Matx3_12d nablaPj12 = Matx3_12d::zeros();
+    for( int r=0; r<3; r++ )
+    {
+        for( int c=0; c<NUM_PARAM_PER_LINE; c++ )
+        {
+            nablaPi12( r, c ) = nablaPi( r, c );
+            nablaPj12( r, c + NUM_PARAM_PER_LINE ) = nablaPj( r, c );
+        }
+    }
+
+    // double projection
+    cv::Vec3d Pi_prime, Pj_prime;
+    Matx3_12d nablaPi_prime, nablaPj_prime;
+    projection<12>( Xj1, Xj2, endpoint<12>(6), endpoint<12>(9), Pi, nablaPi12, Pi_prime, nablaPi_prime );
+    projection<12>( Xi1, Xi2, endpoint<12>(0), endpoint<12>(3), Pj, nablaPj12, Pj_prime, nablaPj_prime );
+
+    const cv::Vec3d Pi_Pj       = Pi - Pj;
+    const cv::Vec3d Pi_Pi_prime = Pi - Pi_prime;
+    const cv::Vec3d Pj_Pj_prime = Pj - Pj_prime;
+
+    const double dist_pi_pj2       = std::max( 1e-27, Pi_Pj.dot( Pi_Pj ) );
+    const double dist_pi_pi_prime2 = std::max( 1e-27, Pi_Pi_prime.dot( Pi_Pi_prime ) );
+    const double dist_pj_pj_prime2 = std::max( 1e-27, Pj_Pj_prime.dot( Pj_Pj_prime ) );
+    const double dist_pi_pj        = std::sqrt( dist_pi_pj2 );
+    const double dist_pi_pi_prime  = std::sqrt( dist_pi_pi_prime2 );
+    const double dist_pj_pj_prime  = std::sqrt( dist_pj_pj_prime2 );
+
+    const Matx1_12d nabla_pi_pi_prime = Pi_Pi_prime.t() * ( nablaPi12 - nablaPi_prime ) * ( 1.0 / dist_pi_pi_prime );
+    const Matx1_12d nabla_pj_pj_prime = Pj_Pj_prime.t() * ( nablaPj12 - nablaPj_prime ) * ( 1.0 / dist_pj_pj_prime );
+    const Matx1_12d nabla_pi_pj       = Pi_Pj.t() * ( nablaPi12 - nablaPj12 ) * ( 1.0 / dist_pi_pj );
+
+    // output result
+    nabla_smooth_cost_i = ( nabla_pi_pi_prime * dist_pi_pj - nabla_pi_pj * dist_pi_pi_prime )
+                          * ( 1.0 / dist_pi_pj2 * PAIRWISE_SMOOTH * coefficient_i );
+    nabla_smooth_cost_j = ( nabla_pj_pj_prime * dist_pi_pj - nabla_pi_pj * dist_pj_pj_prime )
+                          * ( 1.0 / dist_pi_pj2 * PAIRWISE_SMOOTH * coefficient_j );
+}
+
+// Append a row of the Jacobian of the data cost to the Jacobian matrix
+// (compressed row storage). 'label' is the line of the local parameters.
+inline void append_row( const Matx16d& J, const int& label,
+                        std::vector<double>&   Jacobian_nzv,
+                        std::vector<unsigned>& Jacobian_colindx,
+                        std::vector<unsigned>& Jacobian_rowptr )
+{
+    const unsigned offset = label * NUM_PARAM_PER_LINE;
+    for( int i=0; i<NUM_PARAM_PER_LINE; i++ )
+    {
+        Jacobian_nzv.push_back( J(0, i) );
+        Jacobian_colindx.push_back( offset + i );
+    }
+    Jacobian_rowptr.push_back( (unsigned) Jacobian_nzv.size() );
+}
+
+// Append a row of the Jacobian of the smooth cost to the Jacobian matrix
+// (compressed row storage). 'labeli' and 'labelj' are the lines of the local
+// parameters. The column indices are kept sorted within the row.
+inline void append_row( const Matx1_12d& J, const int& labeli, const int& labelj,
+                        std::vector<double>&   Jacobian_nzv,
+                        std::vector<unsigned>& Jacobian_colindx,
+                        std::vector<unsigned>& Jacobian_rowptr )
+{
+    const int first  = ( labeli < labelj ) ? 0 : NUM_PARAM_PER_LINE;
+    const int second = NUM_PARAM_PER_LINE - first;
+    const unsigned offset_first  = std::min( labeli, labelj ) * NUM_PARAM_PER_LINE;
+    const unsigned offset_second = std::max( labeli, labelj ) * NUM_PARAM_PER_LINE;
+    for( int i=0; i<NUM_PARAM_PER_LINE; i++ )
+    {
+        Jacobian_nzv.push_back( J(0, first + i) );
+        Jacobian_colindx.push_back( offset_first + i );
+    }
+    for( int i=0; i<NUM_PARAM_PER_LINE; i++ )
+    {
+        Jacobian_nzv.push_back( J(0, second + i) );
+        Jacobian_colindx.push_back( offset_second + i );
+    }
+    Jacobian_rowptr.push_back( (unsigned) Jacobian_nzv.size() );
+}
+
+} // end of namespace LineJacobian
@@ -0,0 +1,201 @@
+#include "LineModelArray.h"
+#include <cstring>
+
+using namespace std;
+using namespace cv;
+
+LineModelArray::LineModelArray( const LineModelArray& src )
+{
+    *this = src;
+}
+
+LineModelArray& LineModelArray::operator=( const LineModelArray& src )
+{
+    if( this==&src ) return *this;
+    for( int d=0; d<3; d++ )
+    {
+        x1[d] = src.x1[d];
+        x2[d] = src.x2[d];
+    }
+    sigma = src.sigma;
+    // the views of src point to src
+    views.clear();
+    return *this;
+}
+
+void LineModelArray::resize( int num_lines )
+{
+    for( int d=0; d<3; d++ )
+    {
+        x1[d].resize( num_lines, 0.0 );
+        x2[d].resize( num_lines, 0.0 );
+    }
+    sigma.resize( num_lines, 1.0 );
+}
+
+void LineModelArray::clear( void )
+{
+    resize( 0 );
+    views.clear();
+}
+
+int LineModelArray::push_back( const Vec3d& p1, const Vec3d& p2, const double& s )
+{
+    for( int d=0; d<3; d++ )
+    {
+        x1[d].push_back( p1[d] );
+        x2[d].push_back( p2[d] );
+    }
+    sigma.push_back( s );
+    return size() - 1;
+}
+
+void LineModelArray::setSigma( const int& i, const double& s )
+{
+    sigma[i] = s;
+    // Line3D::getSigma() is not virtual, keep the view up to date
+    if( i < (int) views.size() ) views[i].setSigma( s );
+}
+
+void LineModelArray::serialize( const int& i, std::ostream& out ) const
+{
+    out << sigma[i] << " ";
+    for( int param=0; param<NUM_PARAM_PER_LINE; param++ ) out << getParameter( i, param ) << " ";
+    out << endl;
+}
+
+void LineModelArray::write_binary( char* dst ) const
+{
+    const std::size_t bytes = sizeof(double) * size();
+    if( bytes==0 ) return;
+    for( int d=0; d<3; d++ )
+    {
+        memcpy( dst, &x1[d][0], bytes );
+        dst += bytes;
+    }
+    for( int d=0; d<3; d++ )
+    {
+        memcpy( dst, &x2[d][0], bytes );
+        dst += bytes;
+    }
+    memcpy( dst, &sigma[0], bytes );
+}
+
+void LineModelArray::project( const int* labels, const Vec3i* points, Vec3d* out, int num_points ) const
+{
+    if( num_points==0 ) return;
+
+    const double* X1[3] = { &x1[0][0], &x1[1][0], &x1[2][0] };
+    const double* X2[3] = { &x2[0][0], &x2[1][0], &x2[2][0] };
+
+    #pragma omp parallel for schedule(static)
+    for( int k = 0; k < num_points; k++ )
+    {
+        const int& i = labels[k];
+        const double pos[3] = { X1[0][i], X1[1][i], X1[2][i] };
+        double dir[3] = { X2[0][i] - pos[0], X2[1][i] - pos[1], X2[2][i] - pos[2] };
+        const double len = std::sqrt( dir[0]*dir[0] + dir[1]*dir[1] + dir[2]*dir[2] );
+        dir[0] /= len;
+        dir[1] /= len;
+        dir[2] /= len;
+        const double t = ( points[k][0]-pos[0] ) * dir[0]
+                         + ( points[k][1]-pos[1] ) * dir[1]
+                         + ( points[k][2]-pos[2] ) * dir[2];
+        out[k][0] = pos[0] + dir[0] * t;
+        out[k][1] = pos[1] + dir[1] * t;
+        out[k][2] = pos[2] + dir[2] * t;
+    }
+}
+
+void LineModelArray::apply_delta( const double* delta, double scale )
+{
+    const int num_lines = size();
+    if( num_lines==0 ) return;
+
+    double* X1[3] = { &x1[0][0], &x1[1][0], &x1[2][0] };
+    double* X2[3] = { &x2[0][0], &x2[1][0], &x2[2][0] };
+
+    #pragma omp parallel for schedule(static)
+    for( int i = 0; i < num_lines; i++ )
+    {
+        const double* d = delta + i * NUM_PARAM_PER_LINE;
+        X1[0][i] += scale * d[0];
+        X1[1][i] += scale * d[1];
+        X1[2][i] += scale * d[2];
+        X2[0][i] += scale * d[3];
+        X2[1][i] += scale * d[4];
+        X2[2][i] += scale * d[5];
+    }
+}
+
+void LineModelArray::build_views( vector<Line3D*>& lines )
+{
+    const int num_lines = size();
+    views.resize( num_lines );
+    lines.resize( num_lines );
+    for( int i = 0; i < num_lines; i++ )
+    {
+        views[i] = LineModelView( this, i );
+        views[i].setSigma( sigma[i] );
+        lines[i] = &views[i];
+    }
+}
+
+
+
+double LineModelView::distanceToLine( const Vec3d& point ) const
+{
+    const Vec3d v = projection( point ) - point;
+    return sqrt( v.dot(v) );
+}
+
+double LineModelView::loglikelihood( const Vec3d& point ) const
+{
+    const double dist = this->distanceToLine( point );
+    return dist * dist / this->sigma;
+}
+
+void LineModelView::updateParameterWithDelta( int i, double delta )
+{
+    array->updateParameterWithDelta( id, i, delta );
+}
+
+Vec3d LineModelView::projection( const Vec3d& point ) const
+{
+    return array->projection( id, point );
+}
+
+Vec3d LineModelView::getDirection( void ) const
+{
+    Vec3d p1, p2;
+    array->getEndPoints( id, p1, p2 );
+    Vec3d dir = p1 - p2;
+    dir /= sqrt( dir.dot( dir ) );
+    return dir;
+}
+
+void LineModelView::getEndPoints( Vec3d& p1, Vec3d& p2 ) const
+{
+    array->getEndPoints( id, p1, p2 );
+}
+
+void LineModelView::setPositions( const Vec3d& pos1, const Vec3d& pos2 )
+{
+    array->setPositions( id, pos1, pos2 );
+}
+
+void LineModelView::serialize( std::ostream& out ) const
+{
+    array->serialize( id, out );
+}
+
+void LineModelView::deserialize( std::istream& in )
+{
+    double s;
+    Vec3d p1, p2;
+    in >> s;
+    in >> p1[0] >> p1[1] >> p1[2];
+    in >> p2[0] >> p2[1] >> p2[2];
+    array->setSigma( id, s );
+    array->setPositions( id, p1, p2 );
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <iostream>
+#include <cstddef>
+#include <opencv2/core/core.hpp>
+#include "Line3D.h"
+
+class LineModelArray;
+
+// A thin Line3D view of a line stored in LineModelArray. It is used by the
+// code working with Line3D* (e.g. the viewer and the minimum spanning tree).
+class LineModelView : public Line3D
+{
+    LineModelArray* array;
+    int id;
+public:
+    LineModelView( LineModelArray* array = nullptr, int id = 0 ) : array( array ), id( id ) { }
+    virtual ~LineModelView( void ) { }
+
+    virtual double distanceToLine( const cv::Vec3d& point ) const;
+    virtual double loglikelihood( const cv::Vec3d& point ) const;
+    virtual inline int getNumOfParameters( void )
+    {
+        return 6;
+    }
+    virtual void updateParameterWithDelta( int i, double delta );
+    virtual cv::Vec3d projection( const cv::Vec3d& point ) const;
+    virtual cv::Vec3d getDirection( void ) const;
+    virtual void getEndPoints( cv::Vec3d& p1, cv::Vec3d& p2 ) const;
+    virtual void setPositions( const cv::Vec3d& pos1, const cv::Vec3d& pos2 );
+    virtual void serialize( std::ostream& out ) const;
+    virtual void deserialize( std::istream& in );
+};
+
+
+// Two-point line models (see Line3DTwoPoint) stored as structure of arrays:
+// the coordinates of the end points and the sigmas of all the lines are in
+// contiguous arrays. The accessors are not virtual and the batch kernels
+// below go through the lines one after another.
+class LineModelArray
+{
+public:
+    // number of parameters of a line: [X1(0), X1(1), X1(2), X2(0), X2(1), X2(2)]
+    static const int NUM_PARAM_PER_LINE = 6;
+
+    LineModelArray( void ) { }
+
+    // Only the line models are copied, not their views (see build_views())
+    LineModelArray( const LineModelArray& src );
+    LineModelArray& operator=( const LineModelArray& src );
+
+    inline int size( void ) const
+    {
+        return (int) sigma.size();
+    }
+
+    void resize( int num_lines );
+    void clear( void );
+
+    // add a line, return its index
+    int push_back( const cv::Vec3d& p1, const cv::Vec3d& p2, const double& s );
+
+    inline void getEndPoints( const int& i, cv::Vec3d& p1, cv::Vec3d& p2 ) const
+    {
+        p1 = cv::Vec3d( x1[0][i], x1[1][i], x1[2][i] );
+        p2 = cv::Vec3d( x2[0][i], x2[1][i], x2[2][i] );
+    }
+
+    inline void setPositions( const int& i, const cv::Vec3d& p1, const cv::Vec3d& p2 )
+    {
+        for( int d=0; d<3; d++ )
+        {
+            x1[d][i] = p1[d];
+            x2[d][i] = p2[d];
+        }
+    }
+
+    inline const double& getSigma( const int& i ) const
+    {
+        return sigma[i];
+    }
+
+    void setSigma( const int& i, const double& s );
+
+    inline double getParameter( const int& i, const int& param ) const
+    {
+        return ( param < 3 ) ? x1[param][i] : x2[param-3][i];
+    }
+
+    inline void updateParameterWithDelta( const int& i, const int& param, const double& delta )
+    {
+        if( param < 3 ) x1[param][i] += delta;
+        else x2[param-3][i] += delta;
+    }
+
+    // Given a point, return its projection on line i
+    inline cv::Vec3d projection( const int& i, const cv::Vec3d& point ) const
+    {
+        const double pos[3] = { x1[0][i], x1[1][i], x1[2][i] };
+        double dir[3] = { x2[0][i] - pos[0], x2[1][i] - pos[1], x2[2][i] - pos[2] };
+        const double len = std::sqrt( dir[0]*dir[0] + dir[1]*dir[1] + dir[2]*dir[2] );
+        dir[0] /= len;
+        dir[1] /= len;
+        dir[2] /= len; // normalize the direction
+        const double t = ( point[0]-pos[0] ) * dir[0] + ( point[1]-pos[1] ) * dir[1] + ( point[2]-pos[2] ) * dir[2];
+        return cv::Vec3d( pos[0] + dir[0] * t, pos[1] + dir[1] * t, pos[2] + dir[2] * t );
+    }
+
+    // write line i in the same format as Line3DTwoPoint::serialize()
+    void serialize( const int& i, std::ostream& out ) const;
+
+    // Binary copy of the line models: the arrays x1[0], x1[1], x1[2],
+    // x2[0], x2[1], x2[2] and sigma, one after another (native byte order)
+    static const int NUM_BINARY_ARRAYS = 2 * 3 + 1;
+    static inline std::size_t binary_size( std::size_t num_lines )
+    {
+        return sizeof(double) * NUM_BINARY_ARRAYS * num_lines;
+    }
+    inline std::size_t binary_size( void ) const
+    {
+        return binary_size( size() );
+    }
+    void write_binary( char* dst ) const;
+    // The k-th array of the binary copy (size() doubles), e.g. to read
+    // the line models in place after resize() (call build_views() again)
+    inline double* binary_array( int k )
+    {
+        return k<3 ? &x1[k][0] : ( k<6 ? &x2[k-3][0] : &sigma[0] );
+    }
+
+    // Batch projection: out[k] is the projection of points[k] on line labels[k]
+    void project( const int* labels, const cv::Vec3i* points, cv::Vec3d* out, int num_points ) const;
+
+    // Update all the lines with delta, the parameters of line i are
+    // delta[ i*NUM_PARAM_PER_LINE ], ..., delta[ i*NUM_PARAM_PER_LINE + 5 ]
+    void apply_delta( const double* delta, double scale = 1.0 );
+
+    // Thin Line3D views of the lines (they are invalidated by resize() and
+    // push_back(), call build_views() again)
+    void build_views( std::vector<Line3D*>& lines );
+
+private:
+    friend class LineModelView;
+
+    std::vector<double> x1[3];  // first end points
+    std::vector<double> x2[3];  // second end points
+    std::vector<double> sigma;  // thickness of the lines
+
+    std::vector<LineModelView> views;
+};
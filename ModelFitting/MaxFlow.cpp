@@ -0,0 +1,101 @@
+#include "MaxFlow.h"
+
+#include <limits>
+#include <algorithm>
+
+using namespace std;
+
+// residual capacities below this are considered as zero
+static const double epsilon_flow = 1e-12;
+
+void MaxFlow::reset( int num_nodes )
+{
+    source = num_nodes;
+    sink   = num_nodes + 1;
+    first.assign( num_nodes + 2, -1 );
+    next.clear();
+    head.clear();
+    residual.clear();
+}
+
+void MaxFlow::add_arc( const int& from, const int& to, const double& cap_forward, const double& cap_backward )
+{
+    // forward arc
+    head.push_back( to );
+    residual.push_back( cap_forward );
+    next.push_back( first[from] );
+    first[from] = (int) head.size() - 1;
+    // backward arc
+    head.push_back( from );
+    residual.push_back( cap_backward );
+    next.push_back( first[to] );
+    first[to] = (int) head.size() - 1;
+}
+
+void MaxFlow::add_tweights( const int& i, const double& cap_source, const double& cap_sink )
+{
+    if( cap_source > 0 ) add_arc( source, i, cap_source, 0.0 );
+    if( cap_sink > 0 )   add_arc( i, sink, cap_sink, 0.0 );
+}
+
+void MaxFlow::add_edge( const int& i, const int& j, const double& cap_ij, const double& cap_ji )
+{
+    if( cap_ij > 0 || cap_ji > 0 ) add_arc( i, j, cap_ij, cap_ji );
+}
+
+bool MaxFlow::build_levels( void )
+{
+    level.assign( first.size(), -1 );
+    queue.resize( first.size() );
+    int front = 0, back = 0;
+    level[source] = 0;
+    queue[back++] = source;
+    while( front < back )
+    {
+        const int node = queue[front++];
+        for( int a = first[node]; a != -1; a = next[a] )
+        {
+            if( residual[a] > epsilon_flow && level[ head[a] ] < 0 )
+            {
+                level[ head[a] ] = level[node] + 1;
+                queue[back++] = head[a];
+            }
+        }
+    }
+    return level[sink] >= 0;
+}
+
+double MaxFlow::augment( const int& node, double flow )
+{
+    if( node==sink ) return flow;
+    for( int& a = current[node]; a != -1; a = next[a] )
+    {
+        const int& to = head[a];
+        if( residual[a] <= epsilon_flow || level[to] != level[node] + 1 ) continue;
+        const double pushed = augment( to, min( flow, residual[a] ) );
+        if( pushed > 0 )
+        {
+            residual[a]   -= pushed;
+            residual[a^1] += pushed;
+            return pushed;
+        }
+    }
+    return 0.0;
+}
+
+double MaxFlow::maxflow( void )
+{
+    double total = 0.0;
+    // the level of a node is negative once it is not reachable from the
+    // source anymore (the last call of build_levels()), see is_sink_side()
+    while( build_levels() )
+    {
+        current = first;
+        double pushed;
+        while( ( pushed = augment( source, numeric_limits<double>::max() ) ) > 0 )
+        {
+            total += pushed;
+        }
+    }
+    return total;
+}
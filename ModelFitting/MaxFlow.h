@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+
+// Maximum flow / minimum cut of a graph with a source and a sink (Dinic's
+// algorithm). It is used to solve the binary problems of the alpha
+// expansion (see AlphaExpansion). The memory is kept by reset(), so the
+// same instance can be reused for many small graphs.
+class MaxFlow
+{
+public:
+    // remove all the edges, the graph has num_nodes nodes (besides the
+    // source and the sink)
+    void reset( int num_nodes );
+
+    // add the edges source->i and i->sink
+    void add_tweights( const int& i, const double& cap_source, const double& cap_sink );
+
+    // add the edges i->j and j->i
+    void add_edge( const int& i, const int& j, const double& cap_ij, const double& cap_ji );
+
+    // compute the maximum flow, return its value
+    double maxflow( void );
+
+    // after maxflow(): whether node i is on the sink side of the minimum cut
+    inline bool is_sink_side( const int& i ) const
+    {
+        return level[i] < 0;
+    }
+
+private:
+    void add_arc( const int& from, const int& to, const double& cap_forward, const double& cap_backward );
+    bool build_levels( void );
+    double augment( const int& node, double flow );
+
+    int source, sink;
+
+    // the arcs leaving a node: first[node], next[first[node]], ...
+    std::vector<int>    first;
+    std::vector<int>    next;
+    std::vector<int>    head;      // the arc 'a' goes to head[a], its reverse arc is a^1
+    std::vector<double> residual;  // residual capacity of the arcs
+
+    std::vector<int> level;        // distance from the source in the residual graph
+    std::vector<int> current;      // the next arc to explore from a node
+    std::vector<int> queue;
+};
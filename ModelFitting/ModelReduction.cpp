@@ -0,0 +1,158 @@
+#include "ModelReduction.h"
+
+#include <vector>
+#include <cmath>
+
+#include "ModelSet.h"
+#include "smart_assert.h"
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+// Union-find of the labels, the root of a set is the label whose line is
+// kept for the whole set
+class LabelSets
+{
+public:
+    LabelSets( int num_labels ) : parent( num_labels ), size( num_labels, 1 )
+    {
+        for( int i=0; i<num_labels; i++ ) parent[i] = i;
+    }
+
+    int find( int i )
+    {
+        int root = i;
+        while( parent[root]!=root ) root = parent[root];
+        while( parent[i]!=root )
+        {
+            const int next = parent[i];
+            parent[i] = root;
+            i = next;
+        }
+        return root;
+    }
+
+    // the root of the bigger set stays the root
+    void merge( int root1, int root2 )
+    {
+        if( size[root1] < size[root2] ) std::swap( root1, root2 );
+        parent[root2] = root1;
+        size[root1] += size[root2];
+    }
+
+private:
+    vector<int> parent;
+    vector<int> size;
+};
+
+// whether the lines a and b agree at the point p
+inline bool lines_agree( const LineModelArray& lines, const int& a, const int& b,
+                         const Vec3d& p, const double& min_cos, const double& max_distance2 )
+{
+    Vec3d a1, a2, b1, b2;
+    lines.getEndPoints( a, a1, a2 );
+    lines.getEndPoints( b, b1, b2 );
+    const Vec3d dir_a = a2 - a1;
+    const Vec3d dir_b = b2 - b1;
+    const double cos_ab = dir_a.dot( dir_b ) / sqrt( dir_a.dot( dir_a ) * dir_b.dot( dir_b ) );
+    if( std::abs( cos_ab ) < min_cos ) return false;
+
+    const Vec3d diff = lines.projection( a, p ) - lines.projection( b, p );
+    return diff.dot( diff ) <= max_distance2;
+}
+}
+
+
+int reduce_models( ModelSet& models, double max_angle, double max_distance )
+{
+    const vector<Vec3i>& tildaP = models.tildaP;
+    vector<int>& labelID = models.labelID;
+    LineModelArray& lines = models.line_array;
+    const NeighbourPairs& pairs = models.pairs;
+    smart_assert( pairs.num_sites()==tildaP.size(),
+                  "Error: the neighbour pairs of the model set are not built" );
+
+    const double min_cos = cos( max_angle );
+    const double max_distance2 = max_distance * max_distance;
+    const int num_sites = (int) tildaP.size();
+    const int num_lines = lines.size();
+
+    // the pairs of neighbouring sites whose lines agree (in parallel)
+    vector<char> candidate( pairs.size(), 0 );
+    #pragma omp parallel for schedule(dynamic, 256)
+    for( int site=0; site<num_sites; site++ )
+    {
+        const int& a = labelID[site];
+        for( unsigned k=pairs.begin(site); k<pairs.end(site); k++ )
+        {
+            const int& b = labelID[ pairs.site2[k] ];
+            if( a==b ) continue;
+            candidate[k] = lines_agree( lines, a, b, Vec3d( tildaP[site] ), min_cos, max_distance2 );
+        }
+    }
+
+    // Merge the sets of labels in the order of the pairs (so the result does
+    // not depend on the number of threads). The lines of the roots of two
+    // sets are compared again, so a chain of slowly bending lines is not
+    // merged into a single line.
+    LabelSets sets( num_lines );
+    for( int site=0; site<num_sites; site++ )
+    {
+        for( unsigned k=pairs.begin(site); k<pairs.end(site); k++ )
+        {
+            if( !candidate[k] ) continue;
+            const int root1 = sets.find( labelID[site] );
+            const int root2 = sets.find( labelID[ pairs.site2[k] ] );
+            if( root1==root2 ) continue;
+            if( lines_agree( lines, root1, root2, Vec3d( tildaP[site] ), min_cos, max_distance2 ) )
+            {
+                sets.merge( root1, root2 );
+            }
+        }
+    }
+
+    for( int site=0; site<num_sites; site++ )
+    {
+        labelID[site] = sets.find( labelID[site] );
+    }
+    return remove_unused_models( models );
+}
+
+
+int remove_unused_models( ModelSet& models )
+{
+    const vector<Vec3i>& tildaP = models.tildaP;
+    vector<int>& labelID = models.labelID;
+    LineModelArray& lines = models.line_array;
+    const int num_sites = (int) tildaP.size();
+    const int num_lines = lines.size();
+
+    vector<char> used( num_lines, 0 );
+    for( int site=0; site<num_sites; site++ ) used[ labelID[site] ] = 1;
+
+    // compact the lines
+    vector<int> new_label( num_lines, -1 );
+    LineModelArray reduced;
+    for( int label=0; label<num_lines; label++ )
+    {
+        if( !used[label] ) continue;
+        Vec3d p1, p2;
+        lines.getEndPoints( label, p1, p2 );
+        new_label[label] = reduced.push_back( p1, p2, lines.getSigma( label ) );
+    }
+    for( int site=0; site<num_sites; site++ )
+    {
+        labelID[site] = new_label[ labelID[site] ];
+    }
+    if( !models.labelID3d.is_empty() )
+    {
+        for( int site=0; site<num_sites; site++ ) models.labelID3d.at( tildaP[site] ) = labelID[site];
+    }
+
+    const int num_removed = num_lines - reduced.size();
+    lines = reduced;
+    lines.build_views( models.lines );
+    return num_removed;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+class ModelSet;
+
+/* Model reduction: merge the labels of neighbouring points whose lines
+   agree (nearly parallel and passing close to each other at the points),
+   reassign labelID and compact the line models. Since the initialization
+   creates one line per point, this is run between the rounds of Levenberg
+   Marquardt to shrink the number of parameters.
+
+   max_angle - maximum angle between two merged lines (radians)
+   max_distance - maximum distance between the projections of a point on
+       the two merged lines (voxels)
+   return the number of lines removed */
+int reduce_models( ModelSet& models, double max_angle = 0.1, double max_distance = 0.5 );
+
+// Remove the line models without any point and reassign labelID, return the
+// number of lines removed
+int remove_unused_models( ModelSet& models );
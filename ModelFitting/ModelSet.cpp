@@ -2,16 +2,114 @@
 #include <opencv2/core/core.hpp>
 #include <iostream>
 #include <string>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <algorithm>
 
-#include "Line3DTwoPoint.h"
 #include "ImageProcessing.h"
 #include "VesselnessTypes.h"
 
 using namespace std;
 using namespace cv;
 
+namespace
+{
+// Header of the binary model set file (little-endian), followed by
+//  - the line models (see LineModelArray::write_binary()),
+//  - the positions of the points (num_points x 3 int32),
+//  - the labels of the points (num_points int32).
+struct ModelSetHeader
+{
+    char     magic[8];       // "MODELSET"
+    uint32_t version;
+    uint32_t line_type;
+    uint64_t num_lines;
+    uint64_t num_points;
+    int32_t  volume_size[3];
+    uint32_t reserved;
+    uint64_t checksum;       // checksum of everything after the header
+};
+
+const char     modelset_magic[8] = { 'M', 'O', 'D', 'E', 'L', 'S', 'E', 'T' };
+const uint32_t modelset_version = 1;
+const uint32_t modelset_two_point_lines = 1;
+
+static_assert( sizeof(Vec3i)==3 * sizeof(int32_t), "Vec3i is expected to be 3 packed int" );
+static_assert( sizeof(ModelSetHeader)==56, "Unexpected padding in ModelSetHeader" );
+
+inline bool is_little_endian( void )
+{
+    const uint16_t one = 1;
+    return *(const unsigned char*) &one==1;
+}
+
+inline bool file_exists( const string& file )
+{
+    FILE* f = fopen( file.c_str(), "rb" );
+    if( !f ) return false;
+    fclose( f );
+    return true;
+}
+
+// FNV-1a on 64-bit words (the tail bytes are hashed one by one), the data
+// may be given in several pieces
+class ModelSetChecksum
+{
+public:
+    ModelSetChecksum( void ) : hash( 14695981039346656037ULL ), pending( 0 ) { }
+
+    void update( const char* data, size_t size )
+    {
+        // complete the word started by the previous piece
+        while( pending && size )
+        {
+            word[pending++] = *data++;
+            size--;
+            if( pending==8 )
+            {
+                hash_word( word );
+                pending = 0;
+            }
+        }
+        for( ; size >= 8; data += 8, size -= 8 ) hash_word( data );
+        for( ; size; size-- ) word[pending++] = *data++;
+    }
+
+    uint64_t value( void ) const
+    {
+        uint64_t h = hash;
+        for( size_t i=0; i<pending; i++ ) h = ( h ^ (unsigned char) word[i] ) * prime;
+        return h;
+    }
+
+private:
+    static const uint64_t prime = 1099511628211ULL;
+
+    inline void hash_word( const char* data )
+    {
+        uint64_t w;
+        memcpy( &w, data, 8 );
+        hash = ( hash ^ w ) * prime;
+    }
+
+    uint64_t hash;
+    char word[8];
+    size_t pending;
+};
+
+// read an array of the model set file in place
+bool read_array( FILE* fin, void* dst, size_t bytes, ModelSetChecksum& checksum )
+{
+    if( bytes==0 ) return true;
+    if( fread( dst, 1, bytes, fin )!=bytes ) return false;
+    checksum.update( (const char*) dst, bytes );
+    return true;
+}
+}
+
 
-ModelSet::ModelSet(void)
+ModelSet::ModelSet(void) : volume_size( 0, 0, 0 )
 {
 
 }
@@ -19,23 +117,200 @@ ModelSet::ModelSet(void)
 
 ModelSet::~ModelSet(void)
 {
-    for( unsigned i=0; i<lines.size(); i++ )
+    // the lines are views of line_array, nothing to delete
+}
+
+
+ModelSet::ModelSet( const ModelSet& src )
+    : tildaP( src.tildaP ), labelID( src.labelID ), line_array( src.line_array )
+    , labelID3d( src.labelID3d ), pointID3d( src.pointID3d )
+    , pairs( src.pairs ), volume_size( src.volume_size )
+{
+    if( !src.lines.empty() ) line_array.build_views( lines );
+}
+
+
+ModelSet& ModelSet::operator=( const ModelSet& src )
+{
+    if( this==&src ) return *this;
+    tildaP = src.tildaP;
+    labelID = src.labelID;
+    line_array = src.line_array;
+    labelID3d = src.labelID3d;
+    pointID3d = src.pointID3d;
+    pairs = src.pairs;
+    volume_size = src.volume_size;
+    lines.clear();
+    if( !src.lines.empty() ) line_array.build_views( lines );
+    return *this;
+}
+
+
+void ModelSet::serialize( std::string file ) const
+{
+    serialize( file, line_array );
+}
+
+
+void ModelSet::serialize( std::string file, const LineModelArray& line_models ) const
+{
+    smart_assert( is_little_endian(), "The binary model set is little-endian only" );
+
+    // header and arrays in a single buffer
+    ModelSetHeader header;
+    memcpy( header.magic, modelset_magic, sizeof(header.magic) );
+    header.version    = modelset_version;
+    header.line_type  = modelset_two_point_lines;
+    header.num_lines  = line_models.size();
+    header.num_points = tildaP.size();
+    for( int d=0; d<3; d++ ) header.volume_size[d] = volume_size[d];
+    header.reserved   = 0;
+
+    const size_t lines_bytes  = line_models.binary_size();
+    const size_t points_bytes = sizeof(Vec3i) * tildaP.size();
+    const size_t labels_bytes = sizeof(int) * labelID.size();
+    vector<char> buffer( sizeof(header) + lines_bytes + points_bytes + labels_bytes );
+
+    char* payload = &buffer[0] + sizeof(header);
+    line_models.write_binary( payload );
+    if( points_bytes ) memcpy( payload + lines_bytes, &tildaP[0], points_bytes );
+    if( labels_bytes ) memcpy( payload + lines_bytes + points_bytes, &labelID[0], labels_bytes );
+
+    ModelSetChecksum checksum;
+    checksum.update( payload, buffer.size() - sizeof(header) );
+    header.checksum = checksum.value();
+    memcpy( &buffer[0], &header, sizeof(header) );
+
+    // write to a temporary file first, so that a checkpoint is never half
+    // written
+    const string modelset_file = file + ".modelset.bin";
+    const string temp_file     = modelset_file + ".tmp";
+    FILE* fout = fopen( temp_file.c_str(), "wb" );
+    smart_return( fout, "Cannot open file '" << temp_file << "'", );
+    const size_t written = fwrite( &buffer[0], 1, buffer.size(), fout );
+    fclose( fout );
+    smart_return( written==buffer.size(), "Cannot write file '" << temp_file << "'", );
+#ifdef _WIN32
+    // rename() does not replace an existing file on Windows (on POSIX it
+    // does, atomically)
+    std::remove( modelset_file.c_str() );
+#endif
+    std::rename( temp_file.c_str(), modelset_file.c_str() );
+}
+
+
+bool ModelSet::deserialize_binary( std::string file, const Data3D<unsigned char>* mask )
+{
+    const string modelset_file = file + ".modelset.bin";
+    FILE* fin = fopen( modelset_file.c_str(), "rb" );
+    smart_return( fin, "Cannot open file '" << modelset_file << "'", false );
+
+    fseek( fin, 0, SEEK_END );
+    const long file_size = ftell( fin );
+    fseek( fin, 0, SEEK_SET );
+
+    ModelSetHeader header;
+    const bool header_read = fread( &header, sizeof(header), 1, fin )==1;
+    if( !header_read || memcmp( header.magic, modelset_magic, sizeof(header.magic) )!=0 ||
+            header.version!=modelset_version || header.line_type!=modelset_two_point_lines )
+    {
+        fclose( fin );
+    }
+    smart_return( header_read, "Invalid model set file '" << modelset_file << "'", false );
+    smart_return( memcmp( header.magic, modelset_magic, sizeof(header.magic) )==0,
+                  "Invalid model set file '" << modelset_file << "'", false );
+    smart_return( header.version==modelset_version,
+                  "Unsupported model set version " << header.version, false );
+    smart_return( header.line_type==modelset_two_point_lines,
+                  "Unsupported line type " << header.line_type, false );
+
+    const size_t lines_bytes  = LineModelArray::binary_size( header.num_lines );
+    const size_t points_bytes = sizeof(Vec3i) * header.num_points;
+    const size_t labels_bytes = sizeof(int) * header.num_points;
+    const bool valid_size = file_size >= 0 &&
+                            (size_t) file_size==sizeof(header) + lines_bytes + points_bytes + labels_bytes;
+    if( !valid_size || !is_little_endian() ) fclose( fin );
+    smart_return( valid_size, "Invalid size of model set file '" << modelset_file << "'", false );
+    smart_return( is_little_endian(), "The binary model set is little-endian only", false );
+
+    // no parsing, the arrays are read in place
+    const int num_lines = (int) header.num_lines;
+    line_array.clear();
+    line_array.resize( num_lines );
+    tildaP.resize( header.num_points );
+    labelID.resize( header.num_points );
+    ModelSetChecksum checksum;
+    bool ok = true;
+    const size_t array_bytes = sizeof(double) * num_lines;
+    for( int k=0; ok && k<LineModelArray::NUM_BINARY_ARRAYS && num_lines; k++ )
+    {
+        ok = read_array( fin, line_array.binary_array( k ), array_bytes, checksum );
+    }
+    if( ok && points_bytes ) ok = read_array( fin, &tildaP[0], points_bytes, checksum );
+    if( ok && labels_bytes ) ok = read_array( fin, &labelID[0], labels_bytes, checksum );
+    fclose( fin );
+    volume_size = Vec3i( header.volume_size[0], header.volume_size[1], header.volume_size[2] );
+
+    // every point is inside the volume and belongs to one of the lines
+    bool valid_points = ok && header.checksum==checksum.value();
+    for( size_t i=0; valid_points && i<tildaP.size(); i++ )
+    {
+        const Vec3i& p = tildaP[i];
+        valid_points = labelID[i]>=0 && labelID[i]<num_lines &&
+                       p[0]>=0 && p[0]<volume_size[0] &&
+                       p[1]>=0 && p[1]<volume_size[1] &&
+                       p[2]>=0 && p[2]<volume_size[2];
+    }
+    if( !valid_points )
+    {
+        // do not leave a half loaded model set behind
+        line_array.clear();
+        lines.clear();
+        tildaP.clear();
+        labelID.clear();
+        volume_size = Vec3i( 0, 0, 0 );
+    }
+    smart_return( ok, "Cannot read model set file '" << modelset_file << "'", false );
+    smart_return( header.checksum==checksum.value(),
+                  "Checksum error in model set file '" << modelset_file << "'", false );
+    smart_return( valid_points, "Invalid point or label in model set file '" << modelset_file << "'", false );
+    line_array.build_views( lines );
+
+    if( mask )
     {
-        delete lines[i];
+        // ignore the masked points
+        smart_assert( volume_size==mask->get_size(), "Size should match. ");
+        unsigned num_points = 0;
+        for( unsigned i=0; i<tildaP.size(); i++ )
+        {
+            if( mask->at( tildaP[i] ) ) continue;
+            tildaP[num_points]  = tildaP[i];
+            labelID[num_points] = labelID[i];
+            num_points++;
+        }
+        tildaP.resize( num_points );
+        labelID.resize( num_points );
     }
+
+    // labelID3d and pointID3d are not stored
+    rebuild_volumes();
+    build_neighbour_pairs();
+    return true;
 }
 
 
-void ModelSet::serialize( std::string file ) const
+void ModelSet::serialize_text( std::string file ) const
 {
+    const LineModelArray& line_models = line_array;
+
     // output file stream
     std::ofstream fout( file + ".modelset");
 
     // serialize lines
-    fout << lines.size() << std::endl;
-    for( unsigned i=0; i<lines.size(); i++ )
+    fout << line_models.size() << std::endl;
+    for( int i=0; i<line_models.size(); i++ )
     {
-        lines[i]->serialize( fout );
+        line_models.serialize( i, fout );
     }
 
 
@@ -51,12 +326,25 @@ void ModelSet::serialize( std::string file ) const
     }
     fout.close();
 
-    labelID3d.save( file + ".labelID3d" );
+    if( labelID3d.is_empty() )
+    {
+        // labelID3d is released during model fitting, rebuild it
+        Data3D<int> labels( volume_size, -1 );
+        for( int i=0; i<num_points; i++ ) labels.at( tildaP[i] ) = labelID[i];
+        labels.save( file + ".labelID3d" );
+    }
+    else
+    {
+        labelID3d.save( file + ".labelID3d" );
+    }
 }
 
 
 bool ModelSet::deserialize( std::string file )
 {
+    if( file_exists( file + ".modelset.bin" ) ) return deserialize_binary( file, NULL );
+
+    // the text format of the older versions
     labelID3d.load( file + ".labelID3d" );
 
     // Get the file stream
@@ -70,15 +358,14 @@ bool ModelSet::deserialize( std::string file )
     }
 
     // Deserializing lines
-    for( unsigned i=0; i<lines.size(); i++ ) delete lines[i];
-    lines.clear();
     int num_lines = 0;
     fin >> num_lines;
+    line_array.clear();
+    line_array.resize( num_lines );
+    line_array.build_views( lines );
     for( int i=0; i<num_lines; i++ )
     {
-        Line3DTwoPoint* new_model = new Line3DTwoPoint();
-        new_model->deserialize( fin );
-        lines.push_back( new_model );
+        lines[i]->deserialize( fin );
     }
 
     int num_points = 0;
@@ -99,12 +386,17 @@ bool ModelSet::deserialize( std::string file )
     }
     fin.close();
 
+    volume_size = labelID3d.get_size();
+    build_neighbour_pairs();
 
     return true;
 }
 
 bool ModelSet::deserialize( std::string file, const Data3D<unsigned char>& mask )
 {
+    if( file_exists( file + ".modelset.bin" ) ) return deserialize_binary( file, &mask );
+
+    // the text format of the older versions
 
     labelID3d.load( file + ".labelID3d" );
     smart_assert( labelID3d.get_size()==mask.get_size(), "Size should match. ");
@@ -134,15 +426,14 @@ bool ModelSet::deserialize( std::string file, const Data3D<unsigned char>& mask
     }
 
     // Deserializing lines
-    for( unsigned i=0; i<lines.size(); i++ ) delete lines[i];
-    lines.clear();
     int num_lines = 0;
     fin >> num_lines;
+    line_array.clear();
+    line_array.resize( num_lines );
+    line_array.build_views( lines );
     for( int i=0; i<num_lines; i++ )
     {
-        Line3DTwoPoint* new_model = new Line3DTwoPoint();
-        new_model->deserialize( fin );
-        lines.push_back( new_model );
+        lines[i]->deserialize( fin );
     }
 
     tildaP.clear();
@@ -171,47 +462,110 @@ bool ModelSet::deserialize( std::string file, const Data3D<unsigned char>& mask
     }
     fin.close();
 
+    volume_size = labelID3d.get_size();
+    build_neighbour_pairs();
+
     return true;
 }
 
 
-void ModelSet::init_one_model_per_point( const Data3D<Vesselness_Sig>& vn_sig, const float& threshold )
+float ModelSet::response_threshold( const Data3D<Vesselness_Sig>& vn_sig, const float& threshold )
 {
-    Data3D<float> vn = vn_sig;
-    IP::normalize( vn, 1.0f );
+    const Vesselness_Sig* vn = vn_sig.getData();
+    const long num_voxels = vn_sig.get_size_total();
+    smart_return( num_voxels > 0, "The vesselness is empty", 0.0f );
+
+    float min_rsp = vn[0].rsp;
+    float max_rsp = vn[0].rsp;
+    #pragma omp parallel for reduction(min:min_rsp) reduction(max:max_rsp)
+    for( long i=0; i<num_voxels; i++ )
+    {
+        min_rsp = std::min( min_rsp, vn[i].rsp );
+        max_rsp = std::max( max_rsp, vn[i].rsp );
+    }
+    // same as thresholding the output of IP::normalize( vn, 1.0f )
+    return min_rsp + threshold * ( max_rsp - min_rsp );
+}
 
-    tildaP.clear();
-    labelID.clear();
-    lines.clear();
-    labelID3d.reset( vn.get_size(), -1 );
 
-    for(int z=0; z<vn.SZ(); z++)
+void ModelSet::init_one_model_per_point( const Data3D<Vesselness_Sig>& vn_sig, const float& threshold )
+{
+    const float rsp_threshold = response_threshold( vn_sig, threshold );
+    const int& SX = vn_sig.SX();
+    const int& SY = vn_sig.SY();
+    const int& SZ = vn_sig.SZ();
+
+    // first pass: count the points of every slice
+    vector<int> offsets( SZ + 1, 0 );
+    #pragma omp parallel for schedule(dynamic)
+    for( int z=0; z<SZ; z++ )
     {
-        for ( int y=0; y<vn.SY(); y++)
-        {
-            for(int x=0; x<vn.SX(); x++)
+        int count = 0;
+        for( int y=0; y<SY; y++ ) for( int x=0; x<SX; x++ )
             {
-                if( vn.at(x,y,z) > threshold )   // a thread hold
-                {
-                    // current line id
-                    int lid = (int) lines.size();
+                if( vn_sig.at(x,y,z).rsp > rsp_threshold ) count++;
+            }
+        offsets[z+1] = count;
+    }
+    for( int z=0; z<SZ; z++ ) offsets[z+1] += offsets[z];
+    const int num_points = offsets[SZ];
+
+    tildaP.resize( num_points );
+    labelID.resize( num_points );
+    line_array.clear();
+    line_array.resize( num_points );
+    labelID3d.reset( vn_sig.get_size(), -1 );
+
+    // second pass: every slice fills its own range, one line per point
+    #pragma omp parallel for schedule(dynamic)
+    for( int z=0; z<SZ; z++ )
+    {
+        int lid = offsets[z];
+        for( int y=0; y<SY; y++ ) for( int x=0; x<SX; x++ )
+            {
+                const Vesselness_Sig& vs = vn_sig.at(x,y,z);
+                if( vs.rsp <= rsp_threshold ) continue;
+
+                labelID3d.at(x,y,z) = lid;
+                labelID[lid] = lid;
+                tildaP[lid] = Vec3i(x,y,z);
+
+                // Compute the parameters of the line
+                const Vec3d pos(x,y,z);
+                const Vec3d dir( vs.dir[0], vs.dir[1], vs.dir[2] );
+                line_array.setPositions( lid, pos-dir, pos+dir );
+                line_array.setSigma( lid, vs.sigma );
+                lid++;
+            }
+    }
+    line_array.build_views( lines );
 
-                    labelID3d.at(x,y,z) = lid;
+    volume_size = vn_sig.get_size();
+    build_neighbour_pairs();
+}
 
-                    labelID.push_back( lid );
 
-                    tildaP.push_back( Vec3i(x,y,z) );
+void ModelSet::build_neighbour_pairs( void )
+{
+    // the points keep their order (callers index them by position)
+    pairs.build( tildaP );
+}
 
-                    // Compute the parameters of the line
-                    const Vec3d pos(x,y,z);
-                    const Vec3d& dir = vn_sig.at(x,y,z).dir;
-                    const double& sigma = vn_sig.at(x,y,z).sigma;
-                    Line3DTwoPoint *tmp  = new Line3DTwoPoint();
-                    tmp->setPositions( pos-dir, pos+dir );
-                    tmp->setSigma( sigma );
-                    this->lines.push_back( tmp );
-                }
-            }
-        }
+
+void ModelSet::release_volumes( void )
+{
+    labelID3d = Data3D<int>();
+    pointID3d = Data3D<int>();
+}
+
+
+void ModelSet::rebuild_volumes( void )
+{
+    labelID3d.reset( volume_size, -1 );
+    pointID3d.reset( volume_size, -1 );
+    for( unsigned i=0; i<tildaP.size(); i++ )
+    {
+        labelID3d.at( tildaP[i] ) = labelID[i];
+        pointID3d.at( tildaP[i] ) = i;
     }
 }
@@ -8,6 +8,8 @@
 
 #include "VesselnessTypes.h"
 #include "Data3D.h"
+#include "NeighbourPairs.h"
+#include "LineModelArray.h"
 
 class Line3D;
 class Vesselness_Sig;
@@ -22,7 +24,11 @@ public:
     /*Todo: since the above two have the same size, it is better to put them
       into one big vector<std::pair<Vec3i, int> > or something similar. */
 
-    // Line models
+    // Line models, stored as structure of arrays (used by model fitting)
+    LineModelArray line_array;
+
+    // Line3D views of the line models in line_array (used by the viewer,
+    // the minimum spanning tree, etc.)
     std::vector<Line3D*> lines;
 
     /* The labeling of 3D data points. '-1' indicates that it is a background
@@ -46,13 +52,37 @@ public:
        */
     Data3D<int> pointID3d;
 
+    /* Pairs of neighbouring points (indeces in tildaP), used by the smooth
+       cost. They are built once the points are known (see
+       build_neighbour_pairs()), so that the model fitting does not need
+       to look up labelID3d or pointID3d. */
+    NeighbourPairs pairs;
+
+    /* Size of the volumes labelID3d and pointID3d (they may be released
+       during the model fitting, see release_volumes()) */
+    cv::Vec3i volume_size;
+
     inline int get_data_size();
 
     ModelSet(void);
     virtual ~ModelSet(void);
 
+    // 'lines' are views of line_array: a copy gets views of its own copy
+    // of the line models
+    ModelSet( const ModelSet& src );
+    ModelSet& operator=( const ModelSet& src );
+
     /// Serialization & Deserialization
+    // The model set is saved in binary to 'file.modelset.bin' (labelID3d
+    // and pointID3d are not saved, they are rebuilt from tildaP).
     void serialize( std::string file ) const;
+    // Serialize with the given line models instead of line_array (e.g. a
+    // copy of the line models taken during model fitting)
+    void serialize( std::string file, const LineModelArray& line_models ) const;
+    // The text format of the older versions ('file.modelset' and
+    // 'file.labelID3d')
+    void serialize_text( std::string file ) const;
+    // Load the binary model set if there is one, otherwise the text one
     bool deserialize( std::string file );
     // A point 'p' is ignored if mask.at(p)!=0.
     bool deserialize( std::string file, const Data3D<unsigned char>& mask );
@@ -60,9 +90,32 @@ public:
     ////////////////////////////////////////////////////////////////
     // Model Initialization
     ////////////////////////////////////////////////////////////////
+    // A line is created for every point whose normalized vesselness
+    // response is larger than threshold
     void init_one_model_per_point( const Data3D<Vesselness_Sig>& vn_sig,
                                    const float& threshold = 0.1f );
 
+    // The vesselness response corresponding to 'threshold' once the
+    // responses are normalized to [0, 1] (without normalizing a copy)
+    static float response_threshold( const Data3D<Vesselness_Sig>& vn_sig,
+                                     const float& threshold );
+
+    ////////////////////////////////////////////////////////////////
+    // Neighbourhood of the points
+    ////////////////////////////////////////////////////////////////
+    // Build the pairs of neighbouring points (the order of tildaP and
+    // labelID is not changed)
+    void build_neighbour_pairs( void );
+
+    // Free the memory of labelID3d and pointID3d, and rebuild them from
+    // tildaP and labelID
+    void release_volumes( void );
+    void rebuild_volumes( void );
+
+private:
+    // load 'file.modelset.bin', return false if it is not a valid model set
+    bool deserialize_binary( std::string file, const Data3D<unsigned char>* mask );
+
 };
 
 
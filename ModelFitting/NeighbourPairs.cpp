@@ -0,0 +1,99 @@
+#include "NeighbourPairs.h"
+#include "Neighbour26.h"
+#include "smart_assert.h"
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+// compare the sites by the Morton code of their positions
+struct MortonLess
+{
+    const vector<unsigned long long>& codes;
+    MortonLess( const vector<unsigned long long>& codes ) : codes( codes ) { }
+    inline bool operator()( const int& a, const int& b ) const
+    {
+        return codes[a] < codes[b];
+    }
+};
+}
+
+void NeighbourPairs::morton_order( const vector<Vec3i>& points, vector<int>& order )
+{
+    const int num_sites = (int) points.size();
+
+    // validate the positions before the parallel loop (smart_assert may
+    // pause or abort)
+    int num_invalid = 0;
+    #pragma omp parallel for reduction(+:num_invalid)
+    for( int site = 0; site < num_sites; site++ )
+    {
+        num_invalid += ( points[site][0]<0 || points[site][1]<0 || points[site][2]<0 );
+    }
+    smart_assert( num_invalid==0, "Positions of the points should be non-negative" );
+
+    vector<unsigned long long> codes( num_sites );
+    #pragma omp parallel for
+    for( int site = 0; site < num_sites; site++ )
+    {
+        codes[site] = morton_code( points[site] );
+    }
+
+    order.resize( num_sites );
+    for( int site = 0; site < num_sites; site++ ) order[site] = site;
+    std::sort( order.begin(), order.end(), MortonLess( codes ) );
+}
+
+void NeighbourPairs::build( const vector<Vec3i>& points )
+{
+    const int num_sites = (int) points.size();
+
+    // Sort the sites by the Morton code of their positions, so that a
+    // neighbour can be found with a binary search
+    vector<int> order;
+    morton_order( points, order );
+    vector<unsigned long long> sorted_codes( num_sites );
+    #pragma omp parallel for
+    for( int i = 0; i < num_sites; i++ ) sorted_codes[i] = morton_code( points[ order[i] ] );
+
+    // the neighbours of the sites, -1 if there is no point at the position
+    vector<int> neighbours( num_sites * 13, -1 );
+    rowptr.assign( num_sites + 1, 0 );
+
+    #pragma omp parallel for
+    for( int site = 0; site < num_sites; site++ )
+    {
+        unsigned count = 0;
+        for( int neibourIndex=0; neibourIndex<13; neibourIndex++ )
+        {
+            Vec3i neig;
+            Neighbour26::getNeigbour( neibourIndex, points[site], neig );
+            if( neig[0]<0 || neig[1]<0 || neig[2]<0 ) continue;
+
+            const unsigned long long code = morton_code( neig );
+            vector<unsigned long long>::const_iterator it =
+                std::lower_bound( sorted_codes.begin(), sorted_codes.end(), code );
+            if( it==sorted_codes.end() || *it!=code ) continue;
+
+            neighbours[site * 13 + count++] = order[ it - sorted_codes.begin() ];
+        }
+        rowptr[site+1] = count;
+    }
+
+    // accumulate the number of neighbours and compact the pairs
+    for( int site = 0; site < num_sites; site++ )
+    {
+        rowptr[site+1] += rowptr[site];
+    }
+    site2.resize( rowptr[num_sites] );
+
+    #pragma omp parallel for
+    for( int site = 0; site < num_sites; site++ )
+    {
+        std::copy( neighbours.begin() + site * 13,
+                   neighbours.begin() + site * 13 + ( rowptr[site+1] - rowptr[site] ),
+                   site2.begin() + rowptr[site] );
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+// Pairs of neighbouring data points (sites), stored in compressed row
+// storage: the neighbours of 'site' are
+//     site2[ rowptr[site] ], ..., site2[ rowptr[site+1]-1 ]
+// Only the 13 forward neighbours of a site (see Neighbour26) are stored,
+// so every pair appears exactly once. The pairs only depend on the
+// positions of the points, not on their labels.
+class NeighbourPairs
+{
+public:
+    std::vector<unsigned> rowptr;
+    std::vector<int>      site2;
+
+    // build the pairs of the given points (no 3D volume is required)
+    void build( const std::vector<cv::Vec3i>& points );
+
+    inline void clear( void )
+    {
+        rowptr.clear();
+        site2.clear();
+    }
+
+    // number of sites
+    inline unsigned num_sites( void ) const
+    {
+        return rowptr.empty() ? 0 : (unsigned) rowptr.size() - 1;
+    }
+
+    // total number of pairs
+    inline unsigned size( void ) const
+    {
+        return (unsigned) site2.size();
+    }
+
+    inline unsigned begin( const int& site ) const
+    {
+        return rowptr[site];
+    }
+
+    inline unsigned end( const int& site ) const
+    {
+        return rowptr[site+1];
+    }
+
+    // indeces of the points sorted in Morton order
+    static void morton_order( const std::vector<cv::Vec3i>& points, std::vector<int>& order );
+
+    // Morton code (Z-order) of a non-negative position, 21 bits per axis
+    static inline unsigned long long morton_code( const cv::Vec3i& pos )
+    {
+        return spread_bits( pos[0] ) | ( spread_bits( pos[1] ) << 1 ) | ( spread_bits( pos[2] ) << 2 );
+    }
+
+private:
+    // insert two zero bits between each of the lowest 21 bits of v
+    static inline unsigned long long spread_bits( unsigned v )
+    {
+        unsigned long long x = v & 0x1fffff;
+        x = ( x | x << 32 ) & 0x1f00000000ffffULL;
+        x = ( x | x << 16 ) & 0x1f0000ff0000ffULL;
+        x = ( x | x << 8 )  & 0x100f00f00f00f00fULL;
+        x = ( x | x << 4 )  & 0x10c30c30c30c30c3ULL;
+        x = ( x | x << 2 )  & 0x1249249249249249ULL;
+        return x;
+    }
+};
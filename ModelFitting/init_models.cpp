@@ -1,6 +1,5 @@
 #include "init_models.h"
 #include "VesselnessTypes.h"
-#include "Line3DTwoPoint.h"
 #include "ModelSet.h"
 #include "Data3D.h"
 #include "ImageProcessing.h"
@@ -12,6 +11,24 @@ using namespace cv;
 
 
 
+namespace
+{
+// root of the tree of i in the disjoint set 'parent', with path compression
+inline int find_root( vector<int>& parent, int i )
+{
+    int root = i;
+    while( parent[root]!=root ) root = parent[root];
+    while( parent[i]!=root )
+    {
+        const int next = parent[i];
+        parent[i] = root;
+        i = next;
+    }
+    return root;
+}
+}
+
+
 void each_model_per_local_maximum(
     const Data3D<Vesselness_Sig>& vn_sig,
     Data3D<int>& labelID3d,
@@ -19,12 +36,17 @@ void each_model_per_local_maximum(
     ModelSet& model,
     vector<int>& labelID )
 {
-    Data3D<float> vn = vn_sig;
-    IP::normalize( vn, 1.0f );
-
-    Data3D<Vec3i> djs( vn.get_size() );
+    const float rsp_threshold = ModelSet::response_threshold( vn_sig, 0.1f );
+    const int& SX = vn_sig.SX();
+    const int& SY = vn_sig.SY();
+    const int& SZ = vn_sig.SZ();
 
-    for(int z=0; z<vn.SZ(); z++) for ( int y=0; y<vn.SY(); y++) for(int x=0; x<vn.SX(); x++)
+    // Every voxel points to the voxel with the maximum response on its
+    // cross section, a local maximum points to itself. The voxels pointing
+    // (transitively) to the same local maximum form a set.
+    vector<int> parent( vn_sig.get_size_total() );
+    #pragma omp parallel for schedule(dynamic)
+    for( int z=0; z<SZ; z++ ) for( int y=0; y<SY; y++ ) for( int x=0; x<SX; x++ )
             {
                 // find the major orientation
                 // assigning the orientation to one of the 13 categories
@@ -41,60 +63,46 @@ void each_model_per_local_maximum(
                     }
                 }
                 const vector<cv::Vec3i>& cross_section = Neighbour26::getCrossSection(mdi);
-                Vec3i mics( -1, -1, -1 ); // maximum index on cross section
-                float mrsp = vn.at(x,y,z); // maximum response
+                int mics = x + SX * ( y + SY * z ); // maximum index on cross section
+                float mrsp = vn_sig.at(x,y,z).rsp;  // maximum response
                 for( unsigned i =0; i < cross_section.size(); i++ )
                 {
-                    Vec3i offset_pos  = Vec3i(x,y,z) + cross_section[i];
-                    if( vn.isValid( offset_pos ) && mrsp < vn.at( offset_pos ) )
+                    const Vec3i offset_pos = Vec3i(x,y,z) + cross_section[i];
+                    if( vn_sig.isValid( offset_pos ) && mrsp < vn_sig.at( offset_pos ).rsp )
                     {
-                        mrsp = vn.at(offset_pos);
-                        mics = offset_pos;
+                        mrsp = vn_sig.at( offset_pos ).rsp;
+                        mics = offset_pos[0] + SX * ( offset_pos[1] + SY * offset_pos[2] );
                     }
                 }
-                // 'mics==Vec3i( -1, -1, -1 )' indicates that the current position is local maximum
-                djs.at(x,y,z) = mics;
+                parent[ x + SX * ( y + SY * z ) ] = mics;
             }
 
-
+    // one line per local maximum (above the threshold)
     tildaP.clear();
     labelID.clear();
-    labelID3d.reset( vn.get_size(), -1 );
-    model.lines.clear();
-    for(int z=0; z<vn.SZ(); z++) for ( int y=0; y<vn.SY(); y++) for(int x=0; x<vn.SX(); x++)
+    labelID3d.reset( vn_sig.get_size(), -1 );
+    model.line_array.clear();
+    for( int z=0, i=0; z<SZ; z++ ) for( int y=0; y<SY; y++ ) for( int x=0; x<SX; x++, i++ )
             {
-                if( vn.at(x,y,z) > 0.1f && djs.at(x,y,z)==Vec3i( -1, -1, -1 ) )
+                if( parent[i]==i && vn_sig.at(x,y,z).rsp > rsp_threshold )
                 {
-                    int lid = (int) model.lines.size();
-
-                    labelID3d.at(x,y,z) = lid;
-
-                    labelID.push_back( lid );
-
-                    tildaP.push_back( Vec3i(x,y,z) );
-
                     const Vec3d pos(x,y,z);
-                    const Vec3d& dir = vn_sig.at(x,y,z).dir;
-                    const double& sigma = vn_sig.at(x,y,z).sigma;
-                    Line3DTwoPoint *line  = new Line3DTwoPoint();
-                    line->setPositions( pos-dir, pos+dir );
-                    line->setSigma( sigma );
-                    model.lines.push_back( line );
+                    const Vec3d dir = vn_sig.at(x,y,z).dir;
+                    labelID3d.at(i) = model.line_array.push_back( pos-dir, pos+dir, vn_sig.at(x,y,z).sigma );
                 }
             }
+    model.line_array.build_views( model.lines );
 
-    for(int z=0; z<vn.SZ(); z++) for ( int y=0; y<vn.SY(); y++) for(int x=0; x<vn.SX(); x++)
+    // every voxel gets the label of its local maximum, the local maxima are
+    // points like the other voxels (only once, in raster order)
+    for( int z=0, i=0; z<SZ; z++ ) for( int y=0; y<SY; y++ ) for( int x=0; x<SX; x++, i++ )
             {
-                Vec3i pos(x,y,z);
-                while( djs.at( pos )!=Vec3i( -1, -1, -1 ) )
+                const int lid = labelID3d.at( find_root( parent, i ) );
+                if( lid!=-1 )
                 {
-                    pos = djs.at( pos );
-                }
-                if( labelID3d.at(pos)!=-1 )
-                {
-                    labelID3d.at(x,y,z) = labelID3d.at(pos);
+                    labelID3d.at(x,y,z) = lid;
                     tildaP.push_back( Vec3i(x,y,z) );
-                    labelID.push_back( labelID3d.at(pos) );
+                    labelID.push_back( lid );
                 }
             }
 }
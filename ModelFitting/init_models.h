@@ -10,6 +10,11 @@ class ModelSet;
 
 template<typename T> class Data3D;
 
+// One line model per local maximum of the vesselness (on the cross section
+// of the vessel) above the normalized threshold 0.1, every voxel gets the
+// label of its local maximum. The points are the labelled voxels, each one
+// once, in raster order (in the original version the local maxima came first
+// and were listed a second time with the other voxels).
 void each_model_per_local_maximum(
     const Data3D<Vesselness_Sig>& vn_sig,
     Data3D<int>& labelID3d,
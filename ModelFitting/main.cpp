@@ -189,7 +189,9 @@ void start_levenberg_marquardt( const string& dataname,
     }
 
     // Levenberg Marquardt
-    LevenbergMarquardt lm( model.tildaP, model.labelID, model, model.labelID3d );
+    // the model fitting only needs the pairs of neighbouring points
+    model.release_volumes();
+    LevenbergMarquardt lm( model.tildaP, model.labelID, model );
     lm.reestimate( 400, LevenbergMarquardt::Quadratic, serialized_dataname );
 
     if( visualization_thread.joinable() ) visualization_thread.join();
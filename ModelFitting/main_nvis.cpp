@@ -6,12 +6,17 @@
 #include <assert.h>
 #include <iostream>
 #include <limits>
+#include <cstdlib>
 #include <thread> // C++11
+#include <omp.h>
 
 #include "Line3D.h"
 #include "Data3D.h"
 #include "Line3DTwoPoint.h"
 #include "LevenbergMarquardt.h"
+#include "DomainDecomposition.h"
+#include "ModelReduction.h"
+#include "AlphaExpansion.h"
 #include "SyntheticData.h"
 #include "ImageProcessing.h"
 #include "Timer.h"
@@ -32,8 +37,18 @@ const double PAIRWISE_SMOOTH2 = PAIRWISE_SMOOTH * PAIRWISE_SMOOTH;
 
 namespace experiments
 {
+// block_size - if positive, Levenberg Marquardt is run on blocks of the
+//     volume of this size (see DomainDecomposition)
+// num_processes - if positive, the blocks are solved by this number of
+//     worker processes (see DomainDecomposition::set_num_processes())
+// max_rounds - maximum number of rounds of Levenberg Marquardt followed
+//     by alpha expansion and model reduction (see AlphaExpansion and
+//     reduce_models())
 void start_levernberg_marquart( const string& foldername = "../data",
-                                const string& dataname = "data15" )
+                                const string& dataname = "data15",
+                                const int& block_size = 0,
+                                const int& num_processes = 0,
+                                const int& max_rounds = 3 )
 {
     const string datafile = foldername + dataname;
 
@@ -56,9 +71,39 @@ void start_levernberg_marquart( const string& foldername = "../data",
 
     cout << "Number of data points: " << model.get_data_size() << endl;
 
-    // Levenberg Marquardt
-    LevenbergMarquardt lm( model.tildaP, model.labelID, model, model.labelID3d );
-    lm.reestimate( 400, LevenbergMarquardt::Quadratic, serialized_dataname );
+    // Levenberg Marquardt, the points are relabelled and the redundant line
+    // models are merged between the rounds
+    // the model fitting only needs the pairs of neighbouring points
+    model.release_volumes();
+    for( int round=0; round<max_rounds; round++ )
+    {
+        if( block_size > 0 )
+        {
+            LevenbergMarquardt::Options options;
+            options.report_file = "output/" + serialized_dataname + ".dd" + to_string( round ) + ".jsonl";
+            DomainDecomposition dd( model.tildaP, model.labelID, model.line_array, model.pairs, block_size );
+            dd.set_num_processes( num_processes );
+            dd.reestimate( 400, LevenbergMarquardt::Quadratic, 10, 1e-4, &model, serialized_dataname, options );
+        }
+        else
+        {
+            LevenbergMarquardt::Options options;
+            options.report_file = "output/" + serialized_dataname + ".lm" + to_string( round ) + ".jsonl";
+            LevenbergMarquardt lm( model.tildaP, model.labelID, model );
+            lm.reestimate( 400, LevenbergMarquardt::Quadratic, serialized_dataname, options );
+        }
+
+        if( round==max_rounds-1 ) break;
+
+        // reassign the labels of the points with the fitted lines
+        AlphaExpansion expansion( model.tildaP, model.labelID, model.line_array, model.pairs );
+        const int num_relabelled = expansion.expand( LevenbergMarquardt::Quadratic );
+
+        const int num_removed = reduce_models( model );
+        cout << "Model reduction: " << num_removed << " lines removed, ";
+        cout << model.line_array.size() << " lines left" << endl;
+        if( num_removed==0 && num_relabelled==0 ) break;
+    }
 
     model.serialize( serialized_dataname );
 }
@@ -70,14 +115,20 @@ int main(int argc, char* argv[])
 {
     make_dir( "output" );
     
-    if( argc!=2 ){
+    if( argc<2 || argc>4 ){
         cout << "Please specify a dataname! " << endl; 
+        cout << "Usage: " << argv[0] << " dataname [block_size [num_processes]]" << endl; 
         return 0; 
     }
 
     const char* dataname = argv[1]; 
+    const int block_size = ( argc>=3 ) ? atoi( argv[2] ) : 0; 
+    const int num_processes = ( argc==4 ) ? atoi( argv[3] ) : 0; 
+
+    // the worker processes are forked, this process must stay single-threaded
+    if( num_processes>0 ) omp_set_num_threads( 1 );
 
-    experiments::start_levernberg_marquart("./", dataname );
+    experiments::start_levernberg_marquart("./", dataname, block_size, num_processes );
     
     return 0;
 }
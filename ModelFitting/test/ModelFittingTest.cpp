@@ -0,0 +1,58 @@
+#include "ModelFittingTest.h"
+#include "../Line3DTwoPoint.h"
+#include "../LineJacobian.h"
+#include "../EnergyFunctions.h"
+
+using namespace cv;
+
+// Weights of the energy, they are defined in main.cpp for the ModelFitting
+// executable.
+const double DATA_COST = 1.0;
+const double PAIRWISE_SMOOTH = 7.0;
+const double DATA_COST2 = DATA_COST * DATA_COST;
+const double PAIRWISE_SMOOTH2 = PAIRWISE_SMOOTH * PAIRWISE_SMOOTH;
+
+void ModelFittingTest::SetUp()
+{
+    Xi1 = Vec3d( 0.1, 0.2, 0.0 );
+    Xi2 = Vec3d( 2.0, 0.5, 1.1 );
+    Xj1 = Vec3d( 0.3, 1.5, 0.4 );
+    Xj2 = Vec3d( 1.2, 2.7, 2.0 );
+
+    tildePi = Vec3d( 1.0, 1.0, 1.0 );
+    tildePj = Vec3d( 1.0, 2.0, 1.0 );
+}
+
+void ModelFittingTest::TearDown()
+{
+
+}
+
+Vec3d ModelFittingTest::projection( const Vec3d& X1, const Vec3d& X2, const Vec3d& p )
+{
+    Line3DTwoPoint line;
+    line.setPositions( X1, X2 );
+    return line.projection( p );
+}
+
+double ModelFittingTest::datacost_residual( const double params[12], const Vec3d& tildeP )
+{
+    const Vec3d P = projection( Vec3d( params ), Vec3d( params+3 ), tildeP );
+    const Vec3d tildeP_P = tildeP - P;
+    return DATA_COST * sqrt( tildeP_P.dot( tildeP_P ) );
+}
+
+double ModelFittingTest::smoothcost_residual( const double params[12],
+        const Vec3d& tildePi, const Vec3d& tildePj, bool is_i )
+{
+    const Vec3d Xi1( params ), Xi2( params+3 ), Xj1( params+6 ), Xj2( params+9 );
+
+    const Vec3d Pi = projection( Xi1, Xi2, tildePi );
+    const Vec3d Pj = projection( Xj1, Xj2, tildePj );
+    const Vec3d Pi_prime = projection( Xj1, Xj2, Pi );
+    const Vec3d Pj_prime = projection( Xi1, Xi2, Pj );
+
+    const Vec3d Pi_Pj = Pi - Pj;
+    const Vec3d P_P_prime = is_i ? Pi - Pi_prime : Pj - Pj_prime;
+    return PAIRWISE_SMOOTH * sqrt( P_P_prime.dot( P_P_prime ) / Pi_Pj.dot( Pi_Pj ) );
+}
@@ -0,0 +1,30 @@
+#ifndef MODELFITTINGTEST_H
+#define MODELFITTINGTEST_H
+
+#include "gtest/gtest.h"
+#include <opencv2/core/core.hpp>
+
+class ModelFittingTest : public testing::Test
+{
+protected:
+    // end points of two neighbouring lines
+    cv::Vec3d Xi1, Xi2, Xj1, Xj2;
+    // two neighbouring data points
+    cv::Vec3d tildePi, tildePj;
+
+    virtual void SetUp();
+    virtual void TearDown();
+
+    // projection of a point on the line (X1, X2)
+    static cv::Vec3d projection( const cv::Vec3d& X1, const cv::Vec3d& X2, const cv::Vec3d& p );
+
+    // square root of the data cost and the quadratic smooth costs (i.e. the
+    // residuals of Levenberg Marquardt) with respect to the parameters of
+    // the lines: params = [Xi1, Xi2, Xj1, Xj2]
+    static double datacost_residual( const double params[12], const cv::Vec3d& tildeP );
+    static double smoothcost_residual( const double params[12],
+                                       const cv::Vec3d& tildePi, const cv::Vec3d& tildePj,
+                                       bool is_i );
+};
+
+#endif // MODELFITTINGTEST_H
@@ -0,0 +1,732 @@
+#include "gtest/gtest.h"
+
+#include "ModelFittingTest.h"
+#include "../LineJacobian.h"
+#include "../NeighbourPairs.h"
+#include "../LineModelArray.h"
+#include "../Line3DTwoPoint.h"
+#include "../DomainDecomposition.h"
+#include "../EnergyFunctions.h"
+#include "../Neighbour26.h"
+#include "../ModelSet.h"
+#include "../init_models.h"
+#include "../ModelReduction.h"
+#include "../AlphaExpansion.h"
+#include "../MaxFlow.h"
+#include "VesselnessTypes.h"
+
+#include <new>
+#include <cstdlib>
+#include <cmath>
+#include <omp.h>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+
+// Counting the number of heap allocations of the program
+static unsigned long long num_heap_allocations = 0;
+
+void* operator new( std::size_t size )
+{
+    num_heap_allocations++;
+    void* p = malloc( size );
+    if( !p ) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete( void* p ) noexcept
+{
+    free( p );
+}
+
+
+// Compare the analytic Jacobian of the data cost with finite differences
+TEST_F(ModelFittingTest, DatacostJacobian)
+{
+    Vec3d P;
+    LineJacobian::Matx36d nablaP;
+    LineJacobian::Matx16d J;
+    LineJacobian::datacost( Xi1, Xi2, tildePi, P, nablaP, J );
+
+    const Vec3d expected_P = projection( Xi1, Xi2, tildePi );
+    for( int i=0; i<3; i++ ) ASSERT_NEAR( expected_P[i], P[i], 1e-9 );
+
+    double params[12];
+    for( int i=0; i<3; i++ )
+    {
+        params[i]   = Xi1[i];
+        params[i+3] = Xi2[i];
+    }
+    const double h = 1e-6;
+    for( int c=0; c<6; c++ )
+    {
+        double params_plus[12], params_minus[12];
+        memcpy( params_plus,  params, sizeof(params) );
+        memcpy( params_minus, params, sizeof(params) );
+        params_plus[c]  += h;
+        params_minus[c] -= h;
+        const double numeric = ( datacost_residual( params_plus, tildePi )
+                                 - datacost_residual( params_minus, tildePi ) ) / ( 2 * h );
+        ASSERT_NEAR( numeric, J(0, c), 1e-5 );
+    }
+}
+
+
+// Compare the analytic Jacobian of the quadratic smooth cost with finite differences
+TEST_F(ModelFittingTest, SmoothcostJacobian)
+{
+    Vec3d Pi, Pj;
+    LineJacobian::Matx36d nablaPi, nablaPj;
+    LineJacobian::Matx16d Jdi, Jdj;
+    LineJacobian::datacost( Xi1, Xi2, tildePi, Pi, nablaPi, Jdi );
+    LineJacobian::datacost( Xj1, Xj2, tildePj, Pj, nablaPj, Jdj );
+
+    LineJacobian::Matx1_12d Ji, Jj;
+    LineJacobian::smoothcost( Xi1, Xi2, Xj1, Xj2, Pi, nablaPi, Pj, nablaPj, 1.0, 1.0, Ji, Jj );
+
+    double params[12];
+    for( int i=0; i<3; i++ )
+    {
+        params[i]   = Xi1[i];
+        params[i+3] = Xi2[i];
+        params[i+6] = Xj1[i];
+        params[i+9] = Xj2[i];
+    }
+    const double h = 1e-6;
+    for( int c=0; c<12; c++ )
+    {
+        double params_plus[12], params_minus[12];
+        memcpy( params_plus,  params, sizeof(params) );
+        memcpy( params_minus, params, sizeof(params) );
+        params_plus[c]  += h;
+        params_minus[c] -= h;
+        const double numeric_i = ( smoothcost_residual( params_plus,  tildePi, tildePj, true )
+                                   - smoothcost_residual( params_minus, tildePi, tildePj, true ) ) / ( 2 * h );
+        const double numeric_j = ( smoothcost_residual( params_plus,  tildePi, tildePj, false )
+                                   - smoothcost_residual( params_minus, tildePi, tildePj, false ) ) / ( 2 * h );
+        ASSERT_NEAR( numeric_i, Ji(0, c), 1e-4 );
+        ASSERT_NEAR( numeric_j, Jj(0, c), 1e-4 );
+    }
+}
+
+
+// The columns of a row of the smooth cost Jacobian are sorted
+TEST_F(ModelFittingTest, AppendRow)
+{
+    LineJacobian::Matx1_12d J;
+    for( int i=0; i<12; i++ ) J(0, i) = i;
+
+    vector<double>   nzv;
+    vector<unsigned> colindx;
+    vector<unsigned> rowptr( 1, 0 );
+    LineJacobian::append_row( J, 5, 2, nzv, colindx, rowptr );
+
+    ASSERT_EQ( 12u, nzv.size() );
+    ASSERT_EQ( 12u, rowptr.back() );
+    for( int i=0; i<6; i++ )
+    {
+        // line 2 comes first, they are the last 6 local parameters
+        ASSERT_EQ( unsigned( 12 + i ), colindx[i] );
+        ASSERT_DOUBLE_EQ( 6.0 + i, nzv[i] );
+        // then line 5
+        ASSERT_EQ( unsigned( 30 + i ), colindx[i+6] );
+        ASSERT_DOUBLE_EQ( 0.0 + i, nzv[i+6] );
+    }
+}
+
+
+// Computing the Jacobians of the residuals should never allocate heap memory
+TEST_F(ModelFittingTest, JacobianHeapAllocations)
+{
+    const int num_residuals = 1000;
+
+    vector<double>   nzv;
+    vector<unsigned> colindx;
+    vector<unsigned> rowptr( 1, 0 );
+    nzv.reserve( num_residuals * 18 );
+    colindx.reserve( num_residuals * 18 );
+    rowptr.reserve( num_residuals * 2 + 1 );
+
+    const unsigned long long allocations_before = num_heap_allocations;
+    for( int i=0; i<num_residuals; i++ )
+    {
+        Vec3d Pi, Pj;
+        LineJacobian::Matx36d nablaPi, nablaPj;
+        LineJacobian::Matx16d Jdi, Jdj;
+        LineJacobian::datacost( Xi1, Xi2, tildePi, Pi, nablaPi, Jdi );
+        LineJacobian::datacost( Xj1, Xj2, tildePj, Pj, nablaPj, Jdj );
+        LineJacobian::append_row( Jdi, 0, nzv, colindx, rowptr );
+
+        LineJacobian::Matx1_12d Ji, Jj;
+        LineJacobian::smoothcost( Xi1, Xi2, Xj1, Xj2, Pi, nablaPi, Pj, nablaPj, 1.0, 1.0, Ji, Jj );
+        LineJacobian::append_row( Ji, 0, 1, nzv, colindx, rowptr );
+    }
+    const unsigned long long allocations_after = num_heap_allocations;
+
+    ASSERT_EQ( allocations_before, allocations_after );
+}
+
+
+// The pairs found with Morton codes should be the same as the ones found
+// by looking up the 13 forward neighbours of every point
+TEST_F(ModelFittingTest, NeighbourPairs)
+{
+    vector<Vec3i> points;
+    for( int z=0; z<4; z++ ) for( int y=0; y<5; y++ ) for( int x=0; x<6; x++ )
+    {
+        if( (x*7 + y*3 + z*5) % 4 != 0 ) points.push_back( Vec3i(x,y,z) );
+    }
+
+    NeighbourPairs pairs;
+    pairs.build( points );
+    ASSERT_EQ( points.size(), pairs.num_sites() );
+
+    unsigned num_pairs = 0;
+    for( unsigned site=0; site<points.size(); site++ )
+    {
+        vector<int> expected;
+        for( int neibourIndex=0; neibourIndex<13; neibourIndex++ )
+        {
+            Vec3i neig;
+            Neighbour26::getNeigbour( neibourIndex, points[site], neig );
+            for( unsigned site2=0; site2<points.size(); site2++ )
+            {
+                if( points[site2]==neig ) expected.push_back( site2 );
+            }
+        }
+
+        ASSERT_EQ( expected.size(), pairs.end(site) - pairs.begin(site) );
+        for( unsigned i=0; i<expected.size(); i++ )
+        {
+            ASSERT_EQ( expected[i], pairs.site2[ pairs.begin(site) + i ] );
+        }
+        num_pairs += (unsigned) expected.size();
+    }
+    ASSERT_EQ( num_pairs, pairs.size() );
+
+    // the Morton order of the sites
+    vector<int> order;
+    NeighbourPairs::morton_order( points, order );
+    ASSERT_EQ( points.size(), order.size() );
+    for( unsigned i=1; i<order.size(); i++ )
+    {
+        ASSERT_LT( NeighbourPairs::morton_code( points[ order[i-1] ] ),
+                   NeighbourPairs::morton_code( points[ order[i] ] ) );
+    }
+}
+
+
+// The line models stored in LineModelArray should behave like Line3DTwoPoint
+TEST_F(ModelFittingTest, LineModelArray)
+{
+    LineModelArray lines;
+    lines.push_back( Xi1, Xi2, 1.5 );
+    lines.push_back( Xj1, Xj2, 2.0 );
+
+    const double delta[12] = { 0.1, -0.2, 0.3, 0.0, 0.5, -0.1,
+                               -0.3, 0.2, 0.1, 0.4, 0.0, 0.2
+                             };
+    lines.apply_delta( delta, -1.0 );
+
+    Line3DTwoPoint li, lj;
+    li.setPositions( Xi1, Xi2 );
+    lj.setPositions( Xj1, Xj2 );
+    for( int i=0; i<6; i++ )
+    {
+        li.updateParameterWithDelta( i, -delta[i] );
+        lj.updateParameterWithDelta( i, -delta[i+6] );
+    }
+
+    const int labels[4] = { 0, 1, 1, 0 };
+    const Vec3i points[4] = { Vec3i(1,1,1), Vec3i(1,2,1), Vec3i(3,0,2), Vec3i(0,4,5) };
+    Vec3d P[4];
+    lines.project( labels, points, P, 4 );
+
+    for( int k=0; k<4; k++ )
+    {
+        const Vec3d expected = ( labels[k]==0 ) ? li.projection( points[k] ) : lj.projection( points[k] );
+        for( int d=0; d<3; d++ )
+        {
+            ASSERT_NEAR( expected[d], P[k][d], 1e-12 );
+            ASSERT_NEAR( expected[d], lines.projection( labels[k], points[k] )[d], 1e-12 );
+        }
+    }
+
+    // the Line3D views forward to the array
+    vector<Line3D*> views;
+    lines.build_views( views );
+    ASSERT_EQ( 2u, views.size() );
+    ASSERT_DOUBLE_EQ( 2.0, views[1]->getSigma() );
+    views[0]->updateParameterWithDelta( 4, 1.0 );
+    ASSERT_DOUBLE_EQ( Xi2[1] - delta[4] + 1.0, lines.getParameter( 0, 4 ) );
+
+    // a copy does not share the line models (e.g. for checkpoints)
+    LineModelArray snapshot = lines;
+    lines.updateParameterWithDelta( 1, 2, 1.0 );
+    ASSERT_EQ( lines.size(), snapshot.size() );
+    ASSERT_DOUBLE_EQ( lines.getParameter( 1, 2 ) - 1.0, snapshot.getParameter( 1, 2 ) );
+}
+
+
+// Points along two crossing tubes, one line model per point
+static void crossing_tubes( vector<Vec3i>& points, vector<int>& labels,
+                            LineModelArray& lines, NeighbourPairs& pairs )
+{
+    for( int z=0; z<12; z++ ) for( int y=0; y<12; y++ ) for( int x=0; x<12; x++ )
+    {
+        if( ( abs( y - 5 ) <= 1 && abs( z - 6 ) <= 1 ) || ( abs( x - 4 ) <= 1 && abs( y - 6 ) <= 1 ) )
+        {
+            points.push_back( Vec3i(x,y,z) );
+        }
+    }
+
+    labels.resize( points.size() );
+    for( unsigned site=0; site<points.size(); site++ )
+    {
+        const Vec3d pos( points[site] );
+        const Vec3d dir = ( site % 3 ) ? Vec3d( 1.0, 0.1 * ( site % 5 ), 0.2 ) : Vec3d( 0.1, 0.3, 1.0 );
+        labels[site] = lines.push_back( pos - dir, pos + dir, 1.0 );
+    }
+
+    pairs.build( points );
+}
+
+// Every block update of the domain decomposition only decreases the energy,
+// and the blocks of the same colour never share an energy term
+TEST_F(ModelFittingTest, DomainDecomposition)
+{
+    vector<Vec3i> points;
+    vector<int> labels;
+    LineModelArray lines;
+    NeighbourPairs pairs;
+    crossing_tubes( points, labels, lines, pairs );
+
+    DomainDecomposition dd( points, labels, lines, pairs, 4 );
+    dd.partition();
+    ASSERT_LT( 1, dd.num_blocks() );
+    for( unsigned site=0; site<points.size(); site++ )
+    {
+        ASSERT_LE( 0, dd.block_of_line( labels[site] ) );
+        for( unsigned i = pairs.begin( site ); i < pairs.end( site ); i++ )
+        {
+            const int b1 = dd.block_of_line( labels[site] );
+            const int b2 = dd.block_of_line( labels[ pairs.site2[i] ] );
+            if( b1!=b2 ) ASSERT_NE( dd.colour_of_block( b1 ), dd.colour_of_block( b2 ) );
+        }
+    }
+
+    // the same blocks, with a report
+    LineModelArray lines2 = lines;
+    DomainDecomposition dd2( points, labels, lines2, pairs, 4 );
+
+    const double energy_before = compute_energy( points, labels, lines, pairs, &smoothcost_func_quadratic );
+    const double energy_after = dd.reestimate( 1e2, LevenbergMarquardt::Quadratic, 3, 0.0 );
+    ASSERT_LT( energy_after, energy_before );
+    ASSERT_NEAR( energy_after, compute_energy( points, labels, lines, pairs, &smoothcost_func_quadratic ),
+                 1e-9 * energy_before );
+
+    LevenbergMarquardt::Options options;
+    options.verbose = false;
+    options.report_file = "ModelFittingTest-dd.jsonl";
+    const double energy_after2 = dd2.reestimate( 1e2, LevenbergMarquardt::Quadratic, 3, 0.0,
+                                 NULL, "default", options );
+    ASSERT_NEAR( energy_after, energy_after2, 1e-9 * energy_before );
+
+    // one line per block and per sweep, and the last line
+    ifstream report( options.report_file.c_str() );
+    string line;
+    int num_blocks = 0, num_sweeps = 0, num_done = 0;
+    while( getline( report, line ) )
+    {
+        num_blocks += ( line.find( "\"block\"" )!=string::npos );
+        num_sweeps += ( line.find( "\"iteration\"" )!=string::npos );
+        num_done += ( line.find( "\"reason\"" )!=string::npos );
+    }
+    report.close();
+    remove( options.report_file.c_str() );
+    ASSERT_LT( 0, num_blocks );
+    ASSERT_EQ( 3, num_sweeps );
+    ASSERT_EQ( 1, num_done );
+}
+
+// Exit code 0 if the blocks solved by worker processes give the same lines
+// as the blocks solved by this process
+static void domain_decomposition_processes( void )
+{
+    // no OpenMP thread, so that the workers can be forked
+    omp_set_num_threads( 1 );
+
+    vector<Vec3i> points;
+    vector<int> labels;
+    LineModelArray lines;
+    NeighbourPairs pairs;
+    crossing_tubes( points, labels, lines, pairs );
+    LineModelArray lines2 = lines;
+
+    DomainDecomposition dd( points, labels, lines, pairs, 4 );
+    const double energy = dd.reestimate( 1e2, LevenbergMarquardt::Quadratic, 3, 0.0 );
+    if( !DomainDecomposition::can_fork_workers() ) exit( 2 );
+
+    DomainDecomposition dd2( points, labels, lines2, pairs, 4 );
+    dd2.set_num_processes( 2 );
+    LevenbergMarquardt::Options options;
+    options.verbose = false;
+    const double energy2 = dd2.reestimate( 1e2, LevenbergMarquardt::Quadratic, 3, 0.0,
+                                           NULL, "default", options );
+    if( std::abs( energy - energy2 ) > 1e-9 * energy ) exit( 3 );
+    for( unsigned label=0; label<lines.size(); label++ )
+    {
+        Vec3d p1, p2, q1, q2;
+        lines.getEndPoints( label, p1, p2 );
+        lines2.getEndPoints( label, q1, q2 );
+        if( norm( p1 - q1 ) + norm( p2 - q2 ) > 1e-9 ) exit( 4 );
+    }
+    exit( 0 );
+}
+
+// The worker processes are only forked by a process with a single thread,
+// while this one may run the OpenMP threads of the other tests: they are used
+// in a new process (the "threadsafe" death tests start a new process)
+TEST_F(ModelFittingTest, DomainDecompositionProcesses)
+{
+    testing::FLAGS_gtest_death_test_style = "threadsafe";
+    EXPECT_EXIT( domain_decomposition_processes(), testing::ExitedWithCode( 0 ), "" );
+    testing::FLAGS_gtest_death_test_style = "fast";
+}
+
+
+// The binary model set gives back the same line models and points, and a
+// corrupted file is rejected
+TEST_F(ModelFittingTest, ModelSetBinary)
+{
+    ModelSet models;
+    models.volume_size = Vec3i( 6, 5, 4 );
+    for( int i=0; i<20; i++ )
+    {
+        models.tildaP.push_back( Vec3i( i%6, (i/6)%5, i/30 + 1 ) );
+        models.labelID.push_back( i%3 );
+    }
+    models.line_array.push_back( Xi1, Xi2, 1.5 );
+    models.line_array.push_back( Xj1, Xj2, 2.0 );
+    models.line_array.push_back( Xi1, Xj2, 0.5 );
+    models.line_array.build_views( models.lines );
+
+    const string file = "ModelFittingTest-binary";
+    models.serialize( file );
+
+    ModelSet loaded;
+    ASSERT_TRUE( loaded.deserialize( file ) );
+    ASSERT_EQ( models.volume_size, loaded.volume_size );
+    ASSERT_EQ( models.line_array.size(), loaded.line_array.size() );
+    ASSERT_EQ( models.line_array.size(), (int) loaded.lines.size() );
+    for( int i=0; i<models.line_array.size(); i++ )
+    {
+        ASSERT_EQ( models.line_array.getSigma( i ), loaded.line_array.getSigma( i ) );
+        for( int param=0; param<LineModelArray::NUM_PARAM_PER_LINE; param++ )
+        {
+            ASSERT_EQ( models.line_array.getParameter( i, param ), loaded.line_array.getParameter( i, param ) );
+        }
+    }
+
+    // the points keep their order and their labels
+    ASSERT_EQ( models.tildaP.size(), loaded.tildaP.size() );
+    for( unsigned i=0; i<loaded.tildaP.size(); i++ )
+    {
+        ASSERT_EQ( loaded.labelID[i], loaded.labelID3d.at( loaded.tildaP[i] ) );
+        ASSERT_EQ( (int) i, loaded.pointID3d.at( loaded.tildaP[i] ) );
+        const Vec3i& p = loaded.tildaP[i];
+        const int k = p[0] + 6 * p[1] + 30 * ( p[2] - 1 );
+        ASSERT_EQ( k%3, loaded.labelID[i] );
+    }
+
+    // flip a byte of the payload
+    const string modelset_file = file + ".modelset.bin";
+    FILE* f = fopen( modelset_file.c_str(), "r+b" );
+    ASSERT_TRUE( f!=NULL );
+    fseek( f, -3, SEEK_END );
+    const int c = fgetc( f );
+    fseek( f, -3, SEEK_END );
+    fputc( c ^ 0x10, f );
+    fclose( f );
+    ModelSet corrupted;
+    ASSERT_FALSE( corrupted.deserialize( file ) );
+
+    // a label without line model, a point outside of the volume
+    models.labelID[4] = 3;
+    models.serialize( file );
+    ASSERT_FALSE( corrupted.deserialize( file ) );
+    ASSERT_EQ( 0u, corrupted.tildaP.size() );
+    models.labelID[4] = 1;
+    models.tildaP[7] = Vec3i( 1, 5, 1 );
+    models.serialize( file );
+    ASSERT_FALSE( corrupted.deserialize( file ) );
+    remove( modelset_file.c_str() );
+}
+
+
+// One line per point above the normalized threshold, centred on the point
+TEST_F(ModelFittingTest, InitOneModelPerPoint)
+{
+    Data3D<Vesselness_Sig> vn_sig( Vec3i(10, 9, 8) );
+    srand( 3 );
+    for( int z=0; z<8; z++ ) for( int y=0; y<9; y++ ) for( int x=0; x<10; x++ )
+            {
+                Vesselness_Sig& vs = vn_sig.at(x,y,z);
+                vs.rsp   = 2.0f + 0.01f * ( rand() % 1000 );
+                vs.dir   = Vec3f( 0.6f, 0.8f, 0.0f );
+                vs.sigma = 1.0f + x;
+            }
+
+    // normalized responses
+    float min_rsp = vn_sig.at(0).rsp, max_rsp = vn_sig.at(0).rsp;
+    for( int i=0; i<vn_sig.get_size_total(); i++ )
+    {
+        min_rsp = std::min( min_rsp, vn_sig.at(i).rsp );
+        max_rsp = std::max( max_rsp, vn_sig.at(i).rsp );
+    }
+    Data3D<float> vn( vn_sig.get_size() );
+    int num_points = 0;
+    for( int i=0; i<vn.get_size_total(); i++ )
+    {
+        vn.at(i) = ( vn_sig.at(i).rsp - min_rsp ) / ( max_rsp - min_rsp );
+        if( vn.at(i) > 0.3f ) num_points++;
+    }
+
+    ModelSet models;
+    models.init_one_model_per_point( vn_sig, 0.3f );
+    ASSERT_EQ( num_points, (int) models.tildaP.size() );
+    ASSERT_EQ( num_points, models.line_array.size() );
+    for( unsigned i=0; i<models.tildaP.size(); i++ )
+    {
+        const Vec3i& p = models.tildaP[i];
+        const int& lid = models.labelID[i];
+        ASSERT_GT( vn.at( p ), 0.3f );
+        ASSERT_EQ( lid, models.labelID3d.at( p ) );
+        ASSERT_DOUBLE_EQ( 1.0 + p[0], models.line_array.getSigma( lid ) );
+        Vec3d p1, p2;
+        models.line_array.getEndPoints( lid, p1, p2 );
+        for( int d=0; d<3; d++ ) ASSERT_NEAR( p[d], 0.5 * ( p1[d] + p2[d] ), 1e-6 );
+    }
+}
+
+
+// One line per local maximum, every labelled voxel is a point once, in
+// raster order
+TEST_F(ModelFittingTest, EachModelPerLocalMaximum)
+{
+    // a vessel along z in the slices 0 to 3, the responses of slice 4 are all
+    // zero (local maxima below the threshold)
+    Data3D<Vesselness_Sig> vn_sig( Vec3i(7, 7, 5) );
+    for( int z=0; z<5; z++ ) for( int y=0; y<7; y++ ) for( int x=0; x<7; x++ )
+            {
+                Vesselness_Sig& vs = vn_sig.at(x,y,z);
+                vs.rsp   = ( z<4 ) ? 10.0f - abs( x-3 ) - abs( y-3 ) : 0.0f;
+                vs.dir   = Vec3f( 0.0f, 0.0f, 1.0f );
+                vs.sigma = 1.0f;
+            }
+
+    Data3D<int> labelID3d;
+    vector<Vec3i> tildaP;
+    vector<int> labelID;
+    ModelSet models;
+    each_model_per_local_maximum( vn_sig, labelID3d, tildaP, models, labelID );
+
+    ASSERT_EQ( 4, models.line_array.size() );
+    ASSERT_EQ( 7u * 7 * 4, tildaP.size() );
+    ASSERT_EQ( tildaP.size(), labelID.size() );
+    unsigned i = 0;
+    for( int z=0; z<4; z++ ) for( int y=0; y<7; y++ ) for( int x=0; x<7; x++, i++ )
+            {
+                ASSERT_EQ( Vec3i(x,y,z), tildaP[i] );
+                ASSERT_EQ( z, labelID[i] );
+                ASSERT_EQ( z, labelID3d.at(x,y,z) );
+            }
+    for( int y=0; y<7; y++ ) for( int x=0; x<7; x++ ) ASSERT_EQ( -1, labelID3d.at(x,y,4) );
+
+    // the line of a local maximum is centred on it
+    Vec3d p1, p2;
+    models.line_array.getEndPoints( 2, p1, p2 );
+    ASSERT_DOUBLE_EQ( 0.0, norm( 0.5 * ( p1 + p2 ) - Vec3d( 3, 3, 2 ) ) );
+}
+
+
+// The lines of the points of a tube are merged, the parallel lines that
+// are one voxel apart are not
+TEST_F(ModelFittingTest, ModelReduction)
+{
+    ModelSet models;
+    models.volume_size = Vec3i( 20, 20, 20 );
+    for( int z=5; z<7; z++ ) for( int y=5; y<7; y++ ) for( int x=2; x<18; x++ )
+            {
+                const Vec3d pos( x, y, z );
+                // slightly noisy lines along the x axis
+                const Vec3d dir( 1.0, 0.01 * ( x%3 ), 0.0 );
+                models.labelID.push_back( models.line_array.push_back( pos-dir, pos+dir, 1.0 ) );
+                models.tildaP.push_back( Vec3i( x, y, z ) );
+            }
+    models.line_array.build_views( models.lines );
+    models.build_neighbour_pairs();
+
+    const int num_lines = models.line_array.size();
+    const int num_removed = reduce_models( models, 0.1, 0.5 );
+    ASSERT_EQ( 4, models.line_array.size() );
+    ASSERT_EQ( num_lines - 4, num_removed );
+    ASSERT_EQ( 4u, models.lines.size() );
+
+    // the points on the same row along the x axis share a line
+    for( unsigned i=0; i<models.tildaP.size(); i++ )
+    {
+        const Vec3i& p = models.tildaP[i];
+        ASSERT_GE( models.labelID[i], 0 );
+        ASSERT_LT( models.labelID[i], 4 );
+        for( unsigned j=0; j<models.tildaP.size(); j++ )
+        {
+            const Vec3i& q = models.tildaP[j];
+            const bool same_row = ( p[1]==q[1] && p[2]==q[2] );
+            ASSERT_EQ( same_row, models.labelID[i]==models.labelID[j] );
+        }
+        ASSERT_LT( std::abs( models.line_array.projection( models.labelID[i], Vec3d( p ) )[1] - p[1] ), 0.5 );
+    }
+
+    // nothing left to merge
+    ASSERT_EQ( 0, reduce_models( models, 0.1, 0.5 ) );
+}
+
+
+// A copy of a model set has views of its own line models
+TEST_F(ModelFittingTest, ModelSetCopy)
+{
+    ModelSet models;
+    models.volume_size = Vec3i( 4, 4, 4 );
+    models.labelID.push_back( models.line_array.push_back( Xi1, Xi2, 1.5 ) );
+    models.tildaP.push_back( Vec3i( 1, 1, 1 ) );
+    models.line_array.build_views( models.lines );
+
+    ModelSet copy( models );
+    ModelSet assigned;
+    assigned = models;
+    models.line_array.setPositions( 0, Xj1, Xj2 );
+
+    const ModelSet* sets[2] = { &copy, &assigned };
+    for( int k=0; k<2; k++ )
+    {
+        ASSERT_EQ( 1u, sets[k]->lines.size() );
+        Vec3d p1, p2;
+        sets[k]->lines[0]->getEndPoints( p1, p2 );
+        ASSERT_DOUBLE_EQ( 0.0, norm( p1 - Xi1 ) );
+        ASSERT_DOUBLE_EQ( 0.0, norm( p2 - Xi2 ) );
+    }
+}
+
+
+// Maximum flow and minimum cut of a small graph
+TEST_F(ModelFittingTest, MaxFlow)
+{
+    MaxFlow graph;
+    graph.reset( 4 );
+    graph.add_tweights( 0, 5.0, 0.0 );
+    graph.add_tweights( 1, 2.0, 0.0 );
+    graph.add_tweights( 2, 0.0, 2.0 );
+    graph.add_tweights( 3, 0.0, 3.0 );
+    graph.add_edge( 0, 2, 1.0, 0.0 );
+    graph.add_edge( 0, 3, 3.0, 0.0 );
+    graph.add_edge( 1, 2, 4.0, 0.0 );
+    ASSERT_DOUBLE_EQ( 5.0, graph.maxflow() );
+    // the cut {source, 0, 1, 2} / {3, sink}
+    ASSERT_FALSE( graph.is_sink_side( 0 ) );
+    ASSERT_FALSE( graph.is_sink_side( 1 ) );
+    ASSERT_FALSE( graph.is_sink_side( 2 ) );
+    ASSERT_TRUE( graph.is_sink_side( 3 ) );
+
+    // the graph can be reused
+    graph.reset( 1 );
+    graph.add_tweights( 0, 1.0, 2.0 );
+    ASSERT_DOUBLE_EQ( 1.0, graph.maxflow() );
+    ASSERT_TRUE( graph.is_sink_side( 0 ) );
+}
+
+
+// The points of a tube that are assigned to a far line are given back to
+// the line of the tube, and the energy decreases
+TEST_F(ModelFittingTest, AlphaExpansion)
+{
+    vector<Vec3i> points;
+    vector<int> labels;
+    LineModelArray lines;
+    const int tube = lines.push_back( Vec3d( 0, 5, 5.5 ), Vec3d( 1, 5, 5.5 ), 1.0 );
+    const int far  = lines.push_back( Vec3d( 0, 9, 5.5 ), Vec3d( 1, 9, 5.5 ), 1.0 );
+    for( int z=5; z<7; z++ ) for( int x=2; x<30; x++ )
+        {
+            points.push_back( Vec3i( x, 5, z ) );
+            labels.push_back( ( x>=12 && x<15 ) ? far : tube );
+            points.push_back( Vec3i( x, 9, z ) );
+            labels.push_back( far );
+        }
+    NeighbourPairs pairs;
+    pairs.build( points );
+
+    const double energy_before = compute_energy( points, labels, lines, pairs, &smoothcost_func_quadratic );
+    AlphaExpansion expansion( points, labels, lines, pairs, 8 );
+    ASSERT_EQ( 6, expansion.expand( LevenbergMarquardt::Quadratic, 5, false ) );
+    const double energy_after = compute_energy( points, labels, lines, pairs, &smoothcost_func_quadratic );
+    ASSERT_LT( energy_after, energy_before );
+
+    for( unsigned i=0; i<points.size(); i++ )
+    {
+        ASSERT_EQ( ( points[i][1]==5 ) ? tube : far, labels[i] );
+    }
+}
+
+
+// The matrix-free mode of Levenberg Marquardt decreases the energy as much
+// as the mode with the assembled J'*J
+TEST_F(ModelFittingTest, MatrixFreeLevenbergMarquardt)
+{
+    double energy[2];
+    for( int mode = 0; mode < 2; mode++ )
+    {
+        // a tube along the z axis, one slightly tilted line per point
+        ModelSet models;
+        models.volume_size = Vec3i( 10, 10, 12 );
+        for( int z=1; z<11; z++ ) for( int y=4; y<6; y++ ) for( int x=4; x<6; x++ )
+                {
+                    const Vec3d pos( x, y, z );
+                    const Vec3d dir( 0.1 * ( ( x + z ) % 3 - 1 ), 0.1 * ( ( y * z ) % 3 - 1 ), 1.0 );
+                    models.labelID.push_back( models.line_array.push_back( pos - dir, pos + dir, 1.0 ) );
+                    models.tildaP.push_back( Vec3i( x, y, z ) );
+                }
+        models.line_array.build_views( models.lines );
+        models.build_neighbour_pairs();
+
+        const double energy_before = compute_energy( models.tildaP, models.labelID, models.line_array,
+                                     models.pairs, &smoothcost_func_quadratic );
+
+        LevenbergMarquardt::Options options;
+        options.max_iterations = 5;
+        options.checkpoint_every = 0;
+        options.async_checkpoint = false;
+        options.verbose = false;
+        options.matrix_free = ( mode==1 );
+        options.cg_tolerance = 1e-8;
+        LevenbergMarquardt lm( models.tildaP, models.labelID, models );
+        lm.reestimate( 100, LevenbergMarquardt::Quadratic, "ModelFittingTest-lm", options );
+
+        energy[mode] = compute_energy( models.tildaP, models.labelID, models.line_array,
+                                       models.pairs, &smoothcost_func_quadratic );
+        ASSERT_LT( energy[mode], energy_before );
+    }
+    remove( "ModelFittingTest-lm.modelset.bin" );
+
+    ASSERT_NEAR( energy[0], energy[1], 1e-2 * energy[0] );
+}
+
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    int flag = RUN_ALL_TESTS();
+    return flag;
+}
@@ -1,6 +1,9 @@
 #ifndef INTERPOLATION_H
 #define INTERPOLATION_H
 
+#include <vector>
+#include <limits>
+#include <algorithm>
 #include <opencv2/core/core.hpp>
 #include "smart_assert.h"
 
@@ -41,6 +44,20 @@ public:
                             const double& dangle,
                             const double& dradius );
 
+    /* The pixels and their weights used by the above two functions: the
+       interpolated value at 'pos' is the weighted sum of the pixels. They
+       only depend on the geometry, not on the image. */
+    static void BilinearWeights( const cv::Vec2d& pos,
+                                 std::vector<cv::Vec2i>& pixels,
+                                 std::vector<double>& weights );
+
+    static void SamplingWeights( const cv::Vec2d& pos,
+                                 const cv::Vec2d& origin,
+                                 const double& dangle,
+                                 const double& dradius,
+                                 std::vector<cv::Vec2i>& pixels,
+                                 std::vector<double>& weights );
+
     /// Test if a image point (x,y) is valid or not
     static inline bool isvalid( const cv::Mat_<T>& m, const cv::Vec2d& pos );
     /// Test if a image point (x,y) is valid or not
@@ -122,6 +139,59 @@ double Interpolation<T>::Sampling( const cv::Mat_<T>& m,
                                    const cv::Vec2d& center,
                                    const double& dangle,
                                    const double& dradius )
+{
+    std::vector<cv::Vec2i> pixels;
+    std::vector<double> weights;
+    SamplingWeights( pos, center, dangle, dradius, pixels, weights );
+
+    double sum = 0.0;
+    for( unsigned i=0; i<pixels.size(); i++ )
+    {
+        sum += m( pixels[i][1], pixels[i][0] ) * weights[i];
+    }
+    return sum;
+}
+
+template<class T>
+void Interpolation<T>::BilinearWeights( const cv::Vec2d& pos,
+                                        std::vector<cv::Vec2i>& pixels,
+                                        std::vector<double>& weights )
+{
+    const double& x = pos[0];
+    const double& y = pos[1];
+
+    const int fx = (int) floor( x );
+    const int cx = (int) ceil( x );
+    const int fy = (int) floor( y );
+    const int cy = (int) ceil( y );
+
+    // the same cases as in Bilinear()
+    const int    px[2] = { fx, cx };
+    const int    py[2] = { fy, cy };
+    const double wx[2] = { ( fx==cx ) ? 1.0 : cx - x, x - fx };
+    const double wy[2] = { ( fy==cy ) ? 1.0 : cy - y, y - fy };
+    const int nx = ( fx==cx ) ? 1 : 2;
+    const int ny = ( fy==cy ) ? 1 : 2;
+
+    pixels.clear();
+    weights.clear();
+    for( int j=0; j<ny; j++ )
+    {
+        for( int i=0; i<nx; i++ )
+        {
+            pixels.push_back( cv::Vec2i( px[i], py[j] ) );
+            weights.push_back( wx[i] * wy[j] );
+        }
+    }
+}
+
+template<class T>
+void Interpolation<T>::SamplingWeights( const cv::Vec2d& pos,
+                                        const cv::Vec2d& center,
+                                        const double& dangle,
+                                        const double& dradius,
+                                        std::vector<cv::Vec2i>& pixels,
+                                        std::vector<double>& weights )
 {
     double angle, radius;
     Interpolation<T>::Cartecian2Polar( pos, center, radius, angle );
@@ -157,7 +227,8 @@ double Interpolation<T>::Sampling( const cv::Mat_<T>& m,
     /// sub-pixel interpolation
     const double sub_pixel = 0.1; // TODO: can make this a parameter
 
-    double sum = 0.0;
+    pixels.clear();
+    weights.clear();
     int count = 0;
 
     for( double y=minY; y<=maxY; y+=sub_pixel )
@@ -166,17 +237,33 @@ double Interpolation<T>::Sampling( const cv::Mat_<T>& m,
         {
             if( InSector( cv::Vec2f(x,y), angle, radius, dangle, dradius ) )
             {
-                sum += m( (int)(y+center[1]), (int)(x+center[0]) );
+                const cv::Vec2i p( (int)(x+center[0]), (int)(y+center[1]) );
+                // the sub-pixels of a pixel are next to each other
+                if( pixels.empty() || pixels.back()!=p )
+                {
+                    const std::vector<cv::Vec2i>::iterator it =
+                        std::find( pixels.begin(), pixels.end(), p );
+                    if( it==pixels.end() )
+                    {
+                        pixels.push_back( p );
+                        weights.push_back( 1.0 );
+                    }
+                    else
+                    {
+                        weights[ it - pixels.begin() ] += 1.0;
+                    }
+                }
+                else
+                {
+                    weights.back() += 1.0;
+                }
                 count++;
             }
         }
     }
 
-    //double t1 = Interpolation<T>::Bilinear(m, pos, center, dangle, dradius);
-    //double t2 = (count ? sum / count : 0);
-    //std::cout << t1 << "\t" << t2 << "\t" << t1 - t2 << std::endl;
-
-    return count ? sum / count : 0;
+    // the average of the sub-pixels
+    for( unsigned i=0; i<weights.size(); i++ ) weights[i] /= count;
 }
 
 
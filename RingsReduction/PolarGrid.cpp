@@ -0,0 +1,164 @@
+#include "PolarGrid.h"
+
+#include <cmath>
+
+using namespace cv;
+using namespace std;
+
+namespace
+{
+// the samples of a ring before they are packed in the grid
+struct SampleSet
+{
+    vector<int> tap_ptr;   // taps of sample s: tap_ptr[s], ..., tap_ptr[s+1]-1
+    vector<int> index;
+    vector<double> weight;
+
+    SampleSet( void ) : tap_ptr( 1, 0 ) { }
+
+    inline int size( void ) const
+    {
+        return (int) tap_ptr.size() - 1;
+    }
+};
+
+// add the sample at position 'pos' to 'set'
+void add_sample( SampleSet& set, const Vec2d& pos,
+                 const Vec2d& centre, const double& dangle_2, const double& dradius_2,
+                 const Size& im_size, const PolarGrid::Sampler& sampler,
+                 vector<Vec2i>& pixels, vector<double>& weights )
+{
+    if( sampler==PolarGrid::SAMPLING )
+    {
+        Interpolation<short>::SamplingWeights( pos, centre, dangle_2, dradius_2, pixels, weights );
+    }
+    else
+    {
+        Interpolation<short>::BilinearWeights( pos, pixels, weights );
+    }
+
+    for( unsigned k=0; k<pixels.size(); k++ )
+    {
+        // the sub-pixels of Sampling() may be slightly out of the image
+        const int x = std::min( std::max( pixels[k][0], 0 ), im_size.width-1 );
+        const int y = std::min( std::max( pixels[k][1], 0 ), im_size.height-1 );
+        set.index.push_back( y * im_size.width + x );
+        set.weight.push_back( weights[k] );
+    }
+    set.tap_ptr.push_back( (int) set.index.size() );
+}
+
+// same as Interpolation<T>::isvalid()
+inline bool isvalid( const Size& im_size, const double& x, const double& y )
+{
+    return ( x>=0 && x<=im_size.width-1 && y>=0 && y<=im_size.height-1 );
+}
+}
+
+
+PolarGrid::PolarGrid( const Size& im_size,
+                      const Vec2d& centre,
+                      const double& dradius,
+                      const int& num_of_rings,
+                      const double& subpixel_on_ring,
+                      const Layout& layout,
+                      const Sampler& sampler )
+    : im_size( im_size )
+    , centre( centre )
+    , num_of_rings( std::max( num_of_rings, 0 ) )
+    , layout( layout )
+    , taps( 0 )
+{
+    smart_assert( dradius>0, "dr indicates the thickness of the rings, \
+                 which should be greater than 0. " );
+    smart_assert( subpixel_on_ring>0, "The distance between the samples \
+                 on a ring should be greater than 0. " );
+
+    const int num_sets = ( layout==RINGS ) ? this->num_of_rings : 2*this->num_of_rings;
+    vector<SampleSet> sets( num_sets );
+
+    const double dradius_2 = dradius / 2;
+
+    #pragma omp parallel
+    {
+        vector<Vec2i> pixels;
+        vector<double> weights;
+
+        #pragma omp for schedule(dynamic)
+        for( int rid=0; rid<this->num_of_rings; rid++ )
+        {
+            // radius of the circle (the outer circle of a pair)
+            const double radius  = rid * dradius;
+            const double radius1 = ( layout==RINGS ) ? radius : radius + dradius;
+
+            // the number of pixels on the circumference approximately
+            const int circumference = std::max( 8, int( 2 * M_PI * radius1 / subpixel_on_ring ) );
+
+            const double dangle = 2 * M_PI / circumference;
+            const double dangle_2 = dangle / 2;
+
+            for( int i=0; i<circumference; i++ )
+            {
+                // angle in radian
+                const double angle = i * dangle;
+                const double cos_angle = cos( angle );
+                const double sin_angle = sin( angle );
+
+                const Vec2d pos( radius * cos_angle + centre[0],
+                                 radius * sin_angle + centre[1] );
+                if( !isvalid( im_size, pos[0], pos[1] ) ) continue;
+
+                if( layout==RINGS )
+                {
+                    add_sample( sets[rid], pos, centre, dangle_2, dradius_2,
+                                im_size, sampler, pixels, weights );
+                    continue;
+                }
+
+                const Vec2d pos1( radius1 * cos_angle + centre[0],
+                                  radius1 * sin_angle + centre[1] );
+                if( !isvalid( im_size, pos1[0], pos1[1] ) ) continue;
+
+                add_sample( sets[2*rid],   pos,  centre, dangle_2, dradius_2,
+                            im_size, sampler, pixels, weights );
+                add_sample( sets[2*rid+1], pos1, centre, dangle_2, dradius_2,
+                            im_size, sampler, pixels, weights );
+            }
+        }
+    }
+
+    // pack the sample sets, every sample has the same number of taps
+    sample_ptr.resize( num_sets + 1 );
+    sample_ptr[0] = 0;
+    for( int i=0; i<num_sets; i++ )
+    {
+        sample_ptr[i+1] = sample_ptr[i] + sets[i].size();
+        for( int s=0; s<sets[i].size(); s++ )
+        {
+            taps = std::max( taps, sets[i].tap_ptr[s+1] - sets[i].tap_ptr[s] );
+        }
+    }
+
+    index.resize( sample_ptr.back() * taps, 0 );
+    weight.resize( sample_ptr.back() * taps, 0.0 );
+
+    #pragma omp parallel for schedule(dynamic)
+    for( int i=0; i<num_sets; i++ )
+    {
+        const SampleSet& set = sets[i];
+        for( int s=0; s<set.size(); s++ )
+        {
+            const int dst = ( sample_ptr[i] + s ) * taps;
+            for( int t=set.tap_ptr[s]; t<set.tap_ptr[s+1]; t++ )
+            {
+                index[  dst + t - set.tap_ptr[s] ] = set.index[t];
+                weight[ dst + t - set.tap_ptr[s] ] = set.weight[t];
+            }
+            // the missing taps read the first pixel of the sample with a weight of 0
+            for( int k=set.tap_ptr[s+1]-set.tap_ptr[s]; k<taps; k++ )
+            {
+                index[ dst + k ] = index[ dst ];
+            }
+        }
+    }
+}
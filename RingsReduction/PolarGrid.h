@@ -0,0 +1,172 @@
+#ifndef POLARGRID_H
+#define POLARGRID_H
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "Interpolation.h"
+#include "smart_assert.h"
+
+/* Precomputed sampling positions of the rings around a centre
+
+   The rings are sampled at regular angles and every sample is interpolated
+   from a few pixels (see Interpolation<T>). The positions of the samples, and
+   therefore the pixels and their weights, only depend on the size of the
+   slices, the centre of the rings, the thickness of the rings and the
+   distance between the samples on a ring: they are computed once and are
+   the same for all the slices of a volume. The intensities on a ring are
+   then a sparse gather over the slice buffer.
+
+   Every sample has the same number of pixels (taps), the missing ones have
+   a weight of 0, so that the gather has no branches. */
+class PolarGrid
+{
+public:
+    enum Layout
+    {
+        /// The samples of each ring, their number is proportional to the radius
+        RINGS,
+        /// Ring rid and ring rid+1 sampled at the same angles (as many
+        /// as for ring rid+1), only the angles valid for both rings are kept
+        NEIGHBOUR_PAIRS
+    };
+
+    enum Sampler
+    {
+        BILINEAR, /// Interpolation<T>::Bilinear
+        SAMPLING  /// Interpolation<T>::Sampling
+    };
+
+    PolarGrid( void ) : num_of_rings( 0 ), layout( RINGS ), taps( 0 ) { }
+
+    /// im_size: the size of the slices
+    /// centre, dradius: centre and thickness of the rings
+    /// num_of_rings: number of rings (NEIGHBOUR_PAIRS: number of pairs)
+    /// subpixel_on_ring: distance between the samples on a ring
+    PolarGrid( const cv::Size& im_size,
+               const cv::Vec2d& centre,
+               const double& dradius,
+               const int& num_of_rings,
+               const double& subpixel_on_ring = 1.0,
+               const Layout& layout = RINGS,
+               const Sampler& sampler = BILINEAR );
+
+    /// the sampler currently selected by Interpolation<T>::Get
+    template<class T>
+    static Sampler current_sampler( void )
+    {
+        return ( Interpolation<T>::Get==&Interpolation<T>::Sampling ) ? SAMPLING : BILINEAR;
+    }
+
+    inline int num_rings( void ) const
+    {
+        return num_of_rings;
+    }
+
+    inline const cv::Vec2d& get_centre( void ) const
+    {
+        return centre;
+    }
+
+    /// number of samples of ring rid (RINGS) or of pair rid (NEIGHBOUR_PAIRS)
+    inline int num_samples( const int& rid ) const
+    {
+        return sample_ptr[ first_set(rid)+1 ] - sample_ptr[ first_set(rid) ];
+    }
+
+    /// Intensities of the samples of ring rid (RINGS) or of the
+    /// differences between ring rid and ring rid+1 (NEIGHBOUR_PAIRS).
+    /// values: OUTPUT, num_samples( rid ) values
+    template<class T>
+    void gather( const cv::Mat_<T>& m, const int& rid, double* values ) const;
+
+    /// Average of the above values
+    template<class T>
+    double average( const cv::Mat_<T>& m, const int& rid ) const;
+
+private:
+    // first sample set of ring (or pair) rid
+    inline int first_set( const int& rid ) const
+    {
+        return ( layout==RINGS ) ? rid : 2*rid;
+    }
+
+    // interpolated value of sample s of the slice 'data'
+    template<class T>
+    inline double sample( const T* data, const int& s ) const
+    {
+        const int* idx = &index[ s*taps ];
+        const double* w = &weight[ s*taps ];
+        double v = 0.0;
+        for( int k=0; k<taps; k++ ) v += w[k] * data[ idx[k] ];
+        return v;
+    }
+
+    template<class T>
+    inline const T* slice_data( const cv::Mat_<T>& m ) const
+    {
+        smart_assert( m.cols==im_size.width && m.rows==im_size.height && m.isContinuous(),
+                      "The slice does not match the polar grid. " );
+        return m[0];
+    }
+
+private:
+    cv::Size  im_size;
+    cv::Vec2d centre;
+    int       num_of_rings;
+    Layout    layout;
+
+    // sample set i: samples sample_ptr[i], ..., sample_ptr[i+1]-1 (RINGS: one
+    // set per ring; NEIGHBOUR_PAIRS: sets 2*rid and 2*rid+1 for the two rings)
+    std::vector<int> sample_ptr;
+
+    // taps of sample s: index[ s*taps + k ] (y * width + x) and weight[ s*taps + k ]
+    int taps;
+    std::vector<int>    index;
+    std::vector<double> weight;
+};
+
+
+template<class T>
+void PolarGrid::gather( const cv::Mat_<T>& m, const int& rid, double* values ) const
+{
+    const T* data = slice_data( m );
+    const int set = first_set( rid );
+    const int first = sample_ptr[set];
+    const int n = sample_ptr[set+1] - first;
+
+    if( layout==RINGS )
+    {
+        for( int i=0; i<n; i++ ) values[i] = sample( data, first+i );
+    }
+    else
+    {
+        const int first1 = sample_ptr[set+1];
+        for( int i=0; i<n; i++ ) values[i] = sample( data, first+i ) - sample( data, first1+i );
+    }
+}
+
+template<class T>
+double PolarGrid::average( const cv::Mat_<T>& m, const int& rid ) const
+{
+    const T* data = slice_data( m );
+    const int set = first_set( rid );
+    const int first = sample_ptr[set];
+    const int n = sample_ptr[set+1] - first;
+    if( n==0 ) return 0;
+
+    double sum = 0.0;
+    if( layout==RINGS )
+    {
+        #pragma omp simd reduction(+:sum)
+        for( int i=0; i<n; i++ ) sum += sample( data, first+i );
+    }
+    else
+    {
+        const int first1 = sample_ptr[set+1];
+        #pragma omp simd reduction(+:sum)
+        for( int i=0; i<n; i++ ) sum += sample( data, first+i ) - sample( data, first1+i );
+    }
+    return sum / n;
+}
+
+#endif // POLARGRID_H
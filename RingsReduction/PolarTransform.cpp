@@ -0,0 +1,115 @@
+#include "PolarTransform.h"
+
+#include <cmath>
+
+using namespace cv;
+using namespace std;
+
+PolarTransform::PolarTransform( const Size& im_size,
+                                const Vec2d& centre,
+                                const double& dradius,
+                                const int& num_of_rings,
+                                const int& num_of_angles )
+    : im_size( im_size )
+    , centre( centre )
+    , num_of_rings( std::max( num_of_rings, 1 ) )
+    , num_of_angles( std::max( num_of_angles, 0 ) )
+    , dradius( dradius )
+{
+    smart_assert( dradius>0, "dr indicates the thickness of the rings, \
+                 which should be greater than 0. " );
+    smart_assert( im_size.width>=2 && im_size.height>=2, "The slices are too small. " );
+
+    const int& w = im_size.width;
+    const int& h = im_size.height;
+
+    /// Forward maps
+    const int num_samples = this->num_of_rings * this->num_of_angles;
+    base.resize( num_samples );
+    fx.resize( num_samples );
+    fy.resize( num_samples );
+    valid.resize( num_samples );
+
+    const double dangle = ( this->num_of_angles>0 ) ? 2 * M_PI / this->num_of_angles : 0.0;
+
+    #pragma omp parallel for schedule(static)
+    for( int r=0; r<this->num_of_rings; r++ )
+    {
+        const double radius = r * dradius;
+        for( int a=0; a<this->num_of_angles; a++ )
+        {
+            const int i = r * this->num_of_angles + a;
+            const double x = radius * cos( a * dangle ) + centre[0];
+            const double y = radius * sin( a * dangle ) + centre[1];
+
+            // same as Interpolation<T>::isvalid()
+            valid[i] = ( x>=0 && x<=w-1 && y>=0 && y<=h-1 );
+            if( !valid[i] )
+            {
+                base[i] = 0;
+                fx[i] = fy[i] = 0.0f;
+                continue;
+            }
+
+            // the four pixels are always inside the slice
+            const int x0 = std::min( (int) x, w-2 );
+            const int y0 = std::min( (int) y, h-2 );
+            base[i] = y0 * w + x0;
+            fx[i] = float( x - x0 );
+            fy[i] = float( y - y0 );
+        }
+    }
+
+    /// Inverse maps
+    rcoord.resize( w * h );
+    if( this->num_of_angles>0 ) tcoord.resize( w * h );
+
+    #pragma omp parallel for schedule(static)
+    for( int y=0; y<h; y++ )
+    {
+        for( int x=0; x<w; x++ )
+        {
+            const double diff_x = x - centre[0];
+            const double diff_y = y - centre[1];
+            const double radius = sqrt( diff_x*diff_x + diff_y*diff_y );
+            rcoord[ y*w + x ] = radius / dradius;
+
+            if( this->num_of_angles==0 ) continue;
+            double angle = atan2( diff_y, diff_x );
+            if( angle<0 ) angle += 2 * M_PI;
+            tcoord[ y*w + x ] = float( angle / dangle );
+        }
+    }
+}
+
+void PolarTransform::inverse( const Mat_<float>& polar, Mat_<float>& dst ) const
+{
+    smart_assert( num_of_angles>0, "The polar transform was built without angles. " );
+    smart_assert( polar.rows==num_of_rings && polar.cols==num_of_angles && polar.isContinuous(),
+                  "The polar image does not match the polar transform. " );
+
+    dst.create( im_size.height, im_size.width );
+
+    const float* p = polar[0];
+    float* out = dst[0];
+    const int n = im_size.area();
+    const double max_rid = num_of_rings - 1;
+
+    #pragma omp parallel for schedule(static)
+    for( int i=0; i<n; i++ )
+    {
+        const double rid = std::min( rcoord[i], max_rid );
+        const int r0 = (int) rid;
+        const int r1 = std::min( r0 + 1, num_of_rings - 1 );
+        const float fr = float( rid - r0 );
+
+        // the angles wrap around
+        const int a0 = std::min( (int) tcoord[i], num_of_angles - 1 );
+        const int a1 = ( a0 + 1 ) % num_of_angles;
+        const float fa = float( tcoord[i] - a0 );
+
+        const float v0 = p[ r0*num_of_angles + a0 ] + fa * ( p[ r0*num_of_angles + a1 ] - p[ r0*num_of_angles + a0 ] );
+        const float v1 = p[ r1*num_of_angles + a0 ] + fa * ( p[ r1*num_of_angles + a1 ] - p[ r1*num_of_angles + a0 ] );
+        out[i] = v0 + fr * ( v1 - v0 );
+    }
+}
@@ -0,0 +1,165 @@
+#ifndef POLARTRANSFORM_H
+#define POLARTRANSFORM_H
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "smart_assert.h"
+
+/* Cartesian to polar transform of the slices around the centre of the rings
+
+   Forward: a slice is resampled into a polar image, row r is the ring of
+   radius r * dradius and column a is the angle a * 2 * PI / num_angles
+   (bilinear interpolation). Inverse: a polar image (or a correction that
+   only depends on the radius) is mapped back to the slice.
+
+   The coordinates of both directions only depend on the size of the slices
+   and on the geometry of the rings. They are computed once, the transforms
+   are then gathers over precomputed maps (structure of arrays, no branch in
+   the inner loops) that the compiler vectorizes. */
+class PolarTransform
+{
+public:
+    PolarTransform( void ) : num_of_rings( 0 ), num_of_angles( 0 ), dradius( 1.0 ) { }
+
+    /// im_size: the size of the slices
+    /// centre, dradius: centre and thickness of the rings
+    /// num_of_rings: number of rows of the polar image
+    /// num_of_angles: number of columns of the polar image, if it is 0, only
+    ///     the radial correction (subtract_radial) is available
+    PolarTransform( const cv::Size& im_size,
+                    const cv::Vec2d& centre,
+                    const double& dradius,
+                    const int& num_of_rings,
+                    const int& num_of_angles = 0 );
+
+    inline int num_rings( void ) const
+    {
+        return num_of_rings;
+    }
+
+    inline int num_angles( void ) const
+    {
+        return num_of_angles;
+    }
+
+    inline const double& get_dradius( void ) const
+    {
+        return dradius;
+    }
+
+    /// whether the sample (r, a) of the polar image is inside the slice
+    inline bool isvalid( const int& r, const int& a ) const
+    {
+        return valid[ r * num_of_angles + a ]!=0;
+    }
+
+    /// Cartesian slice to polar image (num_rings() x num_angles()). The
+    /// samples outside the slice (see isvalid()) are undefined.
+    template<class T>
+    void forward( const cv::Mat_<T>& src, cv::Mat_<float>& polar ) const;
+
+    /// Polar image back to the Cartesian slice (bilinear interpolation, the
+    /// pixels beyond the last ring take the value of the last ring)
+    void inverse( const cv::Mat_<float>& polar, cv::Mat_<float>& dst ) const;
+
+    /// dst = src - correction( radius ), where correction[rid] is the
+    /// correction of the ring of radius rid * dradius (linear interpolation
+    /// between the rings, the pixels beyond the last ring take the correction
+    /// of the last ring). src and dst are slices, they may be the same.
+    // parallel: false if the caller already processes slices in parallel
+    template<class T>
+    void subtract_radial( const T* src, const std::vector<double>& correction, T* dst,
+                          const bool& parallel = true ) const;
+
+    template<class T>
+    void subtract_radial( const cv::Mat_<T>& src, const std::vector<double>& correction,
+                          cv::Mat_<T>& dst ) const;
+
+private:
+    cv::Size  im_size;
+    cv::Vec2d centre;
+    int       num_of_rings;
+    int       num_of_angles;
+    double    dradius;
+
+    // Forward maps (one element per sample of the polar image): the sample
+    // is interpolated from the pixels base, base+1, base+width and
+    // base+width+1 with the fractions fx and fy
+    std::vector<int>   base;
+    std::vector<float> fx, fy;
+    std::vector<unsigned char> valid;
+
+    // Inverse maps (one element per pixel of the slice): radius / dradius
+    // and angle / (2 * PI / num_angles) of the pixel
+    std::vector<double> rcoord;
+    std::vector<float>  tcoord;
+};
+
+
+template<class T>
+void PolarTransform::forward( const cv::Mat_<T>& src, cv::Mat_<float>& polar ) const
+{
+    smart_assert( num_of_angles>0, "The polar transform was built without angles. " );
+    smart_assert( src.cols==im_size.width && src.rows==im_size.height && src.isContinuous(),
+                  "The slice does not match the polar transform. " );
+
+    polar.create( num_of_rings, num_of_angles );
+
+    const T* p = src[0];
+    const int w = im_size.width;
+
+    #pragma omp parallel for schedule(static)
+    for( int r=0; r<num_of_rings; r++ )
+    {
+        float* out = polar[r];
+        const int*   b   = &base[ r * num_of_angles ];
+        const float* frx = &fx[ r * num_of_angles ];
+        const float* fry = &fy[ r * num_of_angles ];
+
+        #pragma omp simd
+        for( int a=0; a<num_of_angles; a++ )
+        {
+            const int& i = b[a];
+            const float v0 = p[i]   + frx[a] * float( p[i+1]   - p[i] );
+            const float v1 = p[i+w] + frx[a] * float( p[i+w+1] - p[i+w] );
+            out[a] = v0 + fry[a] * ( v1 - v0 );
+        }
+    }
+}
+
+template<class T>
+void PolarTransform::subtract_radial( const T* src, const std::vector<double>& correction, T* dst,
+                                      const bool& parallel ) const
+{
+    smart_assert( correction.size()>0, "The correction vector is empty. " );
+
+    const int n = (int) rcoord.size();
+    const double* rc = &rcoord[0];
+    const double* c = &correction[0];
+    const double max_rid = (double) correction.size() - 1;
+    const int last = (int) correction.size() - 1;
+
+    #pragma omp parallel for schedule(static) if( parallel )
+    for( int i=0; i<n; i++ )
+    {
+        /* For any rid that bigger than the size of the correction vector,
+           pretend that it is the most outer ring (rid = correction.size()-1). */
+        const double rid = std::min( rc[i], max_rid );
+        const int flo = (int) rid;
+        const int cei = std::min( flo + 1, last );
+        const double value = c[flo] * ( flo + 1 - rid ) + c[cei] * ( rid - flo );
+        dst[i] = T( src[i] - value );
+    }
+}
+
+template<class T>
+void PolarTransform::subtract_radial( const cv::Mat_<T>& src, const std::vector<double>& correction,
+                                      cv::Mat_<T>& dst ) const
+{
+    smart_assert( src.cols==im_size.width && src.rows==im_size.height && src.isContinuous(),
+                  "The slice does not match the polar transform. " );
+    if( dst.data!=src.data ) dst.create( src.rows, src.cols );
+    subtract_radial( src[0], correction, dst[0] );
+}
+
+#endif // POLARTRANSFORM_H
@@ -2,6 +2,8 @@
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp> // For Canny, Gaussianblur and etc.
+#include <algorithm>
+#include <cmath>
 
 using namespace cv;
 
@@ -440,6 +442,206 @@ float RingCentre::distance_to_line( const cv::Vec2i& approx_centre,
 }
 
 
+void RingCentre::track_centres( const Data3D<short>& src,
+                                const cv::Vec2d& approx_centre,
+                                std::vector<cv::Vec2d>& centres,
+                                const double& sigma,
+                                const float& threshold_distance,
+                                const int& degree,
+                                const int& num_passes )
+{
+    const int SZ = src.SZ();
+    const Size size( src.SX(), src.SY() );
+    const long slice_size = src.get_size_slice();
+
+    centres.assign( SZ, approx_centre );
+    std::vector<NormalEquations> equations( SZ );
+
+    for( int pass=0; pass<std::max( 1, num_passes ); pass++ )
+    {
+        #pragma omp parallel
+        {
+            Mat_<float> blurred;
+
+            #pragma omp for schedule(dynamic)
+            for( int z=0; z<SZ; z++ )
+            {
+                equations[z] = slice_equations( src.getData() + z * slice_size, size,
+                                                centres[z], sigma, threshold_distance, blurred );
+            }
+        }
+
+        fit_trajectory( equations, degree, centres );
+    }
+}
+
+
+bool RingCentre::NormalEquations::solve( cv::Vec2d& centre ) const
+{
+    const double det = a11 * a22 - a12 * a12;
+    const double trace = a11 + a22;
+    if( trace<=0 || det<=1e-12 * trace * trace ) return false;
+    centre = Vec2d( ( a22 * b1 - a12 * b2 ) / det, ( a11 * b2 - a12 * b1 ) / det );
+    return true;
+}
+
+
+RingCentre::NormalEquations RingCentre::slice_equations( const short* slice,
+        const cv::Size& size,
+        const cv::Vec2d& centre,
+        const double& sigma,
+        const float& threshold_distance,
+        cv::Mat_<float>& blurred )
+{
+    const int& rows = size.height;
+    const int& cols = size.width;
+
+    blurred.create( rows, cols );
+    float* data = blurred[0];
+    for( long i=0; i<(long) rows * cols; i++ ) data[i] = slice[i];
+    cv::GaussianBlur( blurred, blurred,
+                      cv::Size(0,0), /*Size is computed from sigma*/
+                      sigma, sigma,  /*sigma along x-y axis*/
+                      BORDER_DEFAULT );
+
+    // the border of cv::Sobel (BORDER_DEFAULT, i.e. reflect 101)
+    auto reflect = []( const int& i, const int& n )
+    {
+        if( n==1 ) return 0;
+        return ( i<0 ) ? -i : ( ( i>=n ) ? 2*n-2-i : i );
+    };
+
+    const double threshold2 = double( threshold_distance ) * threshold_distance;
+
+    NormalEquations eq;
+    for( int y=0; y<rows; y++ )
+    {
+        const float* up   = blurred[ reflect( y-1, rows ) ];
+        const float* row  = blurred[ y ];
+        const float* down = blurred[ reflect( y+1, rows ) ];
+        for( int x=0; x<cols; x++ )
+        {
+            const int xm = reflect( x-1, cols );
+            const int xp = reflect( x+1, cols );
+
+            /// Sobel gradients (3x3)
+            const double dx = ( up[xp] + 2*row[xp] + down[xp] ) - ( up[xm] + 2*row[xm] + down[xm] );
+            const double dy = ( down[xm] + 2*down[x] + down[xp] ) - ( up[xm] + 2*up[x] + up[xp] );
+
+            /// The weight is the norm of the gradient (at least 1e-2)
+            const double grad2 = dx*dx + dy*dy;
+            if( grad2<=1e-4 ) continue;
+
+            /// Distance from the centre to the line along the gradient
+            const double cross = ( centre[0] - x ) * dy - ( centre[1] - y ) * dx;
+            if( cross*cross >= threshold2 * grad2 ) continue;
+
+            /// Weighted row of the linear system: ( dy, -dx ) * X = x * dy - y * dx
+            const double b = x * dy - y * dx;
+            eq.a11 += dy * dy;
+            eq.a12 -= dx * dy;
+            eq.a22 += dx * dx;
+            eq.b1  += dy * b;
+            eq.b2  -= dx * b;
+        }
+    }
+    return eq;
+}
+
+
+void RingCentre::fit_trajectory( const std::vector<NormalEquations>& equations,
+                                 const int& degree,
+                                 std::vector<cv::Vec2d>& centres )
+{
+    const int SZ = (int) equations.size();
+
+    // centre of each slice on its own, the slices without centre are ignored
+    std::vector<Vec2d> own( SZ );
+    std::vector<char> solved( SZ, 0 );
+    std::vector<double> weight( SZ, 0.0 );
+    int num_valid = 0;
+    for( int z=0; z<SZ; z++ )
+    {
+        if( equations[z].solve( own[z] ) )
+        {
+            solved[z] = 1;
+            weight[z] = 1.0;
+            num_valid++;
+        }
+    }
+    if( num_valid==0 ) return;
+
+    // c(z) = sum_k coeffs[k] * t^k, with t in [-1, 1]. The unknowns are
+    // ( x_0, y_0, x_1, y_1, ... )
+    const int D = std::min( std::max( degree, 0 ), num_valid - 1 ) + 1;
+    std::vector<double> phi( D );
+    auto basis = [&]( const int& z )
+    {
+        const double t = ( SZ>1 ) ? 2.0 * z / ( SZ - 1 ) - 1.0 : 0.0;
+        phi[0] = 1.0;
+        for( int k=1; k<D; k++ ) phi[k] = phi[k-1] * t;
+    };
+
+    std::vector<double> residual;
+    for( int iter=0; iter<20; iter++ )
+    {
+        // sum of the normal equations of the slices, each slice is
+        // normalized (by the trace of A^T A) and weighted
+        Mat_<double> M( 2*D, 2*D, 0.0 ), V( 2*D, 1, 0.0 ), X;
+        for( int z=0; z<SZ; z++ )
+        {
+            if( weight[z]<=0 ) continue;
+            const NormalEquations& e = equations[z];
+            const double s = weight[z] / ( e.a11 + e.a22 );
+            basis( z );
+            for( int k=0; k<D; k++ )
+            {
+                for( int l=0; l<D; l++ )
+                {
+                    const double p = s * phi[k] * phi[l];
+                    M( 2*k,   2*l )   += p * e.a11;
+                    M( 2*k,   2*l+1 ) += p * e.a12;
+                    M( 2*k+1, 2*l )   += p * e.a12;
+                    M( 2*k+1, 2*l+1 ) += p * e.a22;
+                }
+                V( 2*k )   += s * phi[k] * e.b1;
+                V( 2*k+1 ) += s * phi[k] * e.b2;
+            }
+        }
+        cv::solve( M, V, X, DECOMP_SVD );
+
+        // the trajectory and the distance of the slices to it
+        residual.clear();
+        for( int z=0; z<SZ; z++ )
+        {
+            basis( z );
+            Vec2d c( 0, 0 );
+            for( int k=0; k<D; k++ ) c += phi[k] * Vec2d( X( 2*k ), X( 2*k+1 ) );
+            centres[z] = c;
+            // the slices without centre of their own have no residual
+            if( solved[z] && ( weight[z]>0 || iter==0 ) ) residual.push_back( norm( own[z] - c ) );
+        }
+
+        // Tukey's biweight, the scale is from the median of the residuals
+        std::vector<double> sorted = residual;
+        std::nth_element( sorted.begin(), sorted.begin() + sorted.size()/2, sorted.end() );
+        const double scale = 4.685 * 1.4826 * sorted[ sorted.size()/2 ];
+        if( scale<1e-6 ) break;
+
+        bool changed = false;
+        for( int z=0; z<SZ; z++ )
+        {
+            if( !solved[z] ) continue;
+            const double u = norm( own[z] - centres[z] ) / scale;
+            const double w = ( u<1.0 ) ? ( 1.0 - u*u ) * ( 1.0 - u*u ) : 0.0;
+            changed = changed || std::abs( w - weight[z] ) > 1e-6;
+            weight[z] = w;
+        }
+        if( !changed ) break;
+    }
+}
+
+
 void RingCentre::save_image( const string& name, const Mat& im )
 {
     Mat dst;
@@ -1,6 +1,7 @@
 #ifndef RINGCENTRE_H
 #define RINGCENTRE_H
 
+#include <vector>
 #include "Data3D.h"
 
 class RingCentre;
@@ -40,6 +41,23 @@ public:
             const double& sigma = 1.89,
             const float& threshold_degree = 5.0f );
 
+    /// Centres of the rings of all the slices (e.g. for MMDPolarRD), a smooth
+    /// trajectory c(z), polynomial of degree 'degree' in z, fitted to the
+    /// gradients of the slices as in method_weighted_gradient. The gradient
+    /// of a slice and the normal equations of its least square are computed
+    /// in one pass, the slices are processed in parallel. The slices whose own
+    /// centre is far from the trajectory are down weighted (iteratively
+    /// reweighted least square, Tukey's biweight). After the first pass, the
+    /// gradients are selected with their distance to c(z) instead of the
+    /// approximate centre.
+    static void track_centres( const Data3D<short>& src,
+                               const cv::Vec2d& approx_centre,
+                               std::vector<cv::Vec2d>& centres, // OUTPUT: one per slice
+                               const double& sigma = 1.0,
+                               const float& threshold_distance = 20.0f,
+                               const int& degree = 2,
+                               const int& num_passes = 2 );
+
     /// Turn on Debug mode to save intermediate result for debugging
     static bool DEBUG_MODE;
     static std::string output_prefix;
@@ -47,6 +65,33 @@ public:
 
 private:
 
+    /// Normal equations A^T A X = A^T B of the least square of a slice
+    /// (A^T A is symmetric: a11, a12, a22)
+    struct NormalEquations
+    {
+        double a11, a12, a22, b1, b2;
+        NormalEquations( void ) : a11( 0 ), a12( 0 ), a22( 0 ), b1( 0 ), b2( 0 ) { }
+        /// the centre of the slice, false if the system is singular
+        bool solve( cv::Vec2d& centre ) const;
+    };
+
+    /// Fused version of get_image_gradient, threshold_distance_to_centre and
+    /// weighted_least_square: one pass over the blurred slice computes the
+    /// Sobel gradients, selects them and accumulates the normal equations.
+    // blurred: work space (reused between the calls of a thread)
+    static NormalEquations slice_equations( const short* slice,
+                                            const cv::Size& size,
+                                            const cv::Vec2d& centre,
+                                            const double& sigma,
+                                            const float& threshold_distance,
+                                            cv::Mat_<float>& blurred );
+
+    /// Fit the trajectory of the centres to the normal equations of the
+    /// slices (see track_centres)
+    static void fit_trajectory( const std::vector<NormalEquations>& equations,
+                                const int& degree,
+                                std::vector<cv::Vec2d>& centres );
+
     /// Get Centre through least square
     static cv::Vec2f least_square( const cv::Mat_<float>& grad_x,
                                    const cv::Mat_<float>& grad_y,
@@ -2,10 +2,12 @@
 
 #include <opencv2/opencv.hpp>
 #include <iostream>
+#include <algorithm>
 #include <omp.h>
 
 #include "Interpolation.h"
 #include "ImageProcessing.h"
+#include "SlicePipeline.h"
 #include "CVPlot.h"
 
 using namespace cv;
@@ -142,7 +144,9 @@ void RingsReduction::sijbers( const Data3D<short>& src, Data3D<short>& dst,
     // Blur the image
     cout << "Blurring the image... ";
     cout.flush();
-    Data3D<short> mean( src.get_size() );
+    // the local mean is kept in float (as in the slice by slice version
+    // below), so that it is not rounded before the difference
+    Data3D<float> mean( src.get_size() );
     if( isGaussianBlur )
     {
         IP::GaussianBlur3D( src, mean, 2*wsize+1 );
@@ -153,7 +157,7 @@ void RingsReduction::sijbers( const Data3D<short>& src, Data3D<short>& dst,
     }
     cout << "Done. " << endl;
 
-    Data3D<short>& diff = mean;
+    Data3D<float>& diff = mean;
     subtract3D( src, mean, diff );
 
     /// TODO: Uncomment the following code if you want to use variance
@@ -168,25 +172,163 @@ void RingsReduction::sijbers( const Data3D<short>& src, Data3D<short>& dst,
 
     const unsigned num_of_rings = unsigned( max_radius / dr );
 
-    vector<double> correction( num_of_rings, 0 );
-    for( int z=0; z<src.SZ(); z++ )
+    // the rings are the same for all the slices
+    const PolarGrid grid( Size( src.SX(), src.SY() ), ring_centre, dr, num_of_rings,
+                          1.0, PolarGrid::RINGS, PolarGrid::current_sampler<short>() );
+    const PolarTransform transform( Size( src.SX(), src.SY() ), ring_centre, dr, num_of_rings );
+
+    // rings reduction is done slice by slice here, the slices are
+    // independent (each thread has its own correction vector)
+    #pragma omp parallel
+    {
+        vector<double> correction( num_of_rings, 0 );
+        vector<double> buffer;
+
+        #pragma omp for schedule(dynamic)
+        for( int z=0; z<src.SZ(); z++ )
+        {
+            const Mat_<float> m = diff.getMat(z);
+
+            for( int ri = 0; ri<int(num_of_rings)-1; ri++ )
+            {
+                correction[ri] = med_on_ring( m, grid, ri, buffer );
+            }
+
+            correct_image( src, dst, correction, z, transform );
+            if( pCorrection && z==src.SZ()-1 ) *pCorrection = correction;
+        }
+    }
+}
+
+bool RingsReduction::sijbers( const std::string& src_file,
+                              const std::string& dst_file,
+                              const double& dr,
+                              const Vec2d& ring_centre,
+                              const int& num_threads )
+{
+    // same window size as above, the local mean of slice z needs the
+    // slices z-wsize/2, ..., z+wsize/2
+    const int wsize = 15;
+    const int hsize = wsize / 2;
+
+    SlicePipeline<short> pipeline( hsize, num_threads );
+    smart_return( pipeline.open( src_file ), "Cannot open the input file. ", false );
+
+    const int SX = pipeline.get_size()[0];
+    const int SY = pipeline.get_size()[1];
+    const long slice_size = (long) SX * SY;
+
+    const Vec2d im_size( (double) SX, (double) SY );
+
+    const double max_radius = max_ring_radius( ring_centre, im_size );
+
+    const unsigned num_of_rings = unsigned( max_radius / dr );
+
+    // the rings are the same for all the slices
+    const PolarGrid grid( Size( SX, SY ), ring_centre, dr, num_of_rings,
+                          1.0, PolarGrid::RINGS, PolarGrid::current_sampler<short>() );
+    const PolarTransform transform( Size( SX, SY ), ring_centre, dr, num_of_rings );
+
+    // thread local data of the workers
+    struct WorkSpace
     {
-        // rings reduction is done slice by slice here
-        cout << '\r' << "Rings Reduction: " << 100 * z / src.SZ() << "%";
-        cout.flush();
+        Mat_<float> diff;
+        vector<double> correction;
+        vector<double> buffer;
+        vector<double> tmp;
+    };
+    vector<WorkSpace> ws( pipeline.num_workers() );
+
+    auto correct_slice = [&]( const int& tid, const int& z,
+                              const vector<const short*>& window, const int& first,
+                              short* dst )
+    {
+        WorkSpace& w = ws[tid];
+        w.diff.create( SY, SX );
+        w.correction.assign( num_of_rings, 0 );
+
+        // local mean: average of the window along z, then in the slice
+        float* mean = w.diff[0];
+        const float inv = 1.0f / window.size();
+        for( long i=0; i<slice_size; i++ )
+        {
+            float sum = 0.0f;
+            for( unsigned k=0; k<window.size(); k++ ) sum += window[k][i];
+            mean[i] = sum * inv;
+        }
+        mean_blur_2d( mean, SX, SY, hsize, w.tmp );
+
+        const short* src = window[z-first];
+        for( long i=0; i<slice_size; i++ ) mean[i] = src[i] - mean[i];
+
+        for( int ri = 0; ri<int(num_of_rings)-1; ri++ )
+        {
+            w.correction[ri] = med_on_ring( w.diff, grid, ri, w.buffer );
+        }
+
+        // the slices are already processed in parallel
+        transform.subtract_radial( src, w.correction, dst, false );
+    };
+
+    return pipeline.run( dst_file, correct_slice, "Rings reduction (sijbers) of " + src_file );
+}
+
+void RingsReduction::mean_blur_2d( float* data, const int& sx, const int& sy,
+                                   const int& hsize, std::vector<double>& tmp )
+{
+    // tmp: a row, followed by the last hsize+1 rows of the slice (see below)
+    tmp.resize( (long) ( hsize + 2 ) * sx );
+    double* line = &tmp[0];
 
-        const Mat_<short> m = diff.getMat(z);
+    // along x: running sum of the row
+    for( int y=0; y<sy; y++ )
+    {
+        float* row = data + (long) y * sx;
+        for( int x=0; x<sx; x++ ) line[x] = row[x];
 
-        #pragma omp parallel for schedule(dynamic)
-        for( unsigned ri = 0; ri<num_of_rings-1; ri++ )
+        double sum = 0.0;
+        for( int x=0; x<std::min( hsize, sx ); x++ ) sum += line[x];
+        for( int x=0; x<sx; x++ )
+        {
+            if( x+hsize<sx ) sum += line[x+hsize];
+            if( x-hsize-1>=0 ) sum -= line[x-hsize-1];
+            const int count = std::min( x+hsize, sx-1 ) - std::max( x-hsize, 0 ) + 1;
+            row[x] = float( sum / count );
+        }
+    }
+
+    // along y: running sums of the columns. Row y-hsize-1 leaves the window
+    // after it is overwritten, a copy of the last hsize+1 rows is kept.
+    double* sum = line;
+    double* saved = &tmp[sx];
+    for( int x=0; x<sx; x++ ) sum[x] = 0.0;
+    for( int y=0; y<std::min( hsize, sy ); y++ )
+    {
+        const float* row = data + (long) y * sx;
+        for( int x=0; x<sx; x++ ) sum[x] += row[x];
+    }
+    for( int y=0; y<sy; y++ )
+    {
+        // slot of row y, it holds row y-hsize-1 until it is replaced
+        double* old = saved + (long) ( y % ( hsize+1 ) ) * sx;
+        if( y+hsize<sy )
+        {
+            const float* row = data + (long) ( y+hsize ) * sx;
+            for( int x=0; x<sx; x++ ) sum[x] += row[x];
+        }
+        if( y-hsize-1>=0 )
         {
-            correction[ri] = med_on_ring( m, ring_centre, ri, dr );
+            for( int x=0; x<sx; x++ ) sum[x] -= old[x];
         }
 
-        correct_image( src, dst, correction, z, ring_centre, dr );
-        if( pCorrection ) *pCorrection = correction;
+        float* row = data + (long) y * sx;
+        const double count = std::min( y+hsize, sy-1 ) - std::max( y-hsize, 0 ) + 1;
+        for( int x=0; x<sx; x++ )
+        {
+            old[x] = row[x];
+            row[x] = float( sum[x] / count );
+        }
     }
-    cout << endl;
 }
 
 void RingsReduction::correct_image( const cv::Mat_<short>& src,
@@ -195,85 +337,23 @@ void RingsReduction::correct_image( const cv::Mat_<short>& src,
                                     const cv::Vec2d& ring_center,
                                     const double& dradius )
 {
+    const PolarTransform transform( Size( src.cols, src.rows ), ring_center,
+                                    dradius, (int) correction.size() );
     dst = Mat_<short>(src.rows, src.cols);
-
-    for( int y=0; y<src.rows; y++ )
-    {
-        for( int x=0; x<src.cols; x++ )
-        {
-
-            const double diff_x = x - ring_center[0];
-            const double diff_y = y - ring_center[1];
-            const double radius = sqrt( diff_x*diff_x + diff_y*diff_y );
-
-            /* For any rid that bigger than the size of the correction vector,
-               pretend that it is the most outer ring (rid = correction.size()-1).
-               This assumption may
-               result in a few of the pixels near the corner of the image corner
-               being ignored. But it will prevent the function from crashing if
-               it was not used properly. */
-            const double rid = min( radius/dradius, (double) correction.size()-1 );
-
-            const int flo = (int) std::floor( rid );
-            const int cei = (int) std::ceil( rid );
-            double c = 0;
-            if( flo!=cei )
-            {
-                c = correction[flo] * ( cei - rid ) +
-                    correction[cei] * ( rid - flo );
-            }
-            else
-            {
-                c = correction[flo];
-            }
-            dst(y, x) = short( src(y,x) - c );
-        }
-    }
+    transform.subtract_radial( src, correction, dst );
 }
 
 void RingsReduction::correct_image( const Data3D<short>& src,
                                     Data3D<short>& dst,
                                     const vector<double>& correction,
                                     const int& slice,
-                                    const Vec2d& ring_center,
-                                    const double& dr )
+                                    const PolarTransform& transform )
 {
     if( dst.get_size()!=src.get_size() )
         dst.reset( src.get_size(), short(0) );
 
-    const int& z = slice;
-    for( int x=0; x<src.SX(); x++ )
-    {
-        for( int y=0; y<src.SY(); y++ )
-        {
-
-            const double diff_x = x - ring_center[0];
-            const double diff_y = y - ring_center[1];
-            const double radius = sqrt( diff_x*diff_x + diff_y*diff_y );
-
-            /* For any rid that bigger than the size of the correction vector,
-               pretend that it is the most outer ring (rid = correction.size()-1).
-               This assumption may
-               result in a few of the pixels near the corner of the image corner
-               being ignored. But it will prevent the function from crashing if
-               it was not used properly. */
-            const double rid = min( radius/dr, (double) correction.size()-1 );
-
-            const int flo = (int) std::floor( rid );
-            const int cei = (int) std::ceil( rid );
-            double c = 0;
-            if( flo!=cei )
-            {
-                c = correction[flo] * ( cei - rid ) +
-                    correction[cei] * ( rid - flo );
-            }
-            else
-            {
-                c = correction[flo];
-            }
-            dst.at(x,y,z) = short( src.at(x,y,z) - c );
-        }
-    }
+    const long offset = long( slice ) * src.SX() * src.SY();
+    transform.subtract_radial( src.getData() + offset, correction, dst.getData() + offset );
 }
 
 
@@ -297,9 +377,8 @@ void RingsReduction::polarRD( const Data3D<short>& src, Data3D<short>& dst,
 
     const int num_of_rings = int( max_radius / dr );
 
-    double (*diff_func)(const cv::Mat_<short>&, const cv::Vec2d&,
-                        const int&, const int&,
-                        const double&, const double& ) = nullptr;
+    double (*diff_func)(const cv::Mat_<short>&, const PolarGrid&,
+                        const int&, const int&, vector<double>& ) = nullptr;
     switch (o )
     {
     case AVG_DIFF:
@@ -317,15 +396,21 @@ void RingsReduction::polarRD( const Data3D<short>& src, Data3D<short>& dst,
        correction[const_ri] = 0*/
     const int const_ri = int( 100/dr );
 
+    const PolarGrid grid( Size( src.SX(), src.SY() ), ring_center, dr,
+                          std::max( num_of_rings, const_ri+1 ), subpixel_on_ring,
+                          PolarGrid::RINGS, PolarGrid::current_sampler<short>() );
+
     // compute correction vector
+    const Mat_<short> m = src.getMat( center_z );
     vector<double> correction( num_of_rings, 0 );
+    vector<double> buffer;
     for( int ri = 0; ri<num_of_rings-1; ri++ )
     {
-        correction[ri] = diff_func( src.getMat(center_z), ring_center,
-                                    ri, const_ri, dr, subpixel_on_ring );
+        correction[ri] = diff_func( m, grid, ri, const_ri, buffer );
     }
 
-    correct_image( src, dst, correction, center_z, ring_center, dr );
+    const PolarTransform transform( Size( src.SX(), src.SY() ), ring_center, dr, num_of_rings );
+    correct_image( src, dst, correction, center_z, transform );
 
     if( pCorrection!=nullptr ) *pCorrection = correction;
 }
@@ -344,13 +429,22 @@ void RingsReduction::MMDPolarRD( const Mat_<short>& src, Mat_<short>& dst,
 
     const unsigned num_of_rings = unsigned( max_radius / dradius );
 
+    const PolarGrid grid( Size( src.cols, src.rows ), ring_center, dradius,
+                          num_of_rings-1, 1.0, PolarGrid::NEIGHBOUR_PAIRS,
+                          PolarGrid::current_sampler<short>() );
+
     // compute correction vector
     vector<double> correction( num_of_rings, 0 );
 
-    #pragma omp parallel for schedule(dynamic)
-    for( unsigned ri = 0; ri<num_of_rings-1; ri++ )
+    #pragma omp parallel
     {
-        correction[ri] = med_diff( src, ring_center, ri, ri+1, dradius );
+        vector<double> buffer;
+
+        #pragma omp for schedule(dynamic)
+        for( int ri = 0; ri<int(num_of_rings)-1; ri++ )
+        {
+            correction[ri] = med_diff( src, grid, ri, buffer );
+        }
     }
 
     // accumulate the correction vector
@@ -371,38 +465,141 @@ void RingsReduction::MMDPolarRD( const Mat_<short>& src, Mat_<short>& dst,
 }
 
 
+void RingsReduction::MMDPolarRD( const Mat_<short>& src, Mat_<short>& dst,
+                                 const PolarTransform& transform )
+{
+    smart_assert( &src!=&dst, "The destination file should not be the same as the original. " );
+
+    // forward warp
+    Mat_<float> polar;
+    transform.forward( src, polar );
+
+    const int num_of_rings = transform.num_rings();
+    const int num_of_angles = transform.num_angles();
+
+    // median difference between neighbouring rings (rows)
+    vector<double> correction( num_of_rings, 0 );
+
+    #pragma omp parallel
+    {
+        vector<double> diffs;
+
+        #pragma omp for schedule(dynamic)
+        for( int ri = 0; ri<num_of_rings-1; ri++ )
+        {
+            diffs.clear();
+            const float* row  = polar[ri];
+            const float* row1 = polar[ri+1];
+            for( int a = 0; a<num_of_angles; a++ )
+            {
+                if( transform.isvalid( ri, a ) && transform.isvalid( ri+1, a ) )
+                {
+                    diffs.push_back( row[a] - row1[a] );
+                }
+            }
+            correction[ri] = median( diffs );
+        }
+    }
+
+    // accumulate the correction vector
+    for( int ri = num_of_rings-2; ri>=0; ri-- )
+    {
+        correction[ri] += correction[ri+1];
+    }
+
+    /* The intensity of this ring is not supposed to be alter, that is,
+       correction[int( 100/dr )] = 0*/
+    const int const_ri = std::min( int( 100/transform.get_dradius() ), num_of_rings-1 );
+    const double drift = correction[ const_ri ];
+    for( int ri = 0; ri<num_of_rings; ri++ )
+    {
+        correction[ri] -= drift;
+    }
+
+    // inverse remap of the correction
+    dst = Mat_<short>( src.rows, src.cols );
+    transform.subtract_radial( src, correction, dst );
+}
+
+
 void RingsReduction::MMDPolarRD( const Data3D<short>& src,
                                  Data3D<short>& dst,
                                  const cv::Vec2d& first_slice_centre,
                                  const cv::Vec2d& last_slice_centre,
                                  const double dradius )
+{
+    vector<Vec2d> centres( src.SZ() );
+    for( int z = 0; z<src.SZ(); z++ )
+    {
+        centres[z] = ( double(z)*first_slice_centre + double(src.SZ()-z-1)*last_slice_centre ) / (src.SZ()-1);
+    }
+    MMDPolarRD( src, dst, centres, dradius );
+}
+
+
+void RingsReduction::MMDPolarRD( const Data3D<short>& src,
+                                 Data3D<short>& dst,
+                                 const std::vector<cv::Vec2d>& centres,
+                                 const double dradius )
 {
     smart_assert( &src!=&dst, "The destination file is the same as the original. " );
+    smart_assert( (int) centres.size()==src.SZ(), "There should be one centre per slice. " );
 
     const Vec2d im_size( (double)src.SX(), (double)src.SY() );
 
-    const double max_radius = std::max(
-                                  max_ring_radius( first_slice_centre, im_size ),
-                                  max_ring_radius( last_slice_centre,  im_size ));
+    double max_radius = 0.0;
+    for( unsigned z = 0; z<centres.size(); z++ )
+    {
+        max_radius = std::max( max_radius, max_ring_radius( centres[z], im_size ) );
+    }
 
     const unsigned num_of_rings = unsigned( max_radius / dradius );
 
+    const Size slice_size( src.SX(), src.SY() );
+    const PolarGrid::Sampler sampler = PolarGrid::current_sampler<short>();
+
+    // the slices are corrected in parallel, each one into its own part of dst
+    dst.reset( src.get_size() );
+
+    // if the centre of the rings is the same for all the slices, so are the rings
+    const bool same_centre = ( std::count( centres.begin(), centres.end(), centres[0] )==(long) centres.size() );
+    PolarGrid shared_grid;
+    PolarTransform shared_transform;
+    if( same_centre )
+    {
+        shared_grid = PolarGrid( slice_size, centres[0], dradius, num_of_rings-1,
+                                 1.0, PolarGrid::NEIGHBOUR_PAIRS, sampler );
+        shared_transform = PolarTransform( slice_size, centres[0], dradius, num_of_rings );
+    }
+
     #pragma omp parallel
     {
         vector<double> correction( num_of_rings, 0 );
+        vector<double> buffer;
+        PolarGrid slice_grid;
+        PolarTransform slice_transform;
 
         #pragma omp for// schedule(dynamic)// private(correction)
         for( int z = 0; z<src.SZ(); z++ )
         {
             std::fill( correction.begin(), correction.end(), 0);
 
-            const Vec2d ring_center = ( double(z)*first_slice_centre + double(src.SZ()-z-1)*last_slice_centre ) / (src.SZ()-1);
+            const Vec2d& ring_center = centres[z];
 
             const Mat_<short> m = src.getMat(z);
 
+            if( !same_centre )
+            {
+                slice_grid = PolarGrid( slice_size, ring_center, dradius, num_of_rings-1,
+                                        1.0, PolarGrid::NEIGHBOUR_PAIRS, sampler );
+                slice_transform = PolarTransform( slice_size, ring_center, dradius, num_of_rings );
+            }
+            const PolarGrid& grid = same_centre ? shared_grid : slice_grid;
+            const PolarTransform& transform = same_centre ? shared_transform : slice_transform;
+
             for( unsigned ri = 0; ri<num_of_rings-1; ri++ )
             {
-                correction[ri] = med_diff( m, ring_center, ri, ri+1, dradius );
+                correction[ri] = med_diff( m, grid, ri, buffer );
             }
 
             // accumulate the correction vector
@@ -419,189 +616,77 @@ void RingsReduction::MMDPolarRD( const Data3D<short>& src,
                 correction[ri] -= drift;
             }
 
-            #pragma omp critical (dst)
-            {
-                correct_image( src, dst, correction, z, ring_center, dradius );
-            }
+            correct_image( src, dst, correction, z, transform );
         }
     }
 }
 
 
 double RingsReduction::avg_diff( const cv::Mat_<short>& m,
-                                 const cv::Vec2d& ring_center,
-                                 const int& rid1,
-                                 const int& rid2,
-                                 const double& dradius )
+                                 const PolarGrid& grid,
+                                 const int& rid )
 {
-    // radius of the two circles
-    const double radius  = rid1 * dradius;
-    const double radius1 = rid2 * dradius;
-
-    // the number of pixels on the circumference approximately
-    const double bigger = std::max( radius, radius1 );
-    const int circumference = std::max( 8, int( 2 * M_PI * bigger ) );
-
-    double sum = 0.0;
-    int count = 0;
-
-    const double dangle = 2 * M_PI / circumference;
-    const double dangle_2 = dangle / 2;
-    const double dradius_2 = dradius / 2;
-
-    for( int i=0; i<circumference; i++ )
-    {
-        // angle in radian
-        const double angle = i * dangle;
-
-        const double sin_angle = sin( angle );
-        const double cos_angle = cos( angle );
-
-        // image position for inner circle
-        const Vec2d pos( radius * cos_angle + ring_center[0],
-                         radius * sin_angle + ring_center[1] );
-
-        // image position for outer circle
-        const Vec2d pos1( radius1 * cos_angle + ring_center[0],
-                          radius1 * sin_angle + ring_center[1] );
-
-        if( Interpolation<short>::isvalid(m, pos) && Interpolation<short>::isvalid(m, pos1) )
-        {
-            const double val  = Interpolation<short>::Get( m, pos,  ring_center, dangle_2, dradius_2 );
-            const double val1 = Interpolation<short>::Get( m, pos1, ring_center, dangle_2, dradius_2 );
-            sum += val - val1;
-            count++;
-        }
-    }
-
-    return (count>0) ? sum/count : 0;
+    return grid.average( m, rid );
 }
 
 double RingsReduction::med_diff( const cv::Mat_<short>& m,
-                                 const cv::Vec2d& ring_center,
-                                 const int& rid1,
-                                 const int& rid2,
-                                 const double& dradius )
+                                 const PolarGrid& grid,
+                                 const int& rid,
+                                 std::vector<double>& buffer )
 {
-    // radius of the two circles
-    const double radius  = rid1 * dradius;
-    const double radius1 = rid2 * dradius;
-
-    // the number of pixels on the circumference approximately
-    const double bigger = std::max( radius, radius1 );
-    const int circumference = std::max( 8, int( 2 * M_PI * bigger ) );
-
-    std::vector<double> diffs(1, 0);
-
-    const double dangle = 2 * M_PI / circumference;
-    const double dangle_2 = dangle / 2;
-    const double dradius_2 = dradius / 2;
-
-    for( int i=0; i<circumference; i++ )
-    {
-        // angle in radian
-        const double angle = i * dangle;
-        const double sin_angle = sin( angle );
-        const double cos_angle = cos( angle );
-
-        // image position for inner circle
-        const double x = radius * cos_angle + ring_center[0];
-        const double y = radius * sin_angle + ring_center[1];
-
-        // image position for outer circle
-        const double x1 = radius1 * cos_angle + ring_center[0];
-        const double y1 = radius1 * sin_angle + ring_center[1];
-
-        if( Interpolation<short>::isvalid( m, x1, y1) && Interpolation<short>::isvalid( m, x, y) )
-        {
-            const double val  = Interpolation<short>::Get( m, Vec2d(x,y),   ring_center, dangle_2, dradius_2 );
-            const double val1 = Interpolation<short>::Get( m, Vec2d(x1,y1), ring_center, dangle_2, dradius_2 );
-            diffs.push_back( val - val1 );
-        }
-    }
-
-    return median( diffs );
+    const int n = grid.num_samples( rid );
+    if( n==0 ) return 0.0;
+    buffer.resize( n );
+    grid.gather( m, rid, &buffer[0] );
+    return median( &buffer[0], n );
 }
 
 double RingsReduction::avg_diff_v2( const cv::Mat_<short>& m,
-                                    const cv::Vec2d& ring_center,
+                                    const PolarGrid& grid,
                                     const int& rid1,
                                     const int& rid2,
-                                    const double& dr,
-                                    const double& subpixel_on_ring )
+                                    std::vector<double>& )
 {
-    const double avg1 = avg_on_ring( m, ring_center, rid1, dr, subpixel_on_ring );
-    const double avg2 = avg_on_ring( m, ring_center, rid2, dr, subpixel_on_ring );
+    const double avg1 = avg_on_ring( m, grid, rid1 );
+    const double avg2 = avg_on_ring( m, grid, rid2 );
     return avg1 - avg2;
 }
 
 
 double RingsReduction::med_diff_v2( const cv::Mat_<short>& m,
-                                    const cv::Vec2d& ring_center,
+                                    const PolarGrid& grid,
                                     const int& rid1,
                                     const int& rid2,
-                                    const double& dr,
-                                    const double& subpixel_on_ring )
+                                    std::vector<double>& buffer )
 {
-    const double med1 = med_on_ring( m, ring_center, rid1, dr, subpixel_on_ring );
-    const double med2 = med_on_ring( m, ring_center, rid2, dr, subpixel_on_ring );
+    const double med1 = med_on_ring( m, grid, rid1, buffer );
+    const double med2 = med_on_ring( m, grid, rid2, buffer );
     return med1 - med2;
 }
 
 
 
 double RingsReduction::avg_on_ring( const cv::Mat_<short>& m,
-                                    const cv::Vec2d& ring_center,
-                                    const int& rid, const double& dradius,
-                                    const double& subpixel_on_ring )
+                                    const PolarGrid& grid,
+                                    const int& rid )
 {
-    // radius of the circle
-    const double radius = rid * dradius;
-
-    // the number of pixels on the circumference approximately
-    const int circumference = max( 8, int( 2 * M_PI * radius / subpixel_on_ring ) );
-
-    int count = 0;
-    double sum = 0.0;
-
-    const double dangle = 2 * M_PI / circumference;
-    const double dangle_2 = dangle / 2;
-    const double dradius_2 = dradius / 2;
-    for( int i=0; i<circumference; i++ )
-    {
-        // angle in radian
-        const double angle = i * dangle;
-        const double sin_angle = sin( angle );
-        const double cos_angle = cos( angle );
-
-        // image position
-        const double x = radius * cos_angle + ring_center[0];
-        const double y = radius * sin_angle + ring_center[1];
-
-        if( Interpolation<short>::isvalid(m, x, y) )
-        {
-            sum += Interpolation<short>::Get( m, Vec2d(x,y), ring_center, dangle_2, dradius_2 );
-            count++;
-        }
-    }
-
-    return (count>0) ? sum/count : 0;
+    return grid.average( m, rid );
 }
 
 
 
-double RingsReduction::median( std::vector<double>& values )
+double RingsReduction::median( double* values, const int& n )
 {
-    if( values.size()==0 ) return 0.0;
-
-    std::sort( values.begin(), values.end() );
-
-    const double mid_id = 0.5 * (double) values.size();
+    if( n==0 ) return 0.0;
 
-    const int id1 = (int) std::floor( mid_id );
-    const int id2 = (int) std::ceil(  mid_id );
+    // upper middle value
+    const int mid = n / 2;
+    std::nth_element( values, values + mid, values + n );
+    if( n % 2 ) return values[mid];
 
-    return 0.5 * ( values[id1] + values[id2] );
+    // lower middle value: the largest of the values before it
+    const double lower = *std::max_element( values, values + mid );
+    return 0.5 * ( lower + values[mid] );
 }
 
 std::vector<double> RingsReduction::distri_of_diff( const cv::Mat_<short>& m,
@@ -3,6 +3,8 @@
 
 #include "Data3D.h"
 #include "Interpolation.h"
+#include "PolarGrid.h"
+#include "PolarTransform.h"
 
 class RingsReduction;
 typedef RingsReduction RR;
@@ -33,6 +35,12 @@ public:
                             const cv::Vec2d& centre = cv::Vec2d(234, 270),
                             const double dradius = 1.0f );
 
+    /// Same as above, but on the polar image of the slice: one forward warp,
+    /// the median differences between the rows, one inverse remap
+    static void MMDPolarRD( const cv::Mat_<short>& src,
+                            cv::Mat_<short>& dst,
+                            const PolarTransform& transform );
+
     /// An mutation of the above function
     /// computing the correction in a accumulative manner
     static void MMDPolarRD( const Data3D<short>& src, Data3D<short>& dst,
@@ -40,6 +48,12 @@ public:
                             const cv::Vec2d& last_slice_centre,
                             const double dradius = 1.0 );
 
+    /// Same as above, with the centre of the rings of every slice (e.g. from
+    /// RingCentre::track_centres)
+    static void MMDPolarRD( const Data3D<short>& src, Data3D<short>& dst,
+                            const std::vector<cv::Vec2d>& centres,
+                            const double dradius = 1.0 );
+
     /// rings reduction using sijbers's methods
     static void sijbers( const Data3D<short>& src, Data3D<short>& dst,
                          const double& dr = 1.0f,
@@ -47,6 +61,18 @@ public:
                          bool isGaussianBlur = false,
                          std::vector<double>* pCorrection = nullptr );
 
+    /// rings reduction using sijbers's methods, streaming version: the volume
+    /// is read from src_file and written to dst_file (Data3D<short>::save()
+    /// format) a few slices at a time, the slices are corrected in parallel
+    /// (see SlicePipeline). The local mean is a box filter of the same size
+    /// as the one of the above function (without isGaussianBlur).
+    /// num_threads: number of worker threads (0: number of hardware threads)
+    static bool sijbers( const std::string& src_file,
+                         const std::string& dst_file,
+                         const double& dr = 1.0f,
+                         const cv::Vec2d& ring_centre = cv::Vec2d(234, 270),
+                         const int& num_threads = 0 );
+
     /// rings reduction using sijbers's methods (old implementation, deprecated)
     static void mm_filter( const Data3D<short>& src, Data3D<short>& dst );
 
@@ -64,53 +90,60 @@ private:
                                  const int& rid,
                                  const double& dr );
 
-    /// Average difference between two rings
+    /// Average difference between ring rid and ring rid+1
+    // grid: the rings of the slice, layout PolarGrid::NEIGHBOUR_PAIRS
     static double avg_diff( const cv::Mat_<short>& m,
-                            const cv::Vec2d& ring_center,
-                            const int& rid1,
-                            const int& rid2,
-                            const double& dr );
+                            const PolarGrid& grid,
+                            const int& rid );
 
-    /// Median difference between two rings
+    /// Median difference between ring rid and ring rid+1
+    // grid: the rings of the slice, layout PolarGrid::NEIGHBOUR_PAIRS
+    // buffer: work space (reused between the calls of a thread)
     static double med_diff( const cv::Mat_<short>& m,
-                            const cv::Vec2d& ring_center,
-                            const int& rid1,
-                            const int& rid2,
-                            const double& dr );
+                            const PolarGrid& grid,
+                            const int& rid,
+                            std::vector<double>& buffer );
 
     /// Average difference between two rings
     // This version (v2) is different from the one above that
     // it computes the average intensity of the rings separately and then
     // compute the difference. the above version compute them together.
+    // grid: the rings of the slice, layout PolarGrid::RINGS
     static double avg_diff_v2( const cv::Mat_<short>& m,
-                               const cv::Vec2d& ring_center,
+                               const PolarGrid& grid,
                                const int& rid1,
                                const int& rid2,
-                               const double& dr,
-                               const double& subpixel_on_ring = 1.0f );
+                               std::vector<double>& buffer );
 
     /// Median difference between two rings
+    // grid: the rings of the slice, layout PolarGrid::RINGS
     static double med_diff_v2( const cv::Mat_<short>& m,
-                               const cv::Vec2d& ring_center,
+                               const PolarGrid& grid,
                                const int& rid1,
                                const int& rid2,
-                               const double& dr,
-                               const double& subpixel_on_ring = 1.0f );
+                               std::vector<double>& buffer );
 
     /// average intensity on rings
+    // grid: the rings of the slice, layout PolarGrid::RINGS
     static double avg_on_ring( const cv::Mat_<short>& m,
-                               const cv::Vec2d& ring_center,
-                               const int& rid,
-                               const double& dr,
-                               const double& subpixel_on_ring = 1.0f );
+                               const PolarGrid& grid,
+                               const int& rid );
 
     /// median intensity on ring
+    // grid: the rings of the slice, layout PolarGrid::RINGS
+    // buffer: work space (reused between the calls of a thread)
     template<class T>
     static double med_on_ring( const cv::Mat_<T>& m,
-                               const cv::Vec2d& ring_center,
+                               const PolarGrid& grid,
                                const int& rid,
-                               const double& dr,
-                               const double& subpixel_on_ring = 1.0f );
+                               std::vector<double>& buffer );
+
+    /// Mean of the (2*hsize+1) x (2*hsize+1) neighbourhood of the pixels of
+    /// a slice (sx x sy), the neighbourhood is clipped at the borders of the
+    /// slice (as in IP::meanBlur3D). Running sums, O(1) per pixel.
+    // tmp: work space (reused between the calls of a thread)
+    static void mean_blur_2d( float* data, const int& sx, const int& sy,
+                              const int& hsize, std::vector<double>& tmp );
 
     /// Adjust image with give correction vector (2D)
     static void correct_image( const cv::Mat_<short>& src,
@@ -120,20 +153,23 @@ private:
                                const double& dradius );
 
     /// Adjust image with give correction vector (3D)
+    // transform: the rings of the slices (see PolarTransform::subtract_radial)
     static void correct_image( const Data3D<short>& src, Data3D<short>& dst,
                                const std::vector<double>& correction,
                                const int& slice,
-                               const cv::Vec2d& ring_center,
-                               const double& dradius );
-private:
-
-
-    /// compute the median values in the vector
-    // The order of the values in the vector in the following function
-    static double median( std::vector<double>& values );
-
+                               const PolarTransform& transform );
 
 public:
+    /// compute the median of the values (the average of the two middle
+    /// values if there is an even number of them, 0 if there is none)
+    // The order of the values is changed by the following functions. They
+    // select the middle values with std::nth_element, in linear time.
+    static double median( double* values, const int& n );
+    static inline double median( std::vector<double>& values )
+    {
+        return values.empty() ? 0.0 : median( &values[0], (int) values.size() );
+    }
+
     /// Utility functions for Yuri
     /* 1) Can I see the distribution of the difference of neighboring
         rings as histograms? Yes. */
@@ -149,42 +185,15 @@ public:
 
 template<class T>
 double RingsReduction::med_on_ring( const cv::Mat_<T>& m,
-                                    const cv::Vec2d& ring_center,
+                                    const PolarGrid& grid,
                                     const int& rid,
-                                    const double& dradius,
-                                    const double& subpixel_on_ring )
+                                    std::vector<double>& buffer )
 {
-    // radius of the circle
-    const double radius = rid * dradius;
-
-    // the number of pixels on the circumference approximately
-    const int circumference = std::max( 8, int( 2 * M_PI * radius / subpixel_on_ring ) );
-
-    std::vector<double> med(1, 0);
-
-    const double dangle = 2 * M_PI / circumference;
-    const double dangle_2 = dangle / 2;
-    const double dradius_2 = dradius / 2;
-
-    for( int i=0; i<circumference; i++ )
-    {
-        // angle in radian
-        const double angle = i * dangle;
-        const double sin_angle = sin( angle );
-        const double cos_angle = cos( angle );
-
-        // image position for inner circle
-        const double x = radius * cos_angle + ring_center[0];
-        const double y = radius * sin_angle + ring_center[1];
-
-        if( Interpolation<T>::isvalid( m, x, y) )
-        {
-            const double val = Interpolation<T>::Get( m, cv::Vec2d(x,y), ring_center, dangle_2, dradius_2 );
-            med.push_back( val );
-        }
-    }
-
-    return median( med );
+    const int n = grid.num_samples( rid );
+    if( n==0 ) return 0.0;
+    buffer.resize( n );
+    grid.gather( m, rid, &buffer[0] );
+    return median( &buffer[0], n );
 }
 
 
@@ -0,0 +1,236 @@
+#ifndef SLICEPIPELINE_H
+#define SLICEPIPELINE_H
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <iostream>
+
+#include "Data3DStream.h"
+#include "smart_assert.h"
+
+/* Slice by slice processing of a volume file (Data3D<T>::save() format) that
+   does not need to fit in memory
+
+   - a reader thread loads blocks of slices into a ring buffer of slices,
+   - a pool of workers processes the slices independently: the worker of
+     slice z sees the slices z-halo, ..., z+halo (clipped to the volume) and
+     writes the result of slice z into its own output slot,
+   - the calling thread writes the finished slices to the output file, in
+     order, and releases their slots.
+
+   The reader does not overwrite a slice until all the slices that have it
+   in their halo are written, the memory is about (2*halo + 2*block + 1)
+   input and output slices, whatever the size of the volume. */
+template<typename T>
+class SlicePipeline
+{
+public:
+    /// tid: index of the worker (0, ..., num_workers()-1), for thread local data
+    /// z: the slice to process
+    /// window: the slices max(0, z-halo), ..., min(SZ-1, z+halo)
+    /// first: index of the first slice of the window
+    /// dst: OUTPUT, slice z of the result
+    typedef std::function<void( const int& tid, const int& z,
+                                const std::vector<const T*>& window, const int& first,
+                                T* dst )> Process;
+
+    /// halo: number of neighbour slices needed on each side of a slice
+    /// num_workers: number of worker threads (0: number of hardware threads)
+    /// block: number of slices per read (0: num_workers)
+    SlicePipeline( const int& halo, int num_workers = 0, int block = 0 );
+
+    inline int num_workers( void ) const
+    {
+        return workers;
+    }
+
+    /// Size of the volume (valid after open())
+    inline const cv::Vec3i& get_size( void ) const
+    {
+        return reader.get_size();
+    }
+
+    /// Open the input file and load its data information
+    bool open( const std::string& src_file );
+
+    /// Process all the slices and write them to dst_file. The slices are
+    /// processed in parallel, the call blocks until the last one is written.
+    bool run( const std::string& dst_file, const Process& process,
+              const std::string& log = "", bool isBigEndian = false );
+
+private:
+    void read_slices( void );
+    void work( const int tid, const Process& process );
+
+    inline T* slot( std::vector<T>& ring, const int& z )
+    {
+        return &ring[ (long) ( z % capacity ) * slice_size ];
+    }
+
+    const int halo;
+    int workers;
+    int block;
+    int capacity;   // number of slices in the ring buffers
+    long slice_size;
+
+    Data3DReader<T> reader;
+    std::vector<T> src_ring, dst_ring;
+
+    // shared states, protected by the mutex
+    std::mutex mtx;
+    std::condition_variable cond;
+    int loaded;     // slices 0, ..., loaded-1 have been read
+    int next_task;  // the next slice to be processed
+    int written;    // slices 0, ..., written-1 have been written
+    std::vector<unsigned char> finished; // per output slot
+    bool failed;
+};
+
+
+template<typename T>
+SlicePipeline<T>::SlicePipeline( const int& halo, int num_workers, int block )
+    : halo( halo ), workers( num_workers ), block( block ), capacity( 0 ), slice_size( 0 )
+{
+    smart_assert( halo>=0, "The halo should not be negative. " );
+    if( workers<=0 ) workers = std::max( 1, (int) std::thread::hardware_concurrency() );
+    if( this->block<=0 ) this->block = workers;
+}
+
+template<typename T>
+bool SlicePipeline<T>::open( const std::string& src_file )
+{
+    return reader.open( src_file );
+}
+
+template<typename T>
+bool SlicePipeline<T>::run( const std::string& dst_file, const Process& process,
+                            const std::string& log, bool isBigEndian )
+{
+    smart_return( reader.tell()==0 && reader.SZ()>0, "The input file is not opened", false );
+
+    Data3DWriter<T> writer;
+    smart_return( writer.open( dst_file, reader.get_size(), log, isBigEndian ),
+                  "Cannot create the output file", false );
+
+    // a block of slices is read only once the slices it replaces are out of
+    // all the halos, this needs at least 2*halo + block + 1 slices (or the
+    // whole volume)
+    capacity = std::min( 2*halo + 1 + 2*block, reader.SZ() + block );
+    slice_size = (long) reader.SX() * reader.SY();
+    src_ring.resize( capacity * slice_size );
+    dst_ring.resize( capacity * slice_size );
+    finished.assign( capacity, 0 );
+    loaded = next_task = written = 0;
+    failed = false;
+
+    std::thread reader_thread( &SlicePipeline<T>::read_slices, this );
+    std::vector<std::thread> worker_threads;
+    for( int tid=0; tid<workers; tid++ )
+    {
+        worker_threads.push_back( std::thread( &SlicePipeline<T>::work, this, tid, std::cref( process ) ) );
+    }
+
+    // write the slices in order
+    for( int z=0; z<reader.SZ(); z++ )
+    {
+        {
+            std::unique_lock<std::mutex> lock( mtx );
+            cond.wait( lock, [&] { return finished[ z % capacity ] || failed; } );
+            if( failed ) break;
+        }
+
+        const bool ok = writer.write( slot( dst_ring, z ), 1 );
+
+        std::lock_guard<std::mutex> lock( mtx );
+        finished[ z % capacity ] = 0;
+        written = z + 1;
+        failed = failed || !ok;
+        cond.notify_all();
+
+        std::cout << '\r' << "Slice Pipeline: " << 100 * written / reader.SZ() << "%";
+        std::cout.flush();
+    }
+    std::cout << std::endl;
+
+    reader_thread.join();
+    for( unsigned i=0; i<worker_threads.size(); i++ ) worker_threads[i].join();
+
+    writer.close();
+    reader.close();
+    src_ring.clear();
+    dst_ring.clear();
+    return !failed;
+}
+
+template<typename T>
+void SlicePipeline<T>::read_slices( void )
+{
+    const int SZ = reader.SZ();
+    for( int s=0; s<SZ; s+=block )
+    {
+        const int n = std::min( block, SZ - s );
+        {
+            // the slots of slices s, ..., s+n-1 hold slices s-capacity, ...,
+            // oldest, which are needed until slice oldest+halo is written
+            const int oldest = s + n - 1 - capacity;
+            std::unique_lock<std::mutex> lock( mtx );
+            cond.wait( lock, [&] { return oldest<0 || written > oldest + halo || failed; } );
+            if( failed ) return;
+        }
+
+        // the block may wrap around the end of the ring buffer
+        int read = 0;
+        while( read<n )
+        {
+            const int first = ( s + read ) % capacity;
+            const int count = std::min( n - read, capacity - first );
+            if( reader.read( &src_ring[ first * slice_size ], count )!=count ) break;
+            read += count;
+        }
+
+        std::lock_guard<std::mutex> lock( mtx );
+        if( read<n ) failed = true;
+        else loaded = s + n;
+        cond.notify_all();
+        if( failed ) return;
+    }
+}
+
+template<typename T>
+void SlicePipeline<T>::work( const int tid, const Process& process )
+{
+    const int SZ = reader.SZ();
+    std::vector<const T*> window;
+    while( true )
+    {
+        int z;
+        {
+            // wait for the halo of the next slice
+            std::unique_lock<std::mutex> lock( mtx );
+            cond.wait( lock, [&]
+            {
+                return failed || next_task>=SZ || std::min( next_task + halo, SZ - 1 ) < loaded;
+            } );
+            if( failed || next_task>=SZ ) return;
+            z = next_task++;
+        }
+
+        const int first = std::max( 0, z - halo );
+        const int last  = std::min( SZ - 1, z + halo );
+        window.resize( last - first + 1 );
+        for( int i=first; i<=last; i++ ) window[i-first] = slot( src_ring, i );
+
+        process( tid, z, window, first, slot( dst_ring, z ) );
+
+        std::lock_guard<std::mutex> lock( mtx );
+        finished[ z % capacity ] = 1;
+        cond.notify_all();
+    }
+}
+
+#endif // SLICEPIPELINE_H
@@ -2,10 +2,32 @@
 
 #include "RingsReductionTest.h"
 #include "../RingsReduction.h"
+#include "../RingCentre.h"
+#include "../PolarGrid.h"
+#include "../PolarTransform.h"
+#include "../SlicePipeline.h"
 
 #include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
 using namespace std;
 
+// Restore the interpolation of the slices (a global setting) at the end of a test
+class InterpolationGuard
+{
+public:
+    InterpolationGuard( void ) : saved( Interpolation<short>::Get ) { }
+    ~InterpolationGuard( void )
+    {
+        Interpolation<short>::Get = saved;
+    }
+private:
+    double (*const saved)( const cv::Mat_<short>& m, const cv::Vec2d& pos,
+                           const cv::Vec2d& origin, const double& dangle,
+                           const double& dradius );
+};
+
 
 TEST( Test, dist )
 {
@@ -20,6 +42,301 @@ TEST( Test, dist )
     EXPECT_DOUBLE_EQ( RR::dist( 1, 1, 0, 1, 1, 1 ), sqrt(2.0)/2 );
 }
 
+TEST( PolarGrid, Samples )
+{
+    const InterpolationGuard guard;
+
+    // a slice with some random intensities
+    cv::Mat_<short> m( 40, 50 );
+    srand( 5 );
+    for( int y=0; y<m.rows; y++ ) for( int x=0; x<m.cols; x++ ) m(y, x) = short( rand() % 1000 );
+
+    const cv::Vec2d centre( 23.3, 18.6 );
+    const double dr = 1.5;
+    const int num_rings = 15;
+
+    for( int k=0; k<2; k++ )
+    {
+        const PolarGrid::Sampler sampler = k ? PolarGrid::SAMPLING : PolarGrid::BILINEAR;
+        Interpolation<short>::Get = k ? Interpolation<short>::Sampling : Interpolation<short>::Bilinear;
+
+        const PolarGrid rings( m.size(), centre, dr, num_rings, 0.7, PolarGrid::RINGS, sampler );
+        const PolarGrid pairs( m.size(), centre, dr, num_rings, 1.0, PolarGrid::NEIGHBOUR_PAIRS, sampler );
+
+        for( int rid=0; rid<num_rings; rid++ )
+        {
+            // the samples of the rings, interpolated one by one
+            const double radius = rid * dr;
+            const int circumference = std::max( 8, int( 2 * M_PI * radius / 0.7 ) );
+            const double dangle = 2 * M_PI / circumference;
+            vector<double> expected;
+            for( int i=0; i<circumference; i++ )
+            {
+                const cv::Vec2d pos( radius * cos( i*dangle ) + centre[0],
+                                     radius * sin( i*dangle ) + centre[1] );
+                if( !Interpolation<short>::isvalid( m, pos ) ) continue;
+                expected.push_back( Interpolation<short>::Get( m, pos, centre, dangle/2, dr/2 ) );
+            }
+
+            ASSERT_EQ( rings.num_samples( rid ), (int) expected.size() );
+            vector<double> values( expected.size() );
+            if( !values.empty() ) rings.gather( m, rid, &values[0] );
+            double sum = 0;
+            for( unsigned i=0; i<expected.size(); i++ )
+            {
+                EXPECT_NEAR( values[i], expected[i], 1e-6 );
+                sum += expected[i];
+            }
+            if( !expected.empty() ) EXPECT_NEAR( rings.average( m, rid ), sum / expected.size(), 1e-6 );
+
+            // the differences between ring rid and ring rid+1
+            const double radius1 = radius + dr;
+            const int circumference1 = std::max( 8, int( 2 * M_PI * radius1 ) );
+            const double dangle1 = 2 * M_PI / circumference1;
+            vector<double> diffs;
+            for( int i=0; i<circumference1; i++ )
+            {
+                const cv::Vec2d dir( cos( i*dangle1 ), sin( i*dangle1 ) );
+                const cv::Vec2d pos  = radius  * dir + centre;
+                const cv::Vec2d pos1 = radius1 * dir + centre;
+                if( !Interpolation<short>::isvalid( m, pos ) ) continue;
+                if( !Interpolation<short>::isvalid( m, pos1 ) ) continue;
+                diffs.push_back( Interpolation<short>::Get( m, pos,  centre, dangle1/2, dr/2 )
+                                 - Interpolation<short>::Get( m, pos1, centre, dangle1/2, dr/2 ) );
+            }
+            ASSERT_EQ( pairs.num_samples( rid ), (int) diffs.size() );
+            values.resize( diffs.size() );
+            if( !values.empty() ) pairs.gather( m, rid, &values[0] );
+            for( unsigned i=0; i<diffs.size(); i++ ) EXPECT_NEAR( values[i], diffs[i], 1e-6 );
+        }
+    }
+}
+
+TEST( PolarTransform, ForwardInverse )
+{
+    cv::Mat_<short> m( 40, 50 );
+    srand( 7 );
+    for( int y=0; y<m.rows; y++ ) for( int x=0; x<m.cols; x++ ) m(y, x) = short( rand() % 1000 );
+
+    const cv::Vec2d centre( 23.3, 18.6 );
+    const double dr = 1.0;
+    const int num_rings = 35;
+    const int num_angles = 220;
+    const PolarTransform transform( m.size(), centre, dr, num_rings, num_angles );
+
+    // forward: bilinear interpolation at the samples inside the slice
+    cv::Mat_<float> polar;
+    transform.forward( m, polar );
+    int num_valid = 0;
+    for( int r=0; r<num_rings; r++ )
+    {
+        for( int a=0; a<num_angles; a++ )
+        {
+            const double angle = a * 2 * M_PI / num_angles;
+            const cv::Vec2d pos( r * dr * cos( angle ) + centre[0], r * dr * sin( angle ) + centre[1] );
+            ASSERT_EQ( transform.isvalid( r, a ), Interpolation<short>::isvalid( m, pos ) );
+            if( !transform.isvalid( r, a ) ) continue;
+            EXPECT_NEAR( polar(r, a), Interpolation<short>::Bilinear( m, pos, centre, 0, 0 ), 1e-2 );
+            num_valid++;
+        }
+    }
+    EXPECT_GT( num_valid, 0 );
+
+    // inverse: a polar image that only depends on the radius
+    for( int r=0; r<num_rings; r++ ) for( int a=0; a<num_angles; a++ ) polar(r, a) = float( 3 * r );
+    cv::Mat_<float> back;
+    transform.inverse( polar, back );
+    for( int y=0; y<m.rows; y++ )
+    {
+        for( int x=0; x<m.cols; x++ )
+        {
+            const double radius = sqrt( (x-centre[0])*(x-centre[0]) + (y-centre[1])*(y-centre[1]) );
+            EXPECT_NEAR( back(y, x), 3 * std::min( radius / dr, num_rings - 1.0 ), 1e-3 );
+        }
+    }
+
+    // radial correction: same as interpolating the correction at every pixel
+    vector<double> correction( 20 );
+    for( unsigned i=0; i<correction.size(); i++ ) correction[i] = rand() % 50 - 25;
+    cv::Mat_<short> dst;
+    transform.subtract_radial( m, correction, dst );
+    for( int y=0; y<m.rows; y++ )
+    {
+        for( int x=0; x<m.cols; x++ )
+        {
+            const double radius = sqrt( (x-centre[0])*(x-centre[0]) + (y-centre[1])*(y-centre[1]) );
+            const double rid = std::min( radius / dr, (double) correction.size()-1 );
+            const int flo = (int) std::floor( rid );
+            const int cei = (int) std::ceil( rid );
+            const double c = ( flo!=cei ) ?
+                             correction[flo] * ( cei - rid ) + correction[cei] * ( rid - flo ) :
+                             correction[flo];
+            EXPECT_EQ( dst(y, x), short( m(y, x) - c ) );
+        }
+    }
+}
+
+TEST( RingsReduction, median )
+{
+    EXPECT_DOUBLE_EQ( RR::median( (double*) nullptr, 0 ), 0.0 );
+
+    srand( 3 );
+    vector<double> values;
+    for( int n=1; n<60; n++ )
+    {
+        values.resize( n );
+        for( int i=0; i<n; i++ ) values[i] = rand() % 20 - 10.5;
+        vector<double> sorted = values;
+        std::sort( sorted.begin(), sorted.end() );
+        const double expected = ( n%2 ) ? sorted[n/2] : 0.5 * ( sorted[n/2-1] + sorted[n/2] );
+        EXPECT_DOUBLE_EQ( RR::median( values ), expected );
+    }
+}
+
+// The polar image version of MMDPolarRD should remove the same rings as the
+// version that samples the rings of the slice
+TEST( RingsReduction, MMDPolarRD )
+{
+    // smooth rings around the centre, on a slope
+    const cv::Vec2d centre( 80.3, 79.6 );
+    cv::Mat_<short> m( 160, 170 );
+    for( int y=0; y<m.rows; y++ ) for( int x=0; x<m.cols; x++ )
+        {
+            const double radius = sqrt( (x-centre[0])*(x-centre[0]) + (y-centre[1])*(y-centre[1]) );
+            m(y, x) = short( 500 + x + 40 * sin( 0.9 * radius ) );
+        }
+
+    const double dr = 1.0;
+    // up to the furthest corner of the slice
+    double max_radius = 0;
+    for( int i=0; i<4; i++ )
+    {
+        const double dx = ( i%2 ) ? m.cols - centre[0] : centre[0];
+        const double dy = ( i/2 ) ? m.rows - centre[1] : centre[1];
+        max_radius = std::max( max_radius, sqrt( dx*dx + dy*dy ) );
+    }
+    const int num_rings = int( max_radius / dr );
+    const PolarTransform transform( m.size(), centre, dr, num_rings, 720 );
+
+    cv::Mat_<short> dst, dst_polar;
+    RR::MMDPolarRD( m, dst, centre, dr );
+    RR::MMDPolarRD( m, dst_polar, transform );
+    ASSERT_EQ( m.rows, dst_polar.rows );
+    ASSERT_EQ( m.cols, dst_polar.cols );
+
+    // the rings are gone (up to the intensity of the ring that is kept), and
+    // both versions agree
+    double offset = 0;
+    for( int y=0; y<m.rows; y++ ) for( int x=0; x<m.cols; x++ ) offset += dst_polar(y, x) - 500 - x;
+    offset /= m.rows * m.cols;
+    double before = 0, after = 0, diff = 0;
+    for( int y=0; y<m.rows; y++ ) for( int x=0; x<m.cols; x++ )
+        {
+            before += std::abs( m(y, x) - 500 - x );
+            after += std::abs( dst_polar(y, x) - 500 - x - offset );
+            diff += std::abs( dst_polar(y, x) - dst(y, x) );
+        }
+    EXPECT_LT( after, 0.2 * before );
+    EXPECT_LT( diff, 0.5 * m.rows * m.cols );
+}
+
+TEST( SlicePipeline, Window )
+{
+    // a volume of SZ slices, written a few slices at a time (big endian)
+    const cv::Vec3i size( 13, 7, 23 );
+    const long slice_size = (long) size[0] * size[1];
+    const std::string src_file = "slice_pipeline_src.data";
+    const std::string dst_file = "slice_pipeline_dst.data";
+
+    srand( 5 );
+    vector<short> volume( slice_size * size[2] );
+    for( unsigned i=0; i<volume.size(); i++ ) volume[i] = short( rand() % 2000 - 1000 );
+    {
+        Data3DWriter<short> writer;
+        ASSERT_TRUE( writer.open( src_file, size, "test", true ) );
+        ASSERT_TRUE( writer.write( &volume[0], 5 ) );
+        ASSERT_TRUE( writer.write( &volume[5*slice_size], size[2]-5 ) );
+    }
+
+    // every slice of the result is the sum of the slices of its window
+    const int halo = 3;
+    for( int num_workers=1; num_workers<=4; num_workers+=3 )
+    {
+        SlicePipeline<short> pipeline( halo, num_workers, 2 );
+        ASSERT_TRUE( pipeline.open( src_file ) );
+        EXPECT_EQ( pipeline.get_size(), size );
+
+        ASSERT_TRUE( pipeline.run( dst_file, [&]( const int& tid, const int& z,
+                                   const vector<const short*>& window, const int& first,
+                                   short* dst )
+        {
+            EXPECT_TRUE( tid>=0 && tid<num_workers );
+            EXPECT_EQ( first, std::max( 0, z-halo ) );
+            EXPECT_EQ( (int) window.size(), std::min( size[2]-1, z+halo ) - first + 1 );
+            for( long i=0; i<slice_size; i++ )
+            {
+                short sum = 0;
+                for( unsigned k=0; k<window.size(); k++ ) sum = short( sum + window[k][i] );
+                dst[i] = sum;
+            }
+        } ) );
+
+        Data3DReader<short> reader;
+        ASSERT_TRUE( reader.open( dst_file ) );
+        vector<short> result( volume.size() );
+        ASSERT_EQ( reader.read( &result[0], size[2] ), size[2] );
+        for( int z=0; z<size[2]; z++ )
+        {
+            for( long i=0; i<slice_size; i++ )
+            {
+                short sum = 0;
+                for( int k=std::max( 0, z-halo ); k<=std::min( size[2]-1, z+halo ); k++ )
+                {
+                    sum = short( sum + volume[ k*slice_size + i ] );
+                }
+                ASSERT_EQ( result[ z*slice_size + i ], sum );
+            }
+        }
+    }
+
+    remove( src_file.c_str() );
+    remove( ( src_file + ".readme.txt" ).c_str() );
+    remove( dst_file.c_str() );
+    remove( ( dst_file + ".readme.txt" ).c_str() );
+}
+
+TEST( RingCentre, track_centres )
+{
+    // rings around a centre that moves along z, two slices are noise and
+    // two are flat (no centre of their own)
+    const int SX = 90, SY = 80, SZ = 21;
+    Data3D<short> src( cv::Vec3i( SX, SY, SZ ) );
+    vector<cv::Vec2d> truth( SZ );
+    srand( 2 );
+    for( int z=0; z<SZ; z++ )
+    {
+        const double t = 2.0 * z / ( SZ - 1 ) - 1.0;
+        truth[z] = cv::Vec2d( 44 + 3*t + 2*t*t, 37 - 2*t );
+        for( int y=0; y<SY; y++ ) for( int x=0; x<SX; x++ )
+            {
+                const double r = cv::norm( cv::Vec2d( x, y ) - truth[z] );
+                double v = 1000 + 400 * cos( r / 2.5 ) * exp( -r / 60 );
+                if( z==5 || z==13 ) v = rand() % 2000;
+                if( z==9 || z==17 ) v = 1000;
+                src.at( x, y, z ) = short( v );
+            }
+    }
+
+    vector<cv::Vec2d> centres;
+    RC::track_centres( src, cv::Vec2d( 45, 36 ), centres );
+    ASSERT_EQ( (int) centres.size(), SZ );
+    for( int z=0; z<SZ; z++ )
+    {
+        EXPECT_NEAR( centres[z][0], truth[z][0], 0.1 );
+        EXPECT_NEAR( centres[z][1], truth[z][1], 0.1 );
+    }
+}
+
 int main(int argc, char **argv)
 {
     testing::InitGoogleTest(&argc, argv);
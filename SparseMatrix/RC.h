@@ -1,5 +1,7 @@
 #pragma once
 
+#include "SparseMatrixArena.h"
+
 // A reference counting class RC. 
 // This class maintains an integer value which represents the reference count.
 // We will have methods to increment and decrement the reference count.
@@ -20,4 +22,8 @@ public:
 	// Decrement the reference count and
 	// return the reference count.
 	int Release(){ return --count; }
+
+	// reference counters are allocated from the arena of the thread
+	static void* operator new( std::size_t bytes ) { return SparseMatrixArena::allocate( bytes ); }
+	static void operator delete( void* ptr ) { SparseMatrixArena::deallocate( ptr ); }
 };
@@ -27,16 +27,18 @@ void mult( const SparseMatrix &A, const double *v, double *w )
     }
 }
 
-void solve( const SparseMatrix& A, const double* B, double* X,
-            double acuracy, SparseMatrix::Options o )
+int solve( const SparseMatrix& A, const double* B, double* X,
+           double acuracy, SparseMatrix::Options o )
 {
+    int iterations = 0;
     switch( o )
     {
     case SparseMatrix::BICGSQ:
-        bicgsq( A.row(), A, B, X, acuracy );
+        iterations = bicgsq( A.row(), A, B, X, acuracy );
         break;
     case SparseMatrix::SUPERLU:
 
         break;
     }
+    return iterations;
 }
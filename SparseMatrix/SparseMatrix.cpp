@@ -52,14 +52,15 @@ SparseMatrix::SparseMatrix( unsigned num_rows, unsigned num_cols,
 
 SparseMatrix::~SparseMatrix(void)
 {
-    if( rc->Release()==0 )
+    // rc is nullptr if the matrix was moved
+    if( rc && rc->Release()==0 )
     {
         delete data;
         delete rc;
     }
 }
 
-const SparseMatrix SparseMatrix::clone(void) const
+SparseMatrix SparseMatrix::clone(void) const
 {
     // deep copy of the data
     if( this->isZero() )
@@ -86,14 +87,38 @@ SparseMatrix::SparseMatrix( const SparseMatrix& matrix )
 
 const SparseMatrix& SparseMatrix::operator=( const SparseMatrix& matrix )
 {
+    // add the reference first, in case of self assignment
+    matrix.rc->AddRef();
     this->~SparseMatrix();
     this->data = matrix.data;
     this->rc   = matrix.rc;
-    this->rc->AddRef();
     return *this;
 }
 
-const SparseMatrix SparseMatrix::t() const
+SparseMatrix::SparseMatrix( SparseMatrix&& matrix )
+{
+    this->data = matrix.data;
+    this->rc   = matrix.rc;
+    matrix.data = nullptr;
+    matrix.rc   = nullptr;
+}
+
+const SparseMatrix& SparseMatrix::operator=( SparseMatrix&& matrix )
+{
+    std::swap( this->data, matrix.data );
+    std::swap( this->rc,   matrix.rc );
+    return *this;
+}
+
+void SparseMatrix::detach( void )
+{
+    if( rc->num() > 1 )
+    {
+        *this = this->clone();
+    }
+}
+
+SparseMatrix SparseMatrix::t() const
 {
     SparseMatrix m = this->clone();
     m.data->transpose();
@@ -103,12 +128,14 @@ const SparseMatrix SparseMatrix::t() const
 
 const SparseMatrix& SparseMatrix::operator*=( const double& value )
 {
+    this->detach();
     this->data->multiply( value );
     return (*this);
 }
 
 const SparseMatrix& SparseMatrix::operator/=( const double& value )
 {
+    this->detach();
     this->data->multiply( 1.0/value );
     return (*this);
 }
@@ -173,7 +200,7 @@ void SparseMatrix::getRowMatrixData( unsigned& N, double const*& non_zero_value,
 
 
 
-const SparseMatrix operator*( const SparseMatrix& m1, const SparseMatrix& m2 )
+SparseMatrix operator*( const SparseMatrix& m1, const SparseMatrix& m2 )
 {
     assert( m1.col()==m2.row() && "Matrix size does not match" );
 
@@ -228,7 +255,7 @@ const SparseMatrix operator*( const SparseMatrix& m1, const SparseMatrix& m2 )
     return SparseMatrix( m1.row(), m2.col(), res_nzval, res_colidx, res_rowptr );
 }
 
-const SparseMatrix operator-( const SparseMatrix& m1, const SparseMatrix& m2 )
+SparseMatrix operator-( const SparseMatrix& m1, const SparseMatrix& m2 )
 {
     assert( m1.row()==m2.row() && m1.col()==m2.col() && "Matrix size does not match" );
 
@@ -240,13 +267,14 @@ const SparseMatrix operator-( const SparseMatrix& m1, const SparseMatrix& m2 )
     }
     else if( m1.data->isZero() )
     {
-        SparseMatrix res = m2.clone();
+        SparseMatrix res = m2;
         res *= (-1.0);
         return res;
     }
     else if( m2.data->isZero() )
     {
-        return m1.clone();
+        // share the data, it is copied on write
+        return m1;
     }
 
     // store the result as row-order
@@ -316,7 +344,7 @@ const SparseMatrix operator-( const SparseMatrix& m1, const SparseMatrix& m2 )
 
 
 
-const SparseMatrix operator+( const SparseMatrix& m1, const SparseMatrix& m2 )
+SparseMatrix operator+( const SparseMatrix& m1, const SparseMatrix& m2 )
 {
     assert( m1.row()==m2.row() && m1.col()==m2.col() && "Matrix size does not match" );
 
@@ -327,11 +355,12 @@ const SparseMatrix operator+( const SparseMatrix& m1, const SparseMatrix& m2 )
     }
     else if( m1.isZero() )
     {
-        return m2.clone();
+        // share the data, it is copied on write
+        return m2;
     }
     else if( m2.isZero() )
     {
-        return m1.clone();
+        return m1;
     }
 
     // store the result as row-order
@@ -402,17 +431,35 @@ const SparseMatrix operator+( const SparseMatrix& m1, const SparseMatrix& m2 )
 }
 
 
-const SparseMatrix operator/( const SparseMatrix& m1, const double& value )
+SparseMatrix operator/( const SparseMatrix& m1, const double& value )
 {
     SparseMatrix sm = m1.clone();
-    return (sm /= value);
+    sm /= value;
+    return sm;
 }
 
 
-const SparseMatrix operator*( const SparseMatrix& m1, const double& value )
+SparseMatrix operator*( const SparseMatrix& m1, const double& value )
 {
     SparseMatrix sm = m1.clone();
-    return (sm *= value);
+    sm *= value;
+    return sm;
+}
+
+SparseMatrix operator/( SparseMatrix&& m1, const double& value )
+{
+    // detach() only copies the data if it is shared
+    SparseMatrix sm( std::move( m1 ) );
+    sm /= value;
+    return sm;
+}
+
+SparseMatrix operator*( SparseMatrix&& m1, const double& value )
+{
+    // detach() only copies the data if it is shared
+    SparseMatrix sm( std::move( m1 ) );
+    sm *= value;
+    return sm;
 }
 
 ostream& operator<<( ostream& out, const SparseMatrix& m )
@@ -514,7 +561,7 @@ SparseMatrix SparseMatrix::diag() const
     return SparseMatrix( this->row(), this->col(), res_nzval, res_colidx, res_rowptr );
 }
 
-const SparseMatrix multiply_openmp( const SparseMatrix& m1, const SparseMatrix& m2 )
+SparseMatrix multiply_openmp( const SparseMatrix& m1, const SparseMatrix& m2 )
 {
     assert( m1.col()==m2.row() && "Matrix size does not match" );
 
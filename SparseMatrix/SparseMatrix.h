@@ -44,8 +44,13 @@ public:
     SparseMatrix( const SparseMatrix& matrix );
     const SparseMatrix& operator=( const SparseMatrix& matrix );
 
+    // c'tor: move constructor (the moved matrix is left empty and
+    // can only be destroyed or assigned)
+    SparseMatrix( SparseMatrix&& matrix );
+    const SparseMatrix& operator=( SparseMatrix&& matrix );
+
     // deep copy of the matrix data
-    const SparseMatrix clone(void) const;
+    SparseMatrix clone(void) const;
 
     // destructor
     ~SparseMatrix(void);
@@ -64,6 +69,9 @@ public:
                            unsigned const*& row_pointer ) const;
 
 protected:
+    // make a deep copy of the data if it is shared with other matrices
+    // (copy on write)
+    void detach( void );
 
     bool updateData( unsigned num_rows, unsigned num_cols,
                      const std::vector<double>& non_zero_value,
@@ -81,21 +89,24 @@ public:
     ////////////////////////////////////////////////////////////////
 
     // Transpose a matrix
-    const SparseMatrix t() const;
+    SparseMatrix t() const;
     // mutiply by value
     const SparseMatrix& operator*=( const double& value );
     const SparseMatrix& operator/=( const double& value );
     // solving linear system
     friend void solve( const SparseMatrix& A, const double* B, double* X );
     // other matrix manipulations
-    friend const SparseMatrix operator*( const SparseMatrix& m1, const SparseMatrix& m2 );
-    friend const SparseMatrix operator+( const SparseMatrix& m1, const SparseMatrix& m2 );
-    friend const SparseMatrix operator-( const SparseMatrix& m1, const SparseMatrix& m2 );
-    friend const SparseMatrix operator/( const SparseMatrix& m1, const double& value );
-    friend const SparseMatrix operator*( const SparseMatrix& m1, const double& value );
+    friend SparseMatrix operator*( const SparseMatrix& m1, const SparseMatrix& m2 );
+    friend SparseMatrix operator+( const SparseMatrix& m1, const SparseMatrix& m2 );
+    friend SparseMatrix operator-( const SparseMatrix& m1, const SparseMatrix& m2 );
+    friend SparseMatrix operator/( const SparseMatrix& m1, const double& value );
+    friend SparseMatrix operator*( const SparseMatrix& m1, const double& value );
+    // the data of a temporary matrix is reused if it is not shared
+    friend SparseMatrix operator/( SparseMatrix&& m1, const double& value );
+    friend SparseMatrix operator*( SparseMatrix&& m1, const double& value );
 
     // parallel function(s)
-    friend const SparseMatrix multiply_openmp( const SparseMatrix& m1, const SparseMatrix& m2 );
+    friend SparseMatrix multiply_openmp( const SparseMatrix& m1, const SparseMatrix& m2 );
 
     // utility functions
     void print( std::ostream& out ) const;
@@ -109,6 +120,7 @@ public:
     // // // // // // // // // // // // // // // // // // // // // //
     enum Options { BICGSQ, SUPERLU };
     friend void mult( const SparseMatrix& A, const double *v, double *w );
-    friend void solve( const SparseMatrix& A, const double* B, double* X,
-                       double acuracy = 1e-3, Options o = BICGSQ );
+    // return the number of iterations of the iterative solver
+    friend int solve( const SparseMatrix& A, const double* B, double* X,
+                      double acuracy = 1e-3, Options o = BICGSQ );
 };
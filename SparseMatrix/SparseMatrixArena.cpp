@@ -0,0 +1,153 @@
+#include "SparseMatrixArena.h"
+#include <stdlib.h>
+#include <assert.h>
+
+namespace
+{
+// Every allocation is preceded by a header of 16 bytes which remembers
+// the memory block of the arena it comes from (nullptr if it comes from the
+// heap)
+const std::size_t HEADER_SIZE = 16;
+
+// Size of a memory block of the arena (4MB)
+const std::size_t BLOCK_SIZE = 1 << 22;
+
+inline std::size_t align16( std::size_t bytes )
+{
+    return ( bytes + 15 ) & ~std::size_t( 15 );
+}
+
+inline void*& owner_of( void* header )
+{
+    return *static_cast<void**>( header );
+}
+}
+
+const std::size_t SparseMatrixArena::MAX_ARENA_ALLOCATION;
+
+// The arena of each thread
+static SparseMatrixArena* thread_arena = nullptr;
+#pragma omp threadprivate(thread_arena)
+
+
+SparseMatrixArena::SparseMatrixArena( void )
+    : block_id( 0 ), offset( 0 ), alive( 0 ), depth( 0 ) { }
+
+SparseMatrixArena::~SparseMatrixArena( void )
+{
+    assert( alive==0 && "Destroying an arena with allocations alive" );
+    for( std::size_t i=0; i<blocks.size(); i++ )
+    {
+        free( blocks[i]->mem );
+        delete blocks[i];
+    }
+}
+
+SparseMatrixArena::Scope::Scope( void )
+{
+    if( thread_arena==nullptr ) thread_arena = new SparseMatrixArena();
+    arena = thread_arena;
+    // matrices that outlived the previous scope may be gone by now
+    if( arena->depth==0 ) arena->reset();
+    arena->depth++;
+}
+
+SparseMatrixArena::Scope::~Scope( void )
+{
+    if( --arena->depth==0 ) arena->reset();
+}
+
+SparseMatrixArena* SparseMatrixArena::current( void )
+{
+    return ( thread_arena && thread_arena->depth>0 ) ? thread_arena : nullptr;
+}
+
+void* SparseMatrixArena::allocate( std::size_t bytes )
+{
+    SparseMatrixArena* arena = current();
+
+    void* header = nullptr;
+    void* block = nullptr;
+    if( arena && bytes<=MAX_ARENA_ALLOCATION )
+    {
+        header = arena->bump( HEADER_SIZE + align16( bytes ) );
+        block = arena->blocks[ arena->block_id ];
+        arena->blocks[ arena->block_id ]->alive++;
+        arena->alive++;
+    }
+    else
+    {
+        header = malloc( HEADER_SIZE + bytes );
+        if( header==nullptr ) return nullptr;
+    }
+    owner_of( header ) = block;
+    return static_cast<char*>( header ) + HEADER_SIZE;
+}
+
+void SparseMatrixArena::deallocate( void* ptr )
+{
+    if( ptr==nullptr ) return;
+
+    void* header = static_cast<char*>( ptr ) - HEADER_SIZE;
+    Block* block = static_cast<Block*>( owner_of( header ) );
+    if( block )
+    {
+        // the memory is given back in bulk when the arena is reset
+        block->alive--;
+        block->arena->alive--;
+    }
+    else
+    {
+        free( header );
+    }
+}
+
+void SparseMatrixArena::release_memory( void )
+{
+    if( thread_arena && thread_arena->depth==0 && thread_arena->alive==0 )
+    {
+        delete thread_arena;
+        thread_arena = nullptr;
+    }
+}
+
+std::size_t SparseMatrixArena::capacity( void ) const
+{
+    return blocks.size() * BLOCK_SIZE;
+}
+
+void* SparseMatrixArena::bump( std::size_t bytes )
+{
+    assert( bytes<=BLOCK_SIZE );
+
+    // look for the next block with enough space, the blocks that are still
+    // used by matrices of a previous scope are skipped
+    while( block_id < blocks.size() &&
+            ( offset + bytes > BLOCK_SIZE || ( offset==0 && blocks[block_id]->alive>0 ) ) )
+    {
+        block_id++;
+        offset = 0;
+    }
+
+    if( block_id==blocks.size() )
+    {
+        // out of memory blocks, add a new one
+        Block* b = new Block();
+        b->arena = this;
+        b->mem = static_cast<char*>( malloc( BLOCK_SIZE ) );
+        b->alive = 0;
+        assert( b->mem && "Out of memory" );
+        blocks.push_back( b );
+        offset = 0;
+    }
+
+    void* ptr = blocks[block_id]->mem + offset;
+    offset += bytes;
+    return ptr;
+}
+
+void SparseMatrixArena::reset( void )
+{
+    block_id = 0;
+    offset   = 0;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+
+// A per-thread memory arena for the temporary matrices.
+//
+// While a SparseMatrixArena::Scope is opened on a thread, all the memory that
+// is required by SparseMatrix (the data, the reference counters and the
+// arrays of non-zero values and indeces) on this thread is taken from the
+// arena of the thread with a simple bump pointer. Releasing the memory only
+// decreases the counter of its memory block. When the outermost scope is
+// closed, the arena is reset in bulk and its memory blocks are reused by the
+// next scope (for example, the next iteration of Levenberg Marquardt).
+//
+// Only the small temporaries are taken from the arena: the allocations above
+// MAX_ARENA_ALLOCATION (e.g. the global Jacobian matrix) and the memory
+// allocated outside of any scope go to the heap as usual. Matrices created
+// in a scope may outlive it: the memory block of such a matrix is skipped by
+// the following scopes until the matrix is destroyed, the other blocks are
+// reused.
+class SparseMatrixArena
+{
+public:
+    // Open the arena of the calling thread for the life time of the scope.
+    // Scopes can be nested, only the outermost one resets the arena.
+    class Scope
+    {
+    public:
+        Scope( void );
+        ~Scope( void );
+    private:
+        Scope( const Scope& );
+        Scope& operator=( const Scope& );
+        SparseMatrixArena* arena;
+    };
+
+    // Maximum size of an allocation from the arena (larger ones go to the
+    // heap)
+    static const std::size_t MAX_ARENA_ALLOCATION = 1 << 18;
+
+    // Allocate memory from the arena of the calling thread if there is an
+    // opened scope on it, otherwise from the heap. The memory is aligned on
+    // 16 bytes.
+    static void* allocate( std::size_t bytes );
+
+    // Release memory obtained with allocate(), the calling thread does not
+    // matter.
+    static void deallocate( void* ptr );
+
+    // The arena of the calling thread, nullptr if no scope is opened on it
+    static SparseMatrixArena* current( void );
+
+    // Return the memory blocks of the arena of the calling thread to the heap
+    // (only if there is no opened scope and no allocation alive)
+    static void release_memory( void );
+
+    // Total size of the memory blocks of the arena
+    std::size_t capacity( void ) const;
+
+    // Number of allocations from the arena that are still alive
+    inline int num_alive( void ) const
+    {
+        return alive;
+    }
+
+private:
+    SparseMatrixArena( void );
+    ~SparseMatrixArena( void );
+    SparseMatrixArena( const SparseMatrixArena& );
+    SparseMatrixArena& operator=( const SparseMatrixArena& );
+
+    void* bump( std::size_t bytes );
+
+    // reset the bump pointer to the beginning of the first block (the
+    // blocks with allocations alive are skipped by bump())
+    void reset( void );
+
+    struct Block
+    {
+        SparseMatrixArena* arena;
+        char* mem;
+        std::atomic<int> alive; // number of allocations alive in the block
+    };
+    // the blocks are never moved, they may be released from other threads
+    std::vector<Block*> blocks;
+    std::size_t block_id;     // the block we are allocating from
+    std::size_t offset;       // offset of the next allocation in the block
+
+    std::atomic<int> alive;   // number of allocations alive (all blocks)
+    int depth;                // number of opened scopes
+};
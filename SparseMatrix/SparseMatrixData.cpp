@@ -2,6 +2,7 @@
 #include "SparseMatrixData.h"
 
 #include <iostream>
+#include <algorithm>
 
 using namespace std;
 
@@ -18,18 +19,15 @@ SparseMatrixData::SparseMatrixData( unsigned num_rows, unsigned num_cols, const
     // N==0, then this is a zero matrix, then don't allocate matrix data
     if( N != 0 )
     {
-        datarow.nnz = N;
+        datarow.allocate( N, nrow+1 );
 
         // non-zero values
-        datarow.nzval = new double[N];
         memcpy( datarow.nzval, non_zero_value, sizeof(double) * N );
 
         // column index
-        datarow.colind = new unsigned[N];
         memcpy( datarow.colind, col_index, sizeof(unsigned) * N );
 
         // row pointer
-        datarow.rowptr = new unsigned[nrow+1];
         memcpy( datarow.rowptr, row_pointer, sizeof(unsigned) * nrow );
         datarow.rowptr[nrow] = N;
     }
@@ -48,9 +46,7 @@ void SparseMatrixData::getCol( unsigned& N, const double*& nzval, const unsigned
 {
     if( !datarow.isEmpty() && datacol.isEmpty() )
     {
-        RowMatrix_to_ColMatrix( nrow, ncol,
-                                datarow.nnz, datarow.nzval, datarow.colind, datarow.rowptr,
-                                datacol.nnz, datacol.nzval, datacol.rowind, datacol.colptr );
+        RowMatrix_to_ColMatrix( nrow, ncol, datarow, datacol );
     }
     N = datacol.nnz;
     nzval  = datacol.nzval;
@@ -69,8 +65,7 @@ void SparseMatrixData::getRow(unsigned& N, const double*& nzval, const unsigned
         RowMatrix_to_ColMatrix(
             ncol,						// number of rows
             nrow,						// number of cols
-            datacol.nnz, datacol.nzval, datacol.rowind, datacol.colptr,
-            datarow.nnz, datarow.nzval, datarow.colind, datarow.rowptr ); // row pointers
+            datacol, datarow );
     }
 
     N = datarow.nnz;
@@ -84,26 +79,9 @@ void SparseMatrixData::transpose( void )
     // tanspose number of rows and columns
     std::swap( nrow, ncol );
 
-    if( this->isCol() && this->isRow() )
-    {
-        // if the matrix is stored as both row-order and col-order
-        std::swap( datarow, datacol );
-    }
-    else if( this->isRow() )
-    {
-        datacol = datarow;
-        datarow.clear();
-    }
-    else if( this->isCol() )
-    {
-        datarow = datacol;
-        datacol.clear();
-    }
-    else
-    {
-        // both datacol and datarow are NULL
-        // this is a empty matrix, nothing to transpose
-    }
+    // the row-order representation becomes the col-order representation
+    // of the transposed matrix and vice versa
+    datarow.swap( datacol );
 }
 
 void SparseMatrixData::multiply( const double& value )
@@ -113,21 +91,21 @@ void SparseMatrixData::multiply( const double& value )
 }
 
 
-void SparseMatrixData::RowMatrix_to_ColMatrix(unsigned m, unsigned n,
-        const unsigned& nnz1, const double * const nzval1, const unsigned * const colind1, const unsigned * const rowptr1,
-        unsigned& nnz2, double *&nzval2, unsigned *&rowind2, unsigned *&colptr2)
+void SparseMatrixData::RowMatrix_to_ColMatrix( unsigned m, unsigned n, const MatrixData& src, MatrixData& dst )
 {
-    nnz2 = nnz1;
+    const unsigned* const rowptr1 = src.rowptr;
+    const unsigned* const colind1 = src.colind;
+    const double*   const nzval1  = src.nzval;
 
     register unsigned i, j;
 
     /* Allocate storage for another copy of the matrix. */
-    nzval2 = new double[nnz1];
-    rowind2 = new unsigned[nnz1];
-    colptr2 = new unsigned[n+1];
-    unsigned *marker = new unsigned[n];
+    dst.allocate( src.nnz, n+1 );
+    double*   nzval2  = dst.nzval;
+    unsigned* rowind2 = dst.rowind;
+    unsigned* colptr2 = dst.colptr;
+    unsigned *marker = (unsigned*) SparseMatrixArena::allocate( sizeof(unsigned)*n );
     memset(marker, 0, sizeof(unsigned)*n );
-
     /* Get counts of each column of A, and set up column pointers */
     for (i = 0; i < m; ++i)
     {
@@ -158,5 +136,60 @@ void SparseMatrixData::RowMatrix_to_ColMatrix(unsigned m, unsigned n,
         }
     }
 
-    delete[] marker;
+    SparseMatrixArena::deallocate( marker );
+}
+
+
+void SparseMatrixData::MatrixData::allocate( unsigned N, unsigned num_ptr )
+{
+    release();
+    nnz = N;
+    if( N <= SMALL_NNZ )
+    {
+        nzval  = small_nzval;
+        colind = small_index;
+    }
+    else
+    {
+        nzval  = (double*)   SparseMatrixArena::allocate( sizeof(double) * N );
+        colind = (unsigned*) SparseMatrixArena::allocate( sizeof(unsigned) * N );
+    }
+    if( num_ptr <= SMALL_PTR )
+    {
+        rowptr = small_ptr;
+    }
+    else
+    {
+        rowptr = (unsigned*) SparseMatrixArena::allocate( sizeof(unsigned) * num_ptr );
+    }
+}
+
+void SparseMatrixData::MatrixData::release()
+{
+    if( nzval  != small_nzval ) SparseMatrixArena::deallocate( nzval );
+    if( colind != small_index ) SparseMatrixArena::deallocate( colind );
+    if( rowptr != small_ptr )   SparseMatrixArena::deallocate( rowptr );
+    clear();
+}
+
+void SparseMatrixData::MatrixData::swap( MatrixData& other )
+{
+    std::swap( nnz,    other.nnz );
+    std::swap( nzval,  other.nzval );
+    std::swap( colind, other.colind );
+    std::swap( rowptr, other.rowptr );
+    std::swap_ranges( small_nzval, small_nzval + SMALL_NNZ, other.small_nzval );
+    std::swap_ranges( small_index, small_index + SMALL_NNZ, other.small_index );
+    std::swap_ranges( small_ptr,   small_ptr   + SMALL_PTR, other.small_ptr );
+
+    // the pointers to the inline storage have to follow the data
+    rebase( other );
+    other.rebase( *this );
+}
+
+void SparseMatrixData::MatrixData::rebase( MatrixData& other )
+{
+    if( nzval  == other.small_nzval ) nzval  = small_nzval;
+    if( colind == other.small_index ) colind = small_index;
+    if( rowptr == other.small_ptr )   rowptr = small_ptr;
 }
@@ -1,10 +1,17 @@
 #pragma once
 #include <utility>
 #include <string.h>
+#include "SparseMatrixArena.h"
 
 class SparseMatrixData
 {
+public:
+    // Small matrices (e.g. the 3 by N Jacobian matrices of the points) are
+    // stored inline, without allocating any memory for their arrays
+    static const unsigned SMALL_NNZ = 18; // max # of non-zero values stored inline
+    static const unsigned SMALL_PTR = 4;  // max # of row (or col) pointers stored inline
 
+private:
     struct MatrixData
     {
         unsigned nnz;       // number of non-zero value
@@ -27,16 +34,21 @@ class SparseMatrixData
             };
         };
 
+        // inline storage for small matrices
+        double   small_nzval[SMALL_NNZ];
+        unsigned small_index[SMALL_NNZ];
+        unsigned small_ptr[SMALL_PTR];
+
         MatrixData()
             : nnz(0), nzval(nullptr), colind(nullptr), rowptr(nullptr) {}
 
-        inline void release()
-        {
-            delete[] nzval;
-            delete[] colind;
-            delete[] rowptr;
-            clear();
-        }
+        // allocate the arrays for N non-zero values and num_ptr row (or col) pointers
+        void allocate( unsigned N, unsigned num_ptr );
+
+        void release();
+
+        // swap the data of the two matrices (the inline storage included)
+        void swap( MatrixData& other );
 
         // A sparse matrix is 'empty' if there is no non zero values in the matrix
         inline bool isEmpty() const
@@ -51,6 +63,15 @@ class SparseMatrixData
             colind = nullptr;
             rowptr = nullptr;
         }
+
+    private:
+        // pointers to the inline storage of 'other' are redirected to ours
+        void rebase( MatrixData& other );
+
+        // the pointers may refer to the inline storage, so the data
+        // should not be copied as is
+        MatrixData( const MatrixData& );
+        MatrixData& operator=( const MatrixData& );
     };
 public:
 
@@ -113,9 +134,19 @@ public:
     // multiple the matrix by a value
     void multiply( const double& value );
 
+    // The data, the reference counters and the arrays of the matrices are
+    // allocated from the arena of the thread (see SparseMatrixArena.h)
+    static void* operator new( std::size_t bytes )
+    {
+        return SparseMatrixArena::allocate( bytes );
+    }
+    static void operator delete( void* ptr )
+    {
+        SparseMatrixArena::deallocate( ptr );
+    }
+
 private:
-    void RowMatrix_to_ColMatrix(unsigned m, unsigned n,
-                                const unsigned& nnz1, const double * const nzval1, const unsigned * const colind1, const unsigned * const rowptr1,
-                                unsigned& nnz2, double *&nzval2, unsigned *&rowind2, unsigned *&colptr2);
+    // convert the m by n matrix 'src' stored in row order into 'dst' stored in col order
+    void RowMatrix_to_ColMatrix( unsigned m, unsigned n, const MatrixData& src, MatrixData& dst );
 };
 
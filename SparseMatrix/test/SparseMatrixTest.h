@@ -3,6 +3,7 @@
 
 #include "gtest/gtest.h"
 #include "../SparseMatrix.h"
+#include "../SparseMatrixArena.h"
 
 #include <iostream>
 
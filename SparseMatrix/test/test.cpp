@@ -95,6 +95,113 @@ TEST_F(SparseMatrixTest, MultiplyTranspose)
 
 
 
+TEST_F(SparseMatrixTest, MoveSemantics)
+{
+    double expected[3][3] =
+    {
+        { 4,  2,  6},
+        { 4, 12, 16},
+        {12, 16, 36}
+    };
+
+    // the data of a temporary matrix is reused
+    SparseMatrix tmp = B.clone();
+    const double* nzval_before = nullptr;
+    unsigned N = 0;
+    const unsigned* colidx = nullptr;
+    const unsigned* rowptr = nullptr;
+    tmp.getRowMatrixData( N, nzval_before, colidx, rowptr );
+
+    SparseMatrix res = std::move( tmp ) * 2.0;
+    const double* nzval_after = nullptr;
+    res.getRowMatrixData( N, nzval_after, colidx, rowptr );
+    ASSERT_EQ( nzval_before, nzval_after );
+    test_equal( expected, res );
+
+    // shared data is copied on write
+    SparseMatrix shared = B;
+    SparseMatrix res2 = std::move( shared ) * 2.0;
+    test_equal( expected, res2 );
+
+    double expected_B[3][3] =
+    {
+        { 2,  1,  3},
+        { 2,  6,  8},
+        { 6,  8, 18}
+    };
+    test_equal( expected_B, B );
+}
+
+TEST_F(SparseMatrixTest, SmallMatrixTranspose)
+{
+    // B is stored inline (3 rows, 9 non-zero values)
+    double expected[3][3] =
+    {
+        { 2,  2,  6},
+        { 1,  6,  8},
+        { 3,  8, 18}
+    };
+    test_equal( expected, B.t() );
+
+    double expected2[3][3] =
+    {
+        {  14,  34,  74},
+        {  34, 104, 204},
+        {  74, 204, 424}
+    };
+    test_equal( expected2, B * B.t() );
+}
+
+TEST_F(SparseMatrixTest, Arena)
+{
+    double expected[5][5] =
+    {
+        {1243,  228,  336,  105,  228},
+        { 228,  585,  252,    0,  396},
+        { 336,  252,  400,    0,  144},
+        { 105,    0,    0,  466,  378},
+        { 228,  396,  144,  378,  613}
+    };
+
+    SparseMatrix outlive;
+    for( int i=0; i<3; i++ )
+    {
+        SparseMatrixArena::Scope scope;
+        ASSERT_NE( (SparseMatrixArena*) nullptr, SparseMatrixArena::current() );
+
+        SparseMatrix res = A1 * A1.t();
+        test_equal( expected, res );
+        ASSERT_GT( SparseMatrixArena::current()->num_alive(), 0 );
+
+        // a matrix is allowed to outlive the scope
+        if( i==1 ) outlive = res;
+    }
+    ASSERT_EQ( (SparseMatrixArena*) nullptr, SparseMatrixArena::current() );
+    test_equal( expected, outlive );
+
+    // the matrix that outlives its scope does not stop the arena from
+    // reusing its memory
+    size_t capacity = 0;
+    for( int i=0; i<20; i++ )
+    {
+        SparseMatrixArena::Scope scope;
+        SparseMatrix res = A1 * A1.t();
+        test_equal( expected, res );
+        if( i==0 ) capacity = SparseMatrixArena::current()->capacity();
+        ASSERT_EQ( capacity, SparseMatrixArena::current()->capacity() );
+    }
+    test_equal( expected, outlive );
+
+    // the large arrays are not taken from the arena
+    {
+        SparseMatrixArena::Scope scope;
+        const int alive = SparseMatrixArena::current()->num_alive();
+        void* big = SparseMatrixArena::allocate( SparseMatrixArena::MAX_ARENA_ALLOCATION + 1 );
+        ASSERT_EQ( alive, SparseMatrixArena::current()->num_alive() );
+        SparseMatrixArena::deallocate( big );
+    }
+}
+
 TEST_F(SparseMatrixTest, MemoryLeak)
 {
     cout << "Hey! We are now testing memory leak. ";
@@ -136,12 +136,12 @@ void SparseMatrixCV::convertTo( cv::Mat_<double>& m )
 }
 
 
-void solve( const SparseMatrixCV& A, const cv::Mat_<double>& B,
-            cv::Mat_<double>& X, double acuracy,
-            SparseMatrix::Options o )
+int solve( const SparseMatrixCV& A, const cv::Mat_<double>& B,
+           cv::Mat_<double>& X, double acuracy,
+           SparseMatrix::Options o )
 {
     X = cv::Mat_<double>::zeros( A.row(), 1 );
 
-    solve(A, (double*)B.data, (double*)X.data, acuracy, o);
+    return solve(A, (double*)B.data, (double*)X.data, acuracy, o);
 }
 
@@ -3,6 +3,7 @@
 #include <opencv2/core/core.hpp>
 #include "../SparseMatrix/SparseMatrix.h"
 #include <vector>
+#include <utility>
 
 // A wrapper for SparseMatrix for OpenCV
 class SparseMatrixCV : public SparseMatrix
@@ -24,6 +25,22 @@ public:
 
     SparseMatrixCV( const SparseMatrix& m ) : SparseMatrix( m ) { }
 
+    SparseMatrixCV( SparseMatrixCV&& m ) : SparseMatrix( std::move( m ) ) { }
+
+    SparseMatrixCV( SparseMatrix&& m ) : SparseMatrix( std::move( m ) ) { }
+
+    const SparseMatrixCV& operator=( const SparseMatrixCV& m )
+    {
+        SparseMatrix::operator=( m );
+        return *this;
+    }
+
+    const SparseMatrixCV& operator=( SparseMatrixCV&& m )
+    {
+        SparseMatrix::operator=( std::move( m ) );
+        return *this;
+    }
+
     SparseMatrixCV( unsigned nrow, unsigned ncol, const unsigned index[][2], const double value[], unsigned N );
 
     template <class _Tp>
@@ -44,7 +61,7 @@ public:
 
     friend const cv::Mat_<double> operator*( const SparseMatrixCV& m1, const cv::Mat_<double>& m2 );
 
-    inline const SparseMatrixCV t() const
+    inline SparseMatrixCV t() const
     {
         return SparseMatrix::t();
     }
@@ -53,12 +70,13 @@ public:
 
     void convertTo( cv::Mat_<double>& m );
 
-    // Solving linear system
-    friend void solve( const SparseMatrixCV& A,
-                       const cv::Mat_<double>& B,
-                       cv::Mat_<double>& X,
-                       double acuracy = 1e-3,
-                       SparseMatrix::Options o = BICGSQ );
+    // Solving linear system, return the number of iterations of the
+    // iterative solver
+    friend int solve( const SparseMatrixCV& A,
+                      const cv::Mat_<double>& B,
+                      cv::Mat_<double>& X,
+                      double acuracy = 1e-3,
+                      SparseMatrix::Options o = BICGSQ );
 };
 
 
@@ -1,7 +1,10 @@
 #pragma once
 #include <queue>
+#include <vector>
+#include <algorithm>
 
 #include "GLViewer.h"
+#include "GLVertexBuffer.h"
 
 #include "VesselnessTypes.h"
 #include "Data3D.h"
@@ -15,10 +18,15 @@ class Direction : public GLViewer::Object
     // Data
     ///////////////////////
     Data3D<Vesselness_Sig> *ptrVnSig;
+    // only the voxels with a response above it are drawn
+    float threshold;
+    // one short line per voxel along the vessel direction
+    VertexBuffer lines;
 public:
-    Direction( Data3D<Vesselness_Sig>& vn_sig )
-        : ptrVnSig( &vn_sig )
+    Direction( Data3D<Vesselness_Sig>& vn_sig, const float& threshold = 0.1f )
+        : ptrVnSig( &vn_sig ), threshold( threshold )
     {
+        updateModel();
     }
 
     ~Direction()
@@ -26,34 +34,66 @@ public:
         ptrVnSig = NULL;
     }
 
-    void init()
-    {
-        glDisable (GL_LINE_SMOOTH);
-        // glHint (GL_LINE_SMOOTH_HINT, GL_NICEST );
-    }
-    void render(void)
+    /// Rebuild the lines, e.g. after the vesselness or the threshold has
+    /// been changed
+    void updateModel( void )
     {
-        glBegin( GL_LINES );
-        int gap = 1;
-        for( int z=0; z<ptrVnSig->SZ(); z+=gap )
+        const Data3D<Vesselness_Sig>& vn_sig = *ptrVnSig;
+        const int SX = vn_sig.SX(), SY = vn_sig.SY(), SZ = vn_sig.SZ();
+
+        // Parallel compaction of the voxels above the threshold: count them
+        // slice by slice, then every slice writes its lines from the
+        // exclusive prefix sum of the counts
+        std::vector<long> offset( SZ + 1, 0 );
+        #pragma omp parallel for schedule(static)
+        for( int z=0; z<SZ; z++ )
         {
-            for( int y=0; y<ptrVnSig->SY(); y+=gap )
+            long n = 0;
+            for( int y=0; y<SY; y++ )
+                for( int x=0; x<SX; x++ )
+                    n += ( vn_sig.at(x, y, z).rsp > threshold );
+            offset[z+1] = n;
+        }
+        for( int z=0; z<SZ; z++ ) offset[z+1] += offset[z];
+
+        std::vector<VertexBuffer::Vertex> vertices( 2 * offset[SZ] );
+        #pragma omp parallel for schedule(static)
+        for( int z=0; z<SZ; z++ )
+        {
+            VertexBuffer::Vertex* v = vertices.empty() ? NULL : &vertices[ 2 * offset[z] ];
+            for( int y=0; y<SY; y++ )
             {
-                for( int x=0; x<ptrVnSig->SX(); x+=gap )
+                for( int x=0; x<SX; x++ )
                 {
-                    if( ptrVnSig->at(x, y, z).rsp > 0.1f )
+                    const Vesselness_Sig& vn = vn_sig.at(x, y, z);
+                    if( vn.rsp > threshold )
                     {
-                        // select line color
-                        glColor4f( 1.0, 0.0, 0.0, ptrVnSig->at(x,y,z).rsp);
-                        // draw line
-                        cv::Vec3f d = ptrVnSig->at(x,y,z).dir;
-                        glVertex3f( x + d[0], y + d[1], z + d[2] );
-                        glVertex3f( x - d[0], y - d[1], z - d[2] );
+                        // red, the opacity is the response
+                        const float a = std::min( vn.rsp, 1.0f ) * 255.0f + 0.5f;
+                        const cv::Vec3f& d = vn.dir;
+                        ( v++ )->set( x + d[0], y + d[1], z + d[2], 255, 0, 0, (unsigned char) a );
+                        ( v++ )->set( x - d[0], y - d[1], z - d[2], 255, 0, 0, (unsigned char) a );
                     }
                 }
             }
         }
-        glEnd();
+        lines.update( vertices );
+    }
+
+    void setThreshold( const float& t )
+    {
+        threshold = t;
+        updateModel();
+    }
+
+    void init()
+    {
+        glDisable (GL_LINE_SMOOTH);
+        // glHint (GL_LINE_SMOOTH_HINT, GL_NICEST );
+    }
+    void render(void)
+    {
+        lines.draw( GL_LINES );
     }
 
     unsigned int size_x() const
@@ -270,7 +270,12 @@ protected:
 private:
     // TODO: I should try yxml later
     void save_info( const std::string& file_name, bool isBigEndian, const std::string& log )  const;
-    bool load_info( const std::string& file_name, cv::Vec3i& size, bool& isBigEndian );
+    static void save_info( const std::string& file_name, const cv::Vec3i& size, bool isBigEndian, const std::string& log );
+    static bool load_info( const std::string& file_name, cv::Vec3i& size, bool& isBigEndian );
+
+    // reading and writing the files slice by slice (see Data3DStream.h)
+    template<typename T1> friend class Data3DReader;
+    template<typename T1> friend class Data3DWriter;
 };
 
 
@@ -573,13 +578,19 @@ void Data3D<T>::show(const std::string& window_name, int current_slice ) const
 
 template<typename T>
 void Data3D<T>::save_info( const std::string& file_name, bool isBigEndian, const std::string& log  ) const
+{
+    save_info( file_name, _size, isBigEndian, log );
+}
+
+template<typename T>
+void Data3D<T>::save_info( const std::string& file_name, const cv::Vec3i& size, bool isBigEndian, const std::string& log )
 {
     std::string info_file = file_name + ".readme.txt";
     std::cout << "Saving data information to '" << info_file << "' " << std::endl;
     std::ofstream fout( info_file.c_str() );
-    fout << _size[0] << " ";
-    fout << _size[1] << " ";
-    fout << _size[2] << " - data size" << std::endl;
+    fout << size[0] << " ";
+    fout << size[1] << " ";
+    fout << size[2] << " - data size" << std::endl;
     fout << TypeInfo<T>::str() << " - data type" << std::endl;
     fout << isBigEndian << " - Big Endian (1 for yes, 0 for no)" << std::endl;
     fout << "Log: " <<  log << std::endl;
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "Data3D.h"
+#include "nstdio.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "smart_assert.h"
+
+// Reading and writing the files of Data3D<T> (see Data3D<T>::load() and
+// Data3D<T>::save()) a few slices at a time, for the volumes that do not
+// fit in memory. The slices are read (or written) one after another, from
+// the first one to the last one.
+template<typename T>
+class Data3DReader
+{
+public:
+    Data3DReader( void ) : pFile( nullptr ), isBigEndian( false ), next_slice( 0 ) { }
+
+    ~Data3DReader( void )
+    {
+        close();
+    }
+
+    // open the file and load its data information (file_name.readme.txt)
+    bool open( const std::string& file_name )
+    {
+        close();
+        smart_return( Data3D<T>::load_info( file_name, size, isBigEndian ),
+                      "Cannot load the data information", false );
+        smart_return( !isBigEndian || sizeof(T)==2,
+                      "Datatype does not support big endian.", false );
+        pFile = fopen( file_name.c_str(), "rb" );
+        smart_return( pFile!=0, "File not found", false );
+        next_slice = 0;
+        return true;
+    }
+
+    void close( void )
+    {
+        if( pFile ) fclose( pFile );
+        pFile = nullptr;
+    }
+
+    inline const cv::Vec3i& get_size( void ) const
+    {
+        return size;
+    }
+
+    inline int SX( void ) const
+    {
+        return size[0];
+    }
+    inline int SY( void ) const
+    {
+        return size[1];
+    }
+    inline int SZ( void ) const
+    {
+        return size[2];
+    }
+
+    // index of the next slice to be read
+    inline int tell( void ) const
+    {
+        return next_slice;
+    }
+
+    // Read the next (at most) num_slices slices to dst (SX() * SY() values
+    // per slice), return the number of slices read
+    int read( T* dst, int num_slices )
+    {
+        smart_return( pFile!=0, "The file is not opened", 0 );
+        num_slices = std::min( num_slices, size[2] - next_slice );
+        if( num_slices<=0 ) return 0;
+
+        const unsigned long long count = (unsigned long long) size[0] * size[1] * num_slices;
+        const unsigned long long size_read = fread_big( dst, sizeof(T), count, pFile );
+        smart_return( size_read==count*sizeof(T), "Data size is incorrect (too small)", 0 );
+
+        if( isBigEndian ) swap_bytes( dst, count );
+        next_slice += num_slices;
+        return num_slices;
+    }
+
+private:
+    static void swap_bytes( T* data, const unsigned long long& count )
+    {
+        unsigned char* temp = (unsigned char*) data;
+        for( unsigned long long i=0; i<count; i++ )
+        {
+            std::swap( *temp, *(temp+1) );
+            temp+=2;
+        }
+    }
+
+    // non-copyable (the file handle)
+    Data3DReader( const Data3DReader& );
+    Data3DReader& operator=( const Data3DReader& );
+
+    FILE* pFile;
+    cv::Vec3i size;
+    bool isBigEndian;
+    int next_slice;
+};
+
+
+template<typename T>
+class Data3DWriter
+{
+public:
+    Data3DWriter( void ) : pFile( nullptr ), isBigEndian( false ), next_slice( 0 ) { }
+
+    ~Data3DWriter( void )
+    {
+        close();
+    }
+
+    // create the file, and its data information file_name.readme.txt
+    bool open( const std::string& file_name, const cv::Vec3i& size,
+               const std::string& log = "", bool isBigEndian = false )
+    {
+        close();
+        smart_return( !isBigEndian || sizeof(T)==2,
+                      "Datatype does not support big endian.", false );
+        pFile = fopen( file_name.c_str(), "wb" );
+        smart_return( pFile!=0, "Cannot create the file", false );
+        this->size = size;
+        this->isBigEndian = isBigEndian;
+        next_slice = 0;
+        Data3D<T>::save_info( file_name, size, isBigEndian, log );
+        return true;
+    }
+
+    void close( void )
+    {
+        if( pFile ) fclose( pFile );
+        pFile = nullptr;
+    }
+
+    // index of the next slice to be written
+    inline int tell( void ) const
+    {
+        return next_slice;
+    }
+
+    // Append num_slices slices (SX * SY values per slice) to the file
+    bool write( const T* src, int num_slices )
+    {
+        smart_return( pFile!=0, "The file is not opened", false );
+        smart_return( next_slice + num_slices <= size[2], "Too many slices", false );
+
+        const unsigned long long count = (unsigned long long) size[0] * size[1] * num_slices;
+        long long size_write;
+        if( isBigEndian )
+        {
+            buffer.assign( src, src + count );
+            unsigned char* temp = (unsigned char*) &buffer[0];
+            for( unsigned long long i=0; i<count; i++ )
+            {
+                std::swap( *temp, *(temp+1) );
+                temp+=2;
+            }
+            size_write = fwrite_big( &buffer[0], sizeof(T), count, pFile );
+        }
+        else
+        {
+            size_write = fwrite_big( src, sizeof(T), count, pFile );
+        }
+        smart_return( (unsigned long long) size_write==count*sizeof(T),
+                      "Failed to write the data", false );
+
+        next_slice += num_slices;
+        return true;
+    }
+
+private:
+    // non-copyable (the file handle)
+    Data3DWriter( const Data3DWriter& );
+    Data3DWriter& operator=( const Data3DWriter& );
+
+    FILE* pFile;
+    cv::Vec3i size;
+    bool isBigEndian;
+    int next_slice;
+    std::vector<T> buffer; // byte swapped slices (big endian)
+};
@@ -0,0 +1,69 @@
+#include "GLVertexBuffer.h"
+#include <cstddef> // for offsetof
+
+using namespace std;
+
+namespace GLViewer
+{
+
+void VertexBuffer::update( vector<Vertex>& new_vertices )
+{
+    std::lock_guard<std::mutex> lock( mutex );
+    pending.swap( new_vertices );
+    count = (unsigned) pending.size();
+    dirty = true;
+}
+
+void VertexBuffer::draw( const GLenum& mode )
+{
+    // take the vertices of the last update (the previous ones are freed
+    // outside of the lock)
+    bool changed = false;
+    vector<Vertex> previous;
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        if( dirty )
+        {
+            previous.swap( vertices );
+            vertices.swap( pending );
+            dirty = false;
+            changed = true;
+        }
+    }
+    if( changed )
+    {
+        num_drawn = (unsigned) vertices.size();
+        if( vbo==0 && ( GLEW_VERSION_1_5 || GLEW_ARB_vertex_buffer_object ) )
+        {
+            glGenBuffers( 1, &vbo );
+        }
+        if( vbo )
+        {
+            glBindBuffer( GL_ARRAY_BUFFER, vbo );
+            glBufferData( GL_ARRAY_BUFFER, num_drawn * sizeof(Vertex),
+                          num_drawn ? &vertices[0] : NULL, GL_STATIC_DRAW );
+            glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+            // the vertices are on the graphics card
+            vector<Vertex>().swap( vertices );
+        }
+    }
+    if( num_drawn==0 ) return;
+
+    // offset of the vertices in the buffer, or their address in memory
+    const char* base = (const char*) ( vbo ? NULL : &vertices[0] );
+    if( vbo ) glBindBuffer( GL_ARRAY_BUFFER, vbo );
+
+    glEnableClientState( GL_VERTEX_ARRAY );
+    glEnableClientState( GL_COLOR_ARRAY );
+    glVertexPointer( 3, GL_FLOAT, sizeof(Vertex), base + offsetof( Vertex, pos ) );
+    glColorPointer( 4, GL_UNSIGNED_BYTE, sizeof(Vertex), base + offsetof( Vertex, color ) );
+
+    glDrawArrays( mode, 0, num_drawn );
+
+    glDisableClientState( GL_COLOR_ARRAY );
+    glDisableClientState( GL_VERTEX_ARRAY );
+    if( vbo ) glBindBuffer( GL_ARRAY_BUFFER, 0 );
+}
+
+}
@@ -0,0 +1,83 @@
+#ifndef GL_VERTEX_BUFFER_H
+#define GL_VERTEX_BUFFER_H
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+#include "GLViewer.h"
+
+namespace GLViewer
+{
+/* Static geometry of a GLViewer::Object (e.g. lines or points), drawn with
+   a single call per frame.
+
+   The vertices are prepared on the CPU (by any thread) with update(). They
+   are handed over to the rendering thread under a lock, and copied into a
+   vertex buffer object the next time draw() is called, the CPU copy is
+   then released. Nothing is sent to the graphics card again until the next
+   update(). If vertex buffer objects are not supported, the vertices are
+   kept and drawn from the client memory. */
+class VertexBuffer
+{
+public:
+    struct Vertex
+    {
+        float pos[3];
+        unsigned char color[4]; // RGBA
+
+        inline void set( const float& x, const float& y, const float& z,
+                         const unsigned char& r, const unsigned char& g,
+                         const unsigned char& b, const unsigned char& a = 255 )
+        {
+            pos[0] = x;
+            pos[1] = y;
+            pos[2] = z;
+            color[0] = r;
+            color[1] = g;
+            color[2] = b;
+            color[3] = a;
+        }
+    };
+
+    VertexBuffer( void ) : vbo( 0 ), num_drawn( 0 ), count( 0 ), dirty( false ) { }
+
+    // may be called from any thread, the buffer is deleted by the rendering
+    // thread (see GLViewer::releaseBuffers())
+    ~VertexBuffer( void )
+    {
+        releaseBuffers( &vbo, 1 );
+    }
+
+    /// Replace the vertices (the content of 'vertices' is swapped out), from
+    /// any thread
+    void update( std::vector<Vertex>& vertices );
+
+    /// Upload the vertices if they were updated, then draw them as
+    /// primitives of the given type (GL_LINES, GL_POINTS, ...)
+    void draw( const GLenum& mode );
+
+    /// Number of vertices (of the last update)
+    inline unsigned size( void ) const
+    {
+        return count;
+    }
+
+private:
+    VertexBuffer( const VertexBuffer& );
+    VertexBuffer& operator=( const VertexBuffer& );
+
+    // owned by the rendering thread
+    GLuint vbo;
+    std::vector<Vertex> vertices;
+    unsigned num_drawn;
+
+    // the vertices of the last update, not taken by draw() yet
+    std::mutex mutex;
+    std::vector<Vertex> pending;
+    std::atomic<unsigned> count;
+    bool dirty;
+};
+}
+
+#endif // GL_VERTEX_BUFFER_H
@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <sstream>
+#include <mutex>
 using namespace std;
 
 #include <time.h>
@@ -53,8 +54,39 @@ bool isAxis = false;
 // Whether or not to take a screen shot from the current rendering result
 bool isSaveFrame = false;
 
+// OpenGL objects to delete in the rendering thread
+std::mutex releasedMutex;
+vector<GLuint> releasedBuffers;
+vector<GLuint> releasedTextures;
+
+void releaseBuffers( const GLuint* buffers, int n )
+{
+    std::lock_guard<std::mutex> lock( releasedMutex );
+    for( int i=0; i<n; i++ ) if( buffers[i] ) releasedBuffers.push_back( buffers[i] );
+}
+
+void releaseTextures( const GLuint* textures, int n )
+{
+    std::lock_guard<std::mutex> lock( releasedMutex );
+    for( int i=0; i<n; i++ ) if( textures[i] ) releasedTextures.push_back( textures[i] );
+}
+
+void deleteReleasedObjects( void )
+{
+    vector<GLuint> buffers, textures;
+    {
+        std::lock_guard<std::mutex> lock( releasedMutex );
+        buffers.swap( releasedBuffers );
+        textures.swap( releasedTextures );
+    }
+    if( !buffers.empty() ) glDeleteBuffers( (GLsizei) buffers.size(), &buffers[0] );
+    if( !textures.empty() ) glDeleteTextures( (GLsizei) textures.size(), &textures[0] );
+}
+
 void render(void)
 {
+    deleteReleasedObjects();
+
     // Clear The Screen And The Depth Buffer
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
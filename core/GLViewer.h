@@ -31,5 +31,11 @@ void dispay( std::vector<Object*> objects, int w=1280, int h = 720  );
 // API for start capture a video clip
 void startCaptureVideo( int maxNumFrames = 3600 );
 
+// Release OpenGL buffers or textures from any thread (e.g. in the destructor
+// of an object): they are deleted by the rendering thread before the next
+// frame. Without any frame, they are released with the context.
+void releaseBuffers( const GLuint* buffers, int n );
+void releaseTextures( const GLuint* textures, int n );
+
 }
 
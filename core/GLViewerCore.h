@@ -43,24 +43,13 @@ void GLViewerCore::addObject( const Data3D<T>& im_data,
     // data is empty
     if( im_data.is_empty() ) return;
 
-    // normalized the data
-    Data3D<T> im_copy = im_data;
-    IP::normalize( im_copy, T(255) );
-
-    // change the data formate to unsigend char
-    Data3D<unsigned char> im_uchar;
-    im_data.convertTo( im_uchar );
-
-    // TODO: Magic number below. In order to increase rendering speed,
-    // resize the volume to a smaller size and scale it up while rendering.
-    float scale = 1.0f;
-    if( im_uchar.SZ()>400 )
-    {
-        im_uchar.shrink_by_half();
-        scale = 2.0f;
-    }
-
-    this->addUcharObject( im_uchar, mode, scale );
+    /* The data is converted to normalized 8-bit bricks in the background
+       (in parallel, without any copy of the volume), the bricks are shown
+       as soon as they are ready. The bricks are downsampled if the volume
+       is too large for the graphics card (see VolumnBricks). */
+    GLViewer::Volumn* vObj = new GLViewer::Volumn( im_data, &GLViewer::camera );
+    vObj->render_mode = mode;
+    objs.push_back( vObj );
 }
 
 #endif // GLVIEWERCORE_H
@@ -8,50 +8,113 @@ namespace GLViewer
 Volumn::Volumn( unsigned char* im_data,
                 const int& im_x, const int& im_y, const int& im_z,
                 GLCamera* ptrCamera, float s )
-    : sx( im_x ), sy( im_y ), sz( im_z ), ptrCam( ptrCamera ), scale( s )
+    : ptrCam( ptrCamera ), scale( s ), next_pbo( 0 )
 {
-    /* From wikipedia: Do not forget that all 3 dimensions must be a power
-       of 2! so your 2D textures must have the same size and this size be
-       a power of 2 AND the number of layers (=2D textures) you use to create
-       your 3D texture must be a power of 2 too. */
-    static const double log2 = log(2.0);
-    texture_sx = (int) pow(2, ceil( log( 1.0*sx )/log2 ));
-    texture_sy = (int) pow(2, ceil( log( 1.0*sy )/log2 ));
-    texture_sz = (int) pow(2, ceil( log( 1.0*sz )/log2 ));
-
-    // allocating memeory for texture
-    int texture_size = texture_sx * texture_sy * texture_sz;
-    data = new (std::nothrow) unsigned char [ texture_size ];
-    if( !data )
-    {
-        cout << "Unable to allocate memory for OpenGL texture" << endl;
-        return;
-    }
+    // the data is already in [0, 255]
+    bricks.build( im_data, cv::Vec3i( im_x, im_y, im_z ), VolumnBricks::DEFAULT_BUDGET, 0, 255 );
+    init_size();
+}
+
+
+Volumn::Volumn( VolumnBricks& volumn_bricks, GLCamera* ptrCamera, float s )
+    : ptrCam( ptrCamera ), scale( s ), next_pbo( 0 )
+{
+    bricks.swap( volumn_bricks );
+    init_size();
+}
+
+
+Volumn::~Volumn()
+{
+    // may be called from any thread, the textures and the pixel buffers are
+    // deleted by the rendering thread (the bricks stop being converted)
+    if( !textures.empty() ) releaseTextures( &textures[0], (int) textures.size() );
+    releaseBuffers( pbo, 2 );
+}
+
+
+void Volumn::init_size( void )
+{
+    sx = bricks.get_size()[0];
+    sy = bricks.get_size()[1];
+    sz = bricks.get_size()[2];
+    pbo[0] = pbo[1] = 0;
+    reset_upload();
 
-    memset( data, 0, sizeof(unsigned char) * texture_size );
-    for( int z=0; z<sz; z++ )
+    render_mode = MIP;
+}
+
+
+void Volumn::reset_upload( void )
+{
+    // the textures are kept, they are updated in place
+    textures.resize( bricks.bricks.size(), 0 );
+    uploaded.assign( bricks.bricks.size(), 0 );
+}
+
+
+void Volumn::upload_bricks( void )
+{
+    int id;
+    if( !bricks.next_ready( id ) ) return;
+
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+
+    long long bytes = 0;
+    do
     {
-        for( int y=0; y<sy; y++ )
+        VolumnBricks::Brick& b = bricks.bricks[id];
+        const size_t size = b.data.size();
+
+        if( textures[id]==0 )
+        {
+            glGenTextures( 1, &textures[id] );
+            glBindTexture( GL_TEXTURE_3D, textures[id] );
+            glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+            glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+            glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+            glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+            glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE );
+            glTexImage3D( GL_TEXTURE_3D, 0, GL_LUMINANCE,
+                          b.tex_size[0], b.tex_size[1], b.tex_size[2], 0,
+                          GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL );
+        }
+        glBindTexture( GL_TEXTURE_3D, textures[id] );
+
+        const void* pixels = &b.data[0];
+        if( pbo[0] )
         {
-            for( int x=0; x<sx; x++ )
+            glBindBuffer( GL_PIXEL_UNPACK_BUFFER, pbo[next_pbo] );
+            // orphan the previous storage, the transfer from it may not be
+            // finished yet
+            glBufferData( GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW );
+            void* ptr = glMapBuffer( GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY );
+            if( ptr )
             {
-                data[ z*texture_sy*texture_sx + y*texture_sx + x]
-                    = im_data[ z*sy*sx + y*sx + x];
+                memcpy( ptr, &b.data[0], size );
+                glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+                pixels = 0; // offset in the pixel buffer
             }
+            else
+            {
+                glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+            }
+            next_pbo = 1 - next_pbo;
         }
-    }
 
-    render_mode = MIP;
-}
+        glTexSubImage3D( GL_TEXTURE_3D, 0, 0, 0, 0,
+                         b.tex_size[0], b.tex_size[1], b.tex_size[2],
+                         GL_LUMINANCE, GL_UNSIGNED_BYTE, pixels );
 
+        if( pbo[0] ) glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
 
-Volumn::~Volumn()
-{
-    if(data)
-    {
-        delete[] data;
-        data = nullptr;
+        // the texels are on the graphics card
+        std::vector<unsigned char>().swap( b.data );
+        uploaded[id] = 1;
+        bytes += size;
     }
+    while( bytes<UPLOAD_BYTES_PER_FRAME && bricks.next_ready( id ) );
+    glBindTexture( GL_TEXTURE_3D, 0 );
 }
 
 
@@ -85,6 +148,20 @@ void Volumn::setRenderMode( RenderMode mode )
 std::vector<cv::Vec3f> Volumn::intersectPoints( const cv::Vec3f& center,
         const cv::Vec3f& norm )
 {
+    return intersectPoints( center, norm, cv::Vec3f( 0, 0, 0 ),
+                            cv::Vec3f( (float)sx, (float)sy, (float)sz ) );
+}
+
+
+std::vector<cv::Vec3f> Volumn::intersectPoints( const cv::Vec3f& center_world,
+        const cv::Vec3f& norm, const cv::Vec3f& lo, const cv::Vec3f& hi )
+{
+    // in the coordinates of the box
+    const cv::Vec3f center = center_world - lo;
+    const float sx = hi[0] - lo[0];
+    const float sy = hi[1] - lo[1];
+    const float sz = hi[2] - lo[2];
+
     float t;
     std::vector<cv::Vec3f> result;
     if( std::abs(norm[2]) > 1.0e-3 )
@@ -148,6 +225,8 @@ std::vector<cv::Vec3f> Volumn::intersectPoints( const cv::Vec3f& center,
     }
 
 
+    for( unsigned int i=0; i<result.size(); i++ ) result[i] += lo;
+
     if( result.size()<=2 )
     {
         result.clear();
@@ -220,19 +299,14 @@ std::vector<cv::Vec3f> Volumn::intersectPoints( const cv::Vec3f& center,
 
 void Volumn::init(void)
 {
-    // Creating Textures
-    glGenTextures(1, &texture); // Create The Texture
-    glBindTexture(GL_TEXTURE_3D, texture);
-
-    // Yuchen [Important]: For the following line of code
-    /* If the graphic hard do not have enough memory for the 3D texture,
-       OpenGL will fail to render the textures. However, since it is hardware
-       related, the porgramm may not show any assertions here (this need to
-       be double-checked later. But now, it has no problem rendering 3D
-       texture with a size of 1024 * 1024 * 1024. */
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_LUMINANCE,
-                 texture_sx, texture_sy, texture_sz, 0,
-                 GL_LUMINANCE, GL_UNSIGNED_BYTE, data );
+    /* The textures are created and uploaded brick by brick while rendering
+       (see upload_bricks()). The bricks are small, they do not need to be
+       powers of 2 (OpenGL 2.0). Pixel buffer objects are used if they are
+       supported. */
+    if( GLEW_VERSION_2_1 || GLEW_ARB_pixel_buffer_object )
+    {
+        glGenBuffers( 2, pbo );
+    }
 
     //////////////////////////////////////
     // Set up OpenGL
@@ -244,14 +318,9 @@ void Volumn::init(void)
     glEnable (GL_LINE_SMOOTH);
     glHint (GL_LINE_SMOOTH_HINT, GL_NICEST );
 
-    // Use GL_NEAREST to see the voxels
-    glEnable( GL_TEXTURE_3D ); // Enable Texture Mapping
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    // Sets the wrap parameter for texture coordinate
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE  );
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE  );
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE  );
+    // Enable Texture Mapping (the parameters of the textures are set
+    // in upload_bricks())
+    glEnable( GL_TEXTURE_3D );
 
     glEnable( GL_POLYGON_SMOOTH_HINT );
     glHint (GL_POLYGON_SMOOTH_HINT, GL_NICEST);
@@ -264,80 +333,59 @@ void Volumn::render_volumn( const float& dx,
                             const float& dy,
                             const float& dz )
 {
-
-    glBindTexture(GL_TEXTURE_3D, texture);
-    glBegin(GL_QUADS);
-    for( float i=0.0f; i<=sx-1; i+=dx )
-    {
-        glTexCoord3f( 1.0f*(i+0.5f)/(float)texture_sx,
-                      0.0f,
-                      0.0f );
-        glVertex3f( i, 0.0f, 0.0f );
-
-        glTexCoord3f( 1.0f*(i+0.5f)/(float)texture_sx,
-                      1.0f*((float)sy-0.5f)/(float)texture_sy,
-                      0.0f );
-        glVertex3f( i, 1.0f*((float)sy-1), 0.0f );
-
-        glTexCoord3f( 1.0f*(i+0.5f)/(float)texture_sx,
-                      1.0f*((float)sy-0.5f)/(float)texture_sy,
-                      1.0f*((float)sz-0.5f)/(float)texture_sz );
-        glVertex3f( i, 1.0f*((float)sy-1), 1.0f*((float)sz-1) );
-
-        glTexCoord3f( 1.0f*(i+0.5f)/(float)texture_sx, 0.0f,
-                      1.0f*((float)sz-0.5f)/(float)texture_sz );
-        glVertex3f( i, 0.0f, 1.0f*((float)sz-1) );
-    }
-    for( float i=0.0f; i<=sy-1; i+=dy )
-    {
-        glTexCoord3f( 0.0f,
-                      1.0f*(i+0.5f)/(float)texture_sy,
-                      0.0f );
-        glVertex3f( 0.0f, i, 0.0f );
-
-        glTexCoord3f( 1.0f*((float)sx-0.5f)/(float)texture_sx,
-                      1.0f*(i+0.5f)/(float)texture_sy,
-                      0.0f );
-        glVertex3f( 1.0f*((float)sx-1), i, 0.0f );
-
-        glTexCoord3f( 1.0f*((float)sx-0.5f)/(float)texture_sx,
-                      1.0f*(i+0.5f)/(float)texture_sy,
-                      1.0f*((float)sz-0.5f)/(float)texture_sz );
-        glVertex3f( 1.0f*((float)sx-1), i, 1.0f*((float)sz-1) );
-
-        glTexCoord3f( 0.0f,
-                      1.0f*(i+0.5f)/(float)texture_sy,
-                      1.0f*((float)sz-0.5f)/(float)texture_sz );
-        glVertex3f( 0.0f,        i, 1.0f*((float)sz-1) );
-    }
-    for( float i=0.0f; i<=sz-1; i+=dz )
+    /* The slices are at the same positions as for a single texture, every
+       brick draws the part of the slices that is inside it: the brick of
+       the voxels [offset, offset+size) covers [offset-0.5, offset+size-0.5]
+       (clipped to [0, size-1] of the volume). */
+    const float step[3] = { std::max( dx, 1e-3f ), std::max( dy, 1e-3f ), std::max( dz, 1e-3f ) };
+    const float last[3] = { (float)sx-1, (float)sy-1, (float)sz-1 };
+
+    for( unsigned int id=0; id<bricks.bricks.size(); id++ )
     {
-        glTexCoord3f( 0.0f,
-                      0.0f,
-                      1.0f*(i+0.5f)/(float)texture_sz );
-        glVertex3f( 0.0f, 0.0f, i );
-
-        glTexCoord3f( 1.0f*((float)sx-0.5f)/(float)texture_sx,
-                      0.0f,
-                      1.0f*(i+0.5f)/(float)texture_sz );
-        glVertex3f( 1.0f*((float)sx-1), 0.0f, i );
-
-        glTexCoord3f( 1.0f*((float)sx-0.5f)/(float)texture_sx,
-                      1.0f*((float)sy-0.5f)/(float)texture_sy,
-                      1.0f*(i+0.5f)/(float)texture_sz );
-        glVertex3f( 1.0f*((float)sx-1),
-                    1.0f*((float)sy-1),
-                    i );
-
-        glTexCoord3f( 0.0f,
-                      1.0f*((float)sy-0.5f)/(float)texture_sy,
-                      1.0f*(i+0.5f)/(float)texture_sz );
-        glVertex3f( 0.0f, 1.0f*((float)sy-1), i );
-    }
-    glEnd();
-    glBindTexture( GL_TEXTURE_3D, 0 );
+        // the other bricks may still be being converted
+        if( !uploaded[id] ) continue;
+        const VolumnBricks::Brick& b = bricks.bricks[id];
 
+        float lo[3], hi[3];
+        for( int a=0; a<3; a++ )
+        {
+            lo[a] = std::max( b.offset[a] - 0.5f, 0.0f );
+            hi[a] = std::min( b.offset[a] + b.size[a] - 0.5f, last[a] );
+        }
 
+        glBindTexture(GL_TEXTURE_3D, textures[id]);
+        glBegin(GL_QUADS);
+        for( int a=0; a<3; a++ )
+        {
+            // the other two axes
+            const int a1 = (a+1) % 3, a2 = (a+2) % 3;
+            const float t1[2] = { bricks.tex_coord( b, a1, lo[a1] ), bricks.tex_coord( b, a1, hi[a1] ) };
+            const float t2[2] = { bricks.tex_coord( b, a2, lo[a2] ), bricks.tex_coord( b, a2, hi[a2] ) };
+            const int corner1[4] = { 0, 1, 1, 0 };
+            const int corner2[4] = { 0, 0, 1, 1 };
+
+            // the slices i*step in [lo, hi]
+            for( int i=(int) ceil( lo[a] / step[a] ); i*step[a]<=hi[a]; i++ )
+            {
+                const float pos = i * step[a];
+                const float tc = bricks.tex_coord( b, a, pos );
+                for( int c=0; c<4; c++ )
+                {
+                    float v[3], t[3];
+                    v[a]  = pos;
+                    t[a]  = tc;
+                    v[a1] = corner1[c] ? hi[a1] : lo[a1];
+                    t[a1] = t1[ corner1[c] ];
+                    v[a2] = corner2[c] ? hi[a2] : lo[a2];
+                    t[a2] = t2[ corner2[c] ];
+                    glTexCoord3fv( t );
+                    glVertex3fv( v );
+                }
+            }
+        }
+        glEnd();
+    }
+    glBindTexture( GL_TEXTURE_3D, 0 );
 }
 
 void Volumn::render_outline(void)
@@ -378,6 +426,9 @@ void Volumn::render_outline(void)
 
 void Volumn::render(void)
 {
+    // stream the textures that are not on the graphics card yet
+    upload_bricks();
+
     glPushMatrix();
     glScalef( scale, scale, scale );
 
@@ -437,18 +488,30 @@ void Volumn::render(void)
 
         glEnable(GL_DEPTH_TEST);
 
-        // draw the cross section
+        // draw the cross section, brick by brick
         glColor3f( 1.0f, 1.0f, 1.0f );
-        glBindTexture(GL_TEXTURE_3D, texture);
-        glBegin( GL_TRIANGLE_FAN );
-        for( unsigned int i=0; i<points.size(); i++ )
+        for( unsigned int id=0; id<bricks.bricks.size(); id++ )
         {
-            glTexCoord3f( points[i][0] / (float)texture_sx,
-                          points[i][1] / (float)texture_sy,
-                          points[i][2] / (float)texture_sz );
-            glVertex3f( points[i][0], points[i][1], points[i][2] );
+            if( !uploaded[id] ) continue;
+            const VolumnBricks::Brick& b = bricks.bricks[id];
+
+            const cv::Vec3f lo( b.offset );
+            const cv::Vec3f hi( b.offset + b.size );
+            std::vector<cv::Vec3f> brick_points = intersectPoints( center, vz, lo, hi );
+
+            glBindTexture(GL_TEXTURE_3D, textures[id]);
+            glBegin( GL_TRIANGLE_FAN );
+            for( unsigned int i=0; i<brick_points.size(); i++ )
+            {
+                // the box of the cross section is [0, sx] x [0, sy] x [0, sz],
+                // i.e. voxel i is centred at i + 0.5
+                glTexCoord3f( bricks.tex_coord( b, 0, brick_points[i][0] - 0.5f ),
+                              bricks.tex_coord( b, 1, brick_points[i][1] - 0.5f ),
+                              bricks.tex_coord( b, 2, brick_points[i][2] - 0.5f ) );
+                glVertex3f( brick_points[i][0], brick_points[i][1], brick_points[i][2] );
+            }
+            glEnd();
         }
-        glEnd();
         glBindTexture( GL_TEXTURE_3D, 0 );
 
         // draw the frame of the box
@@ -484,24 +547,17 @@ void Volumn::render(void)
 
 bool Volumn::update_data( unsigned char* im_data )
 {
-    if( !data ) return false;;
-
-    // Update texture data
-    for( int z=0; z<sz; z++ )
+    // the textures that already exist are updated in place if the
+    // bricks did not change size (see upload_bricks())
+    bricks.wait();
+    const int old_level = bricks.get_level();
+    bricks.build( im_data, cv::Vec3i( sx, sy, sz ), VolumnBricks::DEFAULT_BUDGET, 0, 255 );
+    if( bricks.get_level()!=old_level && !textures.empty() )
     {
-        for( int y=0; y<sy; y++ )
-        {
-            memcpy( data + z*texture_sy*texture_sx + y*texture_sx,
-                    im_data + z*sy*sx + y*sx,
-                    sx );
-        }
+        releaseTextures( &textures[0], (int) textures.size() );
+        textures.assign( textures.size(), 0 );
     }
-
-    // update texture for rendering
-    glBindTexture(GL_TEXTURE_3D, texture);
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_LUMINANCE,
-                 texture_sx, texture_sy, texture_sz, 0,
-                 GL_LUMINANCE, GL_UNSIGNED_BYTE, data );
+    reset_upload();
     return true;
 }
 
@@ -6,6 +6,7 @@
 #define _CRT_SECURE_NO_DEPRECATE
 #endif
 #include <queue>
+#include <vector>
 #include <new> // for no throw
 
 //#include "Graph.h"
@@ -18,6 +19,7 @@
 
 #include "GLViewer.h"
 #include "GLCamera.h"
+#include "GLVolumnBricks.h"
 
 namespace GLViewer
 {
@@ -37,25 +39,62 @@ private:
     /////////////////////////////////////////
     // Data
     ///////////////////////
-    // 3D Volumn Texture
-    GLuint texture;
-    // size of texture
-    int texture_sx, texture_sy, texture_sz;
+    // Texture data, cut into bricks (one 3D texture per brick)
+    VolumnBricks bricks;
+    // 3D textures of the bricks (0: not created yet)
+    std::vector<GLuint> textures;
+    // the textures of the bricks are up to date
+    std::vector<char> uploaded;
     // Original Data
     int sx, sy, sz;
-    // Texture Data
-    unsigned char* data;
     // Reference to the camera
     GLCamera* ptrCam;
 
     float scale;
 
+    /////////////////////////////////////////
+    // Streaming of the textures
+    ///////////////////////
+    /* The bricks are uploaded a few at a time at the beginning of every
+       frame, as soon as they are ready (see VolumnBricks::next_ready()),
+       so that the viewer does not stall while a large volume is loaded or
+       converted. The texels go through two pixel buffer objects in turns:
+       the copy to one buffer overlaps with the transfer from the other
+       one. */
+    GLuint pbo[2];
+    int next_pbo;
+    // number of bytes uploaded per frame
+    static const long long UPLOAD_BYTES_PER_FRAME = 32LL * 1024 * 1024;
+
+    void upload_bricks( void );
+    void reset_upload( void );
+
+    void init_size( void );
+
 public:
     Volumn(unsigned char* im_data,
            const int& im_x, const int& im_y, const int& im_z,
            GLCamera* ptrCamera,
            float scale = 1.0f );
 
+    // The bricks are taken from 'volumn_bricks' (which is left empty)
+    Volumn( VolumnBricks& volumn_bricks,
+            GLCamera* ptrCamera,
+            float scale = 1.0f );
+
+    // The bricks of 'im_data' are converted in the background, they are
+    // shown as soon as they are ready (the data should not be modified in
+    // the meantime, see VolumnBricks::build_async())
+    template<typename T>
+    Volumn( const Data3D<T>& im_data,
+            GLCamera* ptrCamera,
+            float s = 1.0f )
+        : ptrCam( ptrCamera ), scale( s ), next_pbo( 0 )
+    {
+        bricks.build_async( im_data );
+        init_size();
+    }
+
     ~Volumn();
 
     bool update_data( unsigned char* im_data );
@@ -84,6 +123,10 @@ public:
 
     std::vector<cv::Vec3f> intersectPoints( const cv::Vec3f& center, const cv::Vec3f& norm );
 
+    // intersection of a plane with the box [lo, hi]
+    static std::vector<cv::Vec3f> intersectPoints( const cv::Vec3f& center, const cv::Vec3f& norm,
+            const cv::Vec3f& lo, const cv::Vec3f& hi );
+
 
     void render_volumn( const float& dx = 1.0f,
                         const float& dy = 1.0f,
@@ -0,0 +1,349 @@
+#ifndef GL_VOLUMN_BRICKS_H
+#define GL_VOLUMN_BRICKS_H
+
+#include <vector>
+#include <deque>
+#include <limits>
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <opencv2/core/core.hpp>
+
+#include "Data3D.h"
+#include "smart_assert.h"
+
+namespace GLViewer
+{
+/* The texture data of a GLViewer::Volumn: the volume is cut into bricks of
+   BRICK_SIZE^3 voxels, each brick is a small 3D texture of 8-bit voxels.
+
+   The bricks are built in parallel, straight from the source data: the
+   intensities are normalized to [0, 255] (window [vmin, vmax]) while they
+   are converted, without any intermediate copy of the volume. The bricks
+   whose voxels are all at the bottom of the window are empty and have no
+   texture at all.
+
+   Level of detail: if the textures of the (non-empty) bricks do not fit in
+   the given budget, the bricks are downsampled by 2^level along each axis
+   (up to MAX_LEVEL, the textures may exceed the budget at that level).
+   A texel is the maximum of the voxels it covers, so that the thin bright
+   structures (i.e. vessels) are kept in the maximum intensity projection.
+
+   Every texture has a border of one texel with the neighbouring voxels, so
+   that the linear interpolation is seamless across the bricks.
+
+   The bricks can also be built in a background thread (build_async()):
+   they are made available one by one (see next_ready()), the nearest ones
+   to the centre of the volume first, so that they can be uploaded to the
+   graphics card while the others are still being converted. */
+class VolumnBricks
+{
+public:
+    struct Brick
+    {
+        cv::Vec3i offset;   // first voxel of the brick
+        cv::Vec3i size;     // number of voxels of the brick
+        cv::Vec3i tex_size; // size of the texture (with the border)
+        bool empty;
+        // texels (tex_size[0] * tex_size[1] * tex_size[2]), released once
+        // uploaded to the graphics card
+        std::vector<unsigned char> data;
+    };
+
+    // number of voxels of a brick along each axis (at full resolution)
+    static const int BRICK_SIZE = 128;
+    // default budget: number of texels of all the textures
+    static const long long DEFAULT_BUDGET = 512LL * 1024 * 1024;
+    // coarsest level of detail: a brick is downsampled to 2 x 2 x 2 texels
+    static const int MAX_LEVEL = 6;
+
+    VolumnBricks( void ) : size( 0, 0, 0 ), level( 0 ), cancel( false ) { }
+
+    // stop building the bricks (if they are being built in the background)
+    ~VolumnBricks( void )
+    {
+        stop();
+    }
+
+    /// Build the bricks of a volume (all the bricks are ready when it
+    /// returns).
+    /// budget: maximum number of texels of all the textures
+    /// vmin, vmax: the window of the normalization (vmin==vmax: the
+    ///     minimum and maximum of the volume)
+    template<typename T>
+    void build( const Data3D<T>& src, long long budget = DEFAULT_BUDGET,
+                double vmin = 0, double vmax = 0 );
+
+    /// The same for a buffer of size[0] * size[1] * size[2] voxels
+    template<typename T>
+    void build( const T* src, const cv::Vec3i& size, long long budget = DEFAULT_BUDGET,
+                double vmin = 0, double vmax = 0 );
+
+    /// The same in a background thread. The size of the volume and the
+    /// number of bricks are known when it returns, the other members of a
+    /// brick (and the level of detail) once it is ready. The data of 'src'
+    /// is shared, not copied: it should not be modified until wait().
+    template<typename T>
+    void build_async( const Data3D<T>& src, long long budget = DEFAULT_BUDGET,
+                      double vmin = 0, double vmax = 0 );
+
+    /// A non-empty brick whose texels are ready and which was not returned
+    /// yet (false if there is none for the moment)
+    bool next_ready( int& id )
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        if( ready.empty() ) return false;
+        id = ready.front();
+        ready.pop_front();
+        return true;
+    }
+
+    /// Wait until all the bricks are built
+    void wait( void )
+    {
+        if( worker.joinable() ) worker.join();
+    }
+
+    /// Exchange the bricks of two volumes (after they are built)
+    void swap( VolumnBricks& other )
+    {
+        wait();
+        other.wait();
+        std::swap( bricks, other.bricks );
+        std::swap( size, other.size );
+        std::swap( level, other.level );
+        std::swap( ready, other.ready );
+    }
+
+    inline const cv::Vec3i& get_size( void ) const
+    {
+        return size;
+    }
+    inline int get_level( void ) const
+    {
+        return level;
+    }
+
+    /// texture coordinate of the position p (in voxels, along axis a)
+    /// inside brick b
+    inline float tex_coord( const Brick& b, const int& a, const float& p ) const
+    {
+        return ( ( p - b.offset[a] + 0.5f ) / float( 1<<level ) + 1.0f ) / b.tex_size[a];
+    }
+
+    std::vector<Brick> bricks;
+
+private:
+    VolumnBricks( const VolumnBricks& );
+    VolumnBricks& operator=( const VolumnBricks& );
+
+    // the bricks of a volume of the given size (offsets and sizes only)
+    void layout( const cv::Vec3i& size );
+
+    // the content of the bricks, they are made ready one by one
+    template<typename T>
+    void build_bricks( const T* src, long long budget, double vmin, double vmax );
+
+    void stop( void )
+    {
+        cancel = true;
+        wait();
+        cancel = false;
+    }
+
+    cv::Vec3i size;
+    int level;
+
+    // the bricks that are ready and not returned yet
+    std::mutex mutex;
+    std::deque<int> ready;
+
+    std::thread worker;
+    std::atomic<bool> cancel;
+};
+
+
+inline void VolumnBricks::layout( const cv::Vec3i& size )
+{
+    this->size = size;
+    level = 0;
+    ready.clear();
+
+    cv::Vec3i nbricks;
+    for( int a=0; a<3; a++ ) nbricks[a] = ( size[a] + BRICK_SIZE - 1 ) / BRICK_SIZE;
+    const int num_bricks = nbricks[0] * nbricks[1] * nbricks[2];
+    bricks.clear();
+    bricks.resize( num_bricks );
+    for( int i=0; i<num_bricks; i++ )
+    {
+        Brick& b = bricks[i];
+        const cv::Vec3i id( i % nbricks[0], ( i / nbricks[0] ) % nbricks[1], i / ( nbricks[0] * nbricks[1] ) );
+        for( int a=0; a<3; a++ )
+        {
+            b.offset[a] = id[a] * BRICK_SIZE;
+            b.size[a] = std::min( BRICK_SIZE, size[a] - b.offset[a] );
+        }
+        b.empty = true;
+    }
+}
+
+
+template<typename T>
+void VolumnBricks::build( const Data3D<T>& src, long long budget, double vmin, double vmax )
+{
+    build( src.getData(), src.get_size(), budget, vmin, vmax );
+}
+
+template<typename T>
+void VolumnBricks::build( const T* src, const cv::Vec3i& size, long long budget,
+                          double vmin, double vmax )
+{
+    smart_return( size[0]>0 && size[1]>0 && size[2]>0, "The volume is empty. ", );
+    stop();
+    layout( size );
+    build_bricks( src, budget, vmin, vmax );
+}
+
+template<typename T>
+void VolumnBricks::build_async( const Data3D<T>& src, long long budget, double vmin, double vmax )
+{
+    smart_return( !src.is_empty(), "The volume is empty. ", );
+    stop();
+    layout( src.get_size() );
+
+    // the matrix header keeps the data alive
+    const cv::Mat_<T> data = src.getMat();
+    worker = std::thread( [this, data, budget, vmin, vmax]()
+    {
+        build_bricks( (const T*) data.data, budget, vmin, vmax );
+    } );
+}
+
+template<typename T>
+void VolumnBricks::build_bricks( const T* src, long long budget, double vmin, double vmax )
+{
+    const int SX = size[0], SY = size[1];
+    const long slice = (long) SX * SY;
+    const int num_bricks = (int) bricks.size();
+
+    // 1) the minimum and maximum of every brick
+    std::vector<double> brick_min( num_bricks ), brick_max( num_bricks );
+    #pragma omp parallel for schedule(dynamic)
+    for( int i=0; i<num_bricks; i++ )
+    {
+        const Brick& b = bricks[i];
+        T bmin = src[ b.offset[2] * slice + (long) b.offset[1] * SX + b.offset[0] ];
+        T bmax = bmin;
+        for( int z=b.offset[2]; z<b.offset[2]+b.size[2]; z++ )
+            for( int y=b.offset[1]; y<b.offset[1]+b.size[1]; y++ )
+            {
+                const T* p = src + z * slice + (long) y * SX + b.offset[0];
+                for( int x=0; x<b.size[0]; x++ )
+                {
+                    bmin = std::min( bmin, p[x] );
+                    bmax = std::max( bmax, p[x] );
+                }
+            }
+        brick_min[i] = (double) bmin;
+        brick_max[i] = (double) bmax;
+    }
+
+    if( vmin==vmax )
+    {
+        vmin = *std::min_element( brick_min.begin(), brick_min.end() );
+        vmax = *std::max_element( brick_max.begin(), brick_max.end() );
+    }
+    for( int i=0; i<num_bricks; i++ ) bricks[i].empty = ( brick_max[i]<=vmin );
+
+    // 2) the level of detail: the finest one that fits in the budget, or
+    // the coarsest one
+    long long texels = 0;
+    for( level=0; ; level++ )
+    {
+        texels = 0;
+        for( int i=0; i<num_bricks; i++ )
+        {
+            if( bricks[i].empty ) continue;
+            long long n = 1;
+            for( int a=0; a<3; a++ ) n *= ( ( bricks[i].size[a] + (1<<level) - 1 ) >> level ) + 2;
+            texels += n;
+        }
+        if( texels<=budget || level==MAX_LEVEL ) break;
+    }
+    if( level>0 )
+    {
+        std::cout << "Volumn: the textures are downsampled by " << ( 1<<level )
+                  << " (level of detail " << level << ")" << std::endl;
+    }
+    if( texels>budget )
+    {
+        std::cerr << "Volumn: warning, the textures (" << texels << " texels) exceed the budget ("
+                  << budget << " texels) at the coarsest level of detail" << std::endl;
+    }
+
+    // the nearest bricks to the centre of the volume first
+    std::vector<std::pair<float, int> > dist;
+    const cv::Vec3f centre( 0.5f*size[0], 0.5f*size[1], 0.5f*size[2] );
+    for( int i=0; i<num_bricks; i++ )
+    {
+        if( bricks[i].empty ) continue;
+        const cv::Vec3f d = cv::Vec3f( bricks[i].offset ) + 0.5f * cv::Vec3f( bricks[i].size ) - centre;
+        dist.push_back( std::pair<float, int>( d.dot( d ), i ) );
+    }
+    std::sort( dist.begin(), dist.end() );
+    const int num_textures = (int) dist.size();
+
+    // 3) the textures, texel (i, j, k) of a brick covers the voxels of the
+    // cell offset/2^level + (i-1, j-1, k-1) of the downsampled volume
+    const int step = 1<<level;
+    cv::Vec3i cells;
+    for( int a=0; a<3; a++ ) cells[a] = ( size[a] + step - 1 ) >> level;
+    const float scale = ( vmax>vmin ) ? float( 255.0 / ( vmax - vmin ) ) : 0.0f;
+    const float fmin = (float) vmin;
+
+    #pragma omp parallel for schedule(dynamic)
+    for( int n=0; n<num_textures; n++ )
+    {
+        if( cancel ) continue;
+        const int i = dist[n].second;
+        Brick& b = bricks[i];
+        for( int a=0; a<3; a++ ) b.tex_size[a] = ( ( b.size[a] + step - 1 ) >> level ) + 2;
+        b.data.resize( (size_t) b.tex_size[0] * b.tex_size[1] * b.tex_size[2] );
+
+        unsigned char* texel = &b.data[0];
+        for( int k=0; k<b.tex_size[2]; k++ )
+        {
+            const int cz = std::min( std::max( ( b.offset[2] >> level ) + k - 1, 0 ), cells[2] - 1 );
+            const int z0 = cz * step, z1 = std::min( z0 + step, size[2] );
+            for( int j=0; j<b.tex_size[1]; j++ )
+            {
+                const int cy = std::min( std::max( ( b.offset[1] >> level ) + j - 1, 0 ), cells[1] - 1 );
+                const int y0 = cy * step, y1 = std::min( y0 + step, size[1] );
+                for( int t=0; t<b.tex_size[0]; t++ )
+                {
+                    const int cx = std::min( std::max( ( b.offset[0] >> level ) + t - 1, 0 ), cells[0] - 1 );
+                    const int x0 = cx * step, x1 = std::min( x0 + step, size[0] );
+
+                    T m = src[ z0 * slice + (long) y0 * SX + x0 ];
+                    for( int z=z0; z<z1; z++ ) for( int y=y0; y<y1; y++ )
+                        {
+                            const T* p = src + z * slice + (long) y * SX;
+                            for( int x=x0; x<x1; x++ ) m = std::max( m, p[x] );
+                        }
+
+                    const float v = ( float( m ) - fmin ) * scale;
+                    *texel++ = (unsigned char) ( std::min( std::max( v, 0.0f ), 255.0f ) + 0.5f );
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock( mutex );
+        ready.push_back( i );
+    }
+}
+
+}
+
+#endif // GL_VOLUMN_BRICKS_H
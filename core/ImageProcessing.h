@@ -1,6 +1,8 @@
 #pragma once
 
 #include <vector>
+#include <limits>
+#include <algorithm>
 #include "Image3D.h"
 #include "Kernel3D.h"
 #include "smart_assert.h"
@@ -48,6 +50,44 @@ bool medianBlur3D( const Data3D<T1>& src, Data3D<T2>& dst, int ksize);
 template<typename T1, typename T2>
 bool meanBlur3D( const Data3D<T1>& src, Data3D<T2>& dst, int ksize);
 
+///////////////////////////////////////////////////////////////////////////
+// INTENSITY PROJECTIONS
+// Maximum (minimum) intensity projection of the slices s0, ..., s1-1 along
+// an axis (0: x, 1: y, 2: z; s1<0: up to the last slice). The projection is
+// a SY x SX (axis 2), SZ x SX (axis 1) or SZ x SY (axis 0) image.
+template<typename T>
+cv::Mat_<T> mip( const Data3D<T>& src, int axis = 2, int s0 = 0, int s1 = -1 );
+template<typename T>
+cv::Mat_<T> minip( const Data3D<T>& src, int axis = 2, int s0 = 0, int s1 = -1 );
+
+// reductions of the projections
+struct MaxOp
+{
+    template<typename T> static inline T apply( const T& a, const T& b )
+    {
+        return ( a>b ) ? a : b;
+    }
+    template<typename T> static inline T identity( void )
+    {
+        return std::numeric_limits<T>::lowest();
+    }
+};
+struct MinOp
+{
+    template<typename T> static inline T apply( const T& a, const T& b )
+    {
+        return ( a<b ) ? a : b;
+    }
+    template<typename T> static inline T identity( void )
+    {
+        return std::numeric_limits<T>::max();
+    }
+};
+// dst = Op( dst, projection of the slices s0, ..., s1-1 ), dst has the size
+// of the projection
+template<class Op, typename T>
+void accumulate_projection( const Data3D<T>& src, int axis, int s0, int s1, cv::Mat_<T>& dst );
+
 
 ///////////////////////////////////////////////////////////////////////////
 // normalize the data
@@ -250,51 +290,274 @@ bool ImageProcessing::GaussianBlur3D( const Data3D<T1>& src, Data3D<T2>& dst, in
 
 
 // median filter
+// Perreault and Hebert's sliding histograms, extended to 3D. For every x,
+// a column histogram counts the voxels (x, y', z') of the (y, z) neighbourhood
+// of the current row. Moving to the next row updates the column histograms
+// with two rows of voxels. Moving along x adds a column histogram to the
+// histogram of the kernel and removes another one. The histograms have two
+// levels (256 coarse bins of 256 fine bins each, for the 16-bit values); the
+// coarse level of the kernel is kept up to date and only the fine bins of
+// the coarse bin of the median are brought up to date. The volume is
+// processed in strips along x, so that the column histograms of a thread
+// stay small.
 template<typename T1, typename T2>
 bool ImageProcessing::medianBlur3D( const Data3D<T1>& src, Data3D<T2>& dst, int ksize)
 {
-    smart_return(0, "Not Implemented!", false );
+    smart_return( std::numeric_limits<T1>::is_integer && sizeof(T1)<=2,
+                  "Median filter only supports 8-bit and 16-bit integer data.", false );
+    smart_return( ksize%2!=0, "kernel size should be odd number", false );
+    // counts of a column histogram: unsigned short
+    smart_return( ksize>0 && ksize<256, "kernel size should be in [1, 255]", false );
+    smart_return( (void*)&src!=(void*)&dst, "src and dst should be different.", false );
+
+    std::cout << "Blurring Image with Median Filter..." << std::endl;
+
+    const int r = ksize / 2;
+    const int SX = src.SX();
+    const int SY = src.SY();
+    const int SZ = src.SZ();
+    const long slice = src.get_size_slice();
+    const int offset = (int) std::numeric_limits<T1>::min(); // value of key 0
+    const int NUM_COARSE = 256;
+    const int NUM_FINE = 256;
+    const int NUM_BINS = NUM_COARSE * NUM_FINE;
+
+    // output columns per strip, with their halo the strips have about 64 columns
+    const int strip = std::min( SX, std::max( 16, 64 - 2*r ) );
+    const int num_strips = ( SX + strip - 1 ) / strip;
+    const int max_cols = strip + 2*r;
+
+    dst.reset( src.get_size() );
+    const T1* data = src.getData();
+    T2* out = dst.getData();
+
+    #pragma omp parallel
+    {
+        // column histograms (zero between the tasks)
+        std::vector<unsigned short> col_coarse( (long) max_cols * NUM_COARSE, 0 );
+        std::vector<unsigned short> col_fine( (long) max_cols * NUM_BINS, 0 );
+        // histogram of the kernel, fine_x[c]: the position x at which the
+        // fine bins of coarse bin c were last brought up to date
+        std::vector<int> coarse( NUM_COARSE );
+        std::vector<int> fine( NUM_BINS );
+        std::vector<int> fine_x( NUM_COARSE );
+
+        #pragma omp for schedule(dynamic)
+        for( int task=0; task<SZ*num_strips; task++ )
+        {
+            const int z  = task / num_strips;
+            const int x0 = ( task % num_strips ) * strip;
+            const int x1 = std::min( SX, x0 + strip );
+            const int cx0 = std::max( 0, x0 - r ); // the columns are cx0, ..., cx1-1
+            const int cx1 = std::min( SX, x1 + r );
+            const int z0 = std::max( 0, z - r );
+            const int z1 = std::min( SZ - 1, z + r );
+
+            // add (delta = 1) or remove (delta = -1) the voxels (x, y, z0...z1)
+            // to the column histograms
+            auto update_columns = [&]( const int& y, const int& delta )
+            {
+                for( int zz=z0; zz<=z1; zz++ )
+                {
+                    const T1* p = data + zz * slice + (long) y * SX;
+                    for( int x=cx0; x<cx1; x++ )
+                    {
+                        const int key = (int) p[x] - offset;
+                        const int col = x - cx0;
+                        col_coarse[ col * NUM_COARSE + ( key >> 8 ) ] += (unsigned short) delta;
+                        col_fine[ (long) col * NUM_BINS + key ] += (unsigned short) delta;
+                    }
+                }
+            };
+
+            // add (delta = 1) or remove (delta = -1) the fine bins of coarse
+            // bin c of column x to the kernel
+            auto update_fine = [&]( const int& x, const int& c, const int& delta )
+            {
+                const unsigned short* h = &col_fine[ (long) ( x - cx0 ) * NUM_BINS + c * NUM_FINE ];
+                int* k = &fine[ c * NUM_FINE ];
+                for( int f=0; f<NUM_FINE; f++ ) k[f] += delta * h[f];
+            };
+
+            for( int y=0; y<std::min( r, SY ); y++ ) update_columns( y, 1 );
+
+            for( int y=0; y<SY; y++ )
+            {
+                // the columns hold the rows y-r, ..., y+r
+                if( y+r<SY ) update_columns( y+r, 1 );
+                if( y-r-1>=0 ) update_columns( y-r-1, -1 );
+
+                const int ny = std::min( y+r, SY-1 ) - std::max( y-r, 0 ) + 1;
+                const int nz = z1 - z0 + 1;
+
+                // kernel of the first voxel of the row
+                std::fill( coarse.begin(), coarse.end(), 0 );
+                std::fill( fine_x.begin(), fine_x.end(), -1 );
+                for( int x=std::max( 0, x0-r ); x<=std::min( SX-1, x0+r ); x++ )
+                {
+                    const unsigned short* h = &col_coarse[ ( x - cx0 ) * NUM_COARSE ];
+                    for( int c=0; c<NUM_COARSE; c++ ) coarse[c] += h[c];
+                }
+
+                for( int x=x0; x<x1; x++ )
+                {
+                    if( x>x0 )
+                    {
+                        if( x+r<SX )
+                        {
+                            const unsigned short* h = &col_coarse[ ( x + r - cx0 ) * NUM_COARSE ];
+                            for( int c=0; c<NUM_COARSE; c++ ) coarse[c] += h[c];
+                        }
+                        if( x-r-1>=0 )
+                        {
+                            const unsigned short* h = &col_coarse[ ( x - r - 1 - cx0 ) * NUM_COARSE ];
+                            for( int c=0; c<NUM_COARSE; c++ ) coarse[c] -= h[c];
+                        }
+                    }
+
+                    // the median is the voxel of rank k of the (clipped) kernel
+                    const int nx = std::min( x+r, SX-1 ) - std::max( x-r, 0 ) + 1;
+                    const int k = ( nx * ny * nz - 1 ) / 2;
+
+                    int c = 0, count = 0;
+                    while( count + coarse[c] <= k ) count += coarse[c++];
+
+                    // bring the fine bins of coarse bin c up to date
+                    if( fine_x[c]<0 || x - fine_x[c] > 2*r+1 )
+                    {
+                        std::fill( &fine[ c * NUM_FINE ], &fine[ c * NUM_FINE ] + NUM_FINE, 0 );
+                        for( int xx=std::max( 0, x-r ); xx<=std::min( SX-1, x+r ); xx++ )
+                        {
+                            update_fine( xx, c, 1 );
+                        }
+                    }
+                    else
+                    {
+                        for( int xx=fine_x[c]+1; xx<=x; xx++ )
+                        {
+                            if( xx+r<SX ) update_fine( xx+r, c, 1 );
+                            if( xx-r-1>=0 ) update_fine( xx-r-1, c, -1 );
+                        }
+                    }
+                    fine_x[c] = x;
+
+                    const int* h = &fine[ c * NUM_FINE ];
+                    int f = 0;
+                    while( count + h[f] <= k ) count += h[f++];
+
+                    out[ z * slice + (long) y * SX + x ] = T2( c * NUM_FINE + f + offset );
+                }
+            }
+
+            // clear the column histograms for the next task
+            for( int y=std::max( 0, SY-1-r ); y<SY; y++ ) update_columns( y, -1 );
+        }
+    }
+
+    std::cout << "done." << std::endl << std::endl;
+    return true;
 }
 
 // mean filter
+// Box filter, separable, with running sums along x, then y, then z: O(1)
+// per voxel whatever the kernel size. The window of a voxel is clipped to
+// the volume and the sum is divided by the number of voxels in it.
 template<typename T1, typename T2>
 bool ImageProcessing::meanBlur3D( const Data3D<T1>& src, Data3D<T2>& dst, int ksize)
 {
-    std::cout << "Blurring Image with Mean Filter..." << std::endl;
+    smart_return( ksize>0, "kernel size should be positive", false );
+    smart_return( (void*)&src!=(void*)&dst, "src and dst should be different.", false );
 
-    Kernel3D<float> kx( cv::Vec3i(ksize, 1, 1) );
-    Kernel3D<float> ky( cv::Vec3i(1, ksize, 1) );
-    Kernel3D<float> kz( cv::Vec3i(1, 1, ksize) );
+    std::cout << "Blurring Image with Mean Filter..." << std::endl;
 
-    float kvalue = 1.0f / ksize;
-    for( int i=0; i<ksize; i++ )
+    // the window of voxel x is x-lo, ..., x+hi (as filter3D_X)
+    const int lo = ksize / 2;
+    const int hi = ksize - 1 - lo;
+    const int SX = src.SX();
+    const int SY = src.SY();
+    const int SZ = src.SZ();
+    const long slice = src.get_size_slice();
+
+    // a single temporary volume, the pass along y is done in place
+    Data3D<float> tmp( src.get_size() );
+
+    // along x
+    const T1* in = src.getData();
+    float* out1 = tmp.getData();
+    #pragma omp parallel for schedule(static)
+    for( long row=0; row<(long) SY*SZ; row++ )
     {
-        kx.at(i,0,0) = kvalue;
-        ky.at(0,i,0) = kvalue;
-        kz.at(0,0,i) = kvalue;
+        const T1* p = in + row * SX;
+        float* q = out1 + row * SX;
+        double sum = 0.0;
+        for( int x=0; x<std::min( hi, SX ); x++ ) sum += p[x];
+        for( int x=0; x<SX; x++ )
+        {
+            if( x+hi<SX ) sum += p[x+hi];
+            if( x-lo-1>=0 ) sum -= p[x-lo-1];
+            q[x] = float( sum / ( std::min( x+hi, SX-1 ) - std::max( x-lo, 0 ) + 1 ) );
+        }
     }
 
-    bool flag;
-    Data3D<T2> tmp;
-    flag = filter3D_X( src, dst, kx );
-    if(!flag)
+    // along y, running sums of the columns of each slice. Row y-lo-1 leaves
+    // the window after it is overwritten, a copy of the last lo+1 rows is
+    // kept (as in RingsReduction::mean_blur_2d).
+    #pragma omp parallel
     {
-        std::cout << "Failed." << std::endl << std::endl;
-        return false;
-    }
+        std::vector<double> sum( SX );
+        std::vector<float> saved( (long) ( lo+1 ) * SX );
 
-    flag = filter3D_Y( dst, tmp, ky );
-    if(!flag)
-    {
-        std::cout << "Failed." << std::endl << std::endl;
-        return false;
+        #pragma omp for schedule(static)
+        for( int z=0; z<SZ; z++ )
+        {
+            float* p = out1 + z * slice;
+            std::fill( sum.begin(), sum.end(), 0.0 );
+            for( int y=0; y<std::min( hi, SY ); y++ )
+            {
+                for( int x=0; x<SX; x++ ) sum[x] += p[ y*SX + x ];
+            }
+            for( int y=0; y<SY; y++ )
+            {
+                // slot of row y, it holds row y-lo-1 until it is replaced
+                float* old = &saved[ (long) ( y % ( lo+1 ) ) * SX ];
+                if( y+hi<SY ) for( int x=0; x<SX; x++ ) sum[x] += p[ (y+hi)*SX + x ];
+                if( y-lo-1>=0 ) for( int x=0; x<SX; x++ ) sum[x] -= old[x];
+                const double count = std::min( y+hi, SY-1 ) - std::max( y-lo, 0 ) + 1;
+                float* q = p + y*SX;
+                for( int x=0; x<SX; x++ )
+                {
+                    old[x] = q[x];
+                    q[x] = float( sum[x] / count );
+                }
+            }
+        }
     }
 
-    flag = filter3D_Z( tmp, dst, kz );
-    if(!flag)
+    // along z, running sums of the rows of each y
+    dst.reset( src.get_size() );
+    T2* out = dst.getData();
+    #pragma omp parallel
     {
-        std::cout << "Failed." << std::endl << std::endl;
-        return false;
+        std::vector<double> sum( SX );
+
+        #pragma omp for schedule(static)
+        for( int y=0; y<SY; y++ )
+        {
+            const float* p = out1 + (long) y * SX;
+            T2* q = out + (long) y * SX;
+            std::fill( sum.begin(), sum.end(), 0.0 );
+            for( int z=0; z<std::min( hi, SZ ); z++ )
+            {
+                for( int x=0; x<SX; x++ ) sum[x] += p[ z*slice + x ];
+            }
+            for( int z=0; z<SZ; z++ )
+            {
+                if( z+hi<SZ ) for( int x=0; x<SX; x++ ) sum[x] += p[ (z+hi)*slice + x ];
+                if( z-lo-1>=0 ) for( int x=0; x<SX; x++ ) sum[x] -= p[ (z-lo-1)*slice + x ];
+                const double count = std::min( z+hi, SZ-1 ) - std::max( z-lo, 0 ) + 1;
+                for( int x=0; x<SX; x++ ) q[ z*slice + x ] = T2( sum[x] / count );
+            }
+        }
     }
 
     std::cout << "done." << std::endl << std::endl;
@@ -389,6 +652,106 @@ bool ImageProcessing::filter3D_Z( const Data3D<T1>& src, Data3D<T2>& dst, const
 }
 
 
+// The projections are reductions over contiguous memory: along z, the
+// slices are reduced element-wise (rows of the image in parallel); along
+// y, the rows of a slice are reduced element-wise; along x, every row is
+// reduced to a value (slices in parallel). The element-wise reductions are
+// vectorized along x, the reductions of a row use PACKET partial results.
+template<class Op, typename T>
+void ImageProcessing::accumulate_projection( const Data3D<T>& src, int axis, int s0, int s1, cv::Mat_<T>& dst )
+{
+    smart_return( axis>=0 && axis<3, "Invalid axis. ", );
+    smart_return( s0>=0 && s0<=s1 && s1<=src.get_size( axis ), "Invalid range of slices. ", );
+
+    const int SX = src.SX(), SY = src.SY(), SZ = src.SZ();
+    const int rows = ( axis==2 ) ? SY : SZ;
+    const int cols = ( axis==0 ) ? SY : SX;
+    smart_return( dst.rows==rows && dst.cols==cols && dst.isContinuous(),
+                  "The size of the projection is incorrect. ", );
+
+    const T* data = src.getData();
+    const long slice = src.get_size_slice();
+
+    if( axis==2 )
+    {
+        #pragma omp parallel for schedule(static)
+        for( int y=0; y<SY; y++ )
+        {
+            T* d = dst[y];
+            for( int z=s0; z<s1; z++ )
+            {
+                const T* p = data + z * slice + (long) y * SX;
+                #pragma omp simd
+                for( int x=0; x<SX; x++ ) d[x] = Op::apply( d[x], p[x] );
+            }
+        }
+    }
+    else if( axis==1 )
+    {
+        #pragma omp parallel for schedule(static)
+        for( int z=0; z<SZ; z++ )
+        {
+            T* d = dst[z];
+            for( int y=s0; y<s1; y++ )
+            {
+                const T* p = data + z * slice + (long) y * SX;
+                #pragma omp simd
+                for( int x=0; x<SX; x++ ) d[x] = Op::apply( d[x], p[x] );
+            }
+        }
+    }
+    else
+    {
+        const int PACKET = 16;
+        #pragma omp parallel for schedule(static)
+        for( int z=0; z<SZ; z++ )
+        {
+            T* d = dst[z];
+            for( int y=0; y<SY; y++ )
+            {
+                const T* p = data + z * slice + (long) y * SX;
+                T lanes[PACKET];
+                for( int l=0; l<PACKET; l++ ) lanes[l] = Op::template identity<T>();
+                int x = s0;
+                for( ; x+PACKET<=s1; x+=PACKET )
+                {
+                    #pragma omp simd
+                    for( int l=0; l<PACKET; l++ ) lanes[l] = Op::apply( lanes[l], p[x+l] );
+                }
+                T r = d[y];
+                for( ; x<s1; x++ ) r = Op::apply( r, p[x] );
+                for( int l=0; l<PACKET; l++ ) r = Op::apply( r, lanes[l] );
+                d[y] = r;
+            }
+        }
+    }
+}
+
+template<typename T>
+cv::Mat_<T> ImageProcessing::mip( const Data3D<T>& src, int axis, int s0, int s1 )
+{
+    smart_return( axis>=0 && axis<3, "Invalid axis. ", cv::Mat_<T>() );
+    if( s1<0 ) s1 = src.get_size( axis );
+
+    cv::Mat_<T> dst( ( axis==2 ) ? src.SY() : src.SZ(), ( axis==0 ) ? src.SY() : src.SX(),
+                     MaxOp::identity<T>() );
+    accumulate_projection<MaxOp>( src, axis, s0, s1, dst );
+    return dst;
+}
+
+template<typename T>
+cv::Mat_<T> ImageProcessing::minip( const Data3D<T>& src, int axis, int s0, int s1 )
+{
+    smart_return( axis>=0 && axis<3, "Invalid axis. ", cv::Mat_<T>() );
+    if( s1<0 ) s1 = src.get_size( axis );
+
+    cv::Mat_<T> dst( ( axis==2 ) ? src.SY() : src.SZ(), ( axis==0 ) ? src.SY() : src.SX(),
+                     MinOp::identity<T>() );
+    accumulate_projection<MinOp>( src, axis, s0, s1, dst );
+    return dst;
+}
+
+
 // normalize the data
 template<typename T>
 void ImageProcessing::normalize( Data3D<T>& data, T norm_max )
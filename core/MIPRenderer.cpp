@@ -0,0 +1,181 @@
+#include "MIPRenderer.h"
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace std;
+using namespace cv;
+
+MIPRenderer::MIPRenderer( const int& width, const int& height )
+    : yaw( 0 ), pitch( 0 ), width( width ), height( height )
+    , voxels_per_pixel( 0 ), step( 1.0 )
+    , slab_thickness( 0 ), slab_offset( 0 )
+    , window_min( 0 ), window_max( 0 )
+    , spacing( 1.0 )
+{
+    smart_assert( width>0 && height>0, "Invalid image size. " );
+    window_used[0] = window_used[1] = 0;
+    set_view( 0, 0 );
+}
+
+void MIPRenderer::set_view( const double& yaw, const double& pitch )
+{
+    this->yaw = yaw;
+    this->pitch = pitch;
+
+    // columns of R = Ry( yaw ) * Rx( pitch )
+    const double cy = cos( yaw ), sy = sin( yaw );
+    const double cp = cos( pitch ), sp = sin( pitch );
+    axis_right = Vec3d( cy, 0, -sy );
+    axis_down  = Vec3d( sy * sp, cp, cy * sp );
+    axis_view  = Vec3d( sy * cp, -sp, cy * cp );
+}
+
+void MIPRenderer::set_spacing( const double& voxels_per_pixel )
+{
+    smart_return( voxels_per_pixel>=0, "The spacing should not be negative. ", );
+    this->voxels_per_pixel = voxels_per_pixel;
+}
+
+void MIPRenderer::set_step( const double& step )
+{
+    smart_return( step>0, "The step should be positive. ", );
+    this->step = step;
+}
+
+void MIPRenderer::set_slab( const double& thickness, const double& offset )
+{
+    smart_return( thickness>=0, "The thickness should not be negative. ", );
+    slab_thickness = thickness;
+    slab_offset = offset;
+}
+
+void MIPRenderer::set_window( const double& min, const double& max )
+{
+    smart_return( min<=max, "Invalid window. ", );
+    window_min = min;
+    window_max = max;
+}
+
+void MIPRenderer::setup_rays( const Vec3i& size, Vec3d& origin,
+                              Vec3d& right, Vec3d& down, double& spacing ) const
+{
+    spacing = voxels_per_pixel;
+    if( spacing==0 )
+    {
+        // the bounding sphere of the volume fits in the image
+        const double diag = sqrt( double( size[0]*size[0] + size[1]*size[1] + size[2]*size[2] ) );
+        spacing = diag / std::min( width, height );
+    }
+
+    // the rays start on the plane through the centre of the volume, the
+    // samples are on both sides of it
+    const Vec3d c = Vec3d( size[0]-1, size[1]-1, size[2]-1 ) * 0.5;
+    right = axis_right * spacing;
+    down  = axis_down * spacing;
+    origin = c - right * ( 0.5 * ( width-1 ) ) - down * ( 0.5 * ( height-1 ) );
+}
+
+void MIPRenderer::add_segment( const Vec3d& p1, const Vec3d& p2, const Vec3b& color )
+{
+    segments.push_back( Segment( p1, p2, color ) );
+}
+
+void MIPRenderer::clear_overlays( void )
+{
+    segments.clear();
+}
+
+Vec3b MIPRenderer::line_color( const int& i )
+{
+    // a hash of the index, in the same range as the colours of GLLineModel
+    unsigned h = (unsigned) i * 2654435761u;
+    h ^= h >> 15;
+    return Vec3b( (h & 0xFF) % 228 + 28, ( (h>>8) & 0xFF ) % 228 + 28, ( (h>>16) & 0xFF ) % 228 + 28 );
+}
+
+Mat_<Vec3b> MIPRenderer::compose( void ) const
+{
+    Mat_<Vec3b> image( height, width, Vec3b( 0, 0, 0 ) );
+    if( projection.rows!=height || projection.cols!=width ) return image;
+
+    const float vmin = (float) window_used[0];
+    const float scale = ( window_used[1]>window_used[0] ) ? float( 255.0 / ( window_used[1] - window_used[0] ) ) : 0.0f;
+
+    #pragma omp parallel for schedule(static)
+    for( int v=0; v<height; v++ )
+    {
+        const float* p = projection[v];
+        Vec3b* q = image[v];
+        for( int u=0; u<width; u++ )
+        {
+            const float g = std::min( std::max( ( p[u] - vmin ) * scale, 0.0f ), 255.0f );
+            const unsigned char c = (unsigned char) ( g + 0.5f );
+            q[u] = Vec3b( c, c, c );
+        }
+    }
+
+    // the overlays, from the farthest to the nearest segment
+    struct Projected
+    {
+        Point a, b;
+        double depth;
+        int id;
+        bool operator<( const Projected& o ) const
+        {
+            return depth > o.depth;
+        }
+    };
+    vector<Projected> projected;
+    projected.reserve( segments.size() );
+
+    const double half_w = 0.5 * ( width-1 ), half_h = 0.5 * ( height-1 );
+    for( unsigned i=0; i<segments.size(); i++ )
+    {
+        Vec3d p1 = segments[i].p1 - centre;
+        Vec3d p2 = segments[i].p2 - centre;
+        double d1 = p1.dot( axis_view ), d2 = p2.dot( axis_view );
+
+        // clip the segment to the slab
+        if( slab_thickness>0 )
+        {
+            const double lo = slab_offset - 0.5 * slab_thickness;
+            const double hi = slab_offset + 0.5 * slab_thickness;
+            if( std::max( d1, d2 )<lo || std::min( d1, d2 )>hi ) continue;
+            const Vec3d q1 = p1, q2 = p2;
+            const double e1 = d1, e2 = d2;
+            const double denom = e2 - e1;
+            double s1 = 0, s2 = 1;
+            if( std::abs( denom )>1e-12 )
+            {
+                s1 = std::max( 0.0, std::min( ( lo - e1 ) / denom, ( hi - e1 ) / denom ) );
+                s2 = std::min( 1.0, std::max( ( lo - e1 ) / denom, ( hi - e1 ) / denom ) );
+            }
+            p1 = q1 + ( q2 - q1 ) * s1;
+            p2 = q1 + ( q2 - q1 ) * s2;
+            d1 = e1 + denom * s1;
+            d2 = e1 + denom * s2;
+        }
+
+        Projected pr;
+        pr.a = Point( cvRound( p1.dot( axis_right ) / spacing + half_w ), cvRound( p1.dot( axis_down ) / spacing + half_h ) );
+        pr.b = Point( cvRound( p2.dot( axis_right ) / spacing + half_w ), cvRound( p2.dot( axis_down ) / spacing + half_h ) );
+        pr.depth = 0.5 * ( d1 + d2 );
+        pr.id = i;
+        projected.push_back( pr );
+    }
+    std::stable_sort( projected.begin(), projected.end() );
+
+    for( unsigned i=0; i<projected.size(); i++ )
+    {
+        const Vec3b& c = segments[ projected[i].id ].color;
+        cv::line( image, projected[i].a, projected[i].b, Scalar( c[0], c[1], c[2] ) );
+    }
+    return image;
+}
+
+bool MIPRenderer::save( const string& file_name ) const
+{
+    smart_return( projection.rows==height && projection.cols==width,
+                  "Nothing has been rendered. ", false );
+    smart_return( cv::imwrite( file_name, compose() ), "Cannot save the image. ", false );
+    return true;
+}
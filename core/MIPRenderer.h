@@ -0,0 +1,345 @@
+#ifndef MIPRENDERER_H
+#define MIPRENDERER_H
+
+#include <vector>
+#include <string>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "Data3D.h"
+#include "smart_assert.h"
+
+/* Headless Maximum Intensity Projection of a Data3D<T> (no OpenGL, no
+   display), for rendering images and videos in batch jobs
+
+   The camera is orthographic and looks at the centre of the volume. Every
+   pixel casts a ray that is marched through the volume with a fixed step
+   (trilinear interpolation), the pixel is the maximum along the ray. A ray
+   stops as soon as it reaches the top of the display window, since the
+   remaining samples cannot change the pixel. A slab (the samples within a
+   given distance from a plane parallel to the image) can be rendered
+   instead of the whole volume.
+
+   The rows of the image are rendered in parallel. Within a row, the rays are
+   marched in packets of PACKET rays sharing the same step, so that the
+   samples of a packet are computed with SIMD instructions.
+
+   Line segments (e.g. line models or the edges of a minimum spanning tree)
+   can be drawn on top of the projection. */
+class MIPRenderer
+{
+public:
+    /// width, height: size of the rendered images
+    MIPRenderer( const int& width, const int& height );
+
+    /// Rotation of the camera around the centre of the volume (in radians),
+    /// around the x-axis by pitch first and then around the y-axis by yaw.
+    /// With (0, 0), the volume is seen along the z-axis, x-axis to the right
+    /// and y-axis downwards.
+    void set_view( const double& yaw, const double& pitch );
+
+    /// Number of voxels per pixel, 0: the volume fits in the image
+    void set_spacing( const double& voxels_per_pixel );
+
+    /// Distance between the samples along the rays (in voxels)
+    void set_step( const double& step );
+
+    /// Only render the samples within thickness/2 of the plane parallel to
+    /// the image at a distance offset from the centre of the volume
+    /// (thickness 0: the whole volume)
+    void set_slab( const double& thickness, const double& offset = 0.0 );
+
+    /// Intensities mapped to black and white (if min==max, the minimum and
+    /// maximum of the volume)
+    void set_window( const double& min, const double& max );
+
+    inline int get_width( void ) const
+    {
+        return width;
+    }
+    inline int get_height( void ) const
+    {
+        return height;
+    }
+
+    /// Render the projection of the volume
+    template<typename T>
+    const cv::Mat_<float>& render( const Data3D<T>& im );
+
+    /// The last projection (raw intensities)
+    inline const cv::Mat_<float>& get_projection( void ) const
+    {
+        return projection;
+    }
+
+    /////////////////////////////////////////////////
+    // Overlays
+    /////////////////////////////////////////////////
+    void add_segment( const cv::Vec3d& p1, const cv::Vec3d& p2, const cv::Vec3b& color );
+
+    /// Line models (see ModelSet): a short segment along the line of every
+    /// data point, at the projection of the point on its line (L: Line3D)
+    template<class L>
+    void add_line_models( const std::vector<cv::Vec3i>& points,
+                          const std::vector<int>& labels,
+                          const std::vector<L*>& lines );
+
+    /// Edges of a graph with 3D nodes (G: MST::Graph<EdgeType, cv::Vec3d>)
+    template<class G>
+    void add_graph( const G& graph, const cv::Vec3b& color = cv::Vec3b( 0, 0, 255 ) );
+
+    void clear_overlays( void );
+
+    /// The last projection as a colour image (BGR) with the overlays
+    cv::Mat_<cv::Vec3b> compose( void ) const;
+
+    /// Save the last projection with the overlays (the format is given by
+    /// the extension of the file, e.g. '.png')
+    bool save( const std::string& file_name ) const;
+
+    /// Render a turntable video of the volume: the camera turns (yaw) by
+    /// 360 degrees in num_frames frames, from the current view
+    template<typename T>
+    bool save_video( const Data3D<T>& im, const std::string& file_name,
+                     const int& num_frames = 72, const double& fps = 20.0 );
+
+    /// Number of rays marched together
+    static const int PACKET = 16;
+
+private:
+    // origin and directions of the rays for a volume of the given size
+    void setup_rays( const cv::Vec3i& size, cv::Vec3d& origin,
+                     cv::Vec3d& right, cv::Vec3d& down, double& spacing ) const;
+
+    // camera basis (rotation of the x-, y- and z-axis)
+    cv::Vec3d axis_right, axis_down, axis_view;
+    double yaw, pitch;
+
+    int width, height;
+    double voxels_per_pixel; // 0: fit
+    double step;
+    double slab_thickness, slab_offset;
+    double window_min, window_max;
+
+    cv::Mat_<float> projection;
+    // geometry and window of the last projection
+    cv::Vec3d centre;
+    double spacing;
+    double window_used[2];
+
+    struct Segment
+    {
+        cv::Vec3d p1, p2;
+        cv::Vec3b color;
+        Segment( const cv::Vec3d& p1, const cv::Vec3d& p2, const cv::Vec3b& c )
+            : p1( p1 ), p2( p2 ), color( c ) { }
+    };
+    std::vector<Segment> segments;
+
+    // colour of the line model i (the same for every image)
+    static cv::Vec3b line_color( const int& i );
+};
+
+
+template<typename T>
+const cv::Mat_<float>& MIPRenderer::render( const Data3D<T>& im )
+{
+    smart_assert( !im.is_empty(), "The volume is empty. " );
+
+    float vmin = (float) window_min, vmax = (float) window_max;
+    if( window_min==window_max )
+    {
+        const cv::Vec<T, 2> min_max = im.get_min_max_value();
+        vmin = (float) min_max[0];
+        vmax = (float) min_max[1];
+    }
+
+    cv::Vec3d origin, right, down;
+    setup_rays( im.get_size(), origin, right, down, spacing );
+    centre = cv::Vec3d( im.SX()-1, im.SY()-1, im.SZ()-1 ) * 0.5;
+    projection.create( height, width );
+
+    const T* data = im.getData();
+    const int SX = im.SX(), SY = im.SY(), SZ = im.SZ();
+    const long slice = im.get_size_slice();
+    const float xmax = float( SX-1 ), ymax = float( SY-1 ), zmax = float( SZ-1 );
+    // the last cell of the interpolation, and the offsets to the next voxel
+    // (0 if the volume is flat along the axis)
+    const int ix_max = std::max( SX-2, 0 ), iy_max = std::max( SY-2, 0 ), iz_max = std::max( SZ-2, 0 );
+    const long dx = ( SX>1 ) ? 1 : 0, dy = ( SY>1 ) ? SX : 0, dz = ( SZ>1 ) ? slice : 0;
+
+    const float vx = (float) axis_view[0], vy = (float) axis_view[1], vz = (float) axis_view[2];
+    const float fstep = (float) step;
+    const double size[3] = { (double) SX, (double) SY, (double) SZ };
+    const double eps = 1e-6;
+
+    #pragma omp parallel for schedule(dynamic)
+    for( int v=0; v<height; v++ )
+    {
+        float bx[PACKET], by[PACKET], bz[PACKET], best[PACKET];
+        int kin[PACKET], kout[PACKET];
+
+        for( int u0=0; u0<width; u0+=PACKET )
+        {
+            // entry and exit samples of the rays of the packet
+            int kmin = std::numeric_limits<int>::max();
+            int kmax = std::numeric_limits<int>::min();
+            for( int l=0; l<PACKET; l++ )
+            {
+                const cv::Vec3d base = origin + right * double( u0 + l ) + down * double( v );
+                bx[l] = (float) base[0];
+                by[l] = (float) base[1];
+                bz[l] = (float) base[2];
+                best[l] = -std::numeric_limits<float>::max();
+
+                double tin = -std::numeric_limits<double>::max();
+                double tout = std::numeric_limits<double>::max();
+                if( slab_thickness>0 )
+                {
+                    tin  = slab_offset - 0.5 * slab_thickness;
+                    tout = slab_offset + 0.5 * slab_thickness;
+                }
+                for( int i=0; i<3; i++ )
+                {
+                    if( std::abs( axis_view[i] )<1e-12 )
+                    {
+                        if( base[i] < -eps || base[i] > size[i] - 1 + eps ) tout = -1, tin = 1;
+                        continue;
+                    }
+                    double t1 = ( 0 - base[i] ) / axis_view[i];
+                    double t2 = ( size[i] - 1 - base[i] ) / axis_view[i];
+                    if( t1>t2 ) std::swap( t1, t2 );
+                    tin = std::max( tin, t1 );
+                    tout = std::min( tout, t2 );
+                }
+
+                if( u0 + l >= width || tin>tout )
+                {
+                    kin[l] = 1;
+                    kout[l] = 0;
+                    continue;
+                }
+                kin[l]  = (int) std::ceil( tin / step - eps );
+                kout[l] = (int) std::floor( tout / step + eps );
+                kmin = std::min( kmin, kin[l] );
+                kmax = std::max( kmax, kout[l] );
+            }
+
+            // march the rays together, until they all leave the volume or
+            // reach the top of the window
+            for( int k=kmin; k<=kmax; k++ )
+            {
+                const float t = fstep * k;
+                int done = 0;
+                #pragma omp simd reduction(+:done)
+                for( int l=0; l<PACKET; l++ )
+                {
+                    // the positions are clamped so that the inactive rays
+                    // read valid voxels as well
+                    const float x = std::min( std::max( bx[l] + t * vx, 0.0f ), xmax );
+                    const float y = std::min( std::max( by[l] + t * vy, 0.0f ), ymax );
+                    const float z = std::min( std::max( bz[l] + t * vz, 0.0f ), zmax );
+                    const int ix = std::min( (int) x, ix_max );
+                    const int iy = std::min( (int) y, iy_max );
+                    const int iz = std::min( (int) z, iz_max );
+                    const float fx = x - ix, fy = y - iy, fz = z - iz;
+
+                    const T* p = data + ( iz * slice + (long) iy * SX + ix );
+                    const float c00 = float( p[0] )     + fx * ( float( p[dx] )      - float( p[0] ) );
+                    const float c10 = float( p[dy] )    + fx * ( float( p[dy+dx] )    - float( p[dy] ) );
+                    const float c01 = float( p[dz] )    + fx * ( float( p[dz+dx] )    - float( p[dz] ) );
+                    const float c11 = float( p[dz+dy] ) + fx * ( float( p[dz+dy+dx] ) - float( p[dz+dy] ) );
+                    const float c0 = c00 + fy * ( c10 - c00 );
+                    const float c1 = c01 + fy * ( c11 - c01 );
+                    const float value = c0 + fz * ( c1 - c0 );
+
+                    const bool active = k>=kin[l] && k<=kout[l] && best[l]<vmax;
+                    best[l] = ( active && value>best[l] ) ? value : best[l];
+                    done += ( k>=kout[l] || best[l]>=vmax ) ? 1 : 0;
+                }
+                if( done==PACKET ) break;
+            }
+
+            // the rays that miss the volume are black
+            float* row = projection[v];
+            const int n = std::min( PACKET, width - u0 );
+            for( int l=0; l<n; l++ ) row[u0+l] = ( kin[l]<=kout[l] ) ? best[l] : vmin;
+        }
+    }
+
+    window_used[0] = vmin;
+    window_used[1] = vmax;
+    return projection;
+}
+
+template<class L>
+void MIPRenderer::add_line_models( const std::vector<cv::Vec3i>& points,
+                                   const std::vector<int>& labels,
+                                   const std::vector<L*>& lines )
+{
+    smart_return( points.size()==labels.size(), "The points and the labels do not match. ", );
+    for( unsigned i=0; i<points.size(); i++ )
+    {
+        const int& lid = labels[i];
+        if( lid<0 || lid>=(int) lines.size() ) continue;
+        const cv::Vec3d prj = lines[lid]->projection( cv::Vec3d( points[i] ) );
+        const cv::Vec3d dir = lines[lid]->getDirection();
+        add_segment( prj - dir * 0.5, prj + dir * 0.5, line_color( lid ) );
+    }
+}
+
+template<class G>
+void MIPRenderer::add_graph( const G& graph, const cv::Vec3b& color )
+{
+    for( unsigned i=0; i<graph.num_edges(); i++ )
+    {
+        const auto& e = graph.get_edge( i );
+        add_segment( graph.get_node( e.node1 ), graph.get_node( e.node2 ), color );
+    }
+}
+
+template<typename T>
+bool MIPRenderer::save_video( const Data3D<T>& im, const std::string& file_name,
+                              const int& num_frames, const double& fps )
+{
+    smart_return( num_frames>0, "The number of frames should be positive. ", false );
+
+    cv::VideoWriter outputVideo;
+    outputVideo.open( file_name, CV_FOURCC('M','J','P','G'), fps, cv::Size( width, height ), true );
+    if( !outputVideo.isOpened() )
+    {
+        std::cout << "Could not open the output video for write: " << file_name << std::endl;
+        return false;
+    }
+
+    // the same window for all the frames
+    const double old_min = window_min, old_max = window_max;
+    if( window_min==window_max )
+    {
+        const cv::Vec<T, 2> min_max = im.get_min_max_value();
+        window_min = (double) min_max[0];
+        window_max = (double) min_max[1];
+    }
+
+    const double old_yaw = yaw;
+    for( int i=0; i<num_frames; i++ )
+    {
+        set_view( old_yaw + 2 * M_PI * i / num_frames, pitch );
+        render( im );
+        outputVideo << compose();
+        std::cout << '\r' << "Saving video: " << 100 * (i+1) / num_frames << "%";
+        std::cout.flush();
+    }
+    std::cout << std::endl;
+
+    set_view( old_yaw, pitch );
+    window_min = old_min;
+    window_max = old_max;
+    return true;
+}
+
+#endif // MIPRENDERER_H
@@ -0,0 +1,133 @@
+#ifndef SLABCACHE_H
+#define SLABCACHE_H
+
+#include <vector>
+#include <algorithm>
+#include <opencv2/core/core.hpp>
+
+#include "Data3D.h"
+#include "ImageProcessing.h"
+#include "smart_assert.h"
+
+/* Thick slab intensity projections (see IP::mip() and IP::minip()) of a
+   window of slices that moves through the volume, e.g. while scrolling
+
+   The cache keeps a split slice m inside the window [s0, s1) and the partial
+   projections on both sides of it:
+       suffix[i]: projection of the slices m-1-i, ..., m-1
+       prefix[i]: projection of the slices m, ..., m+i
+   The projection of the window is then Op( suffix[m-1-s0], prefix[s1-1-m] ).
+   When the window moves by one slice, at most one partial projection is
+   added. When the window leaves the split slice behind, the split slice is
+   moved to the front edge of the window and the partial projections are
+   rebuilt from there. Scrolling through the volume in either direction
+   costs a constant number of slice reductions per step on average (as a
+   sliding maximum with two stacks), whatever the thickness of the slab.
+
+   Op: IP::MaxOp (maximum intensity projection) or IP::MinOp. */
+template<typename T, class Op = IP::MaxOp>
+class SlabCache
+{
+public:
+    /// src: the volume (it should not change while the cache is used)
+    /// axis: the projection axis (0: x, 1: y, 2: z)
+    SlabCache( const Data3D<T>& src, const int& axis = 2 );
+
+    /// Projection of the slices s0, ..., s1-1 (s0 < s1). The result is
+    /// valid until the next call.
+    const cv::Mat_<T>& get( int s0, int s1 );
+
+    /// Drop the partial projections (the memory is kept)
+    inline void clear( void )
+    {
+        num_suffix = num_prefix = 0;
+    }
+
+private:
+    // buffer[i] = Op( buffer[i-1], projection of the slice s ) (for i==0:
+    // the projection of the slice s)
+    void slice_projection( const int& s, std::vector<cv::Mat_<T> >& buffer, const int& i );
+
+    const Data3D<T>& src;
+    const int axis;
+    int rows, cols;
+
+    int split;
+    int num_suffix, num_prefix;
+    std::vector<cv::Mat_<T> > suffix, prefix;
+    cv::Mat_<T> result;
+};
+
+
+template<typename T, class Op>
+SlabCache<T, Op>::SlabCache( const Data3D<T>& src, const int& axis )
+    : src( src ), axis( axis ), split( 0 ), num_suffix( 0 ), num_prefix( 0 )
+{
+    smart_assert( axis>=0 && axis<3, "Invalid axis. " );
+    rows = ( axis==2 ) ? src.SY() : src.SZ();
+    cols = ( axis==0 ) ? src.SY() : src.SX();
+}
+
+template<typename T, class Op>
+void SlabCache<T, Op>::slice_projection( const int& s, std::vector<cv::Mat_<T> >& buffer, const int& i )
+{
+    // the buffers are only allocated once
+    if( (int) buffer.size()<=i ) buffer.resize( i+1 );
+    cv::Mat_<T>& dst = buffer[i];
+    if( i>0 )
+    {
+        buffer[i-1].copyTo( dst );
+    }
+    else
+    {
+        dst.create( rows, cols );
+        std::fill( dst[0], dst[0] + (long) rows * cols, Op::template identity<T>() );
+    }
+    IP::accumulate_projection<Op>( src, axis, s, s+1, dst );
+}
+
+template<typename T, class Op>
+const cv::Mat_<T>& SlabCache<T, Op>::get( int s0, int s1 )
+{
+    const int num_slices = src.get_size( axis );
+    s0 = std::max( s0, 0 );
+    s1 = std::min( s1, num_slices );
+    smart_return( s0<s1, "The window of slices is empty. ", result );
+
+    // move the split slice to the front edge of the window if the window
+    // has left it behind
+    if( split<s0 || split>s1 || num_suffix + num_prefix==0 )
+    {
+        split = ( split<s0 ) ? s1 : s0;
+        clear();
+    }
+
+    // extend the partial projections to the edges of the window
+    while( split - num_suffix > s0 )
+    {
+        slice_projection( split - num_suffix - 1, suffix, num_suffix );
+        num_suffix++;
+    }
+    while( split + num_prefix < s1 )
+    {
+        slice_projection( split + num_prefix, prefix, num_prefix );
+        num_prefix++;
+    }
+
+    // combine the two sides of the window
+    if( s0==split ) return prefix[ s1-1-split ];
+    if( s1==split ) return suffix[ split-1-s0 ];
+
+    const cv::Mat_<T>& a = suffix[ split-1-s0 ];
+    const cv::Mat_<T>& b = prefix[ s1-1-split ];
+    result.create( rows, cols );
+    const long n = (long) rows * cols;
+    const T* pa = a[0];
+    const T* pb = b[0];
+    T* pr = result[0];
+    #pragma omp parallel for simd schedule(static)
+    for( long i=0; i<n; i++ ) pr[i] = Op::apply( pa[i], pb[i] );
+    return result;
+}
+
+#endif // SLABCACHE_H
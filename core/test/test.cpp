@@ -0,0 +1,291 @@
+#include "gtest/gtest.h"
+
+#include "ImageProcessing.h"
+#include "SlabCache.h"
+#include "GLVolumnBricks.h"
+#include "MIPRenderer.h"
+
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+
+TEST( ImageProcessing, meanBlur3D )
+{
+    srand( 7 );
+    Data3D<short> src( cv::Vec3i( 17, 11, 9 ) );
+    for( int i=0; i<src.get_size_total(); i++ ) src.at(i) = short( rand() % 2000 - 1000 );
+
+    // brute force: average of the voxels of the (clipped) window
+    for( int ksize=1; ksize<=6; ksize++ )
+    {
+        Data3D<float> dst;
+        ASSERT_TRUE( IP::meanBlur3D( src, dst, ksize ) );
+        const int lo = ksize / 2, hi = ksize - 1 - lo;
+        for( int z=0; z<src.SZ(); z++ ) for( int y=0; y<src.SY(); y++ ) for( int x=0; x<src.SX(); x++ )
+                {
+                    double sum = 0.0;
+                    int count = 0;
+                    for( int k=std::max( 0, z-lo ); k<=std::min( src.SZ()-1, z+hi ); k++ )
+                        for( int j=std::max( 0, y-lo ); j<=std::min( src.SY()-1, y+hi ); j++ )
+                            for( int i=std::max( 0, x-lo ); i<=std::min( src.SX()-1, x+hi ); i++ )
+                            {
+                                sum += src.at( i, j, k );
+                                count++;
+                            }
+                    ASSERT_NEAR( dst.at( x, y, z ), sum / count, 1e-2 );
+                }
+    }
+}
+
+TEST( ImageProcessing, medianBlur3D )
+{
+    srand( 11 );
+    // wider than a strip of the filter, values all over the 16-bit range
+    Data3D<short> src( cv::Vec3i( 83, 13, 7 ) );
+    for( int i=0; i<src.get_size_total(); i++ )
+    {
+        src.at(i) = short( ( rand() % 2 ) ? rand() % 65536 - 32768 : rand() % 40 );
+    }
+
+    // brute force: median (lower median for an even number of voxels) of
+    // the voxels of the (clipped) window
+    vector<short> values;
+    for( int ksize=1; ksize<=7; ksize+=2 )
+    {
+        Data3D<short> dst;
+        ASSERT_TRUE( IP::medianBlur3D( src, dst, ksize ) );
+        const int r = ksize / 2;
+        for( int z=0; z<src.SZ(); z++ ) for( int y=0; y<src.SY(); y++ ) for( int x=0; x<src.SX(); x++ )
+                {
+                    values.clear();
+                    for( int k=std::max( 0, z-r ); k<=std::min( src.SZ()-1, z+r ); k++ )
+                        for( int j=std::max( 0, y-r ); j<=std::min( src.SY()-1, y+r ); j++ )
+                            for( int i=std::max( 0, x-r ); i<=std::min( src.SX()-1, x+r ); i++ )
+                            {
+                                values.push_back( src.at( i, j, k ) );
+                            }
+                    std::nth_element( values.begin(), values.begin() + ( values.size()-1 ) / 2, values.end() );
+                    ASSERT_EQ( dst.at( x, y, z ), values[ ( values.size()-1 ) / 2 ] );
+                }
+    }
+
+    Data3D<short> dst;
+    EXPECT_FALSE( IP::medianBlur3D( src, dst, 4 ) );
+}
+
+TEST( ImageProcessing, mip )
+{
+    srand( 17 );
+    // longer than a packet of the reductions along x
+    Data3D<short> src( cv::Vec3i( 37, 11, 7 ) );
+    for( int i=0; i<src.get_size_total(); i++ ) src.at(i) = short( rand() % 2000 - 1000 );
+
+    for( int axis=0; axis<3; axis++ )
+    {
+        const int n = src.get_size( axis );
+        const int ranges[3][2] = { { 0, n }, { 1, n-2 }, { n/2, n/2+1 } };
+        for( int r=0; r<3; r++ )
+        {
+            const int s0 = ranges[r][0], s1 = ranges[r][1];
+            const cv::Mat_<short> mx = IP::mip( src, axis, s0, s1 );
+            const cv::Mat_<short> mn = IP::minip( src, axis, s0, s1 );
+            for( int z=0; z<src.SZ(); z++ ) for( int y=0; y<src.SY(); y++ ) for( int x=0; x<src.SX(); x++ )
+                    {
+                        const cv::Vec3i pos( x, y, z );
+                        if( pos[axis]!=s0 ) continue;
+                        // brute force along the axis
+                        short vmax = src.at( pos ), vmin = src.at( pos );
+                        cv::Vec3i p = pos;
+                        for( p[axis]=s0; p[axis]<s1; p[axis]++ )
+                        {
+                            vmax = std::max( vmax, src.at( p ) );
+                            vmin = std::min( vmin, src.at( p ) );
+                        }
+                        const int row = ( axis==2 ) ? y : z;
+                        const int col = ( axis==0 ) ? y : x;
+                        ASSERT_EQ( mx( row, col ), vmax );
+                        ASSERT_EQ( mn( row, col ), vmin );
+                    }
+        }
+    }
+    EXPECT_EQ( IP::mip( src ).rows, src.SY() );
+}
+
+TEST( ImageProcessing, SlabCache )
+{
+    srand( 19 );
+    Data3D<short> src( cv::Vec3i( 13, 9, 40 ) );
+    for( int i=0; i<src.get_size_total(); i++ ) src.at(i) = short( rand() % 2000 - 1000 );
+
+    // scrolling forwards and backwards, changing the thickness and jumping
+    for( int axis=0; axis<3; axis++ )
+    {
+        SlabCache<short> cache( src, axis );
+        SlabCache<short, IP::MinOp> min_cache( src, axis );
+        const int n = src.get_size( axis );
+        int s0 = 0, thickness = 3;
+        for( int step=0; step<120; step++ )
+        {
+            const int r = rand() % 10;
+            if( r<5 ) s0++;
+            else if( r<8 ) s0--;
+            else if( r<9 ) thickness = 1 + rand() % 6;
+            else s0 = rand() % n;
+            s0 = std::min( std::max( s0, 0 ), n-1 );
+            const int s1 = std::min( s0 + thickness, n );
+
+            const cv::Mat_<short>& slab = cache.get( s0, s1 );
+            const cv::Mat_<short> expected = IP::mip( src, axis, s0, s1 );
+            ASSERT_EQ( slab.rows, expected.rows );
+            ASSERT_EQ( slab.cols, expected.cols );
+            for( int i=0; i<expected.rows * expected.cols; i++ ) ASSERT_EQ( slab( i ), expected( i ) );
+
+            const cv::Mat_<short>& min_slab = min_cache.get( s0, s1 );
+            const cv::Mat_<short> min_expected = IP::minip( src, axis, s0, s1 );
+            for( int i=0; i<min_expected.rows * min_expected.cols; i++ ) ASSERT_EQ( min_slab( i ), min_expected( i ) );
+        }
+    }
+}
+
+TEST( GLViewer, VolumnBricks )
+{
+    srand( 23 );
+    // 2 x 2 x 1 bricks, the voxels of the last brick are all at the minimum
+    Data3D<short> src( cv::Vec3i( 150, 140, 9 ) );
+    for( int z=0; z<src.SZ(); z++ ) for( int y=0; y<src.SY(); y++ ) for( int x=0; x<src.SX(); x++ )
+            {
+                const bool last = x>=GLViewer::VolumnBricks::BRICK_SIZE && y>=GLViewer::VolumnBricks::BRICK_SIZE;
+                src.at( x, y, z ) = short( last ? 100 : 100 + rand() % 1000 );
+            }
+    src.at( 0, 0, 0 ) = 1100;
+
+    // full resolution, then downsampled to fit a small budget, then at the
+    // coarsest level of detail for a budget that can not be met
+    const long long budgets[3] = { GLViewer::VolumnBricks::DEFAULT_BUDGET, 20000, 1 };
+    for( int r=0; r<3; r++ )
+    {
+        GLViewer::VolumnBricks bricks;
+        bricks.build( src, budgets[r] );
+        ASSERT_EQ( (int) bricks.bricks.size(), 4 );
+        EXPECT_EQ( bricks.get_level()>0, r>0 );
+        if( r==2 ) EXPECT_TRUE( bricks.get_level()==GLViewer::VolumnBricks::MAX_LEVEL );
+        const int level = bricks.get_level();
+        const int step = 1<<level;
+
+        long long texels = 0;
+        for( unsigned i=0; i<bricks.bricks.size(); i++ )
+        {
+            const GLViewer::VolumnBricks::Brick& b = bricks.bricks[i];
+            ASSERT_EQ( b.empty, i==3 );
+            if( b.empty ) continue;
+            texels += b.data.size();
+
+            // every texel is the normalized maximum of the voxels of its cell
+            // (the border texels: the neighbouring cells, clamped)
+            for( int k=0; k<b.tex_size[2]; k++ ) for( int j=0; j<b.tex_size[1]; j++ ) for( int t=0; t<b.tex_size[0]; t++ )
+                    {
+                        const cv::Vec3i tex( t, j, k );
+                        cv::Vec3i from, to;
+                        for( int a=0; a<3; a++ )
+                        {
+                            const int cells = ( src.get_size( a ) + step - 1 ) / step;
+                            const int c = std::min( std::max( b.offset[a] / step + tex[a] - 1, 0 ), cells - 1 );
+                            from[a] = c * step;
+                            to[a] = std::min( from[a] + step, src.get_size( a ) );
+                        }
+                        short m = src.at( from );
+                        for( int z=from[2]; z<to[2]; z++ ) for( int y=from[1]; y<to[1]; y++ ) for( int x=from[0]; x<to[0]; x++ )
+                                    m = std::max( m, src.at( x, y, z ) );
+                        const int expected = int( ( m - 100 ) * 255.0 / 1000.0 + 0.5 );
+                        const int value = b.data[ ( k * b.tex_size[1] + j ) * b.tex_size[0] + t ];
+                        ASSERT_NEAR( value, expected, 1 );
+                    }
+        }
+        if( r==1 ) EXPECT_LE( texels, budgets[r] );
+
+        // voxel (x, y, z) is at the centre of its texel
+        const GLViewer::VolumnBricks::Brick& b = bricks.bricks[0];
+        EXPECT_NEAR( bricks.tex_coord( b, 0, 0.5f * ( step - 1 ) ) * b.tex_size[0], 1.5f, 1e-4 );
+
+        // the same in the background: every non-empty brick is ready once
+        GLViewer::VolumnBricks async;
+        async.build_async( src, budgets[r] );
+        ASSERT_EQ( async.bricks.size(), bricks.bricks.size() );
+        std::vector<int> num_ready( bricks.bricks.size(), 0 );
+        int id, num_empty = 0;
+        for( unsigned i=0; i<bricks.bricks.size(); i++ ) num_empty += bricks.bricks[i].empty;
+        for( int n=0; n<(int) bricks.bricks.size() - num_empty; )
+        {
+            if( async.next_ready( id ) )
+            {
+                num_ready[id]++;
+                n++;
+            }
+        }
+        async.wait();
+        EXPECT_FALSE( async.next_ready( id ) );
+        EXPECT_EQ( async.get_level(), level );
+        for( unsigned i=0; i<bricks.bricks.size(); i++ )
+        {
+            EXPECT_EQ( num_ready[i], bricks.bricks[i].empty ? 0 : 1 );
+            EXPECT_TRUE( async.bricks[i].data==bricks.bricks[i].data );
+        }
+    }
+}
+
+TEST( MIPRenderer, render )
+{
+    srand( 13 );
+    // wider than a packet of rays, the last packet is not full
+    Data3D<short> src( cv::Vec3i( 37, 21, 9 ) );
+    for( int i=0; i<src.get_size_total(); i++ ) src.at(i) = short( rand() % 2000 - 1000 );
+
+    // one pixel per voxel, the rays go through the centres of the voxels
+    MIPRenderer renderer( src.SX(), src.SY() );
+    renderer.set_spacing( 1.0 );
+    renderer.set_window( -1000, 5000 );
+    cv::Mat_<float> mip = renderer.render( src ).clone();
+
+    // top of the window below the maximum: the rays stop early, only the
+    // saturated pixels may differ
+    renderer.set_window( -1000, 500 );
+    const cv::Mat_<float>& mip_exit = renderer.render( src );
+    for( int y=0; y<src.SY(); y++ ) for( int x=0; x<src.SX(); x++ )
+        {
+            short m = src.at( x, y, 0 );
+            for( int z=1; z<src.SZ(); z++ ) m = std::max( m, src.at( x, y, z ) );
+            ASSERT_NEAR( mip( y, x ), m, 1e-3 );
+            ASSERT_NEAR( std::min( mip_exit( y, x ), 500.0f ), std::min( (float) m, 500.0f ), 1e-3 );
+        }
+
+    // a slab of one slice, 2 slices behind the centre of the volume
+    renderer.set_window( -1000, 5000 );
+    renderer.set_slab( 1.0, 2.0 );
+    renderer.render( src );
+    for( int y=0; y<src.SY(); y++ ) for( int x=0; x<src.SX(); x++ )
+        {
+            ASSERT_NEAR( renderer.get_projection()( y, x ), src.at( x, y, 6 ), 1e-3 );
+        }
+
+    // seen along the x-axis: z to the left
+    MIPRenderer side( src.SZ(), src.SY() );
+    side.set_spacing( 1.0 );
+    side.set_window( -1000, 5000 );
+    side.set_view( 0.5 * M_PI, 0 );
+    side.render( src );
+    for( int y=0; y<src.SY(); y++ ) for( int z=0; z<src.SZ(); z++ )
+        {
+            short m = src.at( 0, y, z );
+            for( int x=1; x<src.SX(); x++ ) m = std::max( m, src.at( x, y, z ) );
+            ASSERT_NEAR( side.get_projection()( y, src.SZ()-1-z ), m, 1e-2 );
+        }
+}
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    int flag = RUN_ALL_TESTS();
+    return flag;
+}